@@ -0,0 +1,117 @@
+/***********************************************************************
+ * File: launch_bench.c
+ * Description: Measures the latency of launching a pipeline of `true'
+ *   commands with each of the launch modes in shell/launch.c, from the
+ *   first stage being started until every stage has been reaped. The
+ *   shell heap can be inflated with -m so the cost of copying page
+ *   tables on fork(2) shows up as it would in a long running shell.
+ *
+ * Usage: launch_bench [-n iterations] [-m heap_megabytes]
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "cmd.h"
+#include "list.h"
+#include "launch.h"
+#include "error.h"
+
+static const int stages[] = { 1, 8, 256 };
+
+/*
+ * Builds an 'n' stage pipeline of `true' commands.
+ */
+static struct expr_t *make_pipeline(int n)
+{
+	int i;
+	struct expr_t *head = NULL, *tail = NULL, *cmd;
+
+	for (i = 0; i < n; i++) {
+		if ((cmd = cmd_create()) == NULL)
+			err_quit("launch_bench: unable to create command");
+		cmd_set_type(cmd, CMD_SIMPLE);
+		list_push(cmd->exec, strdup("true"));
+		if (tail)
+			cmd_pipe(tail, cmd);
+		else
+			head = cmd;
+		tail = cmd;
+	}
+
+	return head;
+}
+
+/*
+ * Returns the mean time in microseconds to launch and reap the
+ * pipeline 'cmd' of 'n' stages, over 'iterations' runs.
+ */
+static double time_pipeline(struct expr_t *cmd, int n, int iterations)
+{
+	int i, j;
+	pid_t pids[n];
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		launch_pipeline(cmd, pids, NULL);
+		for (j = 0; j < n; j++)
+			if (pids[j] != -1)
+				waitpid(pids[j], NULL, 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return ((end.tv_sec - start.tv_sec) * 1e6 +
+			(end.tv_nsec - start.tv_nsec) / 1e3) / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+	int c, i;
+	int iterations = 20;
+	size_t heap = 0;
+	char *ballast = NULL;
+	struct expr_t *cmd;
+	double fork_us, spawn_us;
+
+	while ((c = getopt(argc, argv, "n:m:")) != -1) {
+		switch (c) {
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'm':
+				heap = (size_t)atoi(optarg) << 20;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n iterations] [-m heap_megabytes]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (iterations <= 0)
+		iterations = 1;
+
+	/* Touch every page so it is really mapped in the shell. */
+	if (heap && (ballast = malloc(heap)) != NULL)
+		memset(ballast, 1, heap);
+
+	printf("%-8s %14s %14s %8s\n", "stages", "fork (us)", "spawn (us)", "speedup");
+	for (i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+		cmd = make_pipeline(stages[i]);
+
+		launch_mode = LAUNCH_FORK;
+		fork_us = time_pipeline(cmd, stages[i], iterations);
+		launch_mode = LAUNCH_SPAWN;
+		spawn_us = time_pipeline(cmd, stages[i], iterations);
+
+		printf("%-8d %14.1f %14.1f %7.2fx\n", stages[i], fork_us, spawn_us,
+				fork_us / spawn_us);
+		cmd_destroy(cmd);
+	}
+
+	free(ballast);
+	return 0;
+}
@@ -0,0 +1,173 @@
+/***********************************************************************
+ * File: pipe_bench.c
+ * Description: Measures the throughput of `yes | head -c SIZE | wc -c'
+ *   with each of several pipe capacities (see `set -o pipesize' and
+ *   launch_pipe_size() in shell/launch.c), along with the number of
+ *   context switches of the pipeline's stages.
+ *
+ * Usage: pipe_bench [-n iterations] [-s size]
+ *   The size takes an optional k, m or g suffix (default 1g).
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "cmd.h"
+#include "list.h"
+#include "launch.h"
+#include "option.h"
+#include "error.h"
+
+#define STAGES  3
+
+/* Pipe capacities to compare; 0 is the kernel default and -1 stands for
+ * /proc/sys/fs/pipe-max-size. */
+static const long sizes[] = { 0, 256 << 10, 1 << 20, -1 };
+
+/*
+ * Builds the pipeline `yes | head -c size | wc -c'.
+ */
+static struct expr_t *make_pipeline(const char *size)
+{
+	int i;
+	const char *words[STAGES][4] = {
+		{ "yes", NULL },
+		{ "head", "-c", size, NULL },
+		{ "wc", "-c", NULL },
+	};
+	struct expr_t *head = NULL, *tail = NULL, *cmd;
+	const char **w;
+
+	for (i = 0; i < STAGES; i++) {
+		if ((cmd = cmd_create()) == NULL)
+			err_quit("pipe_bench: unable to create command");
+		cmd_set_type(cmd, CMD_SIMPLE);
+		for (w = words[i]; *w; w++)
+			list_push(cmd->exec, strdup(*w));
+		if (tail)
+			cmd_pipe(tail, cmd);
+		else
+			head = cmd;
+		tail = cmd;
+	}
+
+	return head;
+}
+
+/*
+ * Returns the mean time in seconds to run the pipeline 'cmd' over
+ * 'iterations' runs, and the mean number of context switches of its
+ * stages in 'switches'.
+ */
+static double time_pipeline(struct expr_t *cmd, int iterations,
+		long *switches)
+{
+	int i, j;
+	pid_t pids[STAGES];
+	struct timespec start, end;
+	struct rusage before, after;
+
+	getrusage(RUSAGE_CHILDREN, &before);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		launch_pipeline(cmd, pids, NULL);
+		for (j = 0; j < STAGES; j++)
+			if (pids[j] != -1)
+				waitpid(pids[j], NULL, 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	getrusage(RUSAGE_CHILDREN, &after);
+
+	*switches = ((after.ru_nvcsw + after.ru_nivcsw) -
+			(before.ru_nvcsw + before.ru_nivcsw)) / iterations;
+	return ((end.tv_sec - start.tv_sec) +
+			(end.tv_nsec - start.tv_nsec) / 1e9) / iterations;
+}
+
+/*
+ * Returns the largest pipe capacity an unprivileged process may ask
+ * for, or 1 MiB if it cannot be read.
+ */
+static long max_pipe_size(void)
+{
+	long size = 1 << 20;
+	FILE *file;
+
+	if ((file = fopen("/proc/sys/fs/pipe-max-size", "r")) != NULL) {
+		if (fscanf(file, "%ld", &size) != 1)
+			size = 1 << 20;
+		fclose(file);
+	}
+
+	return size;
+}
+
+int main(int argc, char *argv[])
+{
+	int c, i, out, null;
+	int iterations = 3;
+	char *size = "1g";
+	char count[32];
+	long bytes, switches;
+	double secs, base = 0;
+	struct expr_t *cmd;
+
+	while ((c = getopt(argc, argv, "n:s:")) != -1) {
+		switch (c) {
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 's':
+				size = optarg;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n iterations] [-s size]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (iterations <= 0)
+		iterations = 1;
+	if ((bytes = option_parse(size, OPTION_SIZE)) <= 0) {
+		fprintf(stderr, "%s: invalid size `%s'\n", argv[0], size);
+		return 1;
+	}
+
+	/* The output of `wc' is not interesting; send it to /dev/null. */
+	fflush(stdout);
+	out = dup(STDOUT_FILENO);
+	if ((null = open("/dev/null", O_WRONLY)) == -1)
+		err_sys("pipe_bench: unable to open /dev/null");
+
+	snprintf(count, sizeof(count), "%ld", bytes);
+	cmd = make_pipeline(count);
+	printf("%-12s %10s %10s %12s %8s\n", "pipe size", "time (s)", "MB/s",
+			"ctx switches", "speedup");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		option_pipesize = sizes[i] == -1 ? max_pipe_size() : sizes[i];
+
+		fflush(stdout);
+		dup2(null, STDOUT_FILENO);
+		secs = time_pipeline(cmd, iterations, &switches);
+		dup2(out, STDOUT_FILENO);
+
+		if (i == 0)
+			base = secs;
+		if (option_pipesize)
+			printf("%-12ld", option_pipesize);
+		else
+			printf("%-12s", "default");
+		printf(" %10.3f %10.1f %12ld %7.2fx\n", secs, bytes / secs / 1e6,
+				switches, base / secs);
+	}
+
+	cmd_destroy(cmd);
+	close(null);
+	close(out);
+	return 0;
+}
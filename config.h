@@ -5,7 +5,10 @@
 
 //#define HISTORY
 //#define ALIAS
+#define PROCESS_SUBSTITUTION  /* <(command) and >(command) */
 
 #define HAVE_LONG_LONG  /* used in strtoimax */
 
+#define NDEBUG_PARSER  /* Comment out to trace the parser on stderr */
+
 #endif
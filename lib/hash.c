@@ -2,6 +2,7 @@
 #define __HASH_C
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include "hash.h"
 
@@ -13,6 +14,10 @@
 
 static int hash_expand(hash_t *hash);
 
+/* The key of a slot whose element has been deleted. Searches probe past
+ * such a slot, while inserts may reuse it. */
+const char hash_deleted_key = 0;
+
 /***********************************************************************
  * Allocates, initializes, and returns a hash container. This function
  * should be used to create hash tables. This function will allocate
@@ -67,6 +72,7 @@ hash_t *hash_create(unsigned int (*hash_code)(const void *key),
 	memset(hash->table, 0, bsize);
 
 	hash->size = 0;
+	hash->deleted = 0;
 	if (inc <= 0)
 		hash->increment = DEFAULT_INCREMENT;
 	else
@@ -101,7 +107,9 @@ void hash_destroy(hash_t *hash)
 
 	int i;
 	for (i = 0; i < hash->length; i++) {
-		if (hash->table[i].key != NULL && hash->kdestroy != NULL)
+		if (!hash_slot_used(hash, i))
+			continue;
+		if (hash->kdestroy != NULL)
 			hash->kdestroy(hash->table[i].key);
 		if (hash->table[i].value != NULL && hash->vdestroy != NULL)
 			hash->vdestroy(hash->table[i].value);
@@ -131,16 +139,22 @@ int hash_insert(hash_t *hash, const void *key, const void *value)
 		return -1;
 
 	int position, i;
+	unsigned int code;
 
-	/* Check to see if the hash table needs to be expanded. */
-	if (hash_load_factor(hash) >= MAX_ALLOWED_LOAD_FACTOR &&
-	    hash_expand(hash) == -1)
+	/* Check to see if the hash table needs to be expanded. Deleted slots
+	 * count as used, as they lengthen the probe sequences just the same. */
+	if ((double)(hash->size + hash->deleted) / hash->length >=
+	    MAX_ALLOWED_LOAD_FACTOR && hash_expand(hash) == -1)
 		return -1;  /* Unable to expand hast table. */
 
 	/* Search for an open position--one is guaranteed to exist. */
+	code = hash->hash_code(key);
 	for (i = 0; i < hash->length; i++) {
-		position = (hash->hash_code(key) + i) % hash->length;
-		if (hash->table[position].key == NULL) {
+		position = (code + i) % hash->length;
+		if (hash->table[position].key == NULL ||
+		    hash->table[position].key == HASH_DELETED) {
+			if (hash->table[position].key == HASH_DELETED)
+				hash->deleted--;
 			hash->table[position].key = (void *)key;
 			hash->table[position].value = (void *)value;
 			hash->size++;
@@ -153,7 +167,9 @@ int hash_insert(hash_t *hash, const void *key, const void *value)
 }
 
 /***********************************************************************
- * An internal function to expand the hash table heap.
+ * An internal function to expand the hash table heap. Every element is
+ * re-inserted at the position its hash code gives in the larger table,
+ * which also drops the slots of deleted elements.
  *
  * NULL is explicitly checked for as a parameter, and no action is taken
  * if the parameter is NULL.
@@ -169,17 +185,36 @@ static int hash_expand(hash_t *hash)
 	if (hash == NULL)
 		return -1;
 
-	int bsize;
+	int bsize, length, i, j, position;
 	hash_node_t *n;
 
-	bsize = (hash->length + hash->increment) * sizeof(hash_node_t);
+	/* Only grow when the table is really full of live elements;
+	 * otherwise re-hashing at the same size reclaims the deleted slots. */
+	length = hash->length;
+	if ((double)hash->size / hash->length >= MAX_ALLOWED_LOAD_FACTOR / 2)
+		length += hash->increment;
+
+	bsize = length * sizeof(hash_node_t);
 	if ((n = malloc(bsize)) == NULL)
 		return -1;
 	memset(n, 0, bsize);
-	memcpy(n, hash->table, hash->length * sizeof(hash_node_t));
+
+	for (i = 0; i < hash->length; i++) {
+		if (!hash_slot_used(hash, i))
+			continue;
+		for (j = 0; j < length; j++) {
+			position = (hash->hash_code(hash->table[i].key) + j) % length;
+			if (n[position].key == NULL) {
+				n[position] = hash->table[i];
+				break;
+			}
+		}
+	}
+
 	free(hash->table);
 	hash->table = n;
-	hash->length += hash->increment;
+	hash->length = length;
+	hash->deleted = 0;
 
 	return 0;
 }
@@ -218,10 +253,15 @@ void *hash_search(hash_t *hash, const void *key, int type)
 		return NULL;
 
 	int position, i;
+	unsigned int code = hash->hash_code(key);
 
+	/* Probing stops at the first never used slot; the key cannot be
+	 * stored any further along. */
 	for (i = 0; i < hash->length; i++) {
-		position = (hash->hash_code(key) + i) % hash->length;
-		if (hash->table[position].key != NULL &&
+		position = (code + i) % hash->length;
+		if (hash->table[position].key == NULL)
+			break;
+		if (hash->table[position].key != HASH_DELETED &&
 		    hash->compare(key, hash->table[position].key) == 0) {
 			switch (type) {
 				case HASH_VALUE:
@@ -229,13 +269,14 @@ void *hash_search(hash_t *hash, const void *key, int type)
 				case HASH_EXISTS:
 					return hash->table[position].key;
 				case HASH_DELETE:
-					if (hash->table[i].key != NULL && hash->kdestroy != NULL)
+					if (hash->kdestroy != NULL)
 						hash->kdestroy(hash->table[position].key);
 					if (hash->table[position].value != NULL && hash->vdestroy != NULL)
 						hash->vdestroy(hash->table[position].value);
-					hash->table[position].key = NULL;
+					hash->table[position].key = HASH_DELETED;
 					hash->table[position].value = NULL;
 					hash->size--;
+					hash->deleted++;
 					return NULL;
 			}
 		}
@@ -245,4 +286,46 @@ void *hash_search(hash_t *hash, const void *key, int type)
 	return NULL;
 }
 
+/***********************************************************************
+ * The djb2 hash of Dan Bernstein, for keys that are NUL terminated
+ * strings. Use it with hash_compare_string().
+ **********************************************************************/
+unsigned int hash_string(const void *key)
+{
+	const unsigned char *s = key;
+	unsigned int h = 5381;
+
+	while (*s)
+		h = ((h << 5) + h) + *s++;
+
+	return h;
+}
+
+/***********************************************************************
+ * Compares the string keys 'left' and 'right' as strcmp(3) does.
+ **********************************************************************/
+int hash_compare_string(const void *left, const void *right)
+{
+	return strcmp(left, right);
+}
+
+/***********************************************************************
+ * The hash of a key that is an integer, such as a pid, stored in the
+ * pointer itself with (void *)(intptr_t). Use it with
+ * hash_compare_int(). A key of 0 is NULL, and cannot be stored.
+ **********************************************************************/
+unsigned int hash_int(const void *key)
+{
+	return (unsigned int)(intptr_t)key;
+}
+
+/***********************************************************************
+ * Compares the integer keys 'left' and 'right', see hash_int().
+ **********************************************************************/
+int hash_compare_int(const void *left, const void *right)
+{
+	return ((intptr_t)left > (intptr_t)right) -
+	       ((intptr_t)left < (intptr_t)right);
+}
+
 #endif
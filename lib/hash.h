@@ -8,6 +8,7 @@ typedef struct hash_node_t {
 
 typedef struct hash_t {
 	int size;    /* The number of used entries in the hash. */
+	int deleted; /* The number of slots holding a deleted entry. */
 	int length;  /* The maximum number of entries possible in the hash. */
 	int increment;  /* User defined increment step when table is full. */
 	hash_node_t *table;
@@ -25,6 +26,16 @@ int      hash_insert(hash_t *hash, const void *key, const void *value);
 void    *hash_search(hash_t *hash, const void *key, int type);
 double   hash_load_factor(hash_t *hash);
 
+/* Hash and compare functions for string and integer keys. */
+unsigned int hash_string(const void *key);
+int          hash_compare_string(const void *left, const void *right);
+unsigned int hash_int(const void *key);
+int          hash_compare_int(const void *left, const void *right);
+
+/* The key of a slot whose entry was deleted. */
+extern const char hash_deleted_key;
+#define HASH_DELETED  ((void *)&hash_deleted_key)
+
 #define HASH_VALUE   0
 #define HASH_DELETE  1
 #define HASH_EXISTS  2
@@ -37,5 +48,8 @@ double   hash_load_factor(hash_t *hash);
 #define  hash_load_factor(hash) \
 	(((double)(hash)->size / (double)(hash)->length))
 #define  hash_probe_estimate(hash) (1 / (1 - hash_load_factor(hash)))
+/* Non-zero if slot 'i' of the table holds an entry. */
+#define  hash_slot_used(hash, i) \
+	((hash)->table[i].key != NULL && (hash)->table[i].key != HASH_DELETED)
 
 #endif
@@ -0,0 +1,352 @@
+/***********************************************************************
+ * File: argbatch.c
+ * Description: Batching of argument lists too long to exec. A command
+ *   whose words, with the environment, exceed ARG_MAX fails with E2BIG
+ *   in any shell, such as `rm $(find . -name "*.log")' in a directory
+ *   with millions of logs. With `set -o argbatch=N' (or $TANSH_ARGBATCH),
+ *   or for a single stage with the attribute word `@batch=N' (see
+ *   stageattr.c), such a stage is run the way xargs(1) would run it:
+ *   its operands are cut into batches that fit, each run with the same
+ *   leading words, N batches at once (one after the other for N = 1):
+ *
+ *     @batch=4 rm -f $(cat stale-files)
+ *
+ *   The leading words kept in every batch are the command and the
+ *   options that follow it (through `--'). `@batch=N:K' keeps the first
+ *   K words instead, as in `@batch=1:3 grep -l pattern $(...)', where
+ *   the pattern must go to every batch. Commands whose last operand is
+ *   special, such as cp and mv, need their -t form.
+ *
+ *   Like a stage with multios (see multio.c), a batched stage is started
+ *   by a process of its own, which takes its place in the job: it
+ *   applies the redirections of the stage once, so every batch appends
+ *   to the same files, runs the batches, and exits with the largest
+ *   exit status among them, or 128 plus the number of a signal that
+ *   killed one. Once a batch cannot be run (status 127), no more are
+ *   started. A batch is not batched again: an operand too long to fit
+ *   in ARG_MAX with the leading words is reported (E2BIG, status 126)
+ *   and ends the stage.
+ **********************************************************************/
+
+#ifndef ARGBATCH_C
+#define ARGBATCH_C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "argbatch.h"
+#include "launch.h"
+#include "pmap.h"
+#include "option.h"
+#include "redirect.h"
+#include "job.h"
+#include "cmd.h"
+#include "list.h"
+#include "error.h"
+
+/* How a stage is batched */
+struct argbatch_spec_t {
+	long jobs;  /* Batches run at once, or 0 if the stage is not batched */
+	int keep;   /* Leading words kept in every batch, or 0 for the
+	             * command and its options */
+};
+
+/***********************************************************************
+ * Parses the value of a `@batch=N[:K]' attribute word.
+ *
+ * Parameters:
+ *   value: The text after `@batch='.
+ *   jobs, keep: If not NULL, set to N and K (0 if K is not given).
+ *
+ * Return value:
+ *   Returns 0, or -1 if 'value' is malformed.
+ **********************************************************************/
+int argbatch_spec(const char *value, long *jobs, int *keep)
+{
+	char *end;
+	long n, k = 0;
+
+	errno = 0;
+	n = strtol(value, &end, 10);
+	if (errno || end == value || n < 1)
+		return -1;
+	if (*end == ':') {
+		value = end + 1;
+		k = strtol(value, &end, 10);
+		if (errno || end == value || k < 1 || k > 1024)
+			return -1;
+	}
+	if (*end != '\0')
+		return -1;
+
+	if (jobs)
+		*jobs = n;
+	if (keep)
+		*keep = k;
+	return 0;
+}
+
+/*
+ * Fills in 'spec' for the stage 'cmd', from its `@batch' word or from
+ * `set -o argbatch'.
+ */
+static void argbatch_options(struct expr_t *cmd, struct argbatch_spec_t *spec)
+{
+	list_node_t *node;
+	char *word;
+
+	spec->jobs = option_value(option_lookup("argbatch"));
+	spec->keep = 0;
+
+	list_foreach(cmd->exec, node) {
+		word = list_key(node);
+		if (word[0] != '@' || !strchr(word, '='))
+			break;
+		if (strncmp(word, "@batch=", 7) == 0 &&
+		    argbatch_spec(word + 7, &spec->jobs, &spec->keep) == -1)
+			spec->jobs = 0;  /* stageattr_parse() reports it */
+	}
+}
+
+/*
+ * Returns the room that the word 'word' takes in the argument space.
+ */
+static long argbatch_size(const char *word)
+{
+	return strlen(word) + 1 + sizeof(char *);
+}
+
+/***********************************************************************
+ * Returns non-zero if the stage 'cmd' is to be run in batches: it is
+ * batched (by `set -o argbatch' or `@batch') and its words do not fit
+ * in ARG_MAX alongside the environment.
+ **********************************************************************/
+int argbatch_needed(struct expr_t *cmd)
+{
+	struct argbatch_spec_t spec;
+	list_node_t *node;
+	long size = 0;
+	char *word;
+
+	if (cmd_is_batched(cmd))
+		return 0;
+	argbatch_options(cmd, &spec);
+	if (spec.jobs <= 0)
+		return 0;
+
+	list_foreach(cmd->exec, node) {
+		word = list_key(node);
+		if (size == 0 && word[0] == '@' && strchr(word, '='))
+			continue;  /* Attributes are not passed to the command */
+		size += argbatch_size(word);
+	}
+
+	return size > pmap_arg_space();
+}
+
+/*
+ * Starts the batch of the words 'head' (the 'nhead' leading words, with
+ * any attribute words first) and the 'n' operands at 'operands'.
+ * Returns its pid, or -1 on error.
+ */
+static pid_t argbatch_launch(char **head, int nhead, char **operands, int n)
+{
+	int i;
+	pid_t pid = -1;
+	struct expr_t *cmd;
+
+	if ((cmd = cmd_create()) == NULL)
+		return -1;
+	cmd_set_type(cmd, CMD_SIMPLE);
+	cmd_set_type(cmd, CMD_BATCHED);
+	for (i = 0; i < nhead; i++)
+		list_push(cmd->exec, strdup(head[i]));
+	for (i = 0; i < n; i++)
+		list_push(cmd->exec, strdup(operands[i]));
+
+	if (launch_pipeline(cmd, &pid, NULL) != 1)
+		pid = -1;
+	cmd_destroy(cmd);
+	return pid;
+}
+
+/*
+ * Returns the number of operands, starting at 'operands', that go into
+ * the next of the 'left' remaining ones: as many as fit in 'space'
+ * after the 'base' bytes of the leading words, and no more than 'max'.
+ * Returns 0 if not even the first one fits.
+ */
+static int argbatch_next(char **operands, int left, int max, long space,
+		long base)
+{
+	int n;
+
+	if (left > max)
+		left = max;
+	for (n = 0; n < left; n++) {
+		base += argbatch_size(operands[n]);
+		if (base > space)
+			break;
+	}
+
+	return n;
+}
+
+/*
+ * Runs the batches of the stage 'cmd', as told by 'spec'. Returns the
+ * largest exit status among them.
+ */
+static int argbatch_run(struct expr_t *cmd, struct argbatch_spec_t *spec)
+{
+	int i, argc, first, nhead, nops, next = 0, running = 0, max, n;
+	int status, code, ret = 0;
+	long space, base = 0;
+	char **args, **head;
+	pid_t pid;
+
+	if ((args = cmd_argv(cmd)) == NULL)
+		return 1;
+	for (argc = 0; args[argc]; argc++)
+		;
+
+	/* The attribute words but @batch go to every batch, ahead of the
+	 * kept words */
+	if ((head = malloc((argc + 1) * sizeof(char *))) == NULL) {
+		err_malloc(errno);
+		free(args);
+		return 1;
+	}
+	for (first = 0, nhead = 0; first < argc && args[first][0] == '@' &&
+			strchr(args[first], '='); first++)
+		if (strncmp(args[first], "@batch=", 7) != 0)
+			head[nhead++] = args[first];
+
+	if (spec->keep > 0) {
+		for (i = first; i < argc && i < first + spec->keep; i++)
+			head[nhead++] = args[i];
+	} else {
+		for (i = first; i < argc && (i == first || args[i][0] == '-'); i++) {
+			head[nhead++] = args[i];
+			if (strcmp(args[i], "--") == 0) {
+				i++;
+				break;
+			}
+		}
+	}
+	for (n = 0; n < nhead; n++)
+		base += argbatch_size(head[n]);
+	nops = argc - i;
+	space = pmap_arg_space();
+	max = (nops + spec->jobs - 1) / spec->jobs;
+
+	/* The batches are started in the group of this process */
+	job_control = 0;
+	signal(SIGCHLD, SIG_DFL);
+
+	/* With no operands left to cut, the command is run as it is */
+	if (nops == 0 && argbatch_launch(head, nhead, NULL, 0) != -1)
+		running = 1;
+
+	while (next < nops || running > 0) {
+		while (running < spec->jobs && next < nops) {
+			n = argbatch_next(args + i + next, nops - next, max, space, base);
+			if (n == 0) {
+				err_msg("tansh: %s: %s", args[first], strerror(E2BIG));
+				if (ret < 126)
+					ret = 126;
+				next = nops;
+				break;
+			}
+			if (argbatch_launch(head, nhead, args + i + next, n) == -1) {
+				ret = 127;
+				next = nops;
+				break;
+			}
+			next += n;
+			running++;
+		}
+		if (running == 0)
+			break;
+
+		if ((pid = waitpid(-1, &status, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;  /* No children left */
+		}
+		running--;
+		code = WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+			: WEXITSTATUS(status);
+		if (code > ret)
+			ret = code;
+		if (code == 127)
+			next = nops;  /* No point in trying again */
+	}
+
+	free(head);
+	free(args);
+	return ret;
+}
+
+/***********************************************************************
+ * Starts the stage 'cmd', whose words are too long (see
+ * argbatch_needed()), through a process that stands for it in the job
+ * and runs it in batches.
+ *
+ * Parameters:
+ *   cmd: The stage.
+ *   fd_in, fd_out: The pipes to the previous and next stages, or -1.
+ *   pgid: The process group to join, 0 for a new one, or -1.
+ *
+ * Return value:
+ *   Returns the pid of the process, or -1 on error.
+ **********************************************************************/
+pid_t argbatch_start(struct expr_t *cmd, int fd_in, int fd_out, pid_t pgid)
+{
+	struct argbatch_spec_t spec;
+	pid_t pid;
+	sigset_t mask;
+
+	argbatch_options(cmd, &spec);
+
+	if ((pid = fork()) == -1) {
+		err_fork(errno);
+		return -1;
+	}
+
+	if (pid == 0) {  /* The process that runs the batches */
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		if (pgid != -1) {
+			setpgid(0, pgid);
+			signal(SIGTSTP, SIG_DFL);
+			signal(SIGTTIN, SIG_DFL);
+			signal(SIGTTOU, SIG_DFL);
+		}
+
+		if ((fd_in != -1 && dup2(fd_in, STDIN_FILENO) == -1) ||
+		    (fd_out != -1 && dup2(fd_out, STDOUT_FILENO) == -1)) {
+			err_dup2(errno);
+			_exit(1);
+		}
+		if (redirect_apply(cmd->redirects, NULL) == -1)
+			_exit(1);
+		/* The other ends of the pipeline must not be held open */
+		launch_close_on_exec();
+
+		signal(SIGINT, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+		_exit(argbatch_run(cmd, &spec));
+	}
+
+	if (pgid != -1)
+		setpgid(pid, pgid ? pgid : pid);
+
+	return pid;
+}
+
+#endif
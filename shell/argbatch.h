@@ -0,0 +1,11 @@
+#ifndef ARGBATCH_H
+#define ARGBATCH_H
+
+#include <sys/types.h>
+#include "cmd.h"
+
+int   argbatch_spec(const char *value, long *jobs, int *keep);
+int   argbatch_needed(struct expr_t *cmd);
+pid_t argbatch_start(struct expr_t *cmd, int fd_in, int fd_out, pid_t pgid);
+
+#endif
@@ -0,0 +1,624 @@
+/***********************************************************************
+ * File: autopar.c
+ * Description: Automatic parallelization of independent commands,
+ *   turned on with `set -o autopar' (or $TANSH_AUTOPAR). Before a run
+ *   of `;'-separated pipelines is executed, the files each pipeline may
+ *   use are worked out from its words and redirections, and pipelines
+ *   that use nothing another one changes run at once, up to
+ *   `set -o autoparjobs=N' at a time (default: one per online
+ *   processor):
+ *
+ *     cp -r /src/a /build/a
+ *     cp -r /src/b /build/b
+ *     grep -r TODO /build/a
+ *     grep -r TODO /build/b
+ *
+ *   runs both copies together, then each grep once its own copy is
+ *   done. A pipeline starts only after every earlier pipeline it
+ *   conflicts with has finished, so the script behaves as if its
+ *   commands ran one after the other:
+ *
+ *   - Each pipeline's stdout and stderr are collected in anonymous
+ *     memory files, and copied out in script order as soon as every
+ *     earlier pipeline has been copied out. The output of a pipeline
+ *     that starts with nothing left to copy before it is not collected.
+ *   - The status of the run is that of its last pipeline.
+ *
+ *   What a pipeline uses is guessed as follows:
+ *
+ *   - A file opened by a redirection is read (`<') or written (`>',
+ *     `>>', `<>'). A descriptor copied with `>&N' is written.
+ *   - The operands of a command, its words that are not options, and
+ *     the values of `--name=value' options, are taken as file names,
+ *     relative to the working directory. A command known to only read
+ *     its operands (cat, grep, ls, ...) reads them; a command known to
+ *     use no other files (cp, mv, mkdir, ...) may write them, or
+ *     anything below them if they are directories.
+ *   - Any other command may change anything, and runs on its own. This
+ *     covers scripts and interpreters (sh, python, make, env, ...),
+ *     whose operands say nothing of the files they use.
+ *   - When the shell's input is a file or a pipe, the pipelines that
+ *     read it run in turn. Otherwise (a terminal, /dev/null) the
+ *     pipelines of a run read /dev/null.
+ *
+ *   Only plain pipelines take part: loops, builtins that change the
+ *   state of the shell (read, set, wait, ...), background and timed
+ *   pipelines and words with substitutions end a run, and execute as
+ *   usual. The guess cannot see files a command opens without naming
+ *   them, which is why the option has to be turned on.
+ **********************************************************************/
+
+#ifndef AUTOPAR_C
+#define AUTOPAR_C
+
+#define _GNU_SOURCE  /* memfd_create(2), asprintf(3) */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "autopar.h"
+#include "launch.h"
+#include "builtin.h"
+#include "cache.h"
+#include "subst.h"
+#include "option.h"
+#include "job.h"
+#include "cmd.h"
+#include "redirect.h"
+#include "list.h"
+#include "error.h"
+
+/* Commands that only read the files they are given */
+static const char *autopar_readers[] = {
+	"cat", "cmp", "diff", "du", "echo", "egrep", "fgrep", "file", "false",
+	"grep", "head", "ls", "md5sum", "printf", "sha1sum", "sha256sum",
+	"sleep", "stat", "tail", "test", "true", "wc", NULL
+};
+
+/* Commands that may write the files they are given, and use no others */
+static const char *autopar_writers[] = {
+	"chgrp", "chmod", "chown", "cp", "ln", "mkdir", "mkfifo", "mv", "rm",
+	"rmdir", "tee", "touch", "truncate", NULL
+};
+
+/* A file a pipeline may use */
+struct autopar_use_t {
+	char *path;  /* Absolute and without `.' or `..', or `&N' for fd N */
+	int write;
+};
+
+/* The states of a pipeline of a run */
+#define AUTOPAR_WAITING  0
+#define AUTOPAR_RUNNING  1
+#define AUTOPAR_DONE     2
+
+/* A pipeline of a run */
+struct autopar_cmd_t {
+	struct expr_t *cmd;  /* The first stage */
+	int n;               /* Stages */
+	struct autopar_use_t *uses;
+	int nuses;
+	int all;             /* Non-zero if it may change anything */
+	int input;           /* Non-zero if it reads the shell's input */
+	int state;
+	int status;
+	int out;             /* Memory file its output is collected in, or -1 */
+	int err;             /* Its stderr, or -1 if it goes with its stdout */
+};
+
+/*
+ * Returns the number of stages of the pipeline at 'cmd' if it may run
+ * concurrently with others, or 0 if it ends a run.
+ */
+static int autopar_candidate(struct expr_t *cmd)
+{
+	int i, n, first;
+	struct builtin_t *builtin;
+	list_node_t *node;
+	char *word;
+
+	if (!cmd || cmd_is_for(cmd) || cmd_is_function(cmd) ||
+	    cmd_is_start_block(cmd) || cmd_is_timed(cmd) || cmd_is_exec(cmd))
+		return 0;
+
+	n = launch_pipeline_length(cmd);
+	for (i = 0; i < n; i++, cmd = cmd->next) {
+		if (!cmd || cmd_is_internal(cmd) || cmd_is_end_block(cmd) ||
+		    cmd_is_end_function(cmd) || list_size(cmd->exec) == 0)
+			return 0;
+		if (i == n - 1 && cmd_is_background(cmd))
+			return 0;
+
+		first = 1;
+		list_foreach(cmd->exec, node) {
+			word = list_key(node);
+			if (subst_needed(word))
+				return 0;
+			if (!first || (word[0] == '@' && strchr(word, '=')))
+				continue;
+			first = 0;
+			if ((builtin = builtin_lookup(word)) && !builtin->threaded)
+				return 0;
+		}
+	}
+
+	return n;
+}
+
+/*
+ * Returns 'word' made absolute against the directory 'cwd', with its
+ * `.' and `..' components resolved, or NULL on error. The string must
+ * be freed.
+ */
+static char *autopar_path(const char *cwd, const char *word)
+{
+	char *path, *p, *q, *s;
+	size_t len;
+
+	if (asprintf(&path, "%s/%s", *word == '/' ? "" : cwd, word) == -1)
+		return NULL;
+
+	for (p = q = path; *p; ) {
+		while (*p == '/')
+			p++;
+		if (*p == '\0')
+			break;
+		for (s = p; *p && *p != '/'; p++)
+			;
+		len = p - s;
+		if (len == 1 && s[0] == '.')
+			continue;
+		if (len == 2 && s[0] == '.' && s[1] == '.') {
+			while (q > path && *--q != '/')
+				;
+			continue;
+		}
+		*q++ = '/';
+		memmove(q, s, len);
+		q += len;
+	}
+	if (q == path)
+		*q++ = '/';
+	*q = '\0';
+
+	return path;
+}
+
+/*
+ * Records that 'm' uses the file 'path' (already absolute if 'cwd' is
+ * NULL). Returns 0, or -1 on error.
+ */
+static int autopar_use(struct autopar_cmd_t *m, const char *cwd,
+		const char *path, int write)
+{
+	struct autopar_use_t *uses;
+	char *name;
+
+	name = cwd ? autopar_path(cwd, path) : strdup(path);
+	if (!name || (uses = realloc(m->uses,
+			(m->nuses + 1) * sizeof(struct autopar_use_t))) == NULL) {
+		free(name);
+		err_malloc(errno);
+		return -1;
+	}
+
+	m->uses = uses;
+	m->uses[m->nuses].path = name;
+	m->uses[m->nuses].write = write;
+	m->nuses++;
+	return 0;
+}
+
+/*
+ * Returns non-zero if the command 'name' (which may be a path) is in
+ * the NULL terminated list 'known'.
+ */
+static int autopar_known(const char *name, const char **known)
+{
+	const char *base = strrchr(name, '/');
+	int i;
+
+	base = base ? base + 1 : name;
+	for (i = 0; known[i]; i++)
+		if (strcmp(base, known[i]) == 0)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Records the files the redirections of the stage 'cmd' use in 'm'.
+ * Sets '*input' to zero if one of them replaces its stdin. Returns 0,
+ * or -1 on error.
+ */
+static int autopar_redirects(struct autopar_cmd_t *m, struct expr_t *cmd,
+		const char *cwd, int *input)
+{
+	list_node_t *node;
+	struct redirect_t *redir;
+	char *path, fd[16];
+
+	if (!cmd->redirects)
+		return 0;
+
+	list_foreach(cmd->redirects, node) {
+		redir = list_key(node);
+		if (redirect_target(redir) == STDIN)
+			*input = 0;
+		if ((path = redirect_filename(redir)) != NULL) {
+			if (autopar_use(m, cwd, path,
+					redir->type != REDIRECT_INPUT) == -1)
+				return -1;
+		} else if ((redir->type == REDIRECT_DUP_OUTPUT ||
+		            redir->type == REDIRECT_DUP_INPUT) && redir->dup_fd > STDERR) {
+			snprintf(fd, sizeof(fd), "&%d", redir->dup_fd);
+			if (autopar_use(m, NULL, fd, 1) == -1)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Works out which files the pipeline 'm' uses, relative to the working
+ * directory 'cwd'. 'input' is non-zero if the shell's input is data
+ * that the pipelines of the run must read in turn. Returns 0, or -1 on
+ * error.
+ */
+static int autopar_analyze(struct autopar_cmd_t *m, const char *cwd,
+		int input)
+{
+	int i, reader, operands, redirected;
+	struct expr_t *cmd = m->cmd;
+	list_node_t *node;
+	char *word, *name, *eq;
+
+	for (i = 0; i < m->n; i++, cmd = cmd->next) {
+		if (autopar_redirects(m, cmd, cwd,
+				i == 0 ? &input : &redirected) == -1)
+			return -1;
+
+		name = NULL;
+		reader = operands = 0;
+		list_foreach(cmd->exec, node) {
+			word = list_key(node);
+			if (!name) {
+				if (word[0] == '@' && strchr(word, '='))
+					continue;  /* A stage attribute */
+				name = word;
+				reader = autopar_known(name, autopar_readers);
+				if (!reader && !autopar_known(name, autopar_writers))
+					m->all = 1;
+				if (strchr(name, '/') && autopar_use(m, cwd, name, 0) == -1)
+					return -1;
+				continue;
+			}
+			if (word[0] == '-') {
+				if ((eq = strchr(word, '=')) == NULL || eq[1] == '\0')
+					continue;
+				word = eq + 1;
+			}
+			operands++;
+			if (autopar_use(m, cwd, word, !reader) == -1)
+				return -1;
+		}
+
+		if (reader && !operands && autopar_use(m, cwd, ".", 0) == -1)
+			return -1;
+	}
+
+	m->input = input;
+	return 0;
+}
+
+/*
+ * Returns non-zero if one of the paths 'a' and 'b' is, or is within,
+ * the other.
+ */
+static int autopar_overlap(const char *a, const char *b)
+{
+	size_t la = strlen(a), lb = strlen(b);
+
+	if (la > lb)
+		return autopar_overlap(b, a);
+	return strncmp(a, b, la) == 0 &&
+		(la == lb || b[la] == '/' || (la == 1 && a[0] == '/'));
+}
+
+/*
+ * Returns non-zero if the pipelines 'a' and 'b' may not run at once.
+ */
+static int autopar_conflict(struct autopar_cmd_t *a, struct autopar_cmd_t *b)
+{
+	int i, j;
+
+	if (a->all || b->all || (a->input && b->input))
+		return 1;
+
+	for (i = 0; i < a->nuses; i++)
+		for (j = 0; j < b->nuses; j++)
+			if ((a->uses[i].write || b->uses[j].write) &&
+			    autopar_overlap(a->uses[i].path, b->uses[j].path))
+				return 1;
+
+	return 0;
+}
+
+/*
+ * Makes 'fd' the descriptor 'target' of the shell, keeping a copy of
+ * the old one in '*saved'. Returns 0, or -1 on error.
+ */
+static int autopar_swap(int fd, int target, int *saved)
+{
+	if ((*saved = fcntl(target, F_DUPFD_CLOEXEC, STDERR + 1)) == -1 &&
+	    errno != EBADF)
+		return -1;
+	if (dup2(fd, target) == -1) {
+		close(*saved);
+		*saved = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Puts back the descriptor 'target' of the shell saved in 'saved'.
+ */
+static void autopar_restore(int target, int saved)
+{
+	if (saved == -1) {
+		close(target);
+		return;
+	}
+	dup2(saved, target);
+	close(saved);
+}
+
+/*
+ * Starts the pipeline 'm', with its output collected unless 'direct',
+ * its stdin from 'null_fd' unless it is -1, and its stderr collected
+ * along with its stdout if 'shared'. Returns its job, or NULL on error.
+ */
+static struct job_t *autopar_start(struct autopar_cmd_t *m, int direct,
+		int null_fd, int shared)
+{
+	int i, fds[3], saved[3] = { -1, -1, -1 }, swapped[3] = { 0, 0, 0 };
+	pid_t pids[m->n];
+	struct job_t *job = NULL;
+	sigset_t mask, omask;
+
+	if (!direct) {
+		if ((m->out = memfd_create("tansh-autopar", MFD_CLOEXEC)) == -1 ||
+		    (!shared &&
+		     (m->err = memfd_create("tansh-autopar", MFD_CLOEXEC)) == -1)) {
+			err_msg("tansh: autopar: %s", strerror(errno));
+			return NULL;
+		}
+	}
+
+	fds[STDIN] = null_fd;
+	fds[STDOUT] = m->out;
+	fds[STDERR] = shared ? m->out : m->err;
+	fflush(stdout);
+	fflush(stderr);
+	for (i = 0; i < 3; i++) {
+		if (fds[i] == -1)
+			continue;
+		if (autopar_swap(fds[i], i, &saved[i]) == -1) {
+			err_dup2(errno);
+			break;
+		}
+		swapped[i] = 1;
+	}
+
+	if (i == 3) {
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGCHLD);
+		sigprocmask(SIG_BLOCK, &mask, &omask);
+		if (launch_pipeline(m->cmd, pids, NULL) != -1)
+			job = job_create(pids, NULL, m->n, 0, cmd_to_string(m->cmd, m->n));
+		sigprocmask(SIG_SETMASK, &omask, NULL);
+	}
+
+	for (i = 0; i < 3; i++)
+		if (swapped[i])
+			autopar_restore(i, saved[i]);
+
+	return job;
+}
+
+/*
+ * Copies out the output collected from the pipeline 'm', and releases
+ * it.
+ */
+static void autopar_flush(struct autopar_cmd_t *m)
+{
+	fflush(stdout);
+	fflush(stderr);
+	if (m->out != -1)
+		cache_send(m->out, STDOUT_FILENO);
+	if (m->err != -1)
+		cache_send(m->err, STDERR_FILENO);
+}
+
+/*
+ * Returns non-zero if the shell's stdout and stderr are the same file,
+ * so that collected output keeps them interleaved.
+ */
+static int autopar_shared_output(void)
+{
+	struct stat out, err;
+
+	return fstat(STDOUT_FILENO, &out) == 0 && fstat(STDERR_FILENO, &err) == 0 &&
+		out.st_dev == err.st_dev && out.st_ino == err.st_ino;
+}
+
+/*
+ * Returns non-zero if the shell's stdin is data, a file or a pipe,
+ * rather than a terminal or a device such as /dev/null.
+ */
+static int autopar_input_is_data(void)
+{
+	struct stat st;
+
+	return fstat(STDIN_FILENO, &st) == 0 &&
+		(S_ISREG(st.st_mode) || S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode));
+}
+
+/*
+ * Returns non-zero if the pipeline 'i' of 'm' may start: every earlier
+ * pipeline it conflicts with (per 'conflict', 'n' by 'n') is done.
+ */
+static int autopar_ready(struct autopar_cmd_t *m, char *conflict, int n,
+		int i)
+{
+	int j;
+
+	for (j = 0; j < i; j++)
+		if (conflict[i * n + j] && m[j].state != AUTOPAR_DONE)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Runs the 'n' pipelines of 'm', whose conflicts are in 'conflict',
+ * with at most 'workers' at once. Returns the status of the last one.
+ */
+static int autopar_schedule(struct autopar_cmd_t *m, char *conflict, int n,
+		long workers)
+{
+	int i, running = 0, flushed = 0, null_fd = -1, shared;
+	struct job_t *jobs[n];
+
+	if (!autopar_input_is_data() &&
+	    (null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1)
+		err_open(errno);
+	shared = autopar_shared_output();
+	for (i = 0; i < n; i++)
+		jobs[i] = NULL;
+
+	while (flushed < n) {
+		for (i = flushed; i < n && running < workers; i++) {
+			if (m[i].state != AUTOPAR_WAITING ||
+			    !autopar_ready(m, conflict, n, i))
+				continue;
+			if ((jobs[i] = autopar_start(&m[i], i == flushed, null_fd,
+					shared)) == NULL) {
+				m[i].state = AUTOPAR_DONE;
+				m[i].status = 127;
+				continue;
+			}
+			m[i].state = AUTOPAR_RUNNING;
+			running++;
+		}
+
+		if (running > 0 && (i = job_wait_slots(jobs, n)) != -1) {
+			m[i].status = job_wait(jobs[i]);
+			m[i].state = AUTOPAR_DONE;
+			jobs[i] = NULL;
+			running--;
+		} else if (running > 0) {
+			break;  /* No children left; nothing more to collect */
+		}
+
+		for (; flushed < n && m[flushed].state == AUTOPAR_DONE; flushed++)
+			autopar_flush(&m[flushed]);
+	}
+
+	if (null_fd != -1)
+		close(null_fd);
+	return m[n - 1].status;
+}
+
+/*
+ * Releases the 'n' pipelines of 'm'.
+ */
+static void autopar_free(struct autopar_cmd_t *m, int n)
+{
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < m[i].nuses; j++)
+			free(m[i].uses[j].path);
+		free(m[i].uses);
+		if (m[i].out != -1)
+			close(m[i].out);
+		if (m[i].err != -1)
+			close(m[i].err);
+	}
+}
+
+/***********************************************************************
+ * Runs the run of independent pipelines that starts at 'cmd', if there
+ * is one, concurrently (see above). Called by do_command() for each
+ * expression while `set -o autopar' is on.
+ *
+ * Parameters:
+ *   cmd: The expression to run next.
+ *   next: Set to the expression after the run, if it was run.
+ *
+ * Return value:
+ *   Returns 1 if a run of at least two pipelines was run, with the
+ *   status of its last one in job_last_status, or 0 if 'cmd' is to be
+ *   run as usual.
+ **********************************************************************/
+int autopar_run(struct expr_t *cmd, struct expr_t **next)
+{
+	int i, j, n = 0, stages, ret = 0;
+	long workers;
+	char *cwd, *conflict;
+	struct expr_t *c = cmd;
+	struct autopar_cmd_t m[AUTOPAR_WINDOW];
+
+	while (n < AUTOPAR_WINDOW && (stages = autopar_candidate(c)) > 0) {
+		memset(&m[n], 0, sizeof(struct autopar_cmd_t));
+		m[n].cmd = c;
+		m[n].n = stages;
+		m[n].out = m[n].err = -1;
+		for (i = 0; i < stages; i++)
+			c = c->next;
+		n++;
+	}
+	if (n < 2 || (cwd = getcwd(NULL, 0)) == NULL)
+		return 0;
+
+	if ((conflict = calloc(n * n, 1)) == NULL) {
+		err_malloc(errno);
+		free(cwd);
+		return 0;
+	}
+	for (i = 0; i < n; i++)
+		if (autopar_analyze(&m[i], cwd, autopar_input_is_data()) == -1)
+			break;
+
+	if (i == n) {
+		for (i = 0; i < n; i++)
+			for (j = 0; j < i; j++)
+				conflict[i * n + j] = autopar_conflict(&m[i], &m[j]);
+
+		workers = option_value(option_lookup("autoparjobs"));
+		if (workers <= 0 && (workers = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+			workers = 1;
+
+		job_last_status = autopar_schedule(m, conflict, n, workers);
+		*next = c;
+		ret = 1;
+	}
+
+	autopar_free(m, n);
+	free(conflict);
+	free(cwd);
+	return ret;
+}
+
+#endif
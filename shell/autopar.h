@@ -0,0 +1,11 @@
+#ifndef AUTOPAR_H
+#define AUTOPAR_H
+
+#include "cmd.h"
+
+/* Pipelines looked at at once; a longer run is run in several parts. */
+#define AUTOPAR_WINDOW  256
+
+int autopar_run(struct expr_t *cmd, struct expr_t **next);
+
+#endif
@@ -0,0 +1,452 @@
+/***********************************************************************
+ * File: builtin.c
+ * Description: The internal commands of the shell. Each builtin takes
+ *   its arguments like main() does, reads and writes the streams it is
+ *   given instead of stdin and stdout, and returns its exit status. New
+ *   builtins only need to be added to the `builtins' table.
+ *
+ *   A builtin may run on a thread of its own as a stage of a pipeline
+ *   (see launch.c), concurrently with other builtins. Builtins must
+ *   therefore parse their options with builtin_getopt() rather than
+ *   getopt(3), whose state is global.
+ **********************************************************************/
+
+#ifndef BUILTIN_C
+#define BUILTIN_C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "builtin.h"
+#include "hashcmd.h"
+#include "job.h"
+#include "option.h"
+#include "pmap.h"
+#include "pipestats.h"
+#include "coproc.h"
+#include "jobqueue.h"
+#include "readbuf.h"
+#include "cache.h"
+#include "list.h"
+#include "error.h"
+
+static int builtin_echo(int argc, char **argv, FILE *in, FILE *out);
+static int builtin_true(int argc, char **argv, FILE *in, FILE *out);
+static int builtin_false(int argc, char **argv, FILE *in, FILE *out);
+static int builtin_hash(int argc, char **argv, FILE *in, FILE *out);
+static int builtin_jobs(int argc, char **argv, FILE *in, FILE *out);
+static int builtin_fg(int argc, char **argv, FILE *in, FILE *out);
+static int builtin_bg(int argc, char **argv, FILE *in, FILE *out);
+static int builtin_wait(int argc, char **argv, FILE *in, FILE *out);
+static int builtin_set(int argc, char **argv, FILE *in, FILE *out);
+static int builtin_pipestats(int argc, char **argv, FILE *in, FILE *out);
+
+/* Builtins that read or change the state of the shell (the command hash
+ * table, the job table, the options) are not threaded: in a pipeline
+ * they run in a child process, on a copy of that state. */
+static struct builtin_t builtins[] = {
+	{ "echo",  builtin_echo,  1 },
+	{ "true",  builtin_true,  1 },
+	{ "false", builtin_false, 1 },
+	{ "hash",  builtin_hash,  0 },
+	{ "jobs",  builtin_jobs,  0 },
+	{ "fg",    builtin_fg,    0 },
+	{ "bg",    builtin_bg,    0 },
+	{ "wait",  builtin_wait,  0 },
+	{ "set",   builtin_set,   0 },
+	{ "pmap",  builtin_pmap,  0 },
+	{ "pipestats", builtin_pipestats, 0 },
+	{ "coproc", builtin_coproc, 0 },
+	{ "read",   builtin_read,   0 },
+	{ "mapfile", builtin_mapfile, 0 },
+	{ "readarray", builtin_mapfile, 0 },
+	{ "cached", builtin_cached, 0 },
+	{ NULL, NULL, 0 }
+};
+
+/*
+ * Returns the builtin called 'name', or NULL if there is none.
+ */
+struct builtin_t *builtin_lookup(const char *name)
+{
+	struct builtin_t *b;
+
+	for (b = builtins; b->name; b++)
+		if (strcmp(b->name, name) == 0)
+			return b;
+
+	return NULL;
+}
+
+/*
+ * Returns the builtin that the simple command 'cmd' invokes, or NULL if
+ * it is not an internal command.
+ */
+struct builtin_t *builtin_find(struct expr_t *cmd)
+{
+	if (!cmd || list_size(cmd->exec) == 0)
+		return NULL;
+
+	return builtin_lookup(list_peek(cmd->exec));
+}
+
+/***********************************************************************
+ * Returns the next option of 'argv', like getopt(3), but keeps its
+ * state in 'opt' so that builtins running on different threads do not
+ * interfere. Parsing stops at the first operand or after `--'.
+ *
+ * Parameters:
+ *   opt: The parser state. Must be initialized with BUILTIN_GETOPT_INIT.
+ *   argc, argv: The arguments of the builtin.
+ *   optstring: The option characters, each followed by `:' if it takes
+ *     an argument.
+ *
+ * Return value:
+ *   Returns the option character, `?' for an unknown option or a
+ *   missing argument, or -1 when there are no more options. The index
+ *   of the first operand is left in opt->ind and the argument of an
+ *   option in opt->arg.
+ **********************************************************************/
+int builtin_getopt(struct builtin_getopt_t *opt, int argc, char **argv,
+		const char *optstring)
+{
+	int c;
+	char *spec;
+
+	if (opt->pos == 0) {
+		if (opt->ind >= argc || argv[opt->ind][0] != '-' ||
+		    argv[opt->ind][1] == '\0')
+			return -1;
+		if (strcmp(argv[opt->ind], "--") == 0) {
+			opt->ind++;
+			return -1;
+		}
+		opt->pos = 1;
+	}
+
+	c = argv[opt->ind][opt->pos++];
+	if (c == ':' || (spec = strchr(optstring, c)) == NULL) {
+		err_msg("%s: -%c: invalid option", argv[0], c);
+		c = '?';
+	} else if (spec[1] == ':') {
+		if (argv[opt->ind][opt->pos] != '\0') {
+			opt->arg = &argv[opt->ind][opt->pos];
+		} else if (opt->ind + 1 < argc) {
+			opt->arg = argv[++opt->ind];
+		} else {
+			err_msg("%s: -%c: option requires an argument", argv[0], c);
+			c = '?';
+		}
+		opt->pos = 0;
+		opt->ind++;
+		return c;
+	}
+
+	if (argv[opt->ind][opt->pos] == '\0') {
+		opt->pos = 0;
+		opt->ind++;
+	}
+
+	return c;
+}
+
+/*
+ * echo [-n] [word ...]
+ *
+ * Writes the words separated by spaces, followed by a newline unless -n
+ * is given.
+ */
+static int builtin_echo(int argc, char **argv, FILE *in, FILE *out)
+{
+	int i = 1, newline = 1;
+
+	if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+		newline = 0;
+		i++;
+	}
+
+	for (; i < argc; i++) {
+		fputs(argv[i], out);
+		if (i < argc - 1)
+			fputc(' ', out);
+	}
+	if (newline)
+		fputc('\n', out);
+
+	return ferror(out) ? 1 : 0;
+}
+
+static int builtin_true(int argc, char **argv, FILE *in, FILE *out)
+{
+	return 0;
+}
+
+static int builtin_false(int argc, char **argv, FILE *in, FILE *out)
+{
+	return 1;
+}
+
+/*
+ * hash [-r] [-d name ...] [name ...]
+ *
+ * Without arguments, lists the remembered commands and the lookup
+ * counters. -r forgets every command, -d forgets the given commands,
+ * and any other name is searched in $PATH and remembered.
+ */
+static int builtin_hash(int argc, char **argv, FILE *in, FILE *out)
+{
+	int c, ret = 0, delete = 0;
+	struct builtin_getopt_t opt = BUILTIN_GETOPT_INIT;
+
+	while ((c = builtin_getopt(&opt, argc, argv, "rd")) != -1) {
+		switch (c) {
+			case 'r':
+				hashcmd_flush();
+				hashcmd_hits = hashcmd_misses = 0;
+				break;
+			case 'd':
+				delete = 1;
+				break;
+			default:
+				err_msg("usage: hash [-r] [-d name ...] [name ...]");
+				return 2;
+		}
+	}
+
+	if (opt.ind == argc && argc == 1) {
+		hashcmd_print(out);
+		return 0;
+	}
+
+	for (; opt.ind < argc; opt.ind++) {
+		if (delete) {
+			hashcmd_remove(argv[opt.ind]);
+		} else if (hashcmd_add(argv[opt.ind]) == -1) {
+			err_msg("hash: %s: not found", argv[opt.ind]);
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * jobs [-l | -p | -q] [job ...]
+ *
+ * Lists the jobs in the job table, or only the given ones. -l also
+ * lists the pid and status of every stage, -p only the process group
+ * (or first pid) of each job. -q lists the background pipelines still
+ * queued by `set -o maxjobs' instead.
+ */
+static int builtin_jobs(int argc, char **argv, FILE *in, FILE *out)
+{
+	int c, ret = 0, verbose = 0, pids = 0, queued = 0;
+	struct job_t *job;
+	list_t *jobs;
+	list_node_t *node;
+	struct builtin_getopt_t opt = BUILTIN_GETOPT_INIT;
+
+	while ((c = builtin_getopt(&opt, argc, argv, "lpq")) != -1) {
+		switch (c) {
+			case 'l':
+				verbose = 1;
+				break;
+			case 'p':
+				pids = 1;
+				break;
+			case 'q':
+				queued = 1;
+				break;
+			default:
+				err_msg("usage: jobs [-l | -p | -q] [job ...]");
+				return 2;
+		}
+	}
+
+	if ((jobs = job_list()) == NULL)
+		return 1;
+	job_reap(0);
+
+	if (queued) {
+		jobqueue_print(out);
+		return 0;
+	}
+
+	if (opt.ind == argc) {
+		list_foreach(jobs, node) {
+			job = list_key(node);
+			if (pids)
+				fprintf(out, "%d\n", job->pgid ? job->pgid : job->procs[0].pid);
+			else
+				job_print(out, job, verbose);
+		}
+		return 0;
+	}
+
+	for (; opt.ind < argc; opt.ind++) {
+		if ((job = job_find_spec(argv[opt.ind])) == NULL) {
+			err_msg("jobs: %s: no such job", argv[opt.ind]);
+			ret = 1;
+		} else if (pids) {
+			fprintf(out, "%d\n", job->pgid ? job->pgid : job->procs[0].pid);
+		} else {
+			job_print(out, job, verbose);
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * fg [job]
+ *
+ * Resumes the job (by default the most recent one) in the foreground
+ * and waits for it.
+ */
+static int builtin_fg(int argc, char **argv, FILE *in, FILE *out)
+{
+	struct job_t *job;
+
+	if ((job = job_find_spec(argc > 1 ? argv[1] : NULL)) == NULL) {
+		err_msg("fg: %s: no such job", argc > 1 ? argv[1] : "current");
+		return 1;
+	}
+
+	fprintf(out, "%s\n", job->text);
+	fflush(out);
+	return job_continue(job, 1) == -1 ? 1 : job_last_status;
+}
+
+/*
+ * bg [job ...]
+ *
+ * Resumes the stopped jobs (by default the most recent one) in the
+ * background.
+ */
+static int builtin_bg(int argc, char **argv, FILE *in, FILE *out)
+{
+	int i = 1, ret = 0;
+	struct job_t *job;
+
+	do {
+		if ((job = job_find_spec(i < argc ? argv[i] : NULL)) == NULL) {
+			err_msg("bg: %s: no such job", i < argc ? argv[i] : "current");
+			ret = 1;
+			continue;
+		}
+		if (job_continue(job, 0) == -1) {
+			ret = 1;
+			continue;
+		}
+		fprintf(out, "[%d] %s &\n", job->id, job->text);
+	} while (++i < argc);
+
+	return ret;
+}
+
+/*
+ * wait [-n] [job | pid ...]
+ *
+ * Waits for the given jobs, or for every job if none is given, and
+ * returns the status of the last one. With -n, waits for the next job
+ * to terminate and returns its status; jobs that terminated before are
+ * reported first, in the order in which they terminated.
+ */
+static int builtin_wait(int argc, char **argv, FILE *in, FILE *out)
+{
+	int c, ret = 0, any = 0;
+	struct job_t *job;
+	struct builtin_getopt_t opt = BUILTIN_GETOPT_INIT;
+
+	while ((c = builtin_getopt(&opt, argc, argv, "n")) != -1) {
+		switch (c) {
+			case 'n':
+				any = 1;
+				break;
+			default:
+				err_msg("usage: wait [-n] [job | pid ...]");
+				return 2;
+		}
+	}
+
+	if (any)
+		return job_wait_any();
+	if (opt.ind == argc)
+		return job_wait_all();
+
+	for (; opt.ind < argc; opt.ind++) {
+		if ((job = job_find_spec(argv[opt.ind])) == NULL) {
+			err_msg("wait: %s: no such job", argv[opt.ind]);
+			ret = 127;
+		} else {
+			ret = job_wait(job);
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * set -o [name[=value] ...]
+ * set +o name ...
+ *
+ * Without a name, lists the shell options and their values. -o sets the
+ * given options, +o turns them off.
+ */
+static int builtin_set(int argc, char **argv, FILE *in, FILE *out)
+{
+	int i, ret = 0;
+
+	if (argc < 2 || (strcmp(argv[1], "-o") && strcmp(argv[1], "+o"))) {
+		err_msg("usage: set -o [name[=value] ...] | set +o name ...");
+		return 2;
+	}
+
+	if (argc == 2) {
+		option_print(out);
+		return 0;
+	}
+
+	for (i = 2; i < argc; i++) {
+		if (argv[1][0] == '-' ? option_set(argv[i]) : option_unset(argv[i]))
+			ret = 1;
+	}
+
+	return ret;
+}
+
+/*
+ * pipestats [job ...]
+ *
+ * Samples the given jobs (by default the most recent one) and prints
+ * the statistics of their stages. Only pipelines started while
+ * `set -o pipestats=MS' was on have statistics.
+ */
+static int builtin_pipestats(int argc, char **argv, FILE *in, FILE *out)
+{
+	int i = 1, ret = 0;
+	struct job_t *job;
+
+	do {
+		if ((job = job_find_spec(i < argc ? argv[i] : NULL)) == NULL) {
+			err_msg("pipestats: %s: no such job", i < argc ? argv[i] : "current");
+			ret = 1;
+			continue;
+		}
+		if (!job->stats) {
+			err_msg("pipestats: %s: no statistics (see `set -o pipestats')",
+					i < argc ? argv[i] : "current");
+			ret = 1;
+			continue;
+		}
+		job_reap(0);
+		if (job->state != JOB_DONE)
+			pipestats_sample(job);
+		pipestats_report(out, job);
+	} while (++i < argc);
+
+	return ret;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include <stdio.h>
+#include "cmd.h"
+
+/* A command that is executed by the shell itself. */
+struct builtin_t {
+	char *name;
+	int (*function)(int argc, char **argv, FILE *in, FILE *out);
+	int threaded;  /* May run on a thread as a stage of a pipeline */
+};
+
+/* The state of builtin_getopt(). */
+struct builtin_getopt_t {
+	int ind;    /* Index of the next argument to parse */
+	int pos;    /* Position within a group of options, as in `-ld' */
+	char *arg;  /* Argument of the last option */
+};
+
+#define BUILTIN_GETOPT_INIT  { 1, 0, NULL }
+
+struct builtin_t *builtin_lookup(const char *name);
+struct builtin_t *builtin_find(struct expr_t *cmd);
+int               builtin_getopt(struct builtin_getopt_t *opt, int argc,
+                                 char **argv, const char *optstring);
+
+#endif
@@ -0,0 +1,787 @@
+/***********************************************************************
+ * File: cache.c
+ * Description: The `cached' builtin, which remembers what a slow,
+ *   deterministic command printed and replays it the next time the
+ *   command is run with the same inputs:
+ *
+ *     hosts=$(cached --ttl 600 -f inventory.yml -- inventory list)
+ *
+ *   The key of a result is made of the working directory, the words of
+ *   the command, the values of the environment variables given with -e,
+ *   the modification time, size and inode of the files given with -f,
+ *   and a hash of the input of the builtin, which is read in full and
+ *   handed to the command from an anonymous memory file. The key is
+ *   hashed with the 64-bit FNV-1a function, and the result is stored in
+ *   the cache directory under that hash:
+ *
+ *     HASH.out  The standard output of the command
+ *     HASH.err  Its standard error
+ *     HASH.key  `tansh-cache 1 STATUS' and the key itself, which is
+ *               compared on a hit, so a hash collision only costs a run
+ *
+ *   Each file is written under a temporary name and renamed into place,
+ *   the key last, so concurrent shells never see a partial result.
+ *   Results found in the directory are also entered in an in-memory
+ *   index (a hash table of lib/hash.c), so later hits in the same shell
+ *   do not read the key file again. A hit is replayed with sendfile(2):
+ *   its output goes from the page cache to the output of the builtin
+ *   without being copied through the shell.
+ *
+ *   On a miss, the output of the command is written to the cache files
+ *   and copied out once the command has finished, so it is not seen as
+ *   it is produced, and the standard output of a replayed result always
+ *   comes before its standard error. Results of commands that could not
+ *   be run (status 126 or 127) or that were killed by a signal are not
+ *   kept.
+ *
+ *   The cache directory is $TANSH_CACHE_DIR, or else tansh within
+ *   $XDG_CACHE_HOME or ~/.cache. Removing its files empties the cache.
+ **********************************************************************/
+
+#ifndef CACHE_C
+#define CACHE_C
+
+#define _GNU_SOURCE  /* memfd_create(2), mkostemp(3), open_memstream(3) */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include "cache.h"
+#include "builtin.h"
+#include "redirect.h"
+#include "launch.h"
+#include "job.h"
+#include "cmd.h"
+#include "hash.h"
+#include "list.h"
+#include "error.h"
+
+#define CACHE_USAGE \
+	"usage: cached [-n] [-t ttl] [-e name] [-f file] [--] command [arg ...]"
+
+/* The first line of a key file, followed by the exit status */
+#define CACHE_MAGIC  "tansh-cache 1"
+
+#define CACHE_FNV_BASIS  0xcbf29ce484222325ULL
+#define CACHE_FNV_PRIME  0x100000001b3ULL
+
+/* A result known to be in the cache directory. The key is kept along,
+ * as two keys may share a hash. */
+struct cache_entry_t {
+	int status;     /* Exit status of the command */
+	time_t stored;  /* When the result was stored */
+	char *text;     /* The key of the command */
+	size_t len;
+};
+
+/* The key of a command */
+struct cache_key_t {
+	char *text;
+	size_t len;
+	char hash[17];  /* The FNV-1a hash of 'text', in hexadecimal */
+};
+
+/* Results found so far, by hash */
+static hash_t *cache_index = NULL;
+
+/* The long forms of the options of `cached' */
+static const struct {
+	const char *name;
+	int c;
+} cache_long_options[] = {
+	{ "--ttl",      't' },
+	{ "--env",      'e' },
+	{ "--file",     'f' },
+	{ "--no-stdin", 'n' },
+	{ NULL, 0 }
+};
+
+static void cache_destroy_entry(void *value)
+{
+	struct cache_entry_t *entry = value;
+
+	free(entry->text);
+	free(entry);
+}
+
+/*
+ * Adds the 'len' bytes at 'data' to the FNV-1a hash 'h'.
+ */
+static uint64_t cache_fnv(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= CACHE_FNV_PRIME;
+	}
+
+	return h;
+}
+
+/*
+ * Returns the next option of 'argv' as builtin_getopt() does, also
+ * accepting the long forms, as in `--ttl 600'.
+ */
+static int cache_getopt(struct builtin_getopt_t *opt, int argc, char **argv)
+{
+	int i;
+	char *arg;
+
+	if (opt->pos == 0 && opt->ind < argc) {
+		arg = argv[opt->ind];
+		for (i = 0; cache_long_options[i].name; i++) {
+			if (strcmp(arg, cache_long_options[i].name) != 0)
+				continue;
+			opt->ind++;
+			if (cache_long_options[i].c == 'n')
+				return 'n';
+			if (opt->ind == argc) {
+				err_msg("%s: %s: option requires an argument", argv[0], arg);
+				return '?';
+			}
+			opt->arg = argv[opt->ind++];
+			return cache_long_options[i].c;
+		}
+	}
+
+	return builtin_getopt(opt, argc, argv, "nt:e:f:");
+}
+
+/*
+ * Writes the 'len' bytes at 'buf' to 'fd'. Returns 0, or -1 on error.
+ */
+static int cache_write(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ * Copies the whole file 'fd', from its start, to 'out_fd' with
+ * sendfile(2), or with read(2) and write(2) where the output does not
+ * support it. Also used by autopar.c to copy out collected output.
+ *
+ * Return value:
+ *   Returns 0, or -1 on error.
+ **********************************************************************/
+int cache_send(int fd, int out_fd)
+{
+	char buf[8192];
+	off_t off = 0;
+	ssize_t n;
+	struct stat st;
+
+	if (fstat(fd, &st) == -1)
+		return -1;
+
+	while (off < st.st_size) {
+		if ((n = sendfile(out_fd, fd, &off, st.st_size - off)) > 0)
+			continue;
+		if (n == 0)
+			return 0;  /* The file shrank */
+		if (errno == EINTR)
+			continue;
+		if (errno != EINVAL && errno != ENOSYS)
+			return -1;
+		break;
+	}
+
+	while (off < st.st_size) {
+		if ((n = pread(fd, buf, sizeof(buf), off)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0 || cache_write(out_fd, buf, n) == -1)
+			return n == 0 ? 0 : -1;
+		off += n;
+	}
+
+	return 0;
+}
+
+/*
+ * Creates the directory 'path' and its missing parents, like `mkdir -p'.
+ * Returns 0, or -1 on error.
+ */
+static int cache_mkdirs(char *path)
+{
+	char *s;
+	int ret;
+
+	for (s = path + 1; *s; s++) {
+		if (*s != '/')
+			continue;
+		*s = '\0';
+		ret = mkdir(path, 0700);
+		*s = '/';
+		if (ret == -1 && errno != EEXIST)
+			return -1;
+	}
+
+	if (mkdir(path, 0700) == -1 && errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+/*
+ * Returns the cache directory, created if needed, or NULL after
+ * printing a message. The string must be freed.
+ */
+static char *cache_dir(void)
+{
+	char *dir, *env;
+	int ret;
+
+	if ((env = getenv("TANSH_CACHE_DIR")) && *env)
+		ret = asprintf(&dir, "%s", env);
+	else if ((env = getenv("XDG_CACHE_HOME")) && *env)
+		ret = asprintf(&dir, "%s/tansh", env);
+	else if ((env = getenv("HOME")) && *env)
+		ret = asprintf(&dir, "%s/.cache/tansh", env);
+	else {
+		err_msg("cached: no cache directory ($TANSH_CACHE_DIR or $HOME)");
+		return NULL;
+	}
+	if (ret == -1) {
+		err_malloc(errno);
+		return NULL;
+	}
+
+	if (cache_mkdirs(dir) == -1) {
+		err_msg("cached: %s: %s", dir, strerror(errno));
+		free(dir);
+		return NULL;
+	}
+
+	return dir;
+}
+
+/*
+ * Reads the whole input 'in' into an anonymous memory file, adding it
+ * to the FNV-1a hash '*hash' and its length to '*size'. Returns the
+ * file, positioned at its start, or -1 on error.
+ */
+static int cache_read_input(FILE *in, uint64_t *hash, off_t *size)
+{
+	char buf[65536];
+	size_t n;
+	int fd;
+
+	if ((fd = memfd_create("tansh-cached", MFD_CLOEXEC)) == -1) {
+		err_msg("cached: %s", strerror(errno));
+		return -1;
+	}
+
+	*hash = CACHE_FNV_BASIS;
+	*size = 0;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		*hash = cache_fnv(*hash, buf, n);
+		*size += n;
+		if (cache_write(fd, buf, n) == -1) {
+			err_msg("cached: %s", strerror(errno));
+			close(fd);
+			return -1;
+		}
+	}
+	if (ferror(in)) {
+		err_msg("cached: input: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+/*
+ * Builds the key of the command 'argv' in 'key': the working directory,
+ * the words, the variables 'envs', the files 'files' and, unless
+ * 'input' is -1, the hash 'input_hash' and length 'input_size' of the
+ * input. Every string is preceded by its length, so that no two keys
+ * read the same. Returns 0, or -1 on error.
+ */
+static int cache_key(struct cache_key_t *key, char **argv, int argc,
+		char **envs, int nenvs, char **files, int nfiles, int input,
+		uint64_t input_hash, off_t input_size)
+{
+	int i;
+	char *cwd, *value;
+	struct stat st;
+	FILE *f;
+
+	if ((f = open_memstream(&key->text, &key->len)) == NULL) {
+		err_malloc(errno);
+		return -1;
+	}
+
+	if ((cwd = getcwd(NULL, 0)) != NULL)
+		fprintf(f, "cwd %zu:%s\n", strlen(cwd), cwd);
+	free(cwd);
+	for (i = 0; i < argc; i++)
+		fprintf(f, "arg %zu:%s\n", strlen(argv[i]), argv[i]);
+	for (i = 0; i < nenvs; i++) {
+		if ((value = getenv(envs[i])) != NULL)
+			fprintf(f, "env %s %zu:%s\n", envs[i], strlen(value), value);
+		else
+			fprintf(f, "env %s unset\n", envs[i]);
+	}
+	for (i = 0; i < nfiles; i++) {
+		fprintf(f, "file %zu:%s ", strlen(files[i]), files[i]);
+		if (stat(files[i], &st) == 0)
+			fprintf(f, "%lld.%09ld %lld %llu\n",
+					(long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+					(long long)st.st_size, (unsigned long long)st.st_ino);
+		else
+			fprintf(f, "missing\n");
+	}
+	if (input != -1)
+		fprintf(f, "input %016llx %lld\n", (unsigned long long)input_hash,
+				(long long)input_size);
+	else
+		fprintf(f, "input none\n");
+
+	if (fclose(f) == EOF) {
+		err_malloc(errno);
+		return -1;
+	}
+
+	snprintf(key->hash, sizeof(key->hash), "%016llx", (unsigned long long)
+			cache_fnv(CACHE_FNV_BASIS, key->text, key->len));
+	return 0;
+}
+
+/*
+ * Records in the index that the result of 'key' has the exit status
+ * 'status' and was stored at 'stored'. Returns the entry, or NULL on
+ * error.
+ */
+static struct cache_entry_t *cache_remember(struct cache_key_t *key,
+		int status, time_t stored)
+{
+	struct cache_entry_t *entry;
+	char *name, *text;
+
+	if (!cache_index && (cache_index = hash_create(hash_string,
+			hash_compare_string, free, cache_destroy_entry, 0)) == NULL) {
+		err_malloc(errno);
+		return NULL;
+	}
+	if ((text = malloc(key->len + 1)) == NULL) {
+		err_malloc(errno);
+		return NULL;
+	}
+	memcpy(text, key->text, key->len);
+
+	if ((entry = hash_value(cache_index, key->hash)) == NULL) {
+		if ((entry = calloc(1, sizeof(struct cache_entry_t))) == NULL ||
+		    (name = strdup(key->hash)) == NULL) {
+			free(entry);
+			free(text);
+			err_malloc(errno);
+			return NULL;
+		}
+		if (hash_insert(cache_index, name, entry) == -1) {
+			free(name);
+			free(entry);
+			free(text);
+			err_malloc(errno);
+			return NULL;
+		}
+	}
+
+	free(entry->text);
+	entry->text = text;
+	entry->len = key->len;
+	entry->status = status;
+	entry->stored = stored;
+	return entry;
+}
+
+/*
+ * Looks up the result of 'key' in the index, or else in the key file
+ * of the directory 'dir'. Returns it, or NULL if there is none.
+ */
+static struct cache_entry_t *cache_lookup(const char *dir,
+		struct cache_key_t *key)
+{
+	struct cache_entry_t *entry;
+	struct stat st;
+	char *path, *text = NULL;
+	size_t n = 0;
+	int status, match;
+	FILE *f;
+
+	if (cache_index && (entry = hash_value(cache_index, key->hash)) != NULL &&
+	    entry->len == key->len && memcmp(entry->text, key->text, key->len) == 0)
+		return entry;
+
+	if (asprintf(&path, "%s/%s.key", dir, key->hash) == -1)
+		return NULL;
+	f = fopen(path, "re");
+	free(path);
+	if (!f)
+		return NULL;
+
+	match = fstat(fileno(f), &st) == 0 &&
+		fscanf(f, CACHE_MAGIC " %d", &status) == 1 && fgetc(f) == '\n' &&
+		(text = malloc(key->len + 1)) != NULL &&
+		(n = fread(text, 1, key->len + 1, f)) == key->len &&
+		memcmp(text, key->text, key->len) == 0;
+	free(text);
+	fclose(f);
+
+	return match ? cache_remember(key, status, st.st_mtime) : NULL;
+}
+
+/*
+ * Opens the file of the result of 'hash' in 'dir' with the suffix
+ * 'suffix'. Returns the descriptor, or -1 on error.
+ */
+static int cache_open(const char *dir, const char *hash, const char *suffix)
+{
+	char *path;
+	int fd;
+
+	if (asprintf(&path, "%s/%s.%s", dir, hash, suffix) == -1)
+		return -1;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+
+	return fd;
+}
+
+/*
+ * Copies the standard output 'out_fd' and error 'err_fd' of a result to
+ * 'out' and the standard error of the shell.
+ */
+static void cache_replay(int out_fd, int err_fd, FILE *out)
+{
+	fflush(out);
+	if (cache_send(out_fd, fileno(out)) == -1 && errno != EPIPE)
+		err_msg("cached: %s", strerror(errno));
+	fflush(stderr);
+	cache_send(err_fd, STDERR_FILENO);
+}
+
+/*
+ * Adds to 'cmd' a redirection of its descriptor 'target' to the shell's
+ * descriptor 'fd'. Returns 0, or -1 on error.
+ */
+static int cache_redirect(struct expr_t *cmd, int target, int fd)
+{
+	struct redirect_t *redir;
+
+	if ((redir = redirect_create()) == NULL)
+		return -1;
+	if (target == STDIN) {
+		redir->type = REDIRECT_DUP_INPUT;
+		redir->input_fd = target;
+	} else {
+		redir->type = REDIRECT_DUP_OUTPUT;
+		redir->output_fd = target;
+	}
+	redir->dup_fd = fd;
+
+	list_push(cmd->redirects, redir);
+	return 0;
+}
+
+/*
+ * Runs the command 'argv' in the foreground, with its input read from
+ * 'input' (or /dev/null if it is -1) and its output written to 'out_fd'
+ * and 'err_fd'. Returns its wait(2) status, which tells if it was
+ * stopped instead, or -1 if it could not be started.
+ */
+static int cache_run(char **argv, int argc, int input, int out_fd,
+		int err_fd)
+{
+	int i, status = -1, null_fd = -1;
+	pid_t pid;
+	struct expr_t *cmd;
+	struct job_t *job;
+
+	if (input == -1 &&
+	    (input = null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1) {
+		err_open(errno);
+		return -1;
+	}
+	if ((cmd = cmd_create()) == NULL) {
+		close(null_fd);
+		return -1;
+	}
+	cmd_set_type(cmd, CMD_SIMPLE);
+	for (i = 0; i < argc; i++)
+		list_push(cmd->exec, strdup(argv[i]));
+	if ((cmd->redirects = list_create(redirect_destroy)) == NULL ||
+	    cache_redirect(cmd, STDIN, input) == -1 ||
+	    cache_redirect(cmd, STDOUT, out_fd) == -1 ||
+	    cache_redirect(cmd, STDERR, err_fd) == -1) {
+		cmd_destroy(cmd);
+		close(null_fd);
+		return -1;
+	}
+
+	fflush(stdout);
+	job = NULL;
+	if (launch_pipeline(cmd, &pid, NULL) == 1 &&
+	    (job = job_create(&pid, NULL, 1, 0, cmd_to_string(cmd, 1))) == NULL &&
+	    pid > 0)
+		kill(pid, SIGTERM);
+
+	cmd_destroy(cmd);
+	close(null_fd);
+
+	if (job) {
+		job->keep = 1;
+		job_foreground(job);
+		status = job->procs[0].status;
+		if (job->state == JOB_DONE)
+			job_destroy(job);
+		else
+			job->keep = 0;
+	}
+
+	return status;
+}
+
+/*
+ * Creates a temporary file for the result of 'hash' in 'dir', whose
+ * name is left in '*path'. Returns the descriptor, or -1 on error.
+ */
+static int cache_temp(const char *dir, const char *hash, char **path)
+{
+	int fd;
+
+	if (asprintf(path, "%s/%s.XXXXXX", dir, hash) == -1) {
+		*path = NULL;
+		err_malloc(errno);
+		return -1;
+	}
+	if ((fd = mkostemp(*path, O_CLOEXEC)) == -1) {
+		err_msg("cached: %s: %s", *path, strerror(errno));
+		free(*path);
+		*path = NULL;
+	}
+
+	return fd;
+}
+
+/*
+ * Renames the temporary file 'temp' of the result of 'hash' in 'dir' to
+ * its name with 'suffix'. Returns 0, or -1 on error.
+ */
+static int cache_rename(const char *dir, const char *hash, char *temp,
+		const char *suffix)
+{
+	char *path;
+	int ret;
+
+	if (asprintf(&path, "%s/%s.%s", dir, hash, suffix) == -1)
+		return -1;
+	ret = rename(temp, path);
+	free(path);
+
+	return ret;
+}
+
+/*
+ * Writes the key file of 'key' for the exit status 'status' and moves
+ * the output files 'out_path' and 'err_path' into place. Returns 0, or
+ * -1 after printing a message.
+ */
+static int cache_store(const char *dir, struct cache_key_t *key,
+		int status, char *out_path, char *err_path)
+{
+	char *key_path, header[32];
+	int fd, len, ret;
+
+	if ((fd = cache_temp(dir, key->hash, &key_path)) == -1)
+		return -1;
+
+	len = snprintf(header, sizeof(header), CACHE_MAGIC " %d\n", status);
+	ret = cache_write(fd, header, len) == -1 ||
+		cache_write(fd, key->text, key->len) == -1;
+	if (close(fd) == -1 || ret ||
+	    cache_rename(dir, key->hash, out_path, "out") == -1 ||
+	    cache_rename(dir, key->hash, err_path, "err") == -1 ||
+	    cache_rename(dir, key->hash, key_path, "key") == -1) {
+		err_msg("cached: %s: %s", dir, strerror(errno));
+		unlink(key_path);
+		free(key_path);
+		return -1;
+	}
+
+	free(key_path);
+	return 0;
+}
+
+/*
+ * Runs the command 'argv' for 'key', stores its result in 'dir' unless
+ * it could not be run or was killed, and copies its output to 'out'.
+ * Returns its exit status.
+ */
+static int cache_miss(const char *dir, struct cache_key_t *key,
+		char **argv, int argc, int input, FILE *out)
+{
+	int out_fd, err_fd = -1, status, code;
+	char *out_path, *err_path = NULL;
+
+	if ((out_fd = cache_temp(dir, key->hash, &out_path)) == -1 ||
+	    (err_fd = cache_temp(dir, key->hash, &err_path)) == -1) {
+		if (out_fd != -1) {
+			close(out_fd);
+			unlink(out_path);
+		}
+		free(out_path);
+		return 1;
+	}
+
+	if ((status = cache_run(argv, argc, input, out_fd, err_fd)) == -1) {
+		code = 127;
+	} else if (WIFSTOPPED(status)) {
+		code = 128 + WSTOPSIG(status);
+		err_msg("cached: %s: stopped; its output is not kept", argv[0]);
+	} else {
+		code = WIFEXITED(status) ? WEXITSTATUS(status)
+			: 128 + WTERMSIG(status);
+		if (WIFEXITED(status) && code != 126 && code != 127 &&
+		    cache_store(dir, key, code, out_path, err_path) == 0) {
+			cache_remember(key, code, time(NULL));
+			out_path[0] = err_path[0] = '\0';
+		}
+		cache_replay(out_fd, err_fd, out);
+	}
+
+	if (out_path[0])
+		unlink(out_path);
+	if (err_path[0])
+		unlink(err_path);
+	free(out_path);
+	free(err_path);
+	close(out_fd);
+	close(err_fd);
+	return code;
+}
+
+/*
+ * cached [-n] [-t ttl] [-e name] [-f file] [--] command [arg ...]
+ *
+ * Runs the command and stores its output, error output and exit status
+ * in the cache, or replays them if a result with the same key is there.
+ *
+ *   -n, --no-stdin  Does not read the input: the command reads /dev/null,
+ *                   as it also does when the input is a terminal.
+ *   -t, --ttl S     Ignores (and replaces) a result older than S seconds.
+ *   -e, --env NAME  Makes the value of the variable NAME part of the key.
+ *   -f, --file PATH Makes the modification time of PATH part of the key.
+ *
+ * The exit status is that of the command, 1 on an error of the cache,
+ * 2 on a usage error and 127 if the command could not be run.
+ */
+int builtin_cached(int argc, char **argv, FILE *in, FILE *out)
+{
+	int c, nenvs = 0, nfiles = 0, read_input = 1, input = -1, ret;
+	long ttl = 0;
+	char *dir, *end, *envs[argc], *files[argc];
+	uint64_t input_hash = 0;
+	off_t input_size = 0;
+	int out_fd, err_fd;
+	struct cache_key_t key = { NULL, 0, "" };
+	struct cache_entry_t *entry;
+	struct builtin_getopt_t opt = BUILTIN_GETOPT_INIT;
+
+	while ((c = cache_getopt(&opt, argc, argv)) != -1) {
+		switch (c) {
+			case 'n':
+				read_input = 0;
+				break;
+			case 't':
+				ttl = strtol(opt.arg, &end, 10);
+				if (*end == '\0' && ttl > 0)
+					break;
+				err_msg("cached: %s: invalid time to live", opt.arg);
+				return 2;
+			case 'e':
+				envs[nenvs++] = opt.arg;
+				break;
+			case 'f':
+				files[nfiles++] = opt.arg;
+				break;
+			default:
+				err_msg(CACHE_USAGE);
+				return 2;
+		}
+	}
+	if (opt.ind == argc) {
+		err_msg(CACHE_USAGE);
+		return 2;
+	}
+	argv += opt.ind;
+	argc -= opt.ind;
+
+	if ((dir = cache_dir()) == NULL)
+		return 1;
+	if (read_input && !isatty(fileno(in)) &&
+	    (input = cache_read_input(in, &input_hash, &input_size)) == -1) {
+		free(dir);
+		return 1;
+	}
+	if (cache_key(&key, argv, argc, envs, nenvs, files, nfiles, input,
+			input_hash, input_size) == -1) {
+		free(dir);
+		if (input != -1)
+			close(input);
+		return 1;
+	}
+
+	ret = -1;
+	if ((entry = cache_lookup(dir, &key)) != NULL &&
+	    (ttl == 0 || time(NULL) - entry->stored <= ttl)) {
+		out_fd = cache_open(dir, key.hash, "out");
+		err_fd = cache_open(dir, key.hash, "err");
+		if (out_fd != -1 && err_fd != -1) {
+			cache_replay(out_fd, err_fd, out);
+			ret = entry->status;
+		} else {
+			hash_delete(cache_index, key.hash);  /* Removed since */
+		}
+		if (out_fd != -1)
+			close(out_fd);
+		if (err_fd != -1)
+			close(err_fd);
+	}
+	if (ret == -1)
+		ret = cache_miss(dir, &key, argv, argc, input, out);
+
+	if (input != -1)
+		close(input);
+	free(key.text);
+	free(dir);
+	return ret;
+}
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+
+int cache_send(int fd, int out_fd);
+int builtin_cached(int argc, char **argv, FILE *in, FILE *out);
+
+#endif
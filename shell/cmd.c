@@ -2,9 +2,15 @@
 #define CMD_C
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include "error.h"
 #include "cmd.h"
+#include "builtin.h"
 #include "list.h"
 
 /***********************************************************************
@@ -37,6 +43,8 @@ struct expr_t *cmd_create()
 
 	cmd->type = CMD_NONE;
 	cmd->redirects = NULL;
+	cmd->njobs = 0;
+	cmd->block_end = NULL;
 	cmd->next = NULL;
 
 	return cmd;
@@ -123,11 +131,349 @@ void cmd_to_char(struct expr_t *cmd, char **args)
   args[i] = NULL;
 }
 
-int cmd_do_internal(struct expr_t *cmd)
+/*
+ * Returns the words of 'cmd' as a NULL terminated array on the heap,
+ * as cmd_to_char() fills in: a command may have millions of words (see
+ * argbatch.c), more than an array on the stack can hold. The words are
+ * not copied. Returns NULL on error.
+ */
+char **cmd_argv(struct expr_t *cmd)
 {
+	char **args;
+
+	if ((args = malloc((list_size(cmd->exec) + 1) * sizeof(char *))) == NULL) {
+		err_malloc(errno);
+		return NULL;
+	}
+	cmd_to_char(cmd, args);
+
+	return args;
+}
+
+/*
+ * Returns the command line of the first 'nstages' stages of the pipeline
+ * 'cmd', with the words of each stage separated by spaces and the stages
+ * by ` | '. The string is newly allocated, or NULL on error.
+ */
+char *cmd_to_string(struct expr_t *cmd, int nstages)
+{
+	int i;
+	size_t len = 1;
+	char *text, *end;
+	struct expr_t *stage;
+	list_node_t *node;
+
+	for (i = 0, stage = cmd; i < nstages && stage; i++, stage = stage->next)
+		list_foreach(stage->exec, node)
+			len += strlen(list_key(node)) + 3;
+
+	if ((text = malloc(len)) == NULL) {
+		err_malloc(errno);
+		return NULL;
+	}
+
+	/* Appended at the end, since a stage may have millions of words */
+	end = text;
+	*end = '\0';
+	for (i = 0, stage = cmd; i < nstages && stage; i++, stage = stage->next) {
+		if (i > 0)
+			end = stpcpy(end, " | ");
+		list_foreach(stage->exec, node) {
+			if (node != list_head(stage->exec))
+				end = stpcpy(end, " ");
+			end = stpcpy(end, list_key(node));
+		}
+	}
+
+	return text;
+}
+
+/***********************************************************************
+ * Parses the options of a parallel `for' loop, `for -j N [-k] name [in
+ * word ...]', from the head of the exec list of the loop header 'cmd',
+ * which the parser built as a plain command since it does not start
+ * with `for name in'. The options are removed, leaving the exec list as
+ * for a serial loop.
+ *
+ * Options:
+ *   -j N: Run the bodies in at most N worker processes at once. N may
+ *     be 0 for the number of online processors.
+ *   -k: Print the output of the iterations in the order of the words,
+ *     rather than as the iterations finish.
+ *
+ * Return value:
+ *   Returns 0 on success or -1 on a syntax error.
+ **********************************************************************/
+int cmd_for_options(struct expr_t *cmd)
+{
+	long n;
+	char *word, *end;
+
+	while (list_size(cmd->exec) && (word = list_peek(cmd->exec))[0] == '-') {
+		if (strcmp(word, "-k") == 0) {
+			cmd_set_type(cmd, CMD_ORDERED);
+			free(list_shift(cmd->exec));
+			continue;
+		}
+		if (strcmp(word, "-j") != 0 || list_size(cmd->exec) < 2) {
+			err_msg("tansh: for: %s: invalid option", word);
+			return -1;
+		}
+		free(list_shift(cmd->exec));
+
+		word = list_peek(cmd->exec);
+		n = strtol(word, &end, 10);
+		if (*end != '\0' || end == word || n < 0) {
+			err_msg("tansh: for: -j %s: invalid number of jobs", word);
+			return -1;
+		}
+		if (n == 0 && (n = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+			n = 1;
+		cmd->njobs = n;
+		free(list_shift(cmd->exec));
+	}
+
+	if (list_size(cmd->exec) == 0) {
+		err_msg("tansh: for: missing loop variable");
+		return -1;
+	}
+	if (list_size(cmd->exec) > 1) {
+		if (strcmp(list_key(list_next(list_head(cmd->exec))), "in") != 0) {
+			err_msg("tansh: for: `in' expected after the loop variable");
+			return -1;
+		}
+		free(list_remove(cmd->exec, list_next(list_head(cmd->exec))));
+		cmd_set_type(cmd, CMD_IN);
+	}
+
 	return 0;
 }
 
+/*
+ * Returns a copy of 'word' in which every `$name' and `${name}' is
+ * replaced with 'value' (a plain copy if 'name' is NULL), or NULL on
+ * error.
+ */
+static char *subst_word(const char *word, const char *name,
+		const char *value)
+{
+	size_t nlen, vlen, skip;
+	const char *p;
+	char *copy, *q;
+
+	if (!name) {
+		if ((copy = strdup(word)) == NULL)
+			err_malloc(errno);
+		return copy;
+	}
+	nlen = strlen(name);
+	vlen = strlen(value);
+
+	/* Every reference is at least one character long, so this is enough
+	 * room even if every character were a reference. */
+	if ((copy = malloc(strlen(word) * (vlen + 1) + 1)) == NULL) {
+		err_malloc(errno);
+		return NULL;
+	}
+
+	for (p = word, q = copy; *p; ) {
+		skip = 0;
+		if (p[0] == '$' && p[1] == '{' && !strncmp(p + 2, name, nlen) &&
+		    p[2 + nlen] == '}')
+			skip = nlen + 3;
+		else if (p[0] == '$' && !strncmp(p + 1, name, nlen) &&
+			 !isalnum((unsigned char)p[1 + nlen]) && p[1 + nlen] != '_')
+			skip = nlen + 1;
+
+		if (skip) {
+			memcpy(q, value, vlen);
+			q += vlen;
+			p += skip;
+		} else {
+			*q++ = *p++;
+		}
+	}
+	*q = '\0';
+
+	return copy;
+}
+
+/***********************************************************************
+ * Copies the single expression 'cmd' (not the expressions that follow
+ * it), replacing references to the variable 'name' in its words,
+ * redirection filenames and unquoted here-documents with 'value', or
+ * copying them as they are if 'name' is NULL. The
+ * copy has no next expression, and it is up to the caller to set the
+ * block end of a loop header.
+ *
+ * Return value:
+ *   Returns the copy, or NULL on error.
+ **********************************************************************/
+struct expr_t *cmd_copy(struct expr_t *cmd, const char *name,
+		const char *value)
+{
+	char *word;
+	struct expr_t *copy;
+	struct redirect_t *redir, *r;
+	list_node_t *node;
+
+	if ((copy = cmd_create()) == NULL)
+		return NULL;
+	copy->type = cmd->type;
+	copy->njobs = cmd->njobs;
+
+	list_foreach(cmd->exec, node) {
+		if ((word = subst_word(list_key(node), name, value)) == NULL) {
+			cmd_destroy(copy);
+			return NULL;
+		}
+		list_push(copy->exec, word);
+	}
+
+	if (!cmd->redirects)
+		return copy;
+	if ((copy->redirects = list_create(redirect_destroy)) == NULL) {
+		err_list_create(errno);
+		cmd_destroy(copy);
+		return NULL;
+	}
+	list_foreach(cmd->redirects, node) {
+		if ((redir = list_key(node)) == NULL ||
+		    (r = redirect_create()) == NULL)
+			continue;
+		*r = *redir;
+		r->input_filename = redir->input_filename ?
+				subst_word(redir->input_filename, name, value) : NULL;
+		r->output_filename = redir->output_filename ?
+				subst_word(redir->output_filename, name, value) : NULL;
+		r->concat_filename = redir->concat_filename ?
+				subst_word(redir->concat_filename, name, value) : NULL;
+		if (redir->here_doc && (redir->here_flags & REDIRECT_HERE_QUOTED))
+			r->here_doc = strdup(redir->here_doc);
+		else if (redir->here_doc)
+			r->here_doc = subst_word(redir->here_doc, name, value);
+		list_push(copy->redirects, r);
+	}
+
+	return copy;
+}
+
+/*
+ * Returns the last expression of the block that begins with 'start',
+ * skipping over any blocks nested within it, or NULL if the block is
+ * not terminated.
+ */
+struct expr_t *cmd_block_end(struct expr_t *start)
+{
+	int depth = 0;
+	struct expr_t *cmd;
+
+	for (cmd = start; cmd; cmd = cmd->next) {
+		if (cmd_is_start_block(cmd))
+			depth++;
+		if (cmd_is_end_block(cmd))
+			depth--;
+		if (depth <= 0)
+			return cmd;
+	}
+
+	return NULL;
+}
+
+/***********************************************************************
+ * Marks the last command of a script (or of a `-c' string) to be
+ * executed in place of the shell, instead of being started in a child
+ * the shell then only waits for before exiting. Only a lone external
+ * command qualifies: not part of a pipeline, not in the background, not
+ * timed and not a builtin. It may end the body of an if or else, or a
+ * group or subshell, as the shell has nothing left to do afterwards,
+ * but not the body of a loop or function, which runs again or later.
+ * do_command() may still start the command as usual (see
+ * launch_exec()).
+ *
+ * Parameters:
+ *   cmd: The whole parsed script.
+ **********************************************************************/
+void cmd_mark_exec(struct expr_t *cmd)
+{
+	int depth = 0, loop = 0;
+	struct expr_t *prev = NULL, *start = NULL, *last = NULL;
+
+	for (; cmd; prev = cmd, cmd = cmd->next) {
+		if (cmd_is_start_block(cmd) || cmd_is_function(cmd)) {
+			depth++;
+			if (!loop && (cmd_is_function(cmd) || (start &&
+			    (cmd_is_for(start) || cmd_is_while(start) ||
+			    cmd_is_until(start)))))
+				loop = depth;  /* The outermost loop or function body */
+		}
+		if (!prev || !cmd_is_output_pipe(prev)) {
+			start = cmd;  /* The start of a pipeline */
+			if (!loop)
+				last = cmd;
+		}
+		if (cmd_is_end_block(cmd) || cmd_is_end_function(cmd)) {
+			if (loop == depth)
+				loop = 0;
+			depth--;
+		}
+	}
+
+	if (!last || last->next || cmd_is_output_pipe(last) ||
+	    cmd_is_for(last) || cmd_is_while(last) || cmd_is_until(last) ||
+	    cmd_is_function(last) || cmd_is_background(last) ||
+	    cmd_is_timed(last) || cmd_is_internal(last) ||
+	    list_size(last->exec) == 0 || builtin_find(last))
+		return;
+
+	cmd_set_type(last, CMD_EXEC);
+}
+
+/*
+ * Executes the internal command 'cmd' in the shell itself. Its
+ * redirections are applied to the shell's own descriptors for as long
+ * as the builtin runs. If stdin is redirected, the builtin reads it
+ * through a stream of its own, so nothing the shell's stdin has
+ * buffered is read in its place.
+ *
+ * Return Value:
+ *   Returns the exit status of the builtin (1 if a redirection failed),
+ *   or -1 if 'cmd' is not an internal command.
+ */
+int cmd_do_internal(struct expr_t *cmd)
+{
+	int i, ret = 1;
+	struct builtin_t *builtin;
+	struct redirect_undo_t undo;
+	FILE *in = stdin;
+	int argc = list_size(cmd->exec);
+	char **args;
+
+	if ((builtin = builtin_find(cmd)) == NULL)
+		return -1;
+
+	if ((args = cmd_argv(cmd)) == NULL)
+		return 1;
+	fflush(stdout);
+	if (redirect_apply(cmd->redirects, &undo) == 0) {
+		for (i = 0; i < undo.n; i++)
+			if (undo.fds[i] == STDIN_FILENO)
+				in = fdopen(fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0), "r");
+
+		if (in)
+			ret = builtin->function(argc, args, in, stdout);
+		else
+			err_msg("tansh: %s: unable to open input stream", args[0]);
+		fflush(stdout);  /* Keep output in order with the next command's */
+	}
+
+	if (in && in != stdin)
+		fclose(in);
+	redirect_restore(&undo);
+	free(args);
+	return ret;
+}
+
 static void cmd_print_recursive(struct expr_t *cmd, int scope,
 		int cmd_num, int block_num)
 {
@@ -193,6 +539,9 @@ static void cmd_print_recursive(struct expr_t *cmd, int scope,
 		err_msg("%s      until expression", buf);
 	if (cmd_is_in(cmd))
 		err_msg("%s      in operator", buf);
+	if (cmd->njobs)
+		err_msg("%s      parallel loop, %d jobs%s", buf, cmd->njobs,
+				cmd_is_ordered(cmd) ? ", ordered output" : "");
 	if (cmd_is_start_block(cmd))
 		err_msg("%s      start block", buf);
 	if (cmd_is_end_block(cmd))
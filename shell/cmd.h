@@ -43,6 +43,8 @@ struct expr_t {
 	unsigned long type;     /* History of the type of expression. operator? */
 	struct list_t *exec;    /* Holds a list of words. */
 	struct list_t *redirects;
+	int njobs;              /* Workers of a parallel loop, or 0. */
+	struct expr_t *block_end;  /* Last expression of a loop's body. */
 	struct expr_t *next;    /* Next expression in the same scope. */
 };
 
@@ -51,6 +53,13 @@ void           cmd_destroy(void *cmd);
 int            cmd_gen_expr(struct expr_t *cmd);
 struct expr_t *cmd_pipe(struct expr_t *lhs, struct expr_t *rhs);
 void           cmd_to_char(struct expr_t *cmd, char **args);
+char         **cmd_argv(struct expr_t *cmd);
+char          *cmd_to_string(struct expr_t *cmd, int nstages);
+int            cmd_for_options(struct expr_t *cmd);
+struct expr_t *cmd_copy(struct expr_t *cmd, const char *name,
+                        const char *value);
+struct expr_t *cmd_block_end(struct expr_t *start);
+void           cmd_mark_exec(struct expr_t *cmd);
 int            cmd_do_internal(struct expr_t *cmd);
 struct expr_t *cmd_last(struct expr_t *expr);
 void           cmd_append(struct expr_t *lhs, struct expr_t *rhs);
@@ -108,6 +117,16 @@ void           cmd_print(struct expr_t *cmd);
 #define CMD_END_FUNCTION_BIT 23
 #define CMD_SUBSHELL         0x1000000  /* subshell command */
 #define CMD_SUBSHELL_BIT     24
+#define CMD_ORDERED          0x2000000  /* parallel loop with ordered output */
+#define CMD_ORDERED_BIT      25
+#define CMD_TIMED            0x4000000  /* pipeline timed with `time' */
+#define CMD_TIMED_BIT        26
+#define CMD_TIME_POSIX       0x8000000  /* `time -p', the POSIX format */
+#define CMD_TIME_POSIX_BIT   27
+#define CMD_EXEC             0x10000000 /* last command, exec'd in place of the shell */
+#define CMD_EXEC_BIT         28
+#define CMD_BATCHED          0x20000000 /* one batch of a batched stage */
+#define CMD_BATCHED_BIT      29
 
 #define cmd_input_filename(cmd) \
 	(((struct redirect_t *)list_peek(cmd->redirects))->input_filename)
@@ -145,6 +164,11 @@ void           cmd_print(struct expr_t *cmd);
 #define cmd_is_function(cmd)     (CHECK_FLAG(cmd->type, CMD_FUNCTION_BIT))
 #define cmd_is_end_function(cmd) (CHECK_FLAG(cmd->type, CMD_END_FUNCTION_BIT))
 #define cmd_is_subshell(cmd)     (CHECK_FLAG(cmd->type, CMD_SUBSHELL_BIT))
+#define cmd_is_ordered(cmd)      (CHECK_FLAG(cmd->type, CMD_ORDERED_BIT))
+#define cmd_is_timed(cmd)        (CHECK_FLAG(cmd->type, CMD_TIMED_BIT))
+#define cmd_is_time_posix(cmd)   (CHECK_FLAG(cmd->type, CMD_TIME_POSIX_BIT))
+#define cmd_is_exec(cmd)         (CHECK_FLAG(cmd->type, CMD_EXEC_BIT))
+#define cmd_is_batched(cmd)      (CHECK_FLAG(cmd->type, CMD_BATCHED_BIT))
 
 /* FIXME: The following three functions are not correct. */
 #define cmd_is_input_redir(cmd) \
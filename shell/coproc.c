@@ -0,0 +1,227 @@
+/***********************************************************************
+ * File: coproc.c
+ * Description: The `coproc' builtin, which starts a long-lived command
+ *   with its stdin on a pipe from the shell and its stdout on a socket
+ *   to the shell. The shell keeps its ends at fixed descriptors (60 for
+ *   reading the output, 61 for writing the input, by default), so later
+ *   commands talk to the coprocess with plain redirections:
+ *
+ *     coproc bc -l
+ *     echo 'scale=3; 1/7' >&61
+ *     head -n 1 <&60
+ *
+ *   A script that needs bc, sqlite3 or a filter inside a loop thus pays
+ *   for a single fork instead of one per iteration.
+ *
+ *   The coprocess is started with launch_pipeline() and is a background
+ *   job of the job table, shown by `jobs' and waited for by `wait'. The
+ *   shell's ends are close-on-exec, so no other command inherits them
+ *   and the coprocess sees end-of-file on its input once the shell
+ *   closes it with `coproc -c'.
+ *
+ *   The output comes on a stream socket rather than a pipe so that
+ *   `read -u 60' can peek at a whole block and take only its record
+ *   (see readbuf.c), leaving the rest for whichever command reads the
+ *   descriptor next.
+ **********************************************************************/
+
+#ifndef COPROC_C
+#define COPROC_C
+
+#define _GNU_SOURCE  /* pipe2(2), dup3(2) */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "coproc.h"
+#include "builtin.h"
+#include "launch.h"
+#include "redirect.h"
+#include "job.h"
+#include "cmd.h"
+#include "list.h"
+#include "error.h"
+
+#define COPROC_USAGE \
+	"usage: coproc [-r rfd] [-w wfd] command [arg ...]\n" \
+	"       coproc -c [-w wfd]"
+
+/*
+ * Adds to 'cmd' a redirection of its descriptor 'target' to the shell's
+ * descriptor 'fd', as `<&fd' or `>&fd' does. Returns 0, or -1 on error.
+ */
+static int coproc_redirect(struct expr_t *cmd, int target, int fd)
+{
+	struct redirect_t *redir;
+
+	if ((redir = redirect_create()) == NULL)
+		return -1;
+	if (target == STDIN) {
+		redir->type = REDIRECT_DUP_INPUT;
+		redir->input_fd = target;
+	} else {
+		redir->type = REDIRECT_DUP_OUTPUT;
+		redir->output_fd = target;
+	}
+	redir->dup_fd = fd;
+
+	list_push(cmd->redirects, redir);
+	return 0;
+}
+
+/*
+ * Moves the shell's ends, 'fds[0]' (read) and 'fds[1]' (write), to the
+ * descriptors 'rfd' and 'wfd', replacing whatever was open there, and
+ * keeps them close-on-exec. The ends are first moved above both
+ * numbers, as either may sit where the other one goes. Returns 0, or -1
+ * on error; 'fds' are closed either way.
+ */
+static int coproc_move(int *fds, int rfd, int wfd)
+{
+	int i, high[2] = { -1, -1 }, target[2] = { rfd, wfd }, ret = 0;
+
+	for (i = 0; i < 2; i++) {
+		high[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, (rfd > wfd ? rfd : wfd) + 1);
+		close(fds[i]);
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (ret == 0 && (high[i] == -1 ||
+		    dup3(high[i], target[i], O_CLOEXEC) == -1)) {
+			err_msg("coproc: %d: %s", target[i], strerror(errno));
+			ret = -1;
+		}
+		if (high[i] != -1)
+			close(high[i]);
+	}
+
+	return ret;
+}
+
+/*
+ * Starts the command 'argv' with its input read from 'to[0]' and its
+ * output written to 'from[1]', and adds it to the job table as a
+ * background job. Returns the job, or NULL on error.
+ */
+static struct job_t *coproc_start(char **argv, int argc, int *to, int *from)
+{
+	int i;
+	pid_t pid;
+	char *text, *name;
+	struct expr_t *cmd;
+	struct job_t *job = NULL;
+
+	if ((cmd = cmd_create()) == NULL)
+		return NULL;
+	cmd_set_type(cmd, CMD_SIMPLE);
+	for (i = 0; i < argc; i++)
+		list_push(cmd->exec, strdup(argv[i]));
+	if ((cmd->redirects = list_create(redirect_destroy)) == NULL ||
+	    coproc_redirect(cmd, STDIN, to[0]) == -1 ||
+	    coproc_redirect(cmd, STDOUT, from[1]) == -1) {
+		cmd_destroy(cmd);
+		return NULL;
+	}
+
+	fflush(stdout);
+	if (launch_pipeline(cmd, &pid, NULL) == 1 && pid > 0) {
+		text = cmd_to_string(cmd, 1);
+		if (text && asprintf(&name, "coproc %s", text) != -1) {
+			free(text);
+			text = name;
+		}
+		if ((job = job_create(&pid, NULL, 1, 1, text)) == NULL)
+			kill(pid, SIGTERM);
+	}
+
+	cmd_destroy(cmd);
+	return job;
+}
+
+/*
+ * coproc [-r rfd] [-w wfd] command [arg ...]
+ * coproc -c [-w wfd]
+ *
+ * Starts the command as a coprocess: the shell reads its output on the
+ * descriptor rfd (default 60) and writes its input on wfd (default 61).
+ * Descriptors already open at those numbers are replaced. With -c, the
+ * shell closes wfd instead, so the coprocess reads end-of-file; its
+ * remaining output can still be read from rfd.
+ *
+ * The exit status is 0 if the coprocess was started (or wfd closed), 2
+ * on a usage error and 1 otherwise.
+ */
+int builtin_coproc(int argc, char **argv, FILE *in, FILE *out)
+{
+	int c, rfd = COPROC_READ_FD, wfd = COPROC_WRITE_FD, close_input = 0;
+	int to[2], from[2], ends[2];
+	struct job_t *job;
+	struct builtin_getopt_t opt = BUILTIN_GETOPT_INIT;
+
+	while ((c = builtin_getopt(&opt, argc, argv, "r:w:c")) != -1) {
+		switch (c) {
+			case 'r':
+				rfd = atoi(opt.arg);
+				break;
+			case 'w':
+				wfd = atoi(opt.arg);
+				break;
+			case 'c':
+				close_input = 1;
+				break;
+			default:
+				err_msg(COPROC_USAGE);
+				return 2;
+		}
+	}
+	if (rfd <= STDERR || wfd <= STDERR || rfd == wfd ||
+	    (opt.ind == argc) != close_input) {
+		err_msg(COPROC_USAGE);
+		return 2;
+	}
+
+	if (close_input) {
+		if (close(wfd) == -1) {
+			err_msg("coproc: %d: %s", wfd, strerror(errno));
+			return 1;
+		}
+		return 0;
+	}
+
+	if (pipe2(to, O_CLOEXEC) == -1) {
+		err_pipe(errno);
+		return 1;
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, from) == -1) {
+		err_socket(errno);
+		close(to[0]);
+		close(to[1]);
+		return 1;
+	}
+
+	job = coproc_start(argv + opt.ind, argc - opt.ind, to, from);
+	close(to[0]);
+	close(from[1]);
+	if (!job) {
+		close(to[1]);
+		close(from[0]);
+		return 1;
+	}
+
+	ends[0] = from[0];
+	ends[1] = to[1];
+	if (coproc_move(ends, rfd, wfd) == -1)
+		return 1;
+
+	if (job_control)
+		fprintf(out, "[%d] %d\n", job->id, job->pgid);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef COPROC_H
+#define COPROC_H
+
+#include <stdio.h>
+
+/* The descriptors on which the shell reads the output of a coprocess
+ * and writes its input, unless given with -r and -w. */
+#define COPROC_READ_FD   60
+#define COPROC_WRITE_FD  61
+
+int builtin_coproc(int argc, char **argv, FILE *in, FILE *out);
+
+#endif
@@ -0,0 +1,355 @@
+/***********************************************************************
+ * File: event.c
+ * Description: The event loop of the shell. The signals the shell acts
+ *   on are not caught by handlers that may interrupt it anywhere, as in
+ *   the middle of the parser: they are kept blocked and read from a
+ *   signalfd(2), which one epoll(7) instance watches together with the
+ *   terminal (or the socket of a server, see server.c).
+ *
+ *     SIGCHLD   Children changed state: job_reap() collects them.
+ *     SIGINT    <CTRL + C> at the prompt: the command being typed is
+ *               dropped and a fresh prompt is printed.
+ *     SIGWINCH  The terminal was resized: $COLUMNS and $LINES are set.
+ *
+ *   While an interactive shell waits for a line (see
+ *   event_wait_input()), these are ordinary events: background jobs
+ *   that finish are reaped and reported right away, which also starts
+ *   the jobs queued behind them (see jobqueue.c), and SIGINT ends the
+ *   wait, so the parser can drop what was read of the command. Elsewhere, job_reap() reads the descriptor only to
+ *   learn whether there is anything to reap (see event_pending()), and
+ *   a shell that samples running jobs sleeps in epoll_wait(2) (see
+ *   event_wait()).
+ *
+ *   As no handler runs behind its back, the shell does not block and
+ *   unblock SIGCHLD around every command it parses or starts. Only an
+ *   interactive shell blocks SIGINT and SIGWINCH, so a script still
+ *   dies of <CTRL + C>. Commands are started with an empty signal mask
+ *   (see launch.c); a child that goes on running shell code, such as a
+ *   command substitution, calls event_child().
+ **********************************************************************/
+
+#ifndef EVENT_C
+#define EVENT_C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include "event.h"
+#include "job.h"
+#include "error.h"
+
+static int event_epoll = -1;     /* The epoll instance */
+static int event_signals = -1;   /* The signalfd, or -1 without events */
+static int event_input = -1;     /* The terminal, or -1 if not watched */
+static pid_t event_owner = 0;    /* The process that owns event_epoll */
+static int event_seen = 0;       /* Events read but not yet reported */
+static sigset_t event_mask;      /* The signals read from event_signals */
+
+/*
+ * Creates the epoll instance of this process, watching the signalfd and
+ * the terminal. A child does not share the instance of the shell, whose
+ * readiness of the signalfd is that of the shell. Returns 0, or -1 on
+ * error.
+ */
+static int event_watch(void)
+{
+	struct epoll_event ev;
+
+	if (event_epoll != -1)
+		close(event_epoll);
+	if ((event_epoll = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		err_msg("tansh: epoll: %s", strerror(errno));
+		return -1;
+	}
+	event_owner = getpid();
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = event_signals;
+	if (epoll_ctl(event_epoll, EPOLL_CTL_ADD, event_signals, &ev) == -1) {
+		err_msg("tansh: epoll: %s", strerror(errno));
+		close(event_epoll);
+		event_epoll = -1;
+		return -1;
+	}
+	ev.data.fd = event_input;
+	if (event_input != -1 &&
+	    epoll_ctl(event_epoll, EPOLL_CTL_ADD, event_input, &ev) == -1) {
+		err_msg("tansh: epoll: %s", strerror(errno));
+		event_input = -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Sets $COLUMNS and $LINES to the size of the terminal.
+ */
+static void event_resize(void)
+{
+	struct winsize size;
+	char value[16];
+
+	if (ioctl(event_input, TIOCGWINSZ, &size) == -1 || size.ws_col == 0)
+		return;
+
+	snprintf(value, sizeof(value), "%u", size.ws_col);
+	setenv("COLUMNS", value, 1);
+	snprintf(value, sizeof(value), "%u", size.ws_row);
+	setenv("LINES", value, 1);
+}
+
+/*
+ * Reads the signals that have arrived into event_seen, without
+ * sleeping. A SIGCHLD also tells job_reap() there is work to do.
+ */
+static void event_read(void)
+{
+	struct signalfd_siginfo info[16];
+	ssize_t i, n;
+
+	while ((n = read(event_signals, info, sizeof(info))) > 0) {
+		for (i = 0; i < n / (ssize_t)sizeof(info[0]); i++) {
+			if (info[i].ssi_signo == SIGCHLD) {
+				event_seen |= EVENT_CHILD;
+				job_sigchld = 1;
+			} else if (info[i].ssi_signo == SIGINT) {
+				event_seen |= EVENT_INTERRUPT;
+			} else if (info[i].ssi_signo == SIGWINCH) {
+				event_seen |= EVENT_RESIZE;
+			}
+		}
+	}
+}
+
+/***********************************************************************
+ * Blocks the signals the shell acts on and starts reading them from a
+ * signalfd, so that they arrive as events (see event_wait()).
+ *
+ * Parameters:
+ *   interactive: Non-zero if the shell reads commands from a terminal.
+ *     The terminal is then watched for input, and SIGINT and SIGWINCH
+ *     are events as well.
+ *
+ * Return value:
+ *   Returns 0, or -1 on error, in which case the signals are left as
+ *   they were.
+ **********************************************************************/
+int event_init(int interactive)
+{
+	sigset_t omask;
+
+	sigemptyset(&event_mask);
+	sigaddset(&event_mask, SIGCHLD);
+	if (interactive) {
+		sigaddset(&event_mask, SIGINT);
+		sigaddset(&event_mask, SIGWINCH);
+	}
+
+	if (sigprocmask(SIG_BLOCK, &event_mask, &omask) == -1) {
+		err_sigprocmask();
+		return -1;
+	}
+	if ((event_signals = signalfd(-1, &event_mask,
+			SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+		err_msg("tansh: signalfd: %s", strerror(errno));
+		sigprocmask(SIG_SETMASK, &omask, NULL);
+		return -1;
+	}
+
+	if (interactive)
+		event_input = STDIN_FILENO;
+	if (event_watch() == -1) {
+		close(event_signals);
+		event_signals = -1;
+		event_input = -1;
+		sigprocmask(SIG_SETMASK, &omask, NULL);
+		return -1;
+	}
+
+	if (event_input != -1)
+		event_resize();
+	return 0;
+}
+
+/***********************************************************************
+ * Sleeps until something happens. Signals that arrived while the shell
+ * was busy are reported at once.
+ *
+ * Parameters:
+ *   timeout: The longest sleep in milliseconds, or -1 for no limit.
+ *
+ * Return value:
+ *   Returns the events that happened (EVENT_*), 0 if none did before
+ *   the timeout, or -1 on error. Without event_init(), the shell just
+ *   sleeps for 'timeout' and 0 is returned.
+ **********************************************************************/
+int event_wait(int timeout)
+{
+	int i, n, events;
+	struct epoll_event ready[2];
+
+	if (event_signals == -1) {
+		if (timeout >= 0)
+			poll(NULL, 0, timeout);
+		return 0;
+	}
+	if (event_owner != getpid() && event_watch() == -1)
+		return -1;
+
+	event_read();
+	if (event_seen == 0) {
+		if ((n = epoll_wait(event_epoll, ready, 2, timeout)) == -1 &&
+		    errno != EINTR) {
+			err_msg("tansh: epoll: %s", strerror(errno));
+			return -1;
+		}
+		for (i = 0; i < n; i++)
+			if (event_input != -1 && ready[i].data.fd == event_input)
+				event_seen |= EVENT_INPUT;
+		event_read();
+	}
+
+	events = event_seen;
+	event_seen = 0;
+	return events;
+}
+
+/***********************************************************************
+ * Takes in the signals that have arrived, without sleeping, so that
+ * job_sigchld is set if a child has changed state. Without
+ * event_init(), there is no telling: job_sigchld is always set.
+ **********************************************************************/
+void event_pending(void)
+{
+	if (event_signals == -1) {
+		job_sigchld = 1;
+		return;
+	}
+
+	event_read();
+	event_seen &= ~EVENT_CHILD;  /* job_sigchld stands for it */
+}
+
+/***********************************************************************
+ * Sleeps until a child changes state, as job_reap() does when the child
+ * that has changed state is not one of the table. Other events are kept
+ * for the next event_wait(), and the terminal is not watched meanwhile.
+ *
+ * Return value:
+ *   Returns 0, or -1 on error. Without event_init(), returns after a
+ *   short sleep, as there is no telling.
+ **********************************************************************/
+int event_wait_child(void)
+{
+	struct pollfd fd;
+
+	if (event_signals == -1) {
+		poll(NULL, 0, 10);
+		return 0;
+	}
+
+	fd.fd = event_signals;
+	fd.events = POLLIN;
+	for (event_read(); !(event_seen & EVENT_CHILD); event_read()) {
+		if (poll(&fd, 1, -1) == -1 && errno != EINTR) {
+			err_msg("tansh: poll: %s", strerror(errno));
+			return -1;
+		}
+	}
+	event_seen &= ~EVENT_CHILD;  /* job_sigchld stands for it */
+
+	return 0;
+}
+
+/***********************************************************************
+ * Waits until the terminal has input, as the parser does before it
+ * reads a line. Meanwhile, background jobs that change state are
+ * reported as soon as they do. <CTRL + C> ends the wait on a fresh
+ * line, without printing the prompt.
+ *
+ * Parameters:
+ *   prompt: Prints the prompt again after something else was printed.
+ *
+ * Return value:
+ *   Returns 0 once there is input (or at once if the terminal is not
+ *   watched), 1 if <CTRL + C> was typed first, or -1 on error.
+ **********************************************************************/
+int event_wait_input(void (*prompt)(void))
+{
+	int events;
+
+	if (event_input == -1 || event_signals == -1)
+		return 0;
+
+	fflush(stdout);
+	while (!((events = event_wait(-1)) & EVENT_INPUT)) {
+		if (events == -1)
+			return -1;
+		if (events & EVENT_RESIZE)
+			event_resize();
+		if (events & EVENT_CHILD)
+			job_reap(0);
+
+		if (events & EVENT_INTERRUPT) {
+			printf("\n");
+			fflush(stdout);
+			return 1;
+		}
+		if (job_notify_pending()) {
+			printf("\n");
+			notify_and_cleanup();
+			prompt();
+		}
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ * Watches 'fd' for input in place of the terminal, as a server does
+ * with its listening socket (see server.c): event_wait() reports
+ * EVENT_INPUT when it is readable.
+ *
+ * Return value:
+ *   Returns 0, or -1 on error or without event_init().
+ **********************************************************************/
+int event_input_fd(int fd)
+{
+	if (event_signals == -1)
+		return -1;
+
+	event_input = fd;
+	return event_watch();
+}
+
+/***********************************************************************
+ * Prepares a child of the shell that goes on running shell code, such
+ * as a command substitution or a worker of a parallel loop: <CTRL + C>
+ * kills it again, and it does not watch the terminal. SIGCHLD stays
+ * blocked; the child has an epoll instance of its own once it waits.
+ **********************************************************************/
+void event_child(void)
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGWINCH);
+	signal(SIGINT, SIG_DFL);
+	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+	event_input = -1;
+	event_seen = 0;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+/* What event_wait() reports, as a bit mask. */
+#define EVENT_INPUT      0x01  /* The terminal (or socket) has input */
+#define EVENT_CHILD      0x02  /* A child changed state (SIGCHLD) */
+#define EVENT_INTERRUPT  0x04  /* <CTRL + C> was typed (SIGINT) */
+#define EVENT_RESIZE     0x08  /* The terminal was resized (SIGWINCH) */
+
+int  event_init(int interactive);
+int  event_wait(int timeout);
+void event_pending(void);
+int  event_wait_child(void);
+int  event_wait_input(void (*prompt)(void));
+int  event_input_fd(int fd);
+void event_child(void);
+
+#endif
@@ -0,0 +1,249 @@
+/***********************************************************************
+ * File: hashcmd.c
+ * Description: Remembers where external commands were found in $PATH,
+ *   so the shell walks the $PATH directories only the first time a
+ *   command is run. The table is keyed by command name and holds the
+ *   absolute path of the command. It is flushed whenever $PATH changes
+ *   and may be inspected and edited with the `hash' builtin.
+ **********************************************************************/
+
+#ifndef HASHCMD_C
+#define HASHCMD_C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "hashcmd.h"
+#include "error.h"
+
+/* Used when $PATH is not set at all. */
+#define DEFAULT_PATH  "/bin:/usr/bin"
+
+unsigned long hashcmd_hits = 0;
+unsigned long hashcmd_misses = 0;
+
+static hash_t *hashed_cmds = NULL;
+
+/* The value of $PATH the table was filled with. */
+static char *hashed_path = NULL;
+
+static char *search_path(const char *name, const char *path);
+
+static void destroy_entry(void *value)
+{
+	free(((struct hashcmd_t *)value)->path);
+	free(value);
+}
+
+/*
+ * Returns the current value of $PATH, or the default search path if it
+ * is not set.
+ */
+static const char *current_path(void)
+{
+	const char *path = getenv("PATH");
+
+	return path ? path : DEFAULT_PATH;
+}
+
+/*
+ * Makes sure the table exists and was filled with the current value of
+ * $PATH, flushing it otherwise. Returns 0 on success or -1 on error.
+ */
+static int hashcmd_validate(void)
+{
+	const char *path = current_path();
+
+	if (hashed_path && strcmp(hashed_path, path) != 0)
+		hashcmd_flush();
+
+	if (!hashed_cmds) {
+		hashed_cmds = hash_create(hash_string, hash_compare_string, free,
+				destroy_entry, 0);
+		if (!hashed_cmds) {
+			err_malloc(errno);
+			return -1;
+		}
+	}
+
+	if (!hashed_path && (hashed_path = strdup(path)) == NULL) {
+		err_malloc(errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ * Returns the path that should be executed for the command 'name'.
+ * Names that contain a slash are never looked up in $PATH and are
+ * returned unchanged. Otherwise the table is consulted first, and the
+ * $PATH directories are only searched (and the result remembered) on a
+ * miss.
+ *
+ * Parameters:
+ *   name: The name of the command, as typed by the user.
+ *
+ * Return value:
+ *   Returns the path of the command, or NULL if it cannot be found.
+ *   The returned string belongs to the table and remains valid until
+ *   the entry is removed or the table is flushed.
+ **********************************************************************/
+char *hashcmd_lookup(const char *name)
+{
+	struct hashcmd_t *entry;
+
+	if (strchr(name, '/'))
+		return (char *)name;
+
+	if (hashcmd_validate() == -1)
+		return NULL;
+
+	if ((entry = hash_value(hashed_cmds, name)) != NULL) {
+		hashcmd_hits++;
+		entry->hits++;
+		return entry->path;
+	}
+
+	hashcmd_misses++;
+	if (hashcmd_add(name) == -1)
+		return NULL;
+
+	entry = hash_value(hashed_cmds, name);
+	entry->hits++;
+	return entry->path;
+}
+
+/***********************************************************************
+ * Searches $PATH for the command 'name' and remembers where it was
+ * found, replacing any previous entry for the same name.
+ *
+ * Parameters:
+ *   name: The name of the command to add.
+ *
+ * Return value:
+ *   Returns 0 on success, or -1 if the command was not found or the
+ *   entry could not be allocated.
+ **********************************************************************/
+int hashcmd_add(const char *name)
+{
+	char *key, *path;
+	struct hashcmd_t *entry;
+
+	if (hashcmd_validate() == -1)
+		return -1;
+
+	if ((path = search_path(name, hashed_path)) == NULL)
+		return -1;
+
+	if ((entry = malloc(sizeof(struct hashcmd_t))) == NULL ||
+	    (key = strdup(name)) == NULL) {
+		err_malloc(errno);
+		free(entry);
+		free(path);
+		return -1;
+	}
+	entry->path = path;
+	entry->hits = 0;
+
+	hash_delete(hashed_cmds, name);
+	if (hash_insert(hashed_cmds, key, entry) == -1) {
+		err_malloc(errno);
+		free(key);
+		destroy_entry(entry);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Forgets where the command 'name' was found, e.g. because executing
+ * the remembered path failed.
+ */
+void hashcmd_remove(const char *name)
+{
+	if (hashed_cmds)
+		hash_delete(hashed_cmds, name);
+}
+
+/*
+ * Forgets every remembered command.
+ */
+void hashcmd_flush(void)
+{
+	hash_destroy(hashed_cmds);
+	hashed_cmds = NULL;
+	free(hashed_path);
+	hashed_path = NULL;
+}
+
+/*
+ * Prints every remembered command with its number of hits, followed by
+ * the overall hit and miss counters, to 'out'.
+ */
+void hashcmd_print(FILE *out)
+{
+	int i;
+	struct hashcmd_t *entry;
+
+	if (hashed_cmds && !hash_is_empty(hashed_cmds)) {
+		fprintf(out, "hits\tcommand\n");
+		for (i = 0; i < hashed_cmds->length; i++) {
+			if (!hash_slot_used(hashed_cmds, i))
+				continue;
+			entry = hashed_cmds->table[i].value;
+			fprintf(out, "%4lu\t%s\n", entry->hits, entry->path);
+		}
+	} else {
+		fprintf(out, "hash: hash table empty\n");
+	}
+	fprintf(out, "lookups: %lu hits, %lu misses\n", hashcmd_hits,
+			hashcmd_misses);
+}
+
+/*
+ * Walks the colon separated directories of 'path' looking for an
+ * executable regular file called 'name'. An empty directory stands for
+ * the current directory. Returns a newly allocated path, or NULL if the
+ * command was not found.
+ */
+static char *search_path(const char *name, const char *path)
+{
+	const char *dir, *end;
+	size_t dlen, nlen = strlen(name);
+	char *file;
+	struct stat sb;
+
+	for (dir = path; dir; dir = *end ? end + 1 : NULL) {
+		if ((end = strchr(dir, ':')) == NULL)
+			end = dir + strlen(dir);
+		dlen = end - dir;
+
+		if ((file = malloc(dlen + nlen + 3)) == NULL) {
+			err_malloc(errno);
+			return NULL;
+		}
+		if (dlen == 0) {
+			file[0] = '.';
+			dlen = 1;
+		} else {
+			memcpy(file, dir, dlen);
+		}
+		file[dlen] = '/';
+		strcpy(file + dlen + 1, name);
+
+		if (stat(file, &sb) == 0 && S_ISREG(sb.st_mode) &&
+		    access(file, X_OK) == 0)
+			return file;
+		free(file);
+	}
+
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef HASHCMD_H
+#define HASHCMD_H
+
+#include <stdio.h>
+
+/* An entry of the command hash table. */
+struct hashcmd_t {
+	char *path;          /* Absolute path of the command. */
+	unsigned long hits;  /* Number of times the entry has been used. */
+};
+
+/* Lookup counters, reported by the `hash' builtin. */
+extern unsigned long hashcmd_hits;
+extern unsigned long hashcmd_misses;
+
+char *hashcmd_lookup(const char *name);
+int   hashcmd_add(const char *name);
+void  hashcmd_remove(const char *name);
+void  hashcmd_flush(void);
+void  hashcmd_print(FILE *out);
+
+#endif
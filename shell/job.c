@@ -1,16 +1,969 @@
+/***********************************************************************
+ * File: job.c
+ * Description: The job table. Every pipeline the shell starts becomes a
+ *   job with one entry per stage. Jobs are kept in a list (for `jobs')
+ *   and in hash tables keyed by job number, process group and the pid
+ *   of every stage, so a status change reported by the kernel is
+ *   recorded in constant time no matter how many jobs are running.
+ *
+ *   SIGCHLD is not handled but read as an event (see event.c).
+ *   Children are reaped by job_reap(), in batches with wait4(2): at the
+ *   prompt, as soon as they change state, and while the shell waits
+ *   for a job. wait4(2) also returns the resources used by each stage,
+ *   which are kept for `time'.
+ *
+ *   A child is first looked at with waitid(WNOWAIT), so that /proc can
+ *   still be read for a stage that has exited (see pipestats.c). A
+ *   child that is not in the table, such as the zygote (see zygote.c),
+ *   is reaped as soon as it has terminated all the same, and its status
+ *   kept for the module that started it (see job_wait_foreign()): it
+ *   would otherwise come up again on every look, and the shell would
+ *   have to look at the children of the table one by one.
+ **********************************************************************/
+
 #ifndef JOB_C
 #define JOB_C
 
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include "job.h"
+#include "pipestats.h"
+#include "jobqueue.h"
+#include "event.h"
+#include "hash.h"
+#include "list.h"
+#include "error.h"
+
+#define INT_KEY(i)  ((void *)(intptr_t)(i))
+
+/* Terminated background jobs kept for `wait' without job control. */
+#define JOB_DONE_MAX  1024
+
+int job_control = 0;
+int job_last_status = 0;
+volatile sig_atomic_t job_sigchld = 0;
+
+static pid_t shell_pgid = 0;
+
+static list_t *jobs = NULL;          /* All jobs, oldest first */
+static list_t *done_jobs = NULL;     /* Terminated jobs not yet waited for */
+static list_t *dead_jobs = NULL;     /* Those that ran in the background */
+static list_t *notify_jobs = NULL;   /* Jobs whose state changed */
+static hash_t *pid_table = NULL;     /* pid -> struct proc_t */
+static hash_t *pgid_table = NULL;    /* process group -> struct job_t */
+static hash_t *id_table = NULL;      /* job number -> struct job_t */
+static hash_t *foreign_table = NULL; /* pid -> status, of other children */
+static int running_jobs = 0;         /* Jobs that are not done */
+
+static pid_t job_wait4(int flags, int *status, struct rusage *usage);
+static int job_reap_timed(long msecs);
+static void job_update(pid_t pid, int status, struct rusage *usage);
+static void job_changed(struct proc_t *proc, int terminated);
+static void job_done(struct job_t *job);
+static void job_unqueue(list_t *queue, list_node_t **node);
+
+/*
+ * Creates the job list and tables the first time they are needed.
+ * Returns 0 on success or -1 on error.
+ */
+static int job_tables(void)
+{
+	if (jobs)
+		return 0;
+
+	jobs = list_create(NULL);
+	done_jobs = list_create(NULL);
+	dead_jobs = list_create(NULL);
+	notify_jobs = list_create(NULL);
+	pid_table = hash_create(hash_int, hash_compare_int, NULL, NULL, 0);
+	pgid_table = hash_create(hash_int, hash_compare_int, NULL, NULL, 0);
+	id_table = hash_create(hash_int, hash_compare_int, NULL, NULL, 0);
+	foreign_table = hash_create(hash_int, hash_compare_int, NULL, NULL, 0);
+
+	if (!jobs || !done_jobs || !dead_jobs || !notify_jobs || !pid_table ||
+	    !pgid_table || !id_table || !foreign_table) {
+		err_malloc(errno);
+		list_destroy(jobs);
+		list_destroy(done_jobs);
+		list_destroy(dead_jobs);
+		list_destroy(notify_jobs);
+		hash_destroy(pid_table);
+		hash_destroy(pgid_table);
+		hash_destroy(id_table);
+		hash_destroy(foreign_table);
+		jobs = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ * Initializes job control. An interactive shell reading from a
+ * terminal puts itself in its own process group, takes the terminal,
+ * and ignores the job control signals so that only its foreground job
+ * is stopped by them.
+ *
+ * Parameters:
+ *   interactive: Non-zero if the shell reads commands from the user.
+ *
+ * Return value:
+ *   Returns 0 on success or -1 on error.
+ **********************************************************************/
+int job_init(int interactive)
+{
+	if (job_tables() == -1)
+		return -1;
+
+	job_control = interactive && isatty(STDIN_FILENO);
+	if (!job_control)
+		return 0;
+
+	signal(SIGTSTP, SIG_IGN);
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTTOU, SIG_IGN);
+
+	shell_pgid = getpid();
+	if (getpgrp() != shell_pgid && setpgid(0, shell_pgid) == -1) {
+		err_msg("tansh: unable to create a process group, no job control");
+		job_control = 0;
+		return 0;
+	}
+	tcsetpgrp(STDIN_FILENO, shell_pgid);
+
+	return 0;
+}
+
+/***********************************************************************
+ * Adds a started pipeline to the job table.
+ *
+ * Parameters:
+ *   pids: The pid of every stage, in pipeline order. A stage that could
+ *     not be started is given as -1 and is recorded as having exited
+ *     with status 127. A builtin running on a thread is given as 0.
+ *   threads: The thread of every stage whose pid is 0. May be NULL if
+ *     there are no such stages.
+ *   n: The number of stages.
+ *   background: Non-zero if the pipeline runs in the background.
+ *   text: The command line of the pipeline. The job takes ownership.
+ *
+ * Return value:
+ *   Returns the new job, or NULL on error.
+ **********************************************************************/
+struct job_t *job_create(pid_t *pids, pthread_t *threads, int n,
+		int background, char *text)
+{
+	int i, status;
+	struct job_t *job;
+
+	if (job_tables() == -1)
+		return NULL;
+
+	if ((job = malloc(sizeof(struct job_t))) == NULL ||
+	    (job->procs = malloc(n * sizeof(struct proc_t))) == NULL) {
+		err_malloc(errno);
+		free(job);
+		return NULL;
+	}
+
+	job->id = list_size(jobs) ?
+			((struct job_t *)list_key(list_tail(jobs)))->id + 1 : 1;
+	job->pgid = 0;
+	job->background = background;
+	job->keep = 0;
+	job->stats = NULL;
+	job->nprocs = n;
+	job->nrunning = 0;
+	job->nstopped = 0;
+	job->text = text;
+	job->done_node = NULL;
+	job->dead_node = NULL;
+	job->notify_node = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+	for (i = 0; i < n; i++) {
+		job->procs[i].pid = pids[i];
+		job->procs[i].job = job;
+		job->procs[i].stopped = 0;
+		job->procs[i].end = job->start;
+		memset(&job->procs[i].usage, 0, sizeof(struct rusage));
+		if (pids[i] == -1) {
+			job->procs[i].running = 0;
+			job->procs[i].status = W_EXITCODE(127, 0);
+			continue;
+		}
+		job->procs[i].running = 1;
+		job->procs[i].status = 0;
+		job->nrunning++;
+		if (pids[i] == 0) {
+			job->procs[i].thread = threads[i];
+			continue;
+		}
+		if (!job->pgid && job_control)
+			job->pgid = pids[i];
+		hash_insert(pid_table, INT_KEY(pids[i]), &job->procs[i]);
+	}
+
+	list_push(jobs, job);
+	job->node = list_tail(jobs);
+	hash_insert(id_table, INT_KEY(job->id), job);
+	if (job->pgid)
+		hash_insert(pgid_table, INT_KEY(job->pgid), job);
+
+	if (job->nrunning) {
+		job->state = JOB_RUNNING;
+		running_jobs++;
+	} else {
+		job->state = JOB_DONE;
+		job_done(job);
+	}
+
+	/* A stage may have been reaped before it was in the table */
+	for (i = 0; i < n; i++) {
+		if (pids[i] > 0 && hash_exists(foreign_table, INT_KEY(pids[i]))) {
+			status = (int)(intptr_t)hash_value(foreign_table, INT_KEY(pids[i]));
+			hash_delete(foreign_table, INT_KEY(pids[i]));
+			job_update(pids[i], status, &job->procs[i].usage);
+		}
+	}
+
+	return job;
+}
+
+/*
+ * Removes 'job' from the job table and releases it.
+ */
+void job_destroy(struct job_t *job)
+{
+	int i;
+
+	if (!job)
+		return;
+
+	for (i = 0; i < job->nprocs; i++)
+		if (job->procs[i].running && job->procs[i].pid > 0)
+			hash_delete(pid_table, INT_KEY(job->procs[i].pid));
+	if (job->state != JOB_DONE)
+		running_jobs--;
+
+	hash_delete(id_table, INT_KEY(job->id));
+	if (job->pgid)
+		hash_delete(pgid_table, INT_KEY(job->pgid));
+	list_remove(jobs, job->node);
+	job_unqueue(done_jobs, &job->done_node);
+	job_unqueue(dead_jobs, &job->dead_node);
+	job_unqueue(notify_jobs, &job->notify_node);
+
+	pipestats_destroy(job->stats);
+	free(job->procs);
+	free(job->text);
+	free(job);
+}
+
+/*
+ * Removes the node '*node' from 'queue', if it is queued at all.
+ */
+static void job_unqueue(list_t *queue, list_node_t **node)
+{
+	if (*node) {
+		list_remove(queue, *node);
+		*node = NULL;
+	}
+}
+
+/*
+ * Returns the job that has a running stage 'pid', or NULL.
+ */
+struct job_t *job_find_pid(pid_t pid)
+{
+	struct proc_t *proc;
+
+	if (job_tables() == -1 || pid <= 0)
+		return NULL;
+
+	proc = hash_value(pid_table, INT_KEY(pid));
+	return proc ? proc->job : NULL;
+}
+
+/*
+ * Returns the job whose process group is 'pgid', or NULL.
+ */
+struct job_t *job_find_pgid(pid_t pgid)
+{
+	if (job_tables() == -1 || pgid <= 0)
+		return NULL;
+
+	return hash_value(pgid_table, INT_KEY(pgid));
+}
+
+/*
+ * Returns the job numbered 'id', or NULL.
+ */
+struct job_t *job_find_id(int id)
+{
+	if (job_tables() == -1 || id <= 0)
+		return NULL;
+
+	return hash_value(id_table, INT_KEY(id));
+}
+
+/***********************************************************************
+ * Returns the job named by 'spec', as given to the job builtins:
+ *   NULL, `%', `%%' or `%+' - the most recent job
+ *   `%-' - the job before it
+ *   `%N' - job number N
+ *   `N' - the job with a stage (or process group) N
+ *
+ * Return value:
+ *   Returns the job, or NULL if there is no such job.
+ **********************************************************************/
+struct job_t *job_find_spec(const char *spec)
+{
+	int i;
+	char *end;
+	long n;
+	struct job_t *job;
+	list_node_t *node;
+
+	if (job_tables() == -1 || list_size(jobs) == 0)
+		return NULL;
+
+	if (!spec || !strcmp(spec, "%") || !strcmp(spec, "%%") ||
+	    !strcmp(spec, "%+"))
+		return list_key(list_tail(jobs));
+	if (!strcmp(spec, "%-"))
+		return list_size(jobs) > 1 ?
+				list_key(list_prev(list_tail(jobs))) : NULL;
+
+	n = strtol(spec[0] == '%' ? spec + 1 : spec, &end, 10);
+	if (*end != '\0' || n <= 0)
+		return NULL;
+	if (spec[0] == '%')
+		return job_find_id(n);
+
+	if ((job = job_find_pid(n)) != NULL || (job = job_find_pgid(n)) != NULL)
+		return job;
+
+	/* A stage that has terminated is no longer in the pid table, but
+	 * its job may still be waiting to be reported. */
+	list_foreach(jobs, node) {
+		job = list_key(node);
+		for (i = 0; i < job->nprocs; i++)
+			if (job->procs[i].pid == n)
+				return job;
+	}
+	return NULL;
+}
+
+/***********************************************************************
+ * Collects the status changes of the children in the table. wait4(2)
+ * is called until no more of them have changed state, so children
+ * that exit close together are all accounted for even though their
+ * SIGCHLD signals were merged into one.
+ *
+ * Parameters:
+ *   block: If non-zero, sleep until at least one child changes state.
+ *     Otherwise return at once, without waiting for children if no
+ *     SIGCHLD arrived since the last call.
+ *
+ * Return value:
+ *   Returns the number of status changes collected.
+ **********************************************************************/
+int job_reap(int block)
+{
+	int n = 0;
+	int flags, status;
+	pid_t pid;
+	struct rusage usage;
+
+	if (!block && !job_sigchld)
+		event_pending();
+	if (!block && !job_sigchld)
+		return 0;
+	job_sigchld = 0;
+
+	for (;;) {
+		flags = WUNTRACED | WCONTINUED;
+		if (!block || n > 0)
+			flags |= WNOHANG;
+
+		if ((pid = job_wait4(flags, &status, &usage)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != ECHILD)
+				err_wait(errno);
+			break;
+		}
+		if (pid == 0)  /* Nothing else has changed state */
+			break;
+
+		job_update(pid, status, &usage);
+		n++;
+	}
+
+	/* Terminated jobs make room for queued ones */
+	if (n > 0)
+		jobqueue_run();
+
+	return n;
+}
+
+/*
+ * Reaps the child that 'info' tells has changed state, which is in the
+ * table as 'proc'. While pipeline statistics are kept, a stage that
+ * has exited is first read from /proc (see pipestats_exit()).
+ */
+static pid_t job_collect(siginfo_t *info, struct proc_t *proc, int flags,
+		int *status, struct rusage *usage)
+{
+	if (info->si_code != CLD_STOPPED && info->si_code != CLD_TRAPPED &&
+	    info->si_code != CLD_CONTINUED && proc->job->stats)
+		pipestats_exit(proc->job, proc - proc->job->procs);
+
+	return wait4(info->si_pid, status, flags | WNOHANG, usage);
+}
+
+/*
+ * Takes the status change of the child that 'info' tells of, which is
+ * not in the table: a terminated child is reaped and its status kept
+ * for job_wait_foreign(), and a stop or continue report is dropped.
+ */
+static void job_foreign(siginfo_t *info)
+{
+	int status;
+	siginfo_t drop;
+
+	if (info->si_code == CLD_STOPPED || info->si_code == CLD_TRAPPED ||
+	    info->si_code == CLD_CONTINUED) {
+		waitid(P_PID, info->si_pid, &drop, WSTOPPED | WCONTINUED | WNOHANG);
+		return;
+	}
+
+	if (waitpid(info->si_pid, &status, WNOHANG) == info->si_pid)
+		hash_insert(foreign_table, INT_KEY(info->si_pid),
+				INT_KEY(status));
+}
+
+/*
+ * Waits for a child of the table like wait4(-1, ...) would. The next
+ * child to report is only looked at with waitid(WNOWAIT), and collected
+ * with job_collect() if it is in the table; any other child is taken
+ * out of the way by job_foreign(), so every look is one system call.
+ */
+static pid_t job_wait4(int flags, int *status, struct rusage *usage)
+{
+	siginfo_t info;
+	struct proc_t *proc;
+
+	for (;;) {
+		/* Only the children of other modules are left */
+		if (hash_is_empty(pid_table)) {
+			errno = ECHILD;
+			return -1;
+		}
+
+		info.si_pid = 0;
+		if (waitid(P_ALL, 0, &info, flags | WEXITED | WNOWAIT) == -1)
+			return -1;
+		if (info.si_pid == 0)
+			return 0;
+		if ((proc = hash_value(pid_table, INT_KEY(info.si_pid))) != NULL)
+			return job_collect(&info, proc, flags, status, usage);
+
+		job_foreign(&info);
+	}
+}
+
+/***********************************************************************
+ * Waits for the child 'pid', which is not in the job table, to
+ * terminate, as waitpid(pid, status, 0) does. job_reap() may have
+ * reaped it already, in which case the status it kept is returned.
+ *
+ * Return value:
+ *   Returns 'pid', or -1 on error.
+ **********************************************************************/
+pid_t job_wait_foreign(pid_t pid, int *status)
+{
+	if (foreign_table && hash_exists(foreign_table, INT_KEY(pid))) {
+		if (status)
+			*status = (int)(intptr_t)hash_value(foreign_table, INT_KEY(pid));
+		hash_delete(foreign_table, INT_KEY(pid));
+		return pid;
+	}
+
+	while (waitpid(pid, status, 0) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+	return pid;
+}
 
-void
-notify_and_cleanup()
+/*
+ * Sleeps until a child changes state, or for at most 'msecs'
+ * milliseconds, and collects the status changes. A SIGCHLD that arrives
+ * just before the sleep is not missed, as it waits in the signalfd (see
+ * event_wait()). Returns the number of changes collected, or -1 if the
+ * shell has no children left.
+ */
+static int job_reap_timed(long msecs)
 {
+	int n;
+	siginfo_t info;
+
+	if (!job_sigchld)
+		event_wait(msecs);
+	if ((n = job_reap(0)) > 0)
+		return n;
+
+	info.si_pid = 0;
+	if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == -1 &&
+	    errno == ECHILD)
+		return -1;
+	return 0;
+}
+
+/*
+ * Records the wait(2) style 'status' of the stage 'pid', and the
+ * resources in 'usage' if it has terminated.
+ */
+static void job_update(pid_t pid, int status, struct rusage *usage)
+{
+	int terminated = 1;
+	struct proc_t *proc;
+	struct job_t *job;
+
+	if ((proc = hash_value(pid_table, INT_KEY(pid))) == NULL)
+		return;  /* Not started by the job table */
+	job = proc->job;
+
+	if (WIFSTOPPED(status)) {
+		terminated = 0;
+		proc->status = status;
+		if (!proc->stopped) {
+			proc->stopped = 1;
+			job->nstopped++;
+		}
+	} else if (WIFCONTINUED(status)) {
+		terminated = 0;
+		if (proc->stopped) {
+			proc->stopped = 0;
+			job->nstopped--;
+		}
+	} else {
+		proc->status = status;
+		proc->usage = *usage;
+		clock_gettime(CLOCK_MONOTONIC, &proc->end);
+	}
+
+	job_changed(proc, terminated);
+}
+
+/*
+ * Updates the state of the job of 'proc' after the status of 'proc' has
+ * changed. If 'terminated' is non-zero, the stage has terminated.
+ */
+static void job_changed(struct proc_t *proc, int terminated)
+{
+	struct job_t *job = proc->job;
+
+	if (terminated) {
+		if (proc->stopped) {
+			proc->stopped = 0;
+			job->nstopped--;
+		}
+		proc->running = 0;
+		job->nrunning--;
+		if (proc->pid > 0)
+			hash_delete(pid_table, INT_KEY(proc->pid));
+	}
+
+	if (job->nrunning == 0) {
+		job->state = JOB_DONE;
+		running_jobs--;
+		job_done(job);
+	} else if (job->nstopped == job->nrunning) {
+		job->state = JOB_STOPPED;
+	} else {
+		job->state = JOB_RUNNING;
+	}
+
+	if (job->background && !job->notify_node) {
+		list_push(notify_jobs, job);
+		job->notify_node = list_tail(notify_jobs);
+	}
+}
+
+/*
+ * Queues 'job', which has terminated, for `wait -n', and a background
+ * job for cleanup_dead_jobs() as well.
+ */
+static void job_done(struct job_t *job)
+{
+	list_push(done_jobs, job);
+	job->done_node = list_tail(done_jobs);
+	if (job->background && !job->keep) {
+		list_push(dead_jobs, job);
+		job->dead_node = list_tail(dead_jobs);
+	}
+}
+
+/***********************************************************************
+ * Returns the exit status of 'job', which is that of its last stage
+ * (see job_proc_status()).
+ **********************************************************************/
+int job_status(struct job_t *job)
+{
+	return job_proc_status(&job->procs[job->nprocs - 1]);
+}
+
+/*
+ * Returns the exit status of the stage 'proc': its exit code if it
+ * exited, or 128 plus the number of the signal that killed or stopped
+ * it.
+ */
+int job_proc_status(struct proc_t *proc)
+{
+	int status = proc->status;
+
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	if (WIFSTOPPED(status))
+		return 128 + WSTOPSIG(status);
+	return 0;
+}
+
+/*
+ * Waits for the builtin stages of 'job' that run on threads of the
+ * shell, and records their exit statuses and resource usage.
+ */
+static void job_join(struct job_t *job)
+{
+	int i;
+	void *ret;
+	struct job_thread_result_t *result;
+	struct proc_t *proc;
+
+	for (i = 0; i < job->nprocs; i++) {
+		proc = &job->procs[i];
+		if (proc->pid != 0 || !proc->running)
+			continue;
+		if (pthread_join(proc->thread, &ret) != 0 || ret == NULL) {
+			proc->status = W_EXITCODE(1, 0);
+			clock_gettime(CLOCK_MONOTONIC, &proc->end);
+		} else {
+			result = ret;
+			proc->status = W_EXITCODE(result->status & 0xff, 0);
+			proc->end = result->end;
+			proc->usage = result->usage;
+			free(result);
+		}
+		job_changed(proc, 1);
+	}
+}
+
+/***********************************************************************
+ * Waits until 'job' has terminated or is stopped. A terminated job is
+ * removed from the table, unless it is to be kept: the caller then
+ * reports on it (see `time' and pipestats.c) and destroys it. A job
+ * with statistics is sampled while it runs.
+ *
+ * Return value:
+ *   Returns the exit status of the job (see job_status()).
+ **********************************************************************/
+int job_wait(struct job_t *job)
+{
+	int status;
+
+	job_join(job);
+	while (job->state == JOB_RUNNING) {
+		if (job->stats && job->stats->interval > 0) {
+			pipestats_sample(job);
+			if (job_reap_timed(job->stats->interval) == -1)
+				break;
+		} else if (job_reap(1) == 0) {
+			break;  /* No children left to wait for */
+		}
+	}
+
+	status = job_status(job);
+	if (job->state == JOB_DONE && !job->keep)
+		job_destroy(job);
+
+	return status;
+}
+
+/***********************************************************************
+ * Waits for the next job to terminate, as `wait -n' does. A job that
+ * terminated earlier without being waited for is returned at once.
+ *
+ * Return value:
+ *   Returns the exit status of the job, or 127 if there is no job left
+ *   to wait for.
+ **********************************************************************/
+int job_wait_any(void)
+{
+	struct job_t *job;
+
+	if (job_tables() == -1)
+		return 127;
+
+	job_reap(0);
+	while (list_size(done_jobs) == 0) {
+		if (running_jobs == 0 || job_reap(1) == 0)
+			return 127;
+	}
+
+	job = list_key(list_head(done_jobs));
+	return job_wait(job);
+}
+
+/***********************************************************************
+ * Waits until one of a set of jobs has terminated, as a caller that
+ * keeps a fixed number of jobs running does: a worker pool refills the
+ * slot of whichever job finished first.
+ *
+ * Parameters:
+ *   slots: The jobs to wait for. NULL slots are ignored.
+ *   n: The number of slots.
+ *
+ * Return value:
+ *   Returns the index of a terminated job, which the caller still has
+ *   to wait for (or destroy), or -1 if no job in 'slots' can terminate
+ *   any more: all slots are empty, or the shell has no children left,
+ *   in which case the statuses of the remaining jobs are lost.
+ **********************************************************************/
+int job_wait_slots(struct job_t **slots, int n)
+{
+	int i, busy;
+
+	job_reap(0);
+	for (;;) {
+		for (i = 0, busy = 0; i < n; i++) {
+			if (!slots[i])
+				continue;
+			if (slots[i]->state == JOB_DONE)
+				return i;
+			busy++;
+		}
+		if (!busy || job_reap(1) == 0)
+			return -1;
+	}
+}
+
+/*
+ * Returns non-zero if a job of the table is running.
+ */
+static int job_any_running(void)
+{
+	list_node_t *node;
+
+	list_foreach(jobs, node) {
+		if (((struct job_t *)list_key(node))->state == JOB_RUNNING)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Waits for every job in the table to terminate or stop. Returns the
+ * exit status of the last job waited for, or 0 if there were none.
+ */
+int job_wait_all(void)
+{
+	int status = 0;
+	list_node_t *node, *lahead;
+
+	if (job_tables() == -1)
+		return 0;
+
+	/* Jobs started from the queue meanwhile are waited for as well */
+	do {
+		list_foreach_safe(jobs, node, lahead)
+			status = job_wait(list_key(node));
+		jobqueue_run();
+	} while (job_any_running());
+
+	return status;
 }
 
-void
-cleanup_dead_jobs()
+/***********************************************************************
+ * Runs 'job' in the foreground: with job control its process group is
+ * given the terminal while the shell waits for it. A job that stops is
+ * kept in the table as a background job.
+ *
+ * Return value:
+ *   Returns the exit status of the job (see job_status()).
+ **********************************************************************/
+int job_foreground(struct job_t *job)
 {
+	int status;
+
+	job->background = 0;
+	if (job_control && job->pgid)
+		tcsetpgrp(STDIN_FILENO, job->pgid);
+
+	if (job->state == JOB_STOPPED)
+		printf("\n");
+	status = job_wait(job);
+
+	if (job_control)
+		tcsetpgrp(STDIN_FILENO, shell_pgid);
+
+	job_last_status = status;
+	return status;
+}
+
+/***********************************************************************
+ * Resumes a (stopped) job, as `fg' and `bg' do.
+ *
+ * Parameters:
+ *   job: The job to resume.
+ *   foreground: Non-zero to run the job in the foreground and wait for
+ *     it, zero to leave it running in the background.
+ *
+ * Return value:
+ *   Returns the exit status of the job when run in the foreground, 0
+ *   when resumed in the background, or -1 on error.
+ **********************************************************************/
+int job_continue(struct job_t *job, int foreground)
+{
+	int i;
+
+	if (job->state == JOB_DONE)
+		return job_wait(job);
+
+	if (job->pgid) {
+		if (killpg(job->pgid, SIGCONT) == -1) {
+			err_kill(errno);
+			return -1;
+		}
+	} else {
+		for (i = 0; i < job->nprocs; i++)
+			if (job->procs[i].running && job->procs[i].pid > 0)
+				kill(job->procs[i].pid, SIGCONT);
+	}
+
+	for (i = 0; i < job->nprocs; i++)
+		job->procs[i].stopped = 0;
+	job->nstopped = 0;
+	job->state = JOB_RUNNING;
+
+	if (foreground)
+		return job_foreground(job);
+
+	job->background = 1;
+	return 0;
+}
+
+/*
+ * Prints a line describing 'job' to 'out', as `jobs' does. If 'verbose'
+ * is non-zero, the pid and status of every stage are printed as well.
+ */
+void job_print(FILE *out, struct job_t *job, int verbose)
+{
+	int i;
+	char *state;
+	struct proc_t *proc;
+
+	if (job->state == JOB_DONE)
+		state = "Done";
+	else if (job->state == JOB_STOPPED)
+		state = "Stopped";
+	else
+		state = "Running";
+
+	fprintf(out, "[%d]%c  %-10s %s\n", job->id,
+			(job->node == list_tail(jobs)) ? '+' : ' ', state, job->text);
+
+	for (i = 0; verbose && i < job->nprocs; i++) {
+		proc = &job->procs[i];
+		if (proc->running && proc->stopped)
+			fprintf(out, "      %d  Stopped (signal %d)\n", proc->pid,
+					WSTOPSIG(proc->status));
+		else if (proc->running)
+			fprintf(out, "      %d  Running\n", proc->pid);
+		else if (WIFSIGNALED(proc->status))
+			fprintf(out, "      %d  Killed (signal %d)\n", proc->pid,
+					WTERMSIG(proc->status));
+		else
+			fprintf(out, "      %d  Exit %d\n", proc->pid,
+					WEXITSTATUS(proc->status));
+	}
+}
+
+/*
+ * Returns the list of all jobs, oldest first.
+ */
+list_t *job_list(void)
+{
+	if (job_tables() == -1)
+		return NULL;
+
+	return jobs;
+}
+
+/*
+ * Returns non-zero if background jobs have stopped or terminated since
+ * they were last reported by notify_and_cleanup().
+ */
+int job_notify_pending(void)
+{
+	return notify_jobs && list_size(notify_jobs) > 0;
+}
+
+/*
+ * Reaps children and tells the user about background jobs that have
+ * stopped or terminated since the last prompt. Terminated jobs are
+ * removed from the table once reported.
+ */
+void notify_and_cleanup()
+{
+	struct job_t *job;
+
+	if (job_tables() == -1)
+		return;
+
+	job_reap(0);
+	while (list_size(notify_jobs)) {
+		job = list_shift(notify_jobs);
+		job->notify_node = NULL;
+		job_print(stdout, job, 0);
+		if (job->state == JOB_DONE && job->stats)
+			pipestats_report(stdout, job);
+		if (job->state == JOB_DONE)
+			job_destroy(job);
+	}
+	fflush(stdout);
+}
+
+/*
+ * Reaps children without printing anything, as a shell without job
+ * control does. Terminated background jobs stay in the table for
+ * `wait', but only the last JOB_DONE_MAX of them: a script that starts
+ * jobs without waiting for them does not grow the table forever.
+ */
+void cleanup_dead_jobs()
+{
+	if (job_tables() == -1)
+		return;
+
+	job_reap(0);
+	while (list_size(notify_jobs))
+		((struct job_t *)list_shift(notify_jobs))->notify_node = NULL;
+
+	while (list_size(dead_jobs) > JOB_DONE_MAX)
+		job_destroy(list_key(list_head(dead_jobs)));
 }
 
 #endif
@@ -1,6 +1,96 @@
 #ifndef JOB_H
 #define JOB_H
 
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "list.h"
+
+/* Possible values for the `state' field of a job. */
+#define JOB_RUNNING  0
+#define JOB_STOPPED  1
+#define JOB_DONE     2
+
+struct job_t;
+struct pipestats_t;
+
+/* A single process (pipeline stage) of a job. A builtin that runs on a
+ * thread of the shell has a pid of 0. */
+struct proc_t {
+	pid_t pid;
+	pthread_t thread;    /* The thread of a builtin stage */
+	int status;          /* wait(2) style status, once it has changed */
+	int running;         /* Non-zero until the process has terminated */
+	int stopped;         /* Non-zero while the process is stopped */
+	struct timespec end; /* When the stage terminated (CLOCK_MONOTONIC) */
+	struct rusage usage; /* Resources used by the stage, once terminated */
+	struct job_t *job;
+};
+
+/* What the thread of a builtin stage returns to job_join(), which
+ * releases it. */
+struct job_thread_result_t {
+	int status;
+	struct timespec end;
+	struct rusage usage;  /* Of the thread only (RUSAGE_THREAD) */
+};
+
+/* A pipeline that was started by the shell. */
+struct job_t {
+	int id;                    /* Job number, as in `%1' */
+	pid_t pgid;                /* Process group of the pipeline, or 0 */
+	int state;
+	int background;
+	int keep;                  /* Kept when done, to be reported */
+	struct timespec start;     /* When the job was created */
+	int nprocs;
+	int nrunning;              /* Stages that have not terminated yet */
+	int nstopped;              /* Stages that are currently stopped */
+	struct proc_t *procs;      /* One per stage, in pipeline order */
+	char *text;                /* The command line, for `jobs' */
+	struct pipestats_t *stats; /* Statistics of the stages, or NULL */
+	list_node_t *node;         /* This job's node in the job list */
+	list_node_t *done_node;    /* Node in the queue used by `wait -n' */
+	list_node_t *dead_node;    /* Node in the queue of cleanup_dead_jobs() */
+	list_node_t *notify_node;  /* Node in the queue of state changes */
+};
+
+/* Non-zero if the shell puts each pipeline in its own process group and
+ * hands the terminal to the foreground one. */
+extern int job_control;
+
+/* The exit status of the most recently waited-for foreground job. */
+extern int job_last_status;
+
+/* Set once a SIGCHLD has been read (see event.c); tells job_reap() there
+ * is work to do. */
+extern volatile sig_atomic_t job_sigchld;
+
+int            job_init(int interactive);
+struct job_t  *job_create(pid_t *pids, pthread_t *threads, int n,
+                          int background, char *text);
+void           job_destroy(struct job_t *job);
+struct job_t  *job_find_pid(pid_t pid);
+struct job_t  *job_find_pgid(pid_t pgid);
+struct job_t  *job_find_id(int id);
+struct job_t  *job_find_spec(const char *spec);
+int            job_reap(int block);
+pid_t          job_wait_foreign(pid_t pid, int *status);
+int            job_wait(struct job_t *job);
+int            job_wait_any(void);
+int            job_wait_all(void);
+int            job_wait_slots(struct job_t **slots, int n);
+int            job_foreground(struct job_t *job);
+int            job_continue(struct job_t *job, int foreground);
+int            job_status(struct job_t *job);
+int            job_proc_status(struct proc_t *proc);
+void           job_print(FILE *out, struct job_t *job, int verbose);
+list_t        *job_list(void);
+
+int  job_notify_pending(void);
 void notify_and_cleanup();
 void cleanup_dead_jobs();
 
@@ -0,0 +1,211 @@
+/***********************************************************************
+ * File: jobqueue.c
+ * Description: The queue of background pipelines, turned on with
+ *   `set -o maxjobs=N' (or $TANSH_MAXJOBS). While N background jobs are
+ *   running (or stopped), a pipeline started with `&' is not launched
+ *   but copied into the queue, and `jobs -q' lists it. Whenever the job
+ *   table reaps a terminated job (see job_reap(), run on SIGCHLD), the
+ *   oldest queued pipelines are started until N jobs run again, so a
+ *   script that backgrounds thousands of commands runs N at a time.
+ *
+ *   Substitutions in a queued pipeline were already expanded when it
+ *   was queued, as for any other pipeline.
+ **********************************************************************/
+
+#ifndef JOBQUEUE_C
+#define JOBQUEUE_C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include "jobqueue.h"
+#include "launch.h"
+#include "job.h"
+#include "pipestats.h"
+#include "option.h"
+#include "cmd.h"
+#include "list.h"
+#include "error.h"
+
+/* A pipeline waiting for a free slot */
+struct jobqueue_entry_t {
+	int number;          /* Shown by `jobs -q' */
+	int n;               /* Stages */
+	struct expr_t *cmd;  /* A copy of the pipeline */
+	char *text;
+};
+
+static list_t *queue = NULL;
+static int next_number = 1;
+static int starting = 0;  /* Set while queued pipelines are started */
+
+/*
+ * Releases the queue entry 'entry'.
+ */
+static void jobqueue_destroy(void *entry)
+{
+	struct jobqueue_entry_t *e = entry;
+
+	cmd_destroy(e->cmd);
+	free(e->text);
+	free(e);
+}
+
+/*
+ * Returns the number of background jobs that have not terminated.
+ */
+static int jobqueue_active(void)
+{
+	int n = 0;
+	list_t *jobs;
+	list_node_t *node;
+	struct job_t *job;
+
+	if ((jobs = job_list()) == NULL)
+		return 0;
+	list_foreach(jobs, node) {
+		job = list_key(node);
+		if (job->background && job->state != JOB_DONE)
+			n++;
+	}
+
+	return n;
+}
+
+/***********************************************************************
+ * Returns non-zero if a background pipeline started now has to be
+ * queued: `set -o maxjobs' is on and either as many background jobs
+ * are running, or earlier pipelines are still queued (which go first).
+ **********************************************************************/
+int jobqueue_full(void)
+{
+	long max = option_value(option_lookup("maxjobs"));
+
+	if (max <= 0)
+		return 0;
+	return jobqueue_size() > 0 || jobqueue_active() >= max;
+}
+
+/***********************************************************************
+ * Queues a copy of the background pipeline of 'n' stages that starts
+ * at 'cmd', to be started by jobqueue_run().
+ *
+ * Return value:
+ *   Returns 0, or -1 on error.
+ **********************************************************************/
+int jobqueue_push(struct expr_t *cmd, int n)
+{
+	int i;
+	struct expr_t *copy, *tail = NULL;
+	struct jobqueue_entry_t *entry;
+
+	if (!queue && (queue = list_create(jobqueue_destroy)) == NULL) {
+		err_list_create(errno);
+		return -1;
+	}
+	if ((entry = calloc(1, sizeof(struct jobqueue_entry_t))) == NULL) {
+		err_malloc(errno);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++, cmd = cmd->next) {
+		if ((copy = cmd_copy(cmd, NULL, NULL)) == NULL) {
+			jobqueue_destroy(entry);
+			return -1;
+		}
+		if (tail)
+			tail->next = copy;
+		else
+			entry->cmd = copy;
+		tail = copy;
+	}
+	entry->n = n;
+	entry->text = cmd_to_string(entry->cmd, n);
+	entry->number = next_number++;
+
+	list_push(queue, entry);
+	if (job_control)
+		printf("[queued %d] %s\n", entry->number,
+				entry->text ? entry->text : "");
+	return 0;
+}
+
+/*
+ * Starts the queued pipeline 'entry' as a background job, as
+ * do_command() starts one.
+ */
+static void jobqueue_start(struct jobqueue_entry_t *entry)
+{
+	int i, n = entry->n, stats;
+	pid_t pids[n];
+	int readers[n];
+	struct job_t *job;
+
+	stats = option_value(option_lookup("pipestats")) > 0;
+	fflush(stdout);
+	if (launch_pipeline_readers(entry->cmd, pids, NULL,
+			stats ? readers : NULL) != -1) {
+		job = job_create(pids, NULL, n, 1, entry->text);
+		entry->text = NULL;
+		if (job && stats)
+			job->stats = pipestats_create(entry->cmd, n, pids, readers);
+		else if (stats)
+			for (i = 0; i < n - 1; i++)
+				close(readers[i]);
+	}
+}
+
+/***********************************************************************
+ * Starts the oldest queued pipelines while fewer background jobs than
+ * `set -o maxjobs' allows are running (all of them if the option has
+ * been turned off). Called by job_reap() once it has collected status
+ * changes.
+ **********************************************************************/
+void jobqueue_run(void)
+{
+	long max;
+	struct jobqueue_entry_t *entry;
+
+	if (starting || !queue)
+		return;
+
+	starting = 1;
+	max = option_value(option_lookup("maxjobs"));
+	while (list_size(queue) > 0 && (max <= 0 || jobqueue_active() < max)) {
+		entry = list_shift(queue);
+		jobqueue_start(entry);
+		jobqueue_destroy(entry);
+	}
+	starting = 0;
+}
+
+/*
+ * Returns the number of queued pipelines.
+ */
+int jobqueue_size(void)
+{
+	return queue ? list_size(queue) : 0;
+}
+
+/*
+ * Prints the queued pipelines to 'out', oldest first, for `jobs -q'.
+ */
+void jobqueue_print(FILE *out)
+{
+	list_node_t *node;
+	struct jobqueue_entry_t *entry;
+
+	if (!queue)
+		return;
+	list_foreach(queue, node) {
+		entry = list_key(node);
+		fprintf(out, "[queued %d]  %s\n", entry->number,
+				entry->text ? entry->text : "");
+	}
+}
+
+#endif
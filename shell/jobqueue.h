@@ -0,0 +1,13 @@
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <stdio.h>
+#include "cmd.h"
+
+int  jobqueue_full(void);
+int  jobqueue_push(struct expr_t *cmd, int n);
+void jobqueue_run(void);
+int  jobqueue_size(void);
+void jobqueue_print(FILE *out);
+
+#endif
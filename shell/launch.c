@@ -0,0 +1,717 @@
+/***********************************************************************
+ * File: launch.c
+ * Description: Starts the stages of a pipeline. All pipes of the
+ *   pipeline are created up front, and each stage is then started
+ *   without recursion, either with posix_spawn(3) (the default) or with
+ *   a plain fork(2). posix_spawn(3) avoids copying the page tables of
+ *   the (possibly large) shell for every stage, which matters once a
+ *   pipeline has more than a handful of stages.
+ *
+ *   The capacity of the pipes may be raised with `set -o pipesize=N'
+ *   (or $TANSH_PIPESIZE), so that a fast producer and consumer trade
+ *   data in large chunks instead of switching on every 64 KiB. A stage
+ *   prefixed with `@pipe=N' sets the capacity of its own output pipe.
+ *
+ *   With `set -o zygote' (experimental), stages are instead started by
+ *   a helper process forked when the shell was small (see zygote.c);
+ *   stages with redirections are still spawned by the shell.
+ *
+ *   With job control, every stage of a pipeline is placed in the
+ *   process group of its first stage.
+ *
+ *   A stage whose command is prefixed with scheduling attributes, such
+ *   as `@cpu=2-3' or `@sched=idle' (see stageattr.c), is always forked,
+ *   and applies them in the child before executing the command.
+ *
+ *   The last command of a script may instead replace the shell itself
+ *   (see launch_exec()), which saves a process and a wait per script.
+ *
+ *   Whichever way a command is started, a file the kernel cannot
+ *   execute (ENOEXEC), such as a script without a `#!' line, is run
+ *   with /bin/sh, as execvp(3) would.
+ *
+ *   A stage that writes a descriptor to several places (`>a >b', or
+ *   `>a |') is started through a copier process (see multio.c), and
+ *   one whose words are too long to exec, through a process that runs
+ *   it in batches (see argbatch.c).
+ *
+ *   A builtin stage is not executed at all: it runs on a thread of the
+ *   shell that reads and writes the pipe ends directly, so the pipeline
+ *   costs one fork (or spawn) less per builtin.
+ **********************************************************************/
+
+#ifndef LAUNCH_C
+#define LAUNCH_C
+
+#define _GNU_SOURCE  /* pipe2(2), RUSAGE_THREAD */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "launch.h"
+#include "cmd.h"
+#include "list.h"
+#include "redirect.h"
+#include "hashcmd.h"
+#include "builtin.h"
+#include "option.h"
+#include "job.h"
+#include "zygote.h"
+#include "stageattr.h"
+#include "multio.h"
+#include "argbatch.h"
+#include "error.h"
+
+extern char **environ;
+
+int launch_mode = LAUNCH_SPAWN;
+
+/* What a builtin stage running on a thread needs to know. The result
+ * comes first: the thread returns it, and job_join() frees the whole. */
+struct launch_thread_t {
+	struct job_thread_result_t result;
+	struct builtin_t *builtin;
+	int argc;
+	char **argv;
+	int fd_in;   /* Owned by the thread, or -1 to read the shell's stdin */
+	int fd_out;  /* Owned by the thread, or -1 to write the shell's stdout */
+};
+
+static void launch_pipe_size(int fd, long size);
+static void launch_sh_args(char **sh, char *path, char **args);
+static void launch_execve(char *path, char **args);
+static pid_t launch_stage(struct expr_t *cmd, char **args, int fd_in,
+		int fd_out, pid_t pgid, struct stageattr_t *attr);
+static pid_t launch_spawn(struct expr_t *cmd, char *path, char **args,
+		int fd_in, int fd_out, pid_t pgid);
+static pid_t launch_fork(struct expr_t *cmd, char *path, char **args,
+		int fd_in, int fd_out, pid_t pgid, struct builtin_t *builtin,
+		struct stageattr_t *attr);
+static pid_t launch_thread(struct expr_t *cmd, struct builtin_t *builtin,
+		char **args, int fd_in, int fd_out, pthread_t *thread);
+
+/***********************************************************************
+ * Counts the number of stages in the pipeline starting at 'cmd'. A
+ * pipeline continues for as long as a stage writes its output to a
+ * pipe.
+ *
+ * Parameters:
+ *   cmd: The first stage of the pipeline.
+ *
+ * Return value:
+ *   Returns the number of stages, or 0 if 'cmd' is NULL.
+ **********************************************************************/
+int launch_pipeline_length(struct expr_t *cmd)
+{
+	int n = 0;
+
+	for (; cmd; cmd = cmd->next) {
+		n++;
+		if (!cmd_is_output_pipe(cmd))
+			break;
+	}
+
+	return n;
+}
+
+/***********************************************************************
+ * Starts every stage of the pipeline beginning at 'cmd'. All pipes are
+ * created before the first stage is started, with close-on-exec set,
+ * so a stage only ever inherits the two pipe ends that are duplicated
+ * onto its standard input and output. The parent closes every pipe end
+ * once all stages have been started.
+ *
+ * A stage that cannot be started does not stop the rest of the
+ * pipeline; its slot in 'pids' is set to -1, just as a command that
+ * fails to exec would exit without reading its input.
+ *
+ * With job control, the first stage that starts becomes the leader of
+ * a new process group which all later stages join.
+ *
+ * Parameters:
+ *   cmd: The first stage of the pipeline.
+ *   pids: Filled in with the process id of each stage. Must have room
+ *     for launch_pipeline_length(cmd) entries.
+ *   threads: If not NULL, builtins that may run on a thread are started
+ *     on one; their pid is set to 0 and their thread is stored here,
+ *     and the caller must join it. If NULL, or for other builtins, a
+ *     builtin stage runs in a child process.
+ *
+ * Return value:
+ *   Returns the number of stages in the pipeline, or -1 if the pipes
+ *   could not be created (in which case nothing was started).
+ **********************************************************************/
+int launch_pipeline(struct expr_t *cmd, pid_t *pids, pthread_t *threads)
+{
+	return launch_pipeline_readers(cmd, pids, threads, NULL);
+}
+
+/***********************************************************************
+ * Starts the pipeline beginning at 'cmd' like launch_pipeline(), but
+ * if 'readers' is not NULL, the read end of every pipe is left open
+ * and stored there, in pipeline order, instead of being closed. This
+ * lets the shell see how full the pipes are (see pipestats.c); the
+ * caller must close them, at the latest when the reading stage exits.
+ **********************************************************************/
+int launch_pipeline_readers(struct expr_t *cmd, pid_t *pids,
+		pthread_t *threads, int *readers)
+{
+	int i, n, skip;
+	char **args;
+	struct builtin_t *builtin;
+	struct stageattr_t attr;
+	int fd_in, fd_out;
+	long pipe_size;
+	pid_t pgid = job_control ? 0 : -1;
+
+	if ((n = launch_pipeline_length(cmd)) == 0)
+		return 0;
+	int fds[2 * n];
+
+	pipe_size = option_value(option_lookup("pipesize"));
+	for (i = 0; i < n - 1; i++) {
+		if (pipe2(&fds[2 * i], O_CLOEXEC) == -1) {
+			err_pipe(errno);
+			while (--i >= 0) {
+				close(fds[2 * i]);
+				close(fds[2 * i + 1]);
+			}
+			return -1;
+		}
+		if (pipe_size)
+			launch_pipe_size(fds[2 * i + 1], pipe_size);
+	}
+
+	for (i = 0; i < n; i++, cmd = cmd->next) {
+		fd_in = (i > 0) ? fds[2 * (i - 1)] : -1;
+		fd_out = (i < n - 1) ? fds[2 * i + 1] : -1;
+
+		/* Leading @name=value words set the scheduling of the stage. A
+		 * stage with multios or too many words to exec is run by a
+		 * process of its own. */
+		args = NULL;
+		attr.pipesize = 0;
+		if (multio_needed(cmd, fd_out != -1))
+			pids[i] = multio_start(cmd, fd_in, fd_out, pgid);
+		else if (argbatch_needed(cmd))
+			pids[i] = argbatch_start(cmd, fd_in, fd_out, pgid);
+		else if ((args = cmd_argv(cmd)) == NULL ||
+		         (skip = stageattr_parse(args, &attr)) == -1)
+			pids[i] = -1;
+		else if ((builtin = args[skip] ? builtin_lookup(args[skip]) : NULL) == NULL)
+			pids[i] = launch_stage(cmd, args + skip, fd_in, fd_out, pgid,
+					&attr);
+		else if (threads && builtin->threaded && !attr.set &&
+		         redirect_is_stdio(cmd->redirects))
+			pids[i] = launch_thread(cmd, builtin, args + skip, fd_in,
+					fd_out, &threads[i]);
+		else
+			pids[i] = launch_fork(cmd, NULL, args + skip, fd_in, fd_out,
+					pgid, builtin, &attr);
+		free(args);
+
+		/* @pipe=N: the reader is not started yet, so the pipe may as
+		 * well grow now that the writer is */
+		if (attr.pipesize && fd_out != -1)
+			launch_pipe_size(fd_out, attr.pipesize);
+
+		if (pgid == 0 && pids[i] > 0)
+			pgid = pids[i];
+	}
+
+	/* Close all pipe file descriptors in the parent */
+	for (i = 0; i < 2 * (n - 1); i++) {
+		if (readers && i % 2 == 0) {
+			readers[i / 2] = fds[i];
+			continue;
+		}
+		if (close(fds[i]) == -1) {
+			err_close(errno);
+			err_msg("warning: [launch_pipeline] Unable to close pipe fd %d.", fds[i]);
+		}
+	}
+
+	return n;
+}
+
+/***********************************************************************
+ * Executes the simple command 'cmd' in place of the shell, as the last
+ * command of a script (see cmd_mark_exec()). Its redirections are
+ * applied to the shell's own descriptors, and the signals the shell
+ * ignores or blocks are restored for it.
+ *
+ * Parameters:
+ *   cmd: The command, with its substitutions already expanded.
+ *
+ * Return value:
+ *   Returns -1, with the shell unchanged, if the command is not found,
+ *   is a builtin, has stage attributes or multios, or must be run in
+ *   batches: the caller then starts it as usual. Otherwise it does not
+ *   return; if a redirection fails or the command cannot be executed,
+ *   the shell exits with 1 or 126.
+ **********************************************************************/
+int launch_exec(struct expr_t *cmd)
+{
+	char *path;
+	sigset_t mask;
+	char **args;
+
+	if (multio_needed(cmd, 0) || argbatch_needed(cmd) ||
+	    (args = cmd_argv(cmd)) == NULL)
+		return -1;
+	if (!args[0] || args[0][0] == '@' || builtin_lookup(args[0]) ||
+	    (path = hashcmd_lookup(args[0])) == NULL || access(path, X_OK) == -1) {
+		free(args);
+		return -1;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	signal(SIGTSTP, SIG_DFL);
+	signal(SIGTTIN, SIG_DFL);
+	signal(SIGTTOU, SIG_DFL);
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	if (redirect_apply(cmd->redirects, NULL) == -1)
+		exit(1);
+
+	launch_execve(path, args);
+	err_exec(errno);
+	err_msg("tansh: `%s' failed to exec", args[0]);
+	exit(126);
+}
+
+/*
+ * Fills 'sh' with the words that run the file 'path' with /bin/sh, in
+ * place of the words 'args' that ran it directly: `sh path args...'.
+ * 'sh' has room for two words more than 'args'.
+ */
+static void launch_sh_args(char **sh, char *path, char **args)
+{
+	int i;
+
+	sh[0] = "sh";
+	sh[1] = path;
+	for (i = 1; args[i]; i++)
+		sh[i + 1] = args[i];
+	sh[i + 1] = NULL;
+}
+
+/*
+ * Executes 'path' with execve(2), or with /bin/sh if the kernel does not
+ * know its format. Returns only on error, with errno set.
+ */
+static void launch_execve(char *path, char **args)
+{
+	int n;
+
+	execve(path, args, environ);
+	if (errno != ENOEXEC)
+		return;
+
+	for (n = 0; args[n]; n++)
+		;
+	char *sh[n + 2];
+	launch_sh_args(sh, path, args);
+	execve("/bin/sh", sh, environ);
+	errno = ENOEXEC;
+}
+
+/*
+ * Sets the capacity of the pipe 'fd' to 'size' bytes. An unprivileged
+ * process may not go beyond /proc/sys/fs/pipe-max-size, so if the
+ * kernel refuses the size (EPERM, or ENOMEM past the user's pipe
+ * quota), the pipe is given that maximum instead, which is read once
+ * and remembered. Failing that, the pipe keeps its default capacity.
+ */
+static void launch_pipe_size(int fd, long size)
+{
+	static long max_size = 0;
+	FILE *file;
+
+	if (max_size > 0 && size > max_size)
+		size = max_size;
+	if (size > INT_MAX)
+		size = INT_MAX;
+	if (fcntl(fd, F_SETPIPE_SZ, (int)size) != -1)
+		return;
+
+	if (!max_size) {
+		if ((file = fopen("/proc/sys/fs/pipe-max-size", "r")) == NULL ||
+		    fscanf(file, "%ld", &max_size) != 1)
+			max_size = -1;  /* Unknown, never try again */
+		if (file)
+			fclose(file);
+	}
+	if (max_size > 0 && size > max_size)
+		fcntl(fd, F_SETPIPE_SZ, (int)max_size);
+}
+
+/*
+ * Starts a single stage with the current launch mode. The command is
+ * looked up through the command hash table, so $PATH is only walked the
+ * first time a command is run. If a remembered command has since
+ * disappeared, the entry is dropped and $PATH is searched once more.
+ * The stage is put in the process group 'pgid' (0 for a new group) unless
+ * 'pgid' is -1, and forked if it has scheduling attributes 'attr'.
+ * Returns the pid of the stage or -1 on error.
+ */
+static pid_t launch_stage(struct expr_t *cmd, char **args, int fd_in,
+		int fd_out, pid_t pgid, struct stageattr_t *attr)
+{
+	int retry;
+	char *path;
+	pid_t pid = -1;
+
+	for (retry = 1; retry >= 0; retry--) {
+		if ((path = hashcmd_lookup(args[0])) == NULL) {
+			err_msg("tansh: %s: command not found", args[0]);
+			return -1;
+		}
+
+		if (launch_mode == LAUNCH_FORK || attr->set)
+			return launch_fork(cmd, path, args, fd_in, fd_out, pgid, NULL,
+					attr);
+
+		errno = 0;
+		pid = ZYGOTE_DIRECT;
+		if (!cmd->redirects && (launch_mode == LAUNCH_ZYGOTE ||
+		    option_value(option_lookup("zygote"))) && zygote_ready())
+			pid = zygote_spawn(path, args, fd_in, fd_out, pgid);
+		if (pid == ZYGOTE_DIRECT)
+			pid = launch_spawn(cmd, path, args, fd_in, fd_out, pgid);
+		if (pid != -1 || errno != ENOENT || path == args[0] ||
+		    access(path, X_OK) == 0)
+			break;
+		hashcmd_remove(args[0]);
+	}
+
+	/* A file action that fails fails the spawn, as exec would. */
+	if (pid == -1 && errno && cmd->redirects && access(path, X_OK) == 0) {
+		err_msg("tansh: %s: cannot redirect: %s", args[0], strerror(errno));
+	} else if (pid == -1 && errno) {
+		err_exec(errno);
+		err_msg("tansh: `%s' failed to exec", args[0]);
+	}
+
+	return pid;
+}
+
+/*
+ * Starts a single stage with posix_spawn(3) on the resolved 'path'. The
+ * pipe ends and then the redirections are applied as file actions, so
+ * the child never runs any code of the shell. Returns the pid of the
+ * stage or -1 with errno set on error (0 if a message was already
+ * printed).
+ */
+static pid_t launch_spawn(struct expr_t *cmd, char *path, char **args,
+		int fd_in, int fd_out, pid_t pgid)
+{
+	int n, ret, nopened;
+	int opened[cmd->redirects ? list_size(cmd->redirects) + 1 : 1];
+	short spawn_flags = POSIX_SPAWN_SETSIGMASK;
+	pid_t pid;
+	sigset_t mask;
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+
+	if ((ret = posix_spawn_file_actions_init(&actions)) != 0) {
+		errno = ret;
+		return -1;
+	}
+	if ((ret = posix_spawnattr_init(&attr)) != 0) {
+		posix_spawn_file_actions_destroy(&actions);
+		errno = ret;
+		return -1;
+	}
+
+	if (fd_in != -1)
+		posix_spawn_file_actions_adddup2(&actions, fd_in, STDIN_FILENO);
+	if (fd_out != -1)
+		posix_spawn_file_actions_adddup2(&actions, fd_out, STDOUT_FILENO);
+	if ((nopened = redirect_spawn(cmd->redirects, &actions, opened)) == -1) {
+		posix_spawnattr_destroy(&attr);
+		posix_spawn_file_actions_destroy(&actions);
+		errno = 0;
+		return -1;
+	}
+
+	/* The shell may have SIGCHLD blocked; the command should not. */
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+
+	/* The shell ignores the job control signals; the command should not. */
+	if (pgid != -1) {
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGTSTP);
+		sigaddset(&mask, SIGTTIN);
+		sigaddset(&mask, SIGTTOU);
+		posix_spawnattr_setsigdefault(&attr, &mask);
+		posix_spawnattr_setpgroup(&attr, pgid);
+		spawn_flags |= POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP;
+	}
+	posix_spawnattr_setflags(&attr, spawn_flags);
+
+	ret = posix_spawn(&pid, path, &actions, &attr, args, environ);
+	if (ret == ENOEXEC) {
+		for (n = 0; args[n]; n++)
+			;
+		char *sh[n + 2];
+		launch_sh_args(sh, path, args);
+		ret = posix_spawn(&pid, "/bin/sh", &actions, &attr, sh, environ);
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	while (--nopened >= 0)
+		close(opened[nopened]);
+
+	if (ret != 0) {
+		errno = ret;
+		return -1;
+	}
+
+	return pid;
+}
+
+/***********************************************************************
+ * Closes the descriptors above stderr that are marked close-on-exec, as
+ * an exec would. A builtin stage in a child process is not exec'd, and
+ * would otherwise hold the pipe ends of the other stages open: a reader
+ * of its own input pipe would never see end-of-file. The copier of a
+ * stage with multios (see multio.c) is in the same position.
+ **********************************************************************/
+void launch_close_on_exec(void)
+{
+	int fd, flags;
+	long max;
+	DIR *dir;
+	struct dirent *entry;
+
+	if ((dir = opendir("/proc/self/fd")) != NULL) {
+		while ((entry = readdir(dir)) != NULL) {
+			fd = atoi(entry->d_name);
+			if (fd > STDERR_FILENO && fd != dirfd(dir) &&
+			    (flags = fcntl(fd, F_GETFD)) != -1 && (flags & FD_CLOEXEC))
+				close(fd);
+		}
+		closedir(dir);
+		return;
+	}
+
+	if ((max = sysconf(_SC_OPEN_MAX)) <= 0 || max > 65536)
+		max = 65536;
+	for (fd = STDERR_FILENO + 1; fd < max; fd++)
+		if ((flags = fcntl(fd, F_GETFD)) != -1 && (flags & FD_CLOEXEC))
+			close(fd);
+}
+
+/*
+ * Starts a single stage in a fork(2)ed child. This is the launch path
+ * the shell has always used, kept for comparison and for platforms
+ * where posix_spawn(3) is itself implemented with fork(2). If 'builtin'
+ * is not NULL, the child runs it instead of executing 'path'. The child
+ * first applies the scheduling attributes 'attr'. Returns the pid of the
+ * stage or -1 on error.
+ */
+static pid_t launch_fork(struct expr_t *cmd, char *path, char **args,
+		int fd_in, int fd_out, pid_t pgid, struct builtin_t *builtin,
+		struct stageattr_t *attr)
+{
+	int argc;
+	pid_t pid;
+	sigset_t mask;
+
+	if ((pid = fork()) == -1) {
+		err_fork(errno);
+		return -1;
+	}
+
+	if (pid == 0) {  /* This is a child */
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+
+		if (pgid != -1) {
+			setpgid(0, pgid);
+			signal(SIGTSTP, SIG_DFL);
+			signal(SIGTTIN, SIG_DFL);
+			signal(SIGTTOU, SIG_DFL);
+		}
+
+		if (fd_in != -1 && dup2(fd_in, STDIN_FILENO) == -1) {
+			err_dup2(errno);
+			_exit(-1);
+		}
+		if (fd_out != -1 && dup2(fd_out, STDOUT_FILENO) == -1) {
+			err_dup2(errno);
+			_exit(-1);
+		}
+
+		if (redirect_apply(cmd->redirects, NULL) == -1)
+			_exit(1);
+
+		if (attr->set && stageattr_apply(attr) == -1)
+			_exit(1);
+
+		if (builtin) {
+			launch_close_on_exec();
+			for (argc = 0; args[argc]; argc++)
+				;
+			argc = builtin->function(argc, args, stdin, stdout);
+			fflush(stdout);
+			_exit(argc);
+		}
+
+		/* Execute the command that we parsed out of our struct */
+		launch_execve(path, args);
+		err_exec(errno);
+		err_msg("tansh: `%s' failed to exec", args[0]);
+
+		_exit(-1);  /* This line only executes if execve fails */
+	}
+
+	/* Also set in the parent, so the group exists before the next stage
+	 * tries to join it, whichever process runs first. */
+	if (pgid != -1)
+		setpgid(pid, pgid ? pgid : pid);
+
+	return pid;
+}
+
+/*
+ * The body of a builtin stage running on a thread. Signals are blocked
+ * so they are all handled by the main thread; in particular a write to
+ * a pipe whose reader has gone fails with EPIPE instead of raising
+ * SIGPIPE in the shell. The pipe ends are closed on return, which is
+ * what lets the next stage see end of file. Returns the exit status of
+ * the builtin and the resources the thread used (see job_join()).
+ */
+static void *launch_thread_main(void *arg)
+{
+	int status = 1;
+	struct launch_thread_t *t = arg;
+	FILE *in = stdin, *out = stdout;
+	sigset_t mask;
+
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	if (t->fd_in != -1 && (in = fdopen(t->fd_in, "r")) == NULL) {
+		close(t->fd_in);
+		in = NULL;
+	}
+	if (t->fd_out != -1 && (out = fdopen(t->fd_out, "w")) == NULL) {
+		close(t->fd_out);
+		out = NULL;
+	}
+
+	if (in && out)
+		status = t->builtin->function(t->argc, t->argv, in, out);
+	else
+		err_msg("tansh: %s: unable to open pipe stream", t->argv[0]);
+
+	if (in && in != stdin)
+		fclose(in);
+	if (out && out != stdout)
+		fclose(out);
+	else if (out)
+		fflush(out);
+
+	t->result.status = status;
+	clock_gettime(CLOCK_MONOTONIC, &t->result.end);
+	getrusage(RUSAGE_THREAD, &t->result.usage);
+	return &t->result;
+}
+
+/*
+ * Starts the builtin stage 'builtin' on a new thread. The thread gets
+ * its own copies of the pipe ends, or the files the stage redirects
+ * its stdin and stdout to (see redirect_is_stdio()), so the caller
+ * closes its pipe ends as for any other stage. The arguments are shared
+ * with 'cmd', which must outlive the thread. Returns 0 with the thread
+ * in 'thread', or -1 on error.
+ */
+static pid_t launch_thread(struct expr_t *cmd, struct builtin_t *builtin,
+		char **args, int fd_in, int fd_out, pthread_t *thread)
+{
+	int argc, ret, fd, file_in = -1, file_out = -1;
+	list_node_t *node;
+	struct redirect_t *redir;
+	struct launch_thread_t *t;
+
+	for (argc = 0; args[argc]; argc++)
+		;
+	if ((t = malloc(sizeof(struct launch_thread_t) +
+			(argc + 1) * sizeof(char *))) == NULL) {
+		err_malloc(errno);
+		return -1;
+	}
+	t->builtin = builtin;
+	t->argc = argc;
+	t->argv = (char **)(t + 1);
+	memcpy(t->argv, args, (argc + 1) * sizeof(char *));
+
+	/* The later of several redirections of the same stream wins */
+	if (cmd->redirects) {
+		list_foreach(cmd->redirects, node) {
+			redir = list_key(node);
+			if ((fd = redirect_open(redir)) == -1) {
+				if (file_in != -1)
+					close(file_in);
+				if (file_out != -1)
+					close(file_out);
+				free(t);
+				return -1;
+			}
+			if (redirect_target(redir) == STDIN_FILENO) {
+				if (file_in != -1)
+					close(file_in);
+				file_in = fd;
+			} else {
+				if (file_out != -1)
+					close(file_out);
+				file_out = fd;
+			}
+		}
+	}
+
+	t->fd_in = file_in != -1 ? file_in : fd_in == -1 ? -1 :
+			fcntl(fd_in, F_DUPFD_CLOEXEC, 0);
+	t->fd_out = file_out != -1 ? file_out : fd_out == -1 ? -1 :
+			fcntl(fd_out, F_DUPFD_CLOEXEC, 0);
+	if ((fd_in != -1 && t->fd_in == -1) || (fd_out != -1 && t->fd_out == -1)) {
+		err_dup2(errno);
+		ret = -1;
+	} else {
+		ret = pthread_create(thread, NULL, launch_thread_main, t);
+	}
+
+	if (ret != 0) {
+		if (ret != -1)
+			err_msg("tansh: %s: unable to create thread: %s", args[0],
+					strerror(ret));
+		if (t->fd_in != -1)
+			close(t->fd_in);
+		if (t->fd_out != -1)
+			close(t->fd_out);
+		free(t);
+		return -1;
+	}
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include "cmd.h"
+
+/* Ways a single pipeline stage may be started. */
+#define LAUNCH_SPAWN  0  /* posix_spawn(3) with file actions (default) */
+#define LAUNCH_FORK   1  /* fork(2), dup2(2) and execve(2) in the child */
+#define LAUNCH_ZYGOTE 2  /* Through the helper process of zygote.c */
+
+/* The mode used by launch_pipeline(). Exposed so the benchmarks can
+ * compare the launch paths. `set -o zygote' turns LAUNCH_SPAWN into
+ * LAUNCH_ZYGOTE. */
+extern int launch_mode;
+
+int   launch_pipeline_length(struct expr_t *cmd);
+int   launch_pipeline(struct expr_t *cmd, pid_t *pids, pthread_t *threads);
+int   launch_pipeline_readers(struct expr_t *cmd, pid_t *pids,
+                              pthread_t *threads, int *readers);
+int   launch_exec(struct expr_t *cmd);
+void  launch_close_on_exec(void);
+
+#endif
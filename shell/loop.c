@@ -0,0 +1,318 @@
+/***********************************************************************
+ * File: loop.c
+ * Description: Executes `for' loops. The loop header holds the loop
+ *   variable and its words, and is followed by the body block. Each
+ *   iteration runs a copy of the body in which references to the loop
+ *   variable have been replaced by the current word.
+ *
+ *   A parallel loop, `for -j N name in word ...', runs every iteration
+ *   in a forked worker, with at most N workers at once. A new worker is
+ *   started as soon as any worker finishes, and the loop does not end
+ *   until the last worker has finished. With -k, the output of each
+ *   iteration is held back until the output of every earlier iteration
+ *   has been printed.
+ **********************************************************************/
+
+#ifndef LOOP_C
+#define LOOP_C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include "loop.h"
+#include "tansh.h"
+#include "job.h"
+#include "event.h"
+#include "list.h"
+#include "error.h"
+
+/* The deepest nesting of loops within a loop body that is copied with
+ * the block ends intact. */
+#define LOOP_MAX_DEPTH  64
+
+/* An iteration of a parallel loop that has been started. */
+struct loop_worker_t {
+	int index;   /* Index of the iteration's word */
+	FILE *out;   /* Holds the output of the iteration, with -k */
+};
+
+/* The output of a finished iteration, waiting for earlier ones. */
+struct loop_output_t {
+	char *data;
+	size_t size;
+	int done;
+};
+
+/*
+ * Returns a copy of the block from 'start' to 'end' (inclusive) in
+ * which the variable 'name' is replaced by 'value', or NULL on error.
+ * The block ends of nested loops are pointed at the copied expressions.
+ */
+static struct expr_t *loop_body(struct expr_t *start, struct expr_t *end,
+		const char *name, const char *value)
+{
+	int i, nloops = 0;
+	struct expr_t *cmd, *copy, *head = NULL, *tail = NULL;
+	struct expr_t *loops[LOOP_MAX_DEPTH];  /* Copied nested loop headers */
+	struct expr_t *ends[LOOP_MAX_DEPTH];   /* ... and their original ends */
+
+	for (cmd = start; ; cmd = cmd->next) {
+		if ((copy = cmd_copy(cmd, name, value)) == NULL) {
+			cmd_destroy(head);
+			return NULL;
+		}
+		if (tail)
+			tail->next = copy;
+		else
+			head = copy;
+		tail = copy;
+
+		for (i = 0; i < nloops; ) {
+			if (ends[i] == cmd) {
+				loops[i]->block_end = copy;
+				nloops--;
+				loops[i] = loops[nloops];
+				ends[i] = ends[nloops];
+			} else {
+				i++;
+			}
+		}
+		if (cmd->block_end && nloops < LOOP_MAX_DEPTH) {
+			loops[nloops] = copy;
+			ends[nloops++] = cmd->block_end;
+		}
+
+		if (cmd == end)
+			break;
+	}
+
+	return head;
+}
+
+/*
+ * Runs one iteration in the shell itself. Returns its exit status.
+ */
+static int loop_run(struct expr_t *start, struct expr_t *end,
+		const char *name, const char *value)
+{
+	struct expr_t *body;
+
+	if ((body = loop_body(start, end, name, value)) == NULL)
+		return 1;
+
+	job_last_status = 0;
+	if (do_command(body) == -1)
+		job_last_status = 1;
+	cmd_destroy(body);
+
+	return job_last_status;
+}
+
+/*
+ * Starts a worker for the iteration 'index' of a parallel loop and adds
+ * it to the job table as 'job'. If 'ordered' is non-zero, the output of the
+ * worker goes to a temporary file. Returns 0 on success or -1 on error.
+ */
+static int loop_start(struct loop_worker_t *worker, struct job_t **job,
+		int index, int ordered, struct expr_t *start, struct expr_t *end,
+		const char *name, const char *value)
+{
+	pid_t pid;
+	char *text;
+
+	worker->index = index;
+	worker->out = NULL;
+	if (ordered && (worker->out = tmpfile()) == NULL) {
+		err_msg("tansh: for: unable to create a temporary file: %s",
+				strerror(errno));
+		return -1;
+	}
+
+	/* No stdio buffer may be written twice, by the shell and the worker. */
+	fflush(stdout);
+	fflush(stderr);
+
+	if ((pid = fork()) == -1) {
+		err_fork(errno);
+		if (worker->out)
+			fclose(worker->out);
+		return -1;
+	}
+
+	if (pid == 0) {  /* The worker */
+		event_child();
+		job_control = 0;
+		if (worker->out && dup2(fileno(worker->out), STDOUT_FILENO) == -1) {
+			err_dup2(errno);
+			_exit(1);
+		}
+		loop_run(start, end, name, value);
+		fflush(stdout);
+		_exit(job_last_status & 0xff);
+	}
+
+	if ((text = malloc(strlen(name) + strlen(value) + 2)) != NULL)
+		sprintf(text, "%s=%s", name, value);
+	*job = job_create(&pid, NULL, 1, 0, text);
+
+	if (!*job) {
+		kill(pid, SIGTERM);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Reads back the output that a worker left in 'file' into 'output', and
+ * closes the file.
+ */
+static void loop_collect(FILE *file, struct loop_output_t *output)
+{
+	long size;
+
+	output->data = NULL;
+	output->size = 0;
+	output->done = 1;
+
+	if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 &&
+	    (output->data = malloc(size)) != NULL) {
+		rewind(file);
+		output->size = fread(output->data, 1, size, file);
+	}
+	fclose(file);
+}
+
+/*
+ * Runs the iterations of a parallel loop over the 'nwords' words in
+ * 'words' with at most 'njobs' workers at once. Returns the exit status
+ * of the iteration for the last word.
+ */
+static int loop_parallel(int njobs, int ordered, struct expr_t *start,
+		struct expr_t *end, const char *name, char **words, int nwords)
+{
+	int i, next = 0, active = 0, printed = 0, status = 0;
+	struct loop_worker_t workers[njobs];
+	struct job_t *jobs[njobs];
+	struct loop_output_t *outputs = NULL;
+	struct loop_worker_t *w;
+
+	if (ordered && (outputs = calloc(nwords, sizeof(*outputs))) == NULL) {
+		err_malloc(errno);
+		return 1;
+	}
+	for (i = 0; i < njobs; i++)
+		jobs[i] = NULL;
+
+	while (next < nwords || active > 0) {
+		/* Keep every worker busy while there is work left */
+		for (i = 0; i < njobs && next < nwords; i++) {
+			if (jobs[i])
+				continue;
+			if (loop_start(&workers[i], &jobs[i], next, ordered, start, end,
+					name, words[next]) == -1) {
+				/* Run out of resources: finish what was started */
+				if (ordered)
+					outputs[next].done = 1;
+				if (next == nwords - 1)
+					status = 1;
+				next++;
+				continue;
+			}
+			next++;
+			active++;
+		}
+		if (active == 0)
+			continue;
+
+		if ((i = job_wait_slots(jobs, njobs)) != -1) {
+			w = &workers[i];
+			if (w->index == nwords - 1)
+				status = job_wait(jobs[i]);
+			else
+				job_wait(jobs[i]);
+			jobs[i] = NULL;
+			active--;
+			if (w->out)
+				loop_collect(w->out, &outputs[w->index]);
+		} else {
+			/* The remaining workers cannot be waited for any more */
+			for (i = 0; i < njobs; i++) {
+				if (!jobs[i])
+					continue;
+				job_destroy(jobs[i]);
+				jobs[i] = NULL;
+				active--;
+				if (workers[i].index == nwords - 1)
+					status = 1;
+				if (workers[i].out)
+					loop_collect(workers[i].out, &outputs[workers[i].index]);
+			}
+		}
+
+		/* Print the outputs that are next in order */
+		while (ordered && printed < nwords && outputs[printed].done) {
+			fwrite(outputs[printed].data, 1, outputs[printed].size, stdout);
+			free(outputs[printed].data);
+			printed++;
+		}
+		fflush(stdout);
+	}
+
+	free(outputs);
+	return status;
+}
+
+/***********************************************************************
+ * Executes the `for' loop whose header is 'cmd'.
+ *
+ * Parameters:
+ *   cmd: The loop header. Its exec list holds the loop variable and,
+ *     for `for name in ...', the words to loop over.
+ *   next: Set to the expression following the loop.
+ *
+ * Return value:
+ *   Returns the exit status of the last iteration, or 0 if the loop
+ *   did not iterate.
+ **********************************************************************/
+int loop_for(struct expr_t *cmd, struct expr_t **next)
+{
+	int i, nwords, status = 0;
+	char *name;
+	struct expr_t *start = cmd->next, *end;
+	list_node_t *node;
+
+	end = cmd->block_end ? cmd->block_end : cmd_block_end(start);
+	if (!start || !end) {
+		err_msg("tansh: for: the loop has no body");
+		*next = NULL;
+		return 1;
+	}
+	*next = end->next;
+
+	if (list_size(cmd->exec) == 0)
+		return 0;
+	name = list_peek(cmd->exec);
+	nwords = cmd_is_in(cmd) ? list_size(cmd->exec) - 1 : 0;
+
+	char *words[nwords + 1];
+	i = 0;
+	list_foreach(cmd->exec, node)
+		if (node != list_head(cmd->exec))
+			words[i++] = list_key(node);
+
+	if (cmd->njobs > 0 && nwords > 0)
+		return loop_parallel(cmd->njobs, cmd_is_ordered(cmd) != 0, start,
+				end, name, words, nwords);
+
+	for (i = 0; i < nwords; i++)
+		status = loop_run(start, end, name, words[i]);
+
+	return status;
+}
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "cmd.h"
+
+int loop_for(struct expr_t *cmd, struct expr_t **next);
+
+#endif
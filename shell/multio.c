@@ -0,0 +1,475 @@
+/***********************************************************************
+ * File: multio.c
+ * Description: Multiple output redirections of a descriptor, as in zsh:
+ *
+ *     make >build.log >>all.log | grep -i error
+ *
+ *   writes the output of make to build.log, appends it to all.log and
+ *   feeds it to grep, where an ordinary shell would only honour the
+ *   last redirection. This replaces `| tee a b |', without copying
+ *   every byte through the memory of a tee process.
+ *
+ *   A stage with multios is started by a copier process, which takes
+ *   its place in the job. The copier starts the command with each such
+ *   descriptor on a pipe, and copies what the command writes there to
+ *   every target: with tee(2) into an empty scratch pipe per target and
+ *   splice(2) out of it, and with splice(2) straight to the last one,
+ *   so the data stays in the kernel. (A target splice(2) cannot write
+ *   to, such as a file opened for appending on older kernels, gets its
+ *   copy through a buffer instead.) The copier exits once the command
+ *   has exited and all of its output has been copied, with the status
+ *   of the command, so waiting for the job also waits for the copies.
+ *
+ *   A descriptor has multios if two or more of `>', `>|' and `>>' name
+ *   it, or if stdout is both redirected to a file and piped to the next
+ *   stage. A target that can no longer be written to is dropped; once
+ *   all are, the command gets SIGPIPE on its next write.
+ **********************************************************************/
+
+#ifndef MULTIO_C
+#define MULTIO_C
+
+#define _GNU_SOURCE  /* tee(2), splice(2), pipe2(2), F_GETPIPE_SZ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "multio.h"
+#include "launch.h"
+#include "redirect.h"
+#include "job.h"
+#include "cmd.h"
+#include "list.h"
+#include "error.h"
+
+/* A target of a descriptor with multios */
+struct multio_target_t {
+	int fd;          /* -1 once the target has been dropped */
+	int scratch[2];  /* Holds its copy of the data, but for the last one */
+	int nosplice;    /* Non-zero once splice(2) to 'fd' has failed */
+	size_t copied;   /* Bytes tee(2) put in 'scratch' this round */
+};
+
+/* A descriptor of the command with multios */
+struct multio_t {
+	int target;     /* The descriptor, in the command */
+	int pipe[2];    /* What the command writes to it */
+	int ntargets;
+	struct multio_target_t *targets;
+	char *buf;      /* For the targets splice(2) cannot write to */
+	size_t size;    /* The capacity of 'pipe' */
+};
+
+/*
+ * Returns non-zero if 'redir' writes to a file, so that another one on
+ * the same descriptor makes multios.
+ */
+static int multio_is_output(struct redirect_t *redir)
+{
+	return redir->type == REDIRECT_OUTPUT || redir->type == REDIRECT_CLOBBER ||
+	       redir->type == REDIRECT_CONCAT;
+}
+
+/*
+ * Returns the number of outputs of the descriptor 'fd': the output
+ * redirections of it in 'redirects', and the pipe to the next stage if
+ * 'piped'.
+ */
+static int multio_outputs(list_t *redirects, int fd, int piped)
+{
+	int n = (fd == STDOUT && piped);
+	list_node_t *node;
+
+	list_foreach(redirects, node) {
+		if (multio_is_output(list_key(node)) &&
+		    redirect_target(list_key(node)) == fd)
+			n++;
+	}
+
+	return n;
+}
+
+/***********************************************************************
+ * Returns non-zero if a descriptor of the stage 'cmd' has multios, in
+ * which case it must be started with multio_start(). 'piped' is
+ * non-zero if its stdout goes to the next stage of a pipeline.
+ **********************************************************************/
+int multio_needed(struct expr_t *cmd, int piped)
+{
+	list_node_t *node;
+
+	if (!cmd->redirects)
+		return 0;
+
+	list_foreach(cmd->redirects, node) {
+		if (multio_is_output(list_key(node)) &&
+		    multio_outputs(cmd->redirects,
+		                   redirect_target(list_key(node)), piped) > 1)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Prepares the copies of the descriptor 'target' of the command: the
+ * pipe to the next stage on stdout if 'piped', and the files of its
+ * output redirections. These are opened, and moved out of 'redirects'
+ * with the others, in order, to 'rest', where a redirection to the pipe
+ * of 'm' replaces the first one. Returns 0, or -1 on error.
+ */
+static int multio_prepare(struct multio_t *m, int target, list_t *redirects,
+		list_t *rest, int piped)
+{
+	int i, fd, replaced = 0;
+	struct redirect_t *redir, *dup;
+
+	memset(m, 0, sizeof(struct multio_t));
+	m->target = target;
+	if (pipe2(m->pipe, O_CLOEXEC) == -1) {
+		err_pipe(errno);
+		return -1;
+	}
+	m->size = fcntl(m->pipe[0], F_GETPIPE_SZ);
+	if ((m->targets = calloc(multio_outputs(redirects, target, piped),
+	                         sizeof(struct multio_target_t))) == NULL ||
+	    (m->buf = malloc(m->size)) == NULL) {
+		err_malloc(errno);
+		return -1;
+	}
+
+	if (target == STDOUT && piped)
+		m->targets[m->ntargets++].fd = STDOUT;
+
+	while (list_size(redirects) > 0) {
+		redir = list_shift(redirects);
+		if (!multio_is_output(redir) || redirect_target(redir) != target) {
+			list_push(rest, redir);
+			continue;
+		}
+
+		if (!replaced++) {
+			if ((dup = redirect_create()) == NULL)
+				return -1;
+			dup->type = REDIRECT_DUP_OUTPUT;
+			dup->output_fd = target;
+			dup->dup_fd = m->pipe[1];
+			list_push(rest, dup);
+		}
+		fd = redirect_open(redir);
+		redirect_destroy(redir);
+		if (fd == -1)
+			return -1;
+		m->targets[m->ntargets++].fd = fd;
+	}
+
+	/* The scratch pipes must take whatever the pipe holds */
+	for (i = 0; i < m->ntargets - 1; i++) {
+		if (pipe2(m->targets[i].scratch, O_CLOEXEC) == -1) {
+			err_pipe(errno);
+			return -1;
+		}
+		fcntl(m->targets[i].scratch[1], F_SETPIPE_SZ, (int)m->size);
+	}
+
+	return 0;
+}
+
+/*
+ * Drops the target 't', which can no longer be written to.
+ */
+static void multio_drop(struct multio_target_t *t)
+{
+	close(t->fd);
+	t->fd = -1;
+}
+
+/*
+ * Writes 'len' bytes at 'buf' to the target 't', dropping it on error.
+ */
+static void multio_write(struct multio_target_t *t, char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (t->fd != -1 && len > 0) {
+		if ((n = write(t->fd, buf, len)) == -1) {
+			if (errno != EINTR)
+				multio_drop(t);
+			continue;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Moves 'len' bytes from the pipe 'from' to the target 't', with
+ * splice(2) if it can. The bytes are taken out of 'from' even if the
+ * target has to be dropped on the way.
+ */
+static void multio_move(struct multio_t *m, int from,
+		struct multio_target_t *t, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if (t->fd != -1 && !t->nosplice) {
+			if ((n = splice(from, NULL, t->fd, NULL, len, SPLICE_F_MOVE)) > 0)
+				len -= n;
+			else if (n == 0)
+				return;
+			else if (n == -1 && errno == EINVAL)
+				t->nosplice = 1;
+			else if (n == -1 && errno != EINTR)
+				multio_drop(t);
+			continue;
+		}
+
+		if ((n = read(from, m->buf, len < m->size ? len : m->size)) <= 0) {
+			if (n == -1 && errno == EINTR)
+				continue;
+			return;
+		}
+		if (t->fd != -1)
+			multio_write(t, m->buf, n);
+		len -= n;
+	}
+}
+
+/*
+ * Copies what the command wrote to the pipe of 'm' to every target.
+ * Every target but the last gets a copy with tee(2); the first of them
+ * waits for data and sets how much this round copies. The last target
+ * then takes the data out of the pipe, unless a tee(2) fell short: the
+ * data is then read, and the missing bytes written from the buffer.
+ * Returns the number of bytes copied, or 0 at the end of the data or
+ * once no target is left.
+ */
+static ssize_t multio_copy(struct multio_t *m)
+{
+	int i, last = -1, full = 1;
+	ssize_t n = 0, got;
+	size_t len;
+	struct multio_target_t *t;
+
+	for (i = 0; i < m->ntargets; i++)
+		if (m->targets[i].fd != -1)
+			last = i;
+	if (last == -1)
+		return 0;
+
+	for (i = 0; i < last; i++) {
+		t = &m->targets[i];
+		if (t->fd == -1)
+			continue;
+		while ((got = tee(m->pipe[0], t->scratch[1], n ? n : m->size, 0)) == -1 &&
+		       errno == EINTR)
+			;
+		if (n == 0 && got <= 0)
+			return 0;
+		if (n == 0)
+			n = got;
+		t->copied = got > 0 ? got : 0;
+		if (t->copied < (size_t)n)
+			full = 0;
+	}
+
+	/* Only one target left: nothing to copy, just move */
+	t = &m->targets[last];
+	if (n == 0) {
+		if (!t->nosplice) {
+			while ((n = splice(m->pipe[0], NULL, t->fd, NULL, m->size,
+			                   SPLICE_F_MOVE)) == -1 && errno == EINTR)
+				;
+			if (n >= 0)
+				return n;
+			if (errno != EINVAL) {
+				multio_drop(t);
+				return 0;
+			}
+			t->nosplice = 1;
+		}
+		while ((n = read(m->pipe[0], m->buf, m->size)) == -1 && errno == EINTR)
+			;
+		if (n > 0)
+			multio_write(t, m->buf, n);
+		return n > 0 ? n : 0;
+	}
+
+	for (i = 0; i < last; i++) {
+		if (m->targets[i].copied > 0)
+			multio_move(m, m->targets[i].scratch[0], &m->targets[i],
+					m->targets[i].copied);
+	}
+
+	if (full) {
+		multio_move(m, m->pipe[0], t, n);
+		return n;
+	}
+
+	for (len = 0; len < (size_t)n; len += got) {
+		if ((got = read(m->pipe[0], m->buf + len, n - len)) <= 0) {
+			if (got == -1 && errno == EINTR) {
+				got = 0;
+				continue;
+			}
+			return 0;
+		}
+	}
+	for (i = 0; i < last; i++) {
+		if (m->targets[i].fd != -1 && m->targets[i].copied < (size_t)n)
+			multio_write(&m->targets[i], m->buf + m->targets[i].copied,
+					n - m->targets[i].copied);
+	}
+	multio_write(t, m->buf, n);
+
+	return n;
+}
+
+/*
+ * Runs the copier of the stage 'cmd' (see the file header), whose
+ * stdout is piped to the next stage if 'piped'. Returns the status of
+ * the command, as from waitpid(2), or -1 on error.
+ */
+static int multio_run(struct expr_t *cmd, int piped)
+{
+	int i, n = 0, nopen, status = -1;
+	pid_t pid = -1;
+	list_t *rest;
+	list_node_t *node;
+	struct expr_t *copy;
+	struct redirect_t *redir;
+
+	if ((copy = cmd_copy(cmd, NULL, NULL)) == NULL)
+		return -1;
+	copy->type &= ~PIPE_OUTPUT;
+
+	/* One copy per descriptor with multios */
+	struct multio_t ms[list_size(cmd->redirects)];
+	struct pollfd fds[list_size(cmd->redirects)];
+
+	list_foreach(cmd->redirects, node) {
+		redir = list_key(node);
+		if (!multio_is_output(redir) ||
+		    multio_outputs(copy->redirects, redirect_target(redir), piped) < 2)
+			continue;
+		if ((rest = list_create(redirect_destroy)) == NULL) {
+			err_list_create(errno);
+			return -1;
+		}
+		if (multio_prepare(&ms[n], redirect_target(redir), copy->redirects,
+		                   rest, piped) == -1)
+			return -1;
+		list_destroy(copy->redirects);
+		copy->redirects = rest;
+		n++;
+	}
+
+	/* The command is started in the group of the copier */
+	job_control = 0;
+	launch_pipeline(copy, &pid, NULL);
+	for (i = 0; i < n; i++)
+		close(ms[i].pipe[1]);
+	cmd_destroy(copy);
+
+	/* Only the command is interrupted; the copier finishes its copies */
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, SIG_IGN);
+	signal(SIGQUIT, SIG_IGN);
+	signal(SIGCHLD, SIG_DFL);
+
+	for (nopen = n; nopen > 0; ) {
+		for (i = 0; i < n; i++) {
+			fds[i].fd = ms[i].pipe[0];
+			fds[i].events = POLLIN;
+		}
+		if (poll(fds, n, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (fds[i].fd == -1 || !fds[i].revents || multio_copy(&ms[i]) > 0)
+				continue;
+			close(ms[i].pipe[0]);
+			ms[i].pipe[0] = -1;
+			nopen--;
+		}
+	}
+
+	if (pid <= 0)
+		return 127 << 8;  /* As if it had exited with 127 */
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+		;
+	return status;
+}
+
+/***********************************************************************
+ * Starts the stage 'cmd', which has multios (see multio_needed()),
+ * through a copier process that stands for it in the job.
+ *
+ * Parameters:
+ *   cmd: The stage.
+ *   fd_in, fd_out: The pipes to the previous and next stages, or -1.
+ *   pgid: The process group to join, 0 for a new one, or -1.
+ *
+ * Return value:
+ *   Returns the pid of the copier, or -1 on error.
+ **********************************************************************/
+pid_t multio_start(struct expr_t *cmd, int fd_in, int fd_out, pid_t pgid)
+{
+	int status;
+	pid_t pid;
+	sigset_t mask;
+
+	if ((pid = fork()) == -1) {
+		err_fork(errno);
+		return -1;
+	}
+
+	if (pid == 0) {  /* The copier */
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		if (pgid != -1) {
+			setpgid(0, pgid);
+			signal(SIGTSTP, SIG_DFL);
+			signal(SIGTTIN, SIG_DFL);
+			signal(SIGTTOU, SIG_DFL);
+		}
+
+		if ((fd_in != -1 && dup2(fd_in, STDIN_FILENO) == -1) ||
+		    (fd_out != -1 && dup2(fd_out, STDOUT_FILENO) == -1)) {
+			err_dup2(errno);
+			_exit(1);
+		}
+		/* The other ends of the pipeline must not be held open */
+		launch_close_on_exec();
+
+		/* Not the shell's handlers, which the command would inherit */
+		signal(SIGINT, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+
+		if ((status = multio_run(cmd, fd_out != -1)) == -1)
+			_exit(1);
+		if (WIFSIGNALED(status)) {
+			signal(WTERMSIG(status), SIG_DFL);
+			kill(getpid(), WTERMSIG(status));
+			_exit(128 + WTERMSIG(status));
+		}
+		_exit(WEXITSTATUS(status));
+	}
+
+	if (pgid != -1)
+		setpgid(pid, pgid ? pgid : pid);
+
+	return pid;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef MULTIO_H
+#define MULTIO_H
+
+#include <sys/types.h>
+#include "cmd.h"
+
+int   multio_needed(struct expr_t *cmd, int piped);
+pid_t multio_start(struct expr_t *cmd, int fd_in, int fd_out, pid_t pgid);
+
+#endif
@@ -0,0 +1,186 @@
+/***********************************************************************
+ * File: option.c
+ * Description: The shell options, set with `set -o name[=value]' and
+ *   cleared with `set +o name'. An option may also take its value from
+ *   an environment variable, which is only consulted while the option
+ *   itself has not been set, so a script can set a default that the
+ *   user overrides with `set -o'.
+ **********************************************************************/
+
+#ifndef OPTION_C
+#define OPTION_C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "option.h"
+#include "error.h"
+
+long option_pipesize = 0;
+long option_timeraw = 0;
+long option_pipestats = 0;
+long option_zygote = 0;
+long option_maxjobs = 0;
+long option_autopar = 0;
+long option_autoparjobs = 0;
+long option_argbatch = 0;
+
+static struct option_t options[] = {
+	{ "pipesize",  OPTION_SIZE,   &option_pipesize,  "TANSH_PIPESIZE" },
+	{ "timeraw",   OPTION_BOOL,   &option_timeraw,   "TANSH_TIMERAW" },
+	{ "pipestats", OPTION_NUMBER, &option_pipestats, "TANSH_PIPESTATS" },
+	{ "zygote",    OPTION_BOOL,   &option_zygote,    "TANSH_ZYGOTE" },
+	{ "maxjobs",   OPTION_NUMBER, &option_maxjobs,   "TANSH_MAXJOBS" },
+	{ "autopar",   OPTION_BOOL,   &option_autopar,   "TANSH_AUTOPAR" },
+	{ "autoparjobs", OPTION_NUMBER, &option_autoparjobs, "TANSH_AUTOPARJOBS" },
+	{ "argbatch",  OPTION_NUMBER, &option_argbatch,  "TANSH_ARGBATCH" },
+	{ NULL, 0, NULL, NULL }
+};
+
+/*
+ * Returns the option called 'name', or NULL if there is none.
+ */
+struct option_t *option_lookup(const char *name)
+{
+	struct option_t *o;
+
+	for (o = options; o->name; o++)
+		if (strcmp(o->name, name) == 0)
+			return o;
+
+	return NULL;
+}
+
+/*
+ * Returns the value of 'option', falling back to its environment
+ * variable while the option is 0. An invalid environment value counts
+ * as 0.
+ */
+long option_value(struct option_t *option)
+{
+	long value;
+	char *env;
+
+	if (*option->value || !option->env || !(env = getenv(option->env)))
+		return *option->value;
+
+	value = option_parse(env, option->type);
+	return value == -1 ? 0 : value;
+}
+
+/***********************************************************************
+ * Parses the value 'text' of an option of kind 'type'.
+ *
+ * Return value:
+ *   Returns the value, or -1 if 'text' is not a valid value for the
+ *   kind of option.
+ **********************************************************************/
+long option_parse(const char *text, int type)
+{
+	char *end;
+	long value;
+
+	if (type == OPTION_BOOL) {
+		if (!strcmp(text, "on") || !strcmp(text, "1"))
+			return 1;
+		if (!strcmp(text, "off") || !strcmp(text, "0"))
+			return 0;
+		return -1;
+	}
+
+	errno = 0;
+	value = strtol(text, &end, 10);
+	if (errno || end == text || value < 0)
+		return -1;
+
+	if (type == OPTION_SIZE) {
+		switch (*end) {
+			case 'g': case 'G':
+				value <<= 10;
+				/* Fall through */
+			case 'm': case 'M':
+				value <<= 10;
+				/* Fall through */
+			case 'k': case 'K':
+				value <<= 10;
+				end++;
+				break;
+		}
+	}
+
+	return *end == '\0' ? value : -1;
+}
+
+/***********************************************************************
+ * Sets an option from 'spec', which is either `name=value' or just
+ * `name' (which turns a boolean option on).
+ *
+ * Return value:
+ *   Returns 0 on success or -1 if there is no such option or the value
+ *   is invalid.
+ **********************************************************************/
+int option_set(const char *spec)
+{
+	long value;
+	const char *eq = strchr(spec, '=');
+	size_t len = eq ? (size_t)(eq - spec) : strlen(spec);
+	char name[len + 1];
+	struct option_t *option;
+
+	memcpy(name, spec, len);
+	name[len] = '\0';
+
+	if ((option = option_lookup(name)) == NULL) {
+		err_msg("set: %s: invalid option name", name);
+		return -1;
+	}
+
+	if (!eq && option->type != OPTION_BOOL) {
+		err_msg("set: %s: option requires a value", name);
+		return -1;
+	}
+
+	value = eq ? option_parse(eq + 1, option->type) : 1;
+	if (value == -1) {
+		err_msg("set: %s: invalid value `%s'", name, eq + 1);
+		return -1;
+	}
+
+	*option->value = value;
+	return 0;
+}
+
+/*
+ * Turns the option 'name' off (sets it to 0). Returns 0 on success or -1
+ * if there is no such option.
+ */
+int option_unset(const char *name)
+{
+	struct option_t *option;
+
+	if ((option = option_lookup(name)) == NULL) {
+		err_msg("set: %s: invalid option name", name);
+		return -1;
+	}
+
+	*option->value = 0;
+	return 0;
+}
+
+/*
+ * Prints every option with its current value to 'out'.
+ */
+void option_print(FILE *out)
+{
+	struct option_t *o;
+
+	for (o = options; o->name; o++) {
+		if (o->type == OPTION_BOOL)
+			fprintf(out, "%-15s %s\n", o->name, option_value(o) ? "on" : "off");
+		else
+			fprintf(out, "%-15s %ld\n", o->name, option_value(o));
+	}
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef OPTION_H
+#define OPTION_H
+
+#include <stdio.h>
+
+/* Kinds of values a shell option may hold. */
+#define OPTION_BOOL    0  /* on or off */
+#define OPTION_NUMBER  1  /* a non-negative number */
+#define OPTION_SIZE    2  /* a number of bytes, with an optional k, m or g */
+
+/* A shell option, as set with `set -o name[=value]'. */
+struct option_t {
+	char *name;
+	int type;
+	long *value;
+	char *env;  /* Environment variable used while the option is 0 */
+};
+
+/* Capacity of the pipes between pipeline stages, or 0 for the default. */
+extern long option_pipesize;
+
+/* Non-zero if `time' reports in key=value lines (see timing.c). */
+extern long option_timeraw;
+
+/* Milliseconds between samples of pipeline statistics, or 0 to keep
+ * none (see pipestats.c). */
+extern long option_pipestats;
+
+/* Non-zero if commands are started by the zygote, which is
+ * experimental and off by default (see zygote.c). */
+extern long option_zygote;
+
+/* Background jobs run at once, past which more are queued, or 0 for no
+ * limit (see jobqueue.c). */
+extern long option_maxjobs;
+
+/* Non-zero if runs of independent commands run concurrently, with at
+ * most option_autoparjobs at once, or one per processor if it is 0 (see
+ * autopar.c). */
+extern long option_autopar;
+extern long option_autoparjobs;
+
+/* Batches run at once for a stage whose words are too long to exec, or
+ * 0 to let it fail (see argbatch.c). */
+extern long option_argbatch;
+
+struct option_t *option_lookup(const char *name);
+long             option_value(struct option_t *option);
+int              option_set(const char *spec);
+int              option_unset(const char *name);
+long             option_parse(const char *text, int type);
+void             option_print(FILE *out);
+
+#endif
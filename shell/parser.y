@@ -29,6 +29,8 @@
 #include "redirect.h"
 #include "alias.h"
 #include "job.h"
+#include "event.h"
+#include "subst.h"
 #include "chartypes.h"
 #include "error.h"
 #include "config.h"
@@ -36,11 +38,22 @@
 static int interactive = 1;
 static struct expr_t *command = NULL;
 
+/* Non-zero if the next line continues the command being read, whose
+ * first line was read by the same parse. */
+static int prompt_continued = 0;
+
 /* External lex/yacc variables/functions */
 static FILE *yyin;
 int yylex(void);
 extern void  yyrestart(FILE *);
 extern void  yyerror(char *s);
+
+static int   push_here_document(struct redirect_t *redir, int flags);
+static char *here_string(char *word);
+static void  remove_quotes(char *s);
+static int   push_redirect(struct expr_t *cmd, struct redirect_t *redir);
+static int   shell_getc(int remove_quoted_newline);
+void         reset_parser(void);
 %}
 
 %union {
@@ -116,7 +129,7 @@ inputunit:	simple_list simple_list_terminator
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "inputunit 0 matched\n");
 #endif
-		command = $1;
+		$$ = command = $1;
 		if (interactive)
 			YYACCEPT;
 	}
@@ -125,7 +138,12 @@ inputunit:	simple_list simple_list_terminator
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "inputunit 1 matched\n");
 #endif
-		cmd_append($1, $2);
+		if ($1) {
+			cmd_append($1, $2);
+			$$ = $1;
+		} else {  /* Only blank lines came before */
+			$$ = command = $2;
+		}
 		if (interactive)
 			YYACCEPT;
 	}
@@ -134,14 +152,20 @@ inputunit:	simple_list simple_list_terminator
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "inputunit 2 matched\n");
 #endif
+		$$ = NULL;
 		if (interactive)
 			YYACCEPT;
 	}
+	|	inputunit NEWLINE
+	{
+		$$ = $1;
+	}
 	|	error NEWLINE
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "inputunit 3 matched\n");
 #endif
+		$$ = NULL;
 		if (interactive)
 			YYACCEPT;
 		else
@@ -152,9 +176,14 @@ inputunit:	simple_list simple_list_terminator
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "inputunit 4 matched\n");
 #endif
+		$$ = NULL;
 		if (interactive)
 			YYACCEPT;
 	}
+	|	inputunit yacc_EOF
+	{
+		$$ = $1;
+	}
 	;
 
 word_list:	WORD
@@ -162,7 +191,9 @@ word_list:	WORD
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "word_list 0 matched\n");
 #endif
+#ifndef NDEBUG_PARSER
 		err_msg(" => %s", $1);
+#endif
 		$$ = list_create(free);
 		if (!$$) {
 			err_msg("error: [yyparse] Unable to create word list.");
@@ -270,140 +301,313 @@ redirection:	GREATER WORD
 			err_msg("error: [yyparse] Unable to create redirection.");
 			YYABORT;
 		}
-		$$->type = REDIRECT_INPUT;
-		$$->input_filename = $2->word;
+		$$->type = REDIRECT_HERE_DOC;
+		$$->input_filename = $2->word;  /* The delimiter, until the body is read */
+		if (push_here_document($$, 0) == -1)
+			YYABORT;
 	}
 	|	NUMBER LESS_LESS WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 7 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_HERE_DOC;
+		$$->input_filename = $3->word;
+		$$->input_fd = $1;
+		if (push_here_document($$, 0) == -1)
+			YYABORT;
 	}
 	|	LESS_LESS_LESS WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 8 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_HERE_DOC;
+		if (($$->here_doc = here_string($2->word)) == NULL)
+			YYABORT;
 	}
 	|	NUMBER LESS_LESS_LESS WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 9 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_HERE_DOC;
+		if (($$->here_doc = here_string($3->word)) == NULL)
+			YYABORT;
+		$$->input_fd = $1;
 	}
 	|	LESS_AND NUMBER
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 10 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_DUP_INPUT;
+		$$->dup_fd = $2;
 	}
 	|	NUMBER LESS_AND NUMBER
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 11 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_DUP_INPUT;
+		$$->dup_fd = $3;
+		$$->input_fd = $1;
 	}
 	|	GREATER_AND NUMBER
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 12 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_DUP_OUTPUT;
+		$$->dup_fd = $2;
 	}
 	|	NUMBER GREATER_AND NUMBER
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 13 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_DUP_OUTPUT;
+		$$->dup_fd = $3;
+		$$->output_fd = $1;
 	}
 	|	LESS_AND WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 14 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_DUP_INPUT;  /* Ambiguous; see redirect.c */
+		$$->input_filename = $2->word;
 	}
 	|	NUMBER LESS_AND WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 15 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_DUP_INPUT;
+		$$->input_filename = $3->word;
+		$$->input_fd = $1;
 	}
 	|	GREATER_AND WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 16 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_ALL_OUTPUT;  /* The same as &> WORD */
+		$$->output_filename = $2->word;
 	}
 	|	NUMBER GREATER_AND WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 17 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_DUP_OUTPUT;  /* Ambiguous; see redirect.c */
+		$$->output_filename = $3->word;
+		$$->output_fd = $1;
 	}
 	|	LESS_LESS_MINUS WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 18 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_HERE_DOC;
+		$$->input_filename = $2->word;
+		if (push_here_document($$, REDIRECT_HERE_STRIP) == -1)
+			YYABORT;
 	}
 	|	NUMBER LESS_LESS_MINUS WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 19 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_HERE_DOC;
+		$$->input_filename = $3->word;
+		$$->input_fd = $1;
+		if (push_here_document($$, REDIRECT_HERE_STRIP) == -1)
+			YYABORT;
 	}
 	|	GREATER_AND MINUS
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 20 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_CLOSE;
+		$$->output_fd = STDOUT;
 	}
 	|	NUMBER GREATER_AND MINUS
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 21 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_CLOSE;
+		$$->output_fd = $1;
 	}
 	|	LESS_AND MINUS
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 22 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_CLOSE;
+		$$->input_fd = STDIN;
 	}
 	|	NUMBER LESS_AND MINUS
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 23 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_CLOSE;
+		$$->input_fd = $1;
 	}
 	|	AND_GREATER WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 24 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_ALL_OUTPUT;
+		$$->output_filename = $2->word;
 	}
 	|	NUMBER LESS_GREATER WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 25 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_READ_WRITE;
+		$$->input_filename = $3->word;
+		$$->input_fd = $1;
 	}
 	|	LESS_GREATER WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 26 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_READ_WRITE;
+		$$->input_filename = $2->word;
 	}
 	|	GREATER_BAR WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 27 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_CLOBBER;
+		$$->output_filename = $2->word;
 	}
 	|	NUMBER GREATER_BAR WORD
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "redirection 28 matched\n");
 #endif
+		$$ = redirect_create();
+		if (!$$) {
+			err_msg("error: [yyparse] Unable to create redirection.");
+			YYABORT;
+		}
+		$$->type = REDIRECT_CLOBBER;
+		$$->output_filename = $3->word;
+		$$->output_fd = $1;
 	}
 	;
 
@@ -414,6 +618,10 @@ simple_command_element: WORD
 		fprintf(stderr, " => Found WORD '%s'\n", $1->word);
 #endif
 		$$.word = $1->word;
+		$$.redirect = NULL;
+		if (($1->flags & W_QUOTED) && !subst_needed($$.word))
+			remove_quotes($$.word);
+		free($1);
 	}
 	|	ASSIGNMENT_WORD
 	{
@@ -421,9 +629,13 @@ simple_command_element: WORD
 		fprintf(stderr, "simple_command_element 1 matched\n");
 #endif
 		/* TODO: Parse an assignment word:
-		 *   <assignment_word> ::= <word> '=' <word> */
-		//$$.word = $1;
-		//$$.redirect = NULL;
+		 *   <assignment_word> ::= <word> '=' <word>
+		 * Until then, it is passed on as a plain word. */
+		$$.word = $1->word;
+		$$.redirect = NULL;
+		if (($1->flags & W_QUOTED) && !subst_needed($$.word))
+			remove_quotes($$.word);
+		free($1);
 	}
 	/*| WORD EQUALS pipeline_command
 	{
@@ -478,7 +690,8 @@ simple_command:	simple_command_element
 		/* Store the word that has been parsed into the exec list. */
 		cmd_set_type($$, CMD_SIMPLE);
 		list_push($$->exec, $1.word);
-		list_push($$->redirects, $1.redirect);
+		if (push_redirect($$, $1.redirect) == -1)
+			YYABORT;
 	}
 	|	simple_command simple_command_element
 	{
@@ -490,7 +703,8 @@ simple_command:	simple_command_element
 		 * don't store the word as part of the exec parameters. */
 		if ($2.word)
 			list_push($$->exec, $2.word);
-		list_push($$->redirects, $2.redirect);
+		if (push_redirect($$, $2.redirect) == -1)
+			YYABORT;
 	}
 	;
 
@@ -624,10 +838,11 @@ for_command:	FOR WORD IN command newline_list LEFT_CURLY compound_list RIGHT_CUR
 #endif
 		$$ = $4;
 		cmd_mark_block($7);
+		$4->block_end = cmd_last($7);
 		cmd_append($4, $7);
 		cmd_set_type($4, CMD_FOR);
 		cmd_set_type($4, CMD_IN);
-		list_unshift($4->exec, $2); /* Push variable name onto the head */
+		list_unshift($4->exec, $2->word); /* Variable name first */
 	}
 	| FOR command newline_list LEFT_CURLY compound_list RIGHT_CURLY
 	{
@@ -635,7 +850,17 @@ for_command:	FOR WORD IN command newline_list LEFT_CURLY compound_list RIGHT_CUR
 		fprintf(stderr, "for_command 1 matched\n");
 #endif
 		$$ = $2;
+		/* A parallel loop, `for -j N name in word ...', is only seen
+		 * here: its first word is not the loop variable, so `in' is not
+		 * recognized as a keyword. */
+		if (list_size($2->exec) && ((char *)list_peek($2->exec))[0] == '-' &&
+		    cmd_for_options($2) == -1) {
+			cmd_destroy($2);
+			cmd_destroy($5);
+			YYABORT;
+		}
 		cmd_mark_block($5);
+		$2->block_end = cmd_last($5);
 		cmd_append($2, $5);
 		cmd_set_type($2, CMD_FOR);
 	}
@@ -755,7 +980,7 @@ function_def:	WORD LEFT_PARENTH RIGHT_PARENTH newline_list function_body
 		fprintf(stderr, "function_def 0 matched\n");
 #endif
 		$$ = $5;
-		list_unshift($5->exec, $1); /* Put func name on top of exec list. */
+		list_unshift($5->exec, $1->word); /* Function name first */
 	}
 	|	FUNCTION WORD LEFT_PARENTH RIGHT_PARENTH newline_list function_body
 	{
@@ -763,7 +988,7 @@ function_def:	WORD LEFT_PARENTH RIGHT_PARENTH newline_list function_body
 		fprintf(stderr, "function_def 1 matched\n");
 #endif
 		$$ = $6;
-		list_unshift($6->exec, $2); /* Put func name on top of exec list. */
+		list_unshift($6->exec, $2->word); /* Function name first */
 	}
 	|	FUNCTION WORD newline_list function_body
 	{
@@ -771,7 +996,7 @@ function_def:	WORD LEFT_PARENTH RIGHT_PARENTH newline_list function_body
 		fprintf(stderr, "function_def 2 matched\n");
 #endif
 		$$ = $4;
-		list_unshift($4->exec, $2); /* Put func name on top of exec list. */
+		list_unshift($4->exec, $2->word); /* Function name first */
 	}
 	;
 
@@ -1013,12 +1238,15 @@ list0:  	list1 NEWLINE newline_list
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "list0 1 matched\n");
 #endif
+		$$ = $1;
+		cmd_set_type(cmd_last($1), CMD_BACGROUND);
 	}
 	|	list1 SEMICOLON newline_list
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "list0 2 matched\n");
 #endif
+		$$ = $1;
 	}
 
 	;
@@ -1028,24 +1256,37 @@ list1:		list1 AND_AND newline_list list1
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "list1 0 matched\n");
 #endif
+		err_msg("tansh: `&&' is not supported yet");
+		cmd_destroy($1);
+		cmd_destroy($4);
+		YYABORT;
 	}
 	|	list1 OR_OR newline_list list1
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "list1 1 matched\n");
 #endif
+		err_msg("tansh: `||' is not supported yet");
+		cmd_destroy($1);
+		cmd_destroy($4);
+		YYABORT;
 	}
 	|	list1 AMPERSAND newline_list list1
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "list1 2 matched\n");
 #endif
+		$$ = $1;
+		cmd_set_type(cmd_last($1), CMD_BACGROUND);
+		cmd_append($1, $4);
 	}
 	|	list1 SEMICOLON newline_list list1
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "list1 3 matched\n");
 #endif
+		$$ = $1;
+		cmd_append($1, $4);
 	}
 	|	list1 NEWLINE newline_list list1
 	{
@@ -1126,12 +1367,15 @@ simple_list:	simple_list1
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "simple_list 1 matched\n");
 #endif
+		$$ = $1;
+		cmd_set_type(cmd_last($1), CMD_BACGROUND);
 	}
 	|	simple_list1 SEMICOLON
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "simple_list 2 matched\n");
 #endif
+		$$ = $1;
 	}
 	;
 
@@ -1140,24 +1384,37 @@ simple_list1:	simple_list1 AND_AND newline_list simple_list1
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "simple_list1 0 matched\n");
 #endif
+		err_msg("tansh: `&&' is not supported yet");
+		cmd_destroy($1);
+		cmd_destroy($4);
+		YYABORT;
 	}
 	|	simple_list1 OR_OR newline_list simple_list1
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "simple_list1 1 matched\n");
 #endif
+		err_msg("tansh: `||' is not supported yet");
+		cmd_destroy($1);
+		cmd_destroy($4);
+		YYABORT;
 	}
 	|	simple_list1 AMPERSAND simple_list1
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "simple_list1 2 matched\n");
 #endif
+		$$ = $1;
+		cmd_set_type(cmd_last($1), CMD_BACGROUND);
+		cmd_append($1, $3);
 	}
 	|	simple_list1 SEMICOLON simple_list1
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "simple_list1 3 matched\n");
 #endif
+		$$ = $1;
+		cmd_append($1, $3);
 	}
 
 	|	pipeline_command
@@ -1187,24 +1444,33 @@ pipeline_command: pipeline
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "pipeline_command 2 matched\n");
 #endif
+		cmd_set_type($2, $1);
+		$$ = $2;
 	}
 	|	timespec BANG pipeline
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "pipeline_command 3 matched\n");
 #endif
+		cmd_set_type($3, $1);
+		$$ = $3;
 	}
 	|	BANG timespec pipeline
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "pipeline_command 4 matched\n");
 #endif
+		cmd_set_type($3, $2);
+		$$ = $3;
 	}
 	|	timespec list_terminator
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "pipeline_command 5 matched\n");
 #endif
+		/* `time' on its own reports the times of the shell so far. */
+		cmd_create_block($$, CMD_SIMPLE);
+		cmd_set_type($$, $1);
 	}
 	;
 
@@ -1230,32 +1496,49 @@ timespec:	TIME
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "timespec 0 matched\n");
 #endif
+		$$ = CMD_TIMED;
 	}
 	|	TIME TIMEOPT
 	{
 #ifndef NDEBUG_PARSER
 		fprintf(stderr, "timespec 1 matched\n");
 #endif
+		$$ = CMD_TIMED | CMD_TIME_POSIX;
 	}
 	;
 %%
 
-void parse(FILE *file)
+/*
+ * Parses the next input unit from 'file' (or the next line from stdin
+ * if 'file' is NULL) and returns the resulting expression. The caller
+ * owns the expression and must release it with cmd_destroy().
+ */
+struct expr_t *parse(FILE *file)
 {
+	command = NULL;
 	if (file) {
 		yyin = file;
 		interactive = 0;
+		reset_parser();
 
-		while (!feof(yyin)) {
-			yyparse();
+		/* A script is parsed as a whole, and not run at all if it has a
+		 * syntax error */
+		if (yyparse() != 0) {
+			cmd_destroy(command);
+			command = NULL;
 		}
 	} else {
 		interactive = 1;
 		yyin = stdin;
-		yyparse();
+		prompt_continued = 0;
+		if (yyparse() != 0) {
+			cmd_destroy(command);
+			command = NULL;
+			reset_parser();  /* The rest of the line is not run */
+		}
 	}
-	cmd_print(command);
-	cmd_destroy(command);
+
+	return command;
 }
 
 /* The token currently being read. */
@@ -1284,6 +1567,10 @@ static int token_buffer_size;
 /* Global var is non-zero when end of file has been reached. */
 int EOF_Reached = 0;
 
+/* Non-zero once <CTRL + C> was typed while a command was being read:
+ * the lexer reads no further and the parse fails quietly. */
+static int input_interrupted = 0;
+
 /* Where shell input comes from.  History expansion is performed on each
  * line when the shell is interactive. */
 static char *shell_input_line = NULL;
@@ -1395,6 +1682,9 @@ extern int extended_glob;
 
 #define interactive_shell (interactive)
 
+/* Characters that end a word that is not quoted. */
+#define shellbreak(c) shellmeta(c)
+
 #if defined (PROCESS_SUBSTITUTION)
 #  define shellexp(c) ((c) == '$' || (c) == '<' || (c) == '>')
 #else
@@ -1687,9 +1977,150 @@ shellquote(int c)
 	}
 }
 
+/* Removes the quotes and backslashes from the word 's', in place, as
+ * quote removal would. A command or process substitution is left as it
+ * is. Words with substitutions keep their quotes until they are
+ * expanded (see subst.c). */
+static void
+remove_quotes(char *s)
+{
+	char *p, quote = 0;
+	int depth;
+
+	for (p = s; *s; s++) {
+		if (quote != '\'' && (*s == '$' || *s == '<' || *s == '>') &&
+		    s[1] == '(') {
+			for (depth = 0; *s; s++) {
+				depth += (*s == '(') - (*s == ')');
+				*p++ = *s;
+				if (*s == ')' && depth == 0)
+					break;
+			}
+			if (!*s)
+				break;
+		} else if (quote && *s == quote) {
+			quote = 0;
+		} else if (!quote && (*s == '\'' || *s == '"')) {
+			quote = *s;
+		} else if (*s == '\\' && quote != '\'' && s[1]) {
+			*p++ = *++s;
+		} else {
+			*p++ = *s;
+		}
+	}
+	*p = '\0';
+}
+
+/* Adds the redirection 'redir', if not NULL, to those of 'cmd'. Returns
+ * 0, or -1 on error. */
+static int
+push_redirect(struct expr_t *cmd, struct redirect_t *redir)
+{
+	if (!redir)
+		return 0;
+	if (!cmd->redirects &&
+	    (cmd->redirects = list_create(redirect_destroy)) == NULL) {
+		err_list_create(errno);
+		return -1;
+	}
+
+	return list_push(cmd->redirects, redir);
+}
+
+/* Queues the here-document 'redir', whose input_filename is still the
+ * delimiter, for its body to be read after the current line. 'flags' is
+ * REDIRECT_HERE_STRIP for <<-. A quoted delimiter keeps the body from
+ * being expanded. Returns 0, or -1 if too many are pending. */
+static int
+push_here_document(struct redirect_t *redir, int flags)
+{
+	if (need_here_doc >= (int)(sizeof(redir_stack) / sizeof(redir_stack[0]))) {
+		err_msg("tansh: too many here-documents on one line");
+		return -1;
+	}
+
+	redir->here_flags = flags;
+	if (strpbrk(redir->input_filename, "'\"\\"))
+		redir->here_flags |= REDIRECT_HERE_QUOTED;
+	remove_quotes(redir->input_filename);
+
+	redir_stack[need_here_doc++] = redir;
+	return 0;
+}
+
+/* Returns the body of the here-string `<<< word', the word without its
+ * quotes and with a newline added, or NULL on error. Takes over
+ * 'word'. */
+static char *
+here_string(char *word)
+{
+	char *body;
+	size_t len;
+
+	remove_quotes(word);
+	len = strlen(word);
+	if ((body = realloc(word, len + 2)) == NULL) {
+		err_malloc(errno);
+		free(word);
+		return NULL;
+	}
+	body[len] = '\n';
+	body[len + 1] = '\0';
+
+	return body;
+}
+
+/* Reads the body of the here-document 'temp' from the input, up to the
+ * line that holds only its delimiter (after leading tabs, for <<-). The
+ * body replaces the delimiter. */
 void
 make_here_document(struct redirect_t *temp)
 {
+	int c = 0, found = 0;
+	size_t len = 0, size = 0, start;
+	char *body = NULL, *line, *delimiter = temp->input_filename;
+
+	while (c != EOF && !found) {
+		/* Read a line at the end of the body; drop it if it ends the
+		 * document. */
+		start = len;
+		while ((c = shell_getc(0)) != EOF) {
+			RESIZE_MALLOCED_BUFFER(body, len, 2, size, 256);
+			body[len++] = c;
+			if (c == '\n')
+				break;
+		}
+		if (!body)
+			break;
+		body[len] = '\0';
+
+		line = body + start;
+		if (temp->here_flags & REDIRECT_HERE_STRIP) {
+			while (*line == '\t')
+				line++;
+			memmove(body + start, line, strlen(line) + 1);
+			len -= line - (body + start);
+			line = body + start;
+		}
+		if (strncmp(line, delimiter, strlen(delimiter)) == 0 &&
+		    (line[strlen(delimiter)] == '\n' || line[strlen(delimiter)] == '\0')) {
+			len = start;
+			found = 1;
+		}
+	}
+
+	if (!found && !input_interrupted)
+		err_msg("tansh: warning: here-document delimited by end-of-file "
+				"(wanted `%s')", delimiter);
+
+	if (!body && (body = malloc(1)) == NULL) {
+		err_malloc(errno);
+		return;
+	}
+	body[len] = '\0';
+	temp->here_doc = body;
+	temp->input_filename = NULL;
+	free(delimiter);
 }
 
 void
@@ -1702,22 +2133,18 @@ gather_here_documents()
 	}
 }
 
-void
-reset_parser(void)
-{
-
-}
-
 static void
 print_prompt()
 {
-	printf("$ ");
+	if (!interactive)
+		return;
+	printf(prompt_continued ? "> " : "$ ");
 }
 
 static void
 prompt_again()
 {
-	printf("$ ");
+	prompt_continued = 1;
 }
 
 /*
@@ -1728,14 +2155,14 @@ static int
 reserved_word_acceptable (int toksym)
 {
 	switch (toksym) {
-		case '\n':
-		case ';':
-		case '(':
-		case ')':
-		case '|':
-		case '&':
-		case '{':
-		case '}':   /* XXX */
+		case NEWLINE:
+		case SEMICOLON:
+		case LEFT_PARENTH:
+		case RIGHT_PARENTH:
+		case PIPE:
+		case AMPERSAND:
+		case LEFT_CURLY:
+		case RIGHT_CURLY:
 		case AND_AND:
 		case BANG:
 		case DO:
@@ -1774,7 +2201,55 @@ static char matched_pair_error;
 static char *
 parse_matched_pair (int qc, int open, int close, int *lenp, int flags)
 {
-	return NULL;
+	int c, count = 1, pass_next = 0, nestlen;
+	int len = 0, size = 0;
+	char *ret = NULL, *nest;
+
+	for (;;) {
+		c = shell_getc(qc != '\'' && pass_next == 0);
+		if (c == EOF) {
+			if (!input_interrupted)
+				err_msg("tansh: unexpected EOF while looking for matching `%c'",
+						close);
+			free(ret);
+			return &matched_pair_error;
+		}
+
+		RESIZE_MALLOCED_BUFFER(ret, len, 2, size, 64);
+		ret[len++] = c;
+
+		if (pass_next) {  /* The character after a backslash */
+			pass_next = 0;
+			continue;
+		}
+		if (c == '\\' && (qc != '\'' || (flags & P_ALLOWESC))) {
+			pass_next = 1;
+			continue;
+		}
+		if (c == close && --count == 0)
+			break;
+		if (open != close && c == open)
+			count++;
+
+		/* Quotes nested within $(...) and the like are matched on their
+		 * own, so a parenthesis within them does not count. */
+		if (open != close && qc != '\'' && (c == '\'' || c == '"')) {
+			nest = parse_matched_pair(c, c, c, &nestlen, 0);
+			if (nest == &matched_pair_error) {
+				free(ret);
+				return nest;
+			}
+			RESIZE_MALLOCED_BUFFER(ret, len, nestlen + 1, size, 64);
+			strcpy(ret + len, nest);
+			len += nestlen;
+			free(nest);
+		}
+	}
+
+	ret[len] = '\0';
+	if (lenp)
+		*lenp = len;
+	return ret;
 }
 
 /*
@@ -1857,6 +2332,27 @@ assignment (const char *string, int flags)
  *   preceded by one of `;', `\n', `||', `&&', or `&'.
 */
 
+/*
+ * Returns non-zero if `time' may start a timed pipeline here: at the
+ * start of a command, after `;', a newline, `||', `&&', `&' or `!'.
+ */
+static int
+time_command_acceptable (void)
+{
+	switch (last_read_token) {
+		case 0:
+		case AND_AND:
+		case OR_OR:
+		case BANG:
+		case SEMICOLON:
+		case NEWLINE:
+		case AMPERSAND:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
 /* When non-zero, we have read the required tokens which allow ESAC to
  * be the next one read. */
 static int esacs_needed_count;
@@ -1905,7 +2401,7 @@ special_case_tokens (char *tokstr)
 		if (tokstr[0] == '{' && tokstr[1] == '\0') {  /* '}' */
 			open_brace_count++;
 			/* TODO: DO I need this: function_bstart = line_number; */
-			return '{';
+			return LEFT_CURLY;
 		}
 	}
 
@@ -1913,15 +2409,62 @@ special_case_tokens (char *tokstr)
 	if (last_read_token == ARITH_FOR_EXPRS && tokstr[0] == '{' &&
 	    tokstr[1] == '\0') {  /* '}' */
 		open_brace_count++;
-		return '{';
+		return LEFT_CURLY;
 	}
 
 	if (open_brace_count && reserved_word_acceptable (last_read_token) &&
 	    tokstr[0] == '}' && !tokstr[1]) {
 		open_brace_count--;  /* '{' */
-		return '}';
+		return RIGHT_CURLY;
 	}
 
+	/* Handle -p after `time'. */
+	if (last_read_token == TIME && STREQ(tokstr, "-p"))
+		return TIMEOPT;
+
+	if (STREQ(tokstr, "time") && time_command_acceptable())
+		return TIME;
+
+	/* The bodies of loops, ifs and functions are in braces, which end
+	 * the command before them: `while cmd {' */
+	if ((tokstr[0] == '{' || tokstr[0] == '}') && tokstr[1] == '\0')
+		return tokstr[0] == '{' ? LEFT_CURLY : RIGHT_CURLY;
+
+	return -1;
+}
+
+/* The reserved words, recognized where a command may start. */
+static struct {
+	const char *word;
+	int token;
+} reserved_words[] = {
+	{ "if", IF },
+	{ "elif", ELIF },
+	{ "else", ELSE },
+	{ "for", FOR },
+	{ "foreach", FOR },
+	{ "while", WHILE },
+	{ "until", UNTIL },
+	{ "function", FUNCTION },
+	{ NULL, 0 }
+};
+
+/*
+ * Returns the token of the reserved word 'tokstr', or -1 if it is not
+ * one or may not be one here.
+ */
+static int
+reserved_word (char *tokstr)
+{
+	int i;
+
+	if (!reserved_word_acceptable(last_read_token))
+		return -1;
+
+	for (i = 0; reserved_words[i].word; i++)
+		if (STREQ(tokstr, reserved_words[i].word))
+			return reserved_words[i].token;
+
 	return -1;
 }
 
@@ -1935,6 +2478,26 @@ special_case_tokens (char *tokstr)
  * with shell_ungetc when we're at the start of a line. */
 static int eol_ungetc_lookahead = 0;
 
+/* Drops what is left of the input, as after a syntax error, <CTRL + C>
+ * or before another script is read. */
+void
+reset_parser(void)
+{
+	need_here_doc = 0;
+	EOF_Reached = 0;
+	input_interrupted = 0;
+	prompt_continued = 0;
+	if (shell_input_line)
+		shell_input_line[0] = '\0';
+	shell_input_line_index = 0;
+	shell_input_line_terminator = 0;
+	eol_ungetc_lookahead = 0;
+	current_token = last_read_token = 0;
+	token_before_that = two_tokens_ago = 0;
+	parser_state = 0;
+	open_brace_count = esacs_needed_count = 0;
+}
+
 static int
 shell_getc(int remove_quoted_newline)
 {
@@ -1942,6 +2505,9 @@ shell_getc(int remove_quoted_newline)
 	int c;
 	unsigned char uc;
 
+	if (input_interrupted)
+		return EOF;
+
 	if (eol_ungetc_lookahead) {
 		c = eol_ungetc_lookahead;
 		eol_ungetc_lookahead = 0;
@@ -1970,15 +2536,26 @@ restart_read:
 		 * notifies or cleanup the jobs -- we want to defer it until we do
 		 * print the next prompt. */
 		if (interactive_shell == 0 || SHOULD_PROMPT()) {
-#ifdef JOB_CONTROL
-			notify_and_cleanup();
-#else  /* !JOB_CONTROL */
-			cleanup_dead_jobs();
-#endif /* !JOB_CONTROL */
+			if (job_control)
+				notify_and_cleanup();
+			else
+				cleanup_dead_jobs();
 		}
 
 		print_prompt();
 
+		/* Jobs that finish and <CTRL + C> are handled while the user has
+		 * yet to type the line (see event.c). <CTRL + C> drops the lines
+		 * read of an unfinished command as well: the parse ends there,
+		 * and parse() resets the parser. */
+		if (interactive && event_wait_input(print_prompt) == 1) {
+			input_interrupted = 1;
+			return EOF;
+		}
+
+		/* Any other line this parse reads continues the command */
+		prompt_continued = 1;
+
 		while (1) {
 			c = fgetc(yyin);
 
@@ -2153,7 +2730,9 @@ static int word_top = -1;
 static int
 read_token_word(int character)
 {
+#ifndef NDEBUG_PARSER
 	err_msg("DEBUG: Begin read_token_word()");
+#endif
 
 	/* The value for YYLVAL when a WORD is read. */
 	struct word_desc_t *the_word;
@@ -2413,12 +2992,10 @@ read_token_word(int character)
 
 		/* When not parsing a multi-character word construct, shell meta-
 		 * characters break words. */
-		/* TODO: FIX THIS ISSUE by adding this functionality.
 		if (shellbreak(character)) {
 			shell_ungetc(character);
 			goto got_token;
 		}
-		*/
 
 got_character:
 
@@ -2456,10 +3033,10 @@ got_token:
 	 * Otherwise, it is just a word, and should be returned as such. */
 	if (all_digit_token && (character == '<' || character == '>' ||
 	    last_read_token == LESS_AND || last_read_token == GREATER_AND)) {
-		if (legal_number(token, &lvalue) && (int)lvalue == lvalue)
+		if (legal_number(token, &lvalue) && (int)lvalue == lvalue) {
 			yylval.number = lvalue;
-		else
-			yylval.number = -1;
+			return NUMBER;
+		}
 	}
 
 	/* Check for special case tokens. */
@@ -2467,6 +3044,9 @@ got_token:
 	if (result >= 0)
 		return result;
 
+	if (!quoted && (result = reserved_word(token)) >= 0)
+		return result;
+
 #if defined (ALIAS)
 	/* Posix.2 does not allow reserved words to be aliased, so check for
 	 * all of them, including special cases, before expanding the current
@@ -2536,15 +3116,45 @@ got_token:
 			break;
 	}
 
+#ifndef NDEBUG_PARSER
 	err_msg("DEBUG: End read_token_word()");
+#endif
 
 	return result;
 }
 
+/*
+ * Returns the token the grammar knows the single meta-character 'c' by.
+ */
+static int
+meta_token(int c)
+{
+	switch (c) {
+		case ';':
+			return SEMICOLON;
+		case '&':
+			return AMPERSAND;
+		case '|':
+			return PIPE;
+		case '<':
+			return LESSER;
+		case '>':
+			return GREATER;
+		case '(':
+			return LEFT_PARENTH;
+		case ')':
+			return RIGHT_PARENTH;
+		default:
+			return c;
+	}
+}
+
 static int
 read_token(int type)
 {
+#ifndef NDEBUG_PARSER
 	err_msg("DEBUG: Begin read_token()");
+#endif
 	int character;  /* Current character. */
 	int peek_char;  /* Look-ahead character. */
 	int result;
@@ -2574,6 +3184,8 @@ re_read_token:  /* Used to re_read an expanded alias expression. */
 		;
 
 	if (character == EOF) {
+		if (EOF_Reached || input_interrupted)
+			return 0;  /* The end of the input, after yacc_EOF */
 		EOF_Reached = 1;
 		return yacc_EOF;
 	}
@@ -2591,12 +3203,14 @@ re_read_token:  /* Used to re_read an expanded alias expression. */
 		 * collect the text of any pending here document. */
 		if (need_here_doc)
 			gather_here_documents();
+		if (input_interrupted)
+			return 0;  /* The command is dropped, here-documents and all */
 
 #if defined (ALIAS)
 			parser_state &= ~PST_ALEXPNEXT;
 #endif
 
-			return character;
+			return NEWLINE;
 	}
 
 	/* Shell meta-characters. */
@@ -2654,7 +3268,7 @@ re_read_token:  /* Used to re_read an expanded alias expression. */
 		/* If we look like we are reading the start of a function
 		 * definition, then let the reader know about it so that we will do
 		 * the right thing with `{'. */
-		if (character == ')' && last_read_token == '(' &&
+		if (character == ')' && last_read_token == LEFT_PARENTH &&
 		    token_before_that == WORD) {
 			parser_state |= PST_ALLOWOPNBRC;
 #if defined (ALIAS)
@@ -2667,13 +3281,13 @@ re_read_token:  /* Used to re_read an expanded alias expression. */
 
 		/* Check for the constructs which introduce process substitution. */
 		if ((character != '>' && character != '<') || peek_char != '(')
-			return character;
+			return meta_token(character);
 	} /* End Shell meta-characters. */
 
 	/* Hack <&- (close stdin) case.  Also <&N- (dup and close). */
 	if (character == '-' && (last_read_token == LESS_AND ||
 	    last_read_token == GREATER_AND))
-		return character;
+		return MINUS;
 
 	/* Okay, if we got this far, we have to read a word.  Read one, and
 	 * then check it against the known ones. */
@@ -2683,7 +3297,9 @@ re_read_token:  /* Used to re_read an expanded alias expression. */
 		goto re_read_token;
 #endif
 
+#ifndef NDEBUG_PARSER
 	err_msg("DEBUG: End read_token()");
+#endif
 
 	return result;
 }
@@ -2691,6 +3307,8 @@ re_read_token:  /* Used to re_read an expanded alias expression. */
 void
 yyerror(char *s)
 {
+	if (input_interrupted)
+		return;
 	//err_msg("yyerror: %s at line #%d:\n  '%s'", s, line_number, yytext);
 	err_msg("yyerror: %s at line #%d", s, line_number);
 }
@@ -2698,9 +3316,6 @@ yyerror(char *s)
 int
 yylex(void)
 {
-	if (interactive && (current_token == 0 || current_token == '\n'))
-		prompt_again();
-
 	two_tokens_ago = token_before_that;
 	token_before_that = last_read_token;
 	last_read_token = current_token;
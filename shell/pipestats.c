@@ -0,0 +1,290 @@
+/***********************************************************************
+ * File: pipestats.c
+ * Description: Per-stage statistics of pipelines, turned on with
+ *   `set -o pipestats=MS' (or $TANSH_PIPESTATS). While the shell waits
+ *   for such a pipeline, it samples every MS milliseconds:
+ *     - the bytes each stage has read and written (/proc/<pid>/io),
+ *     - the CPU time of each stage (/proc/<pid>/stat),
+ *     - how full each pipe is (FIONREAD on a read end the shell keeps).
+ *   A stage that is asleep while its output pipe is full counts the
+ *   time since the last sample as blocked on output; one asleep on an
+ *   empty input pipe, as blocked on input. The blocked times are thus
+ *   estimates, as good as the sampling interval.
+ *
+ *   The counters of a stage are read one last time when it exits,
+ *   before the job table reaps it, so short stages are accounted for
+ *   in full. The report is printed when a foreground pipeline ends,
+ *   when a background one is reported done, and by the `pipestats'
+ *   builtin at any time.
+ **********************************************************************/
+
+#ifndef PIPESTATS_C
+#define PIPESTATS_C
+
+#define _GNU_SOURCE  /* F_GETPIPE_SZ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include "pipestats.h"
+#include "job.h"
+#include "option.h"
+#include "list.h"
+#include "error.h"
+
+/* A pipe counts as full when less than a page is free: a writer blocks
+ * as soon as no page of the pipe is left for it. */
+#define PIPESTATS_SLACK  4096
+
+int pipestats_active = 0;
+
+/***********************************************************************
+ * Starts keeping the statistics of a pipeline that has just been
+ * started.
+ *
+ * Parameters:
+ *   cmd: The first stage of the pipeline.
+ *   n: The number of stages.
+ *   pids: The pids of the stages, as set by launch_pipeline().
+ *   readers: The read ends of the n - 1 pipes, kept open by
+ *     launch_pipeline_readers(). They belong to the statistics from now
+ *     on, and are closed even on error.
+ *
+ * Return value:
+ *   Returns the statistics, or NULL on error.
+ **********************************************************************/
+struct pipestats_t *pipestats_create(struct expr_t *cmd, int n, pid_t *pids,
+		int *readers)
+{
+	int i;
+	struct pipestats_t *stats;
+
+	if ((stats = calloc(1, sizeof(struct pipestats_t))) == NULL ||
+	    (stats->stages = calloc(n, sizeof(struct pipestats_stage_t))) == NULL ||
+	    (stats->pipes = calloc(n, sizeof(struct pipestats_pipe_t))) == NULL) {
+		err_malloc(errno);
+		if (stats)
+			free(stats->stages);
+		free(stats);
+		for (i = 0; i < n - 1; i++)
+			close(readers[i]);
+		return NULL;
+	}
+
+	stats->nstages = n;
+	stats->interval = option_value(option_lookup("pipestats"));
+	clock_gettime(CLOCK_MONOTONIC, &stats->last);
+
+	for (i = 0; i < n; i++, cmd = cmd->next) {
+		stats->stages[i].name = strdup(list_size(cmd->exec) ?
+				(char *)list_peek(cmd->exec) : "");
+		if (i == n - 1)
+			break;
+
+		/* Only a stage that is a process tells when it has exited; the
+		 * shell must not hold the pipe of any other reader open. */
+		stats->pipes[i].fd = readers[i];
+		if (pids[i + 1] <= 0) {
+			close(readers[i]);
+			stats->pipes[i].fd = -1;
+		} else {
+			stats->pipes[i].capacity = fcntl(readers[i], F_GETPIPE_SZ);
+		}
+	}
+
+	pipestats_active++;
+	return stats;
+}
+
+/*
+ * Closes the pipes still held by 'stats' and releases it.
+ */
+void pipestats_destroy(struct pipestats_t *stats)
+{
+	int i;
+
+	if (!stats)
+		return;
+
+	for (i = 0; i < stats->nstages; i++) {
+		if (i < stats->nstages - 1 && stats->pipes[i].fd != -1)
+			close(stats->pipes[i].fd);
+		free(stats->stages[i].name);
+	}
+	free(stats->stages);
+	free(stats->pipes);
+	free(stats);
+	pipestats_active--;
+}
+
+/*
+ * Reads the I/O counters and CPU time of the process 'pid' into 'stage'.
+ * Returns the state letter of the process (`R', `S', `Z', ...), or 0 if
+ * it could not be read.
+ */
+static int pipestats_read(struct pipestats_stage_t *stage, pid_t pid)
+{
+	char path[64], line[512], *p;
+	char state = 0;
+	unsigned long long value, utime, stime;
+	FILE *file;
+
+	snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+	if ((file = fopen(path, "r")) != NULL) {
+		while (fgets(line, sizeof(line), file)) {
+			if (sscanf(line, "rchar: %llu", &value) == 1)
+				stage->rchar = value;
+			else if (sscanf(line, "wchar: %llu", &value) == 1)
+				stage->wchar = value;
+		}
+		fclose(file);
+		stage->sampled = 1;
+	}
+
+	/* The command name may hold spaces and parentheses; the fields
+	 * that matter follow the last `)'. */
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	if ((file = fopen(path, "r")) != NULL) {
+		if (fgets(line, sizeof(line), file) && (p = strrchr(line, ')')) &&
+		    sscanf(p + 1, " %c %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s "
+				"%llu %llu", &state, &utime, &stime) == 3)
+			stage->cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+		fclose(file);
+	}
+
+	return state;
+}
+
+/***********************************************************************
+ * Takes a sample of the running pipeline 'job': the counters of every
+ * stage that is a process, the fill level of every pipe still open,
+ * and whether each stage is blocked on one of its pipes.
+ **********************************************************************/
+void pipestats_sample(struct job_t *job)
+{
+	int i, n, state;
+	double elapsed;
+	struct timespec now;
+	struct pipestats_t *stats = job->stats;
+	struct pipestats_pipe_t *pipe;
+
+	if (!stats)
+		return;
+	n = stats->nstages;
+	int fill[n];
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - stats->last.tv_sec) +
+			(now.tv_nsec - stats->last.tv_nsec) / 1e9;
+	stats->last = now;
+	stats->samples++;
+
+	for (i = 0; i < n - 1; i++) {
+		pipe = &stats->pipes[i];
+		fill[i] = -1;
+		if (pipe->fd == -1 || ioctl(pipe->fd, FIONREAD, &fill[i]) == -1)
+			continue;
+		if (fill[i] > pipe->max_fill)
+			pipe->max_fill = fill[i];
+		pipe->total_fill += fill[i];
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!job->procs[i].running || job->procs[i].pid <= 0)
+			continue;
+		state = pipestats_read(&stats->stages[i], job->procs[i].pid);
+		if (state != 'S')
+			continue;
+
+		if (i < n - 1 && fill[i] != -1 &&
+		    fill[i] >= stats->pipes[i].capacity - PIPESTATS_SLACK)
+			stats->stages[i].blocked_out += elapsed;
+		else if (i > 0 && fill[i - 1] == 0)
+			stats->stages[i].blocked_in += elapsed;
+	}
+}
+
+/***********************************************************************
+ * Reads the final counters of the stage 'stage' of 'job', which has
+ * exited but not been reaped yet, and closes the shell's read end of
+ * its input pipe, so the stage writing to it sees EPIPE as it would if
+ * the shell did not keep statistics.
+ **********************************************************************/
+void pipestats_exit(struct job_t *job, int stage)
+{
+	struct pipestats_t *stats = job->stats;
+
+	if (!stats || stage < 0 || stage >= stats->nstages)
+		return;
+
+	if (job->procs[stage].pid > 0)
+		pipestats_read(&stats->stages[stage], job->procs[stage].pid);
+
+	if (stage > 0 && stats->pipes[stage - 1].fd != -1) {
+		close(stats->pipes[stage - 1].fd);
+		stats->pipes[stage - 1].fd = -1;
+	}
+}
+
+/***********************************************************************
+ * Prints the statistics of 'job' to 'out': a line for every stage with
+ * the bytes it read and wrote, its CPU time and the time it spent
+ * blocked on its pipes, then a line for every pipe with its capacity
+ * and fill levels. The CPU time of a stage that has terminated is the
+ * exact one from its resource usage.
+ **********************************************************************/
+void pipestats_report(FILE *out, struct job_t *job)
+{
+	int i;
+	double cpu;
+	struct pipestats_t *stats = job->stats;
+	struct pipestats_stage_t *stage;
+	struct pipestats_pipe_t *pipe;
+	struct proc_t *proc;
+
+	if (!stats)
+		return;
+
+	fprintf(out, "[%d] %s: %ld samples every %ld ms\n", job->id, job->text,
+			stats->samples, stats->interval);
+	fprintf(out, "%-5s %-7s %14s %14s %8s %10s %11s  %s\n", "stage", "pid",
+			"bytes in", "bytes out", "cpu", "blocked in", "blocked out",
+			"command");
+
+	for (i = 0; i < stats->nstages; i++) {
+		stage = &stats->stages[i];
+		proc = &job->procs[i];
+
+		fprintf(out, "%-5d %-7d ", i + 1, (int)proc->pid);
+		if (stage->sampled)
+			fprintf(out, "%14llu %14llu ", stage->rchar, stage->wchar);
+		else
+			fprintf(out, "%14s %14s ", "-", "-");
+
+		cpu = stage->cpu;
+		if (!proc->running)
+			cpu = proc->usage.ru_utime.tv_sec + proc->usage.ru_stime.tv_sec +
+					(proc->usage.ru_utime.tv_usec +
+					 proc->usage.ru_stime.tv_usec) / 1e6;
+		fprintf(out, "%8.3f %10.3f %11.3f  %s\n", cpu, stage->blocked_in,
+				stage->blocked_out, stage->name ? stage->name : "");
+	}
+
+	for (i = 0; i < stats->nstages - 1; i++) {
+		pipe = &stats->pipes[i];
+		if (pipe->capacity <= 0)
+			continue;  /* Read by a builtin; never measured */
+		fprintf(out, "pipe %d|%d: capacity %ld, max fill %ld, mean fill %.0f\n",
+				i + 1, i + 2, pipe->capacity, pipe->max_fill,
+				stats->samples ? pipe->total_fill / stats->samples : 0.0);
+	}
+
+	fflush(out);
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef PIPESTATS_H
+#define PIPESTATS_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include "cmd.h"
+
+struct job_t;
+
+/* What is known about a stage of a pipeline whose statistics are kept. */
+struct pipestats_stage_t {
+	char *name;                /* The command of the stage */
+	int sampled;               /* Non-zero once /proc has been read */
+	unsigned long long rchar;  /* Bytes read, from /proc/<pid>/io */
+	unsigned long long wchar;  /* Bytes written */
+	double cpu;                /* CPU seconds, from /proc/<pid>/stat */
+	double blocked_in;         /* Seconds asleep on an empty input pipe */
+	double blocked_out;        /* Seconds asleep on a full output pipe */
+};
+
+/* A pipe between two stages. The shell keeps its read end open, only
+ * to measure how full the pipe is, until the reading stage exits. */
+struct pipestats_pipe_t {
+	int fd;              /* The read end, or -1 once closed */
+	long capacity;       /* F_GETPIPE_SZ */
+	long max_fill;       /* Most bytes seen waiting in the pipe */
+	double total_fill;   /* Sum of the fill levels of all samples */
+};
+
+/* The statistics of a pipeline, kept with its job. */
+struct pipestats_t {
+	int nstages;
+	long interval;       /* Milliseconds between samples */
+	long samples;
+	struct timespec last;  /* When the last sample was taken */
+	struct pipestats_stage_t *stages;
+	struct pipestats_pipe_t *pipes;  /* nstages - 1 of them */
+};
+
+/* The number of pipelines whose statistics are kept; while it is not 0
+ * the job table lets a stage be read from /proc before reaping it. */
+extern int pipestats_active;
+
+struct pipestats_t *pipestats_create(struct expr_t *cmd, int n, pid_t *pids,
+                                     int *readers);
+void                pipestats_destroy(struct pipestats_t *stats);
+void                pipestats_sample(struct job_t *job);
+void                pipestats_exit(struct job_t *job, int stage);
+void                pipestats_report(FILE *out, struct job_t *job);
+
+#endif
@@ -0,0 +1,277 @@
+/***********************************************************************
+ * File: pmap.c
+ * Description: The `pmap' builtin, a parallel xargs(1) within the
+ *   shell. Argument records are read from the input of the builtin and
+ *   handed to a command in batches, with up to N batches running at
+ *   once. The batches are started with launch_pipeline(), like any other
+ *   command, so they use the command hash table and may be builtins,
+ *   and each batch is a job in the job table.
+ *
+ *   A batch that has been exec'd cannot give records back, so the load
+ *   is balanced when the batches are cut instead: each batch takes a
+ *   share of the records that are left (guided self-scheduling). The
+ *   first batches are large, and they shrink toward the end, so a
+ *   worker that finishes early picks up the small batches that busy
+ *   workers would otherwise have run after their current one.
+ **********************************************************************/
+
+#ifndef PMAP_C
+#define PMAP_C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "pmap.h"
+#include "builtin.h"
+#include "launch.h"
+#include "job.h"
+#include "cmd.h"
+#include "list.h"
+#include "error.h"
+
+extern char **environ;
+
+/* Room left in the argument space for what the kernel and the dynamic
+ * loader add, as POSIX suggests for xargs(1). */
+#define PMAP_ARG_HEADROOM  2048
+
+/* The records read from the input. */
+struct pmap_input_t {
+	char **records;
+	int nrecords;
+	int size;  /* Allocated slots */
+};
+
+/*
+ * Reads the records from 'in', separated by 'delim'. Empty records are
+ * skipped. Returns 0 on success or -1 on error.
+ */
+static int pmap_read(FILE *in, int delim, struct pmap_input_t *input)
+{
+	char *line = NULL, **records;
+	size_t cap = 0;
+	ssize_t len;
+
+	while ((len = getdelim(&line, &cap, delim, in)) != -1) {
+		if (len > 0 && line[len - 1] == delim)
+			line[--len] = '\0';
+		if (len == 0)
+			continue;
+
+		if (input->nrecords == input->size) {
+			input->size = input->size ? input->size * 2 : 256;
+			if ((records = realloc(input->records,
+					input->size * sizeof(char *))) == NULL) {
+				err_malloc(errno);
+				free(line);
+				return -1;
+			}
+			input->records = records;
+		}
+		if ((input->records[input->nrecords] = strdup(line)) == NULL) {
+			err_malloc(errno);
+			free(line);
+			return -1;
+		}
+		input->nrecords++;
+	}
+
+	free(line);
+	return 0;
+}
+
+/*
+ * Releases the records read into 'input'.
+ */
+static void pmap_free(struct pmap_input_t *input)
+{
+	int i;
+
+	for (i = 0; i < input->nrecords; i++)
+		free(input->records[i]);
+	free(input->records);
+}
+
+/***********************************************************************
+ * Returns the number of bytes available for the arguments of a command,
+ * which is ARG_MAX less the space taken by the environment and a margin.
+ * Each argument takes its length plus a terminator and a pointer.
+ **********************************************************************/
+long pmap_arg_space(void)
+{
+	long space = sysconf(_SC_ARG_MAX);
+	char **env;
+
+	if (space <= 0)
+		space = 128 * 1024;  /* The POSIX minimum is far smaller */
+	for (env = environ; env && *env; env++)
+		space -= strlen(*env) + 1 + sizeof(char *);
+
+	return space - PMAP_ARG_HEADROOM;
+}
+
+/*
+ * Returns the number of records, starting at 'next', that go into the
+ * next batch: a share of the records left so that every worker gets
+ * about two more batches, but no more than 'max_args' records or fit in
+ * 'space' bytes alongside the 'base' bytes of the command itself.
+ */
+static int pmap_batch(struct pmap_input_t *input, int next, int njobs,
+		int max_args, long space, long base)
+{
+	int n, left = input->nrecords - next;
+	long bytes = base;
+
+	n = (left + 2 * njobs - 1) / (2 * njobs);
+	if (max_args > 0 && n > max_args)
+		n = max_args;
+
+	for (left = 0; left < n; left++) {
+		bytes += strlen(input->records[next + left]) + 1 + sizeof(char *);
+		if (bytes > space)
+			break;
+	}
+
+	return left > 0 ? left : 1;  /* An oversized record still gets a try */
+}
+
+/*
+ * Starts the command 'argv' with the 'n' records from 'records' appended,
+ * and adds it to the job table. Returns the job, or NULL on error.
+ */
+static struct job_t *pmap_start(char **argv, int argc, char **records,
+		int n)
+{
+	int i;
+	pid_t pid;
+	struct expr_t *cmd;
+	struct job_t *job = NULL;
+
+	if ((cmd = cmd_create()) == NULL)
+		return NULL;
+	cmd_set_type(cmd, CMD_SIMPLE);
+	for (i = 0; i < argc; i++)
+		list_push(cmd->exec, strdup(argv[i]));
+	for (i = 0; i < n; i++)
+		list_push(cmd->exec, strdup(records[i]));
+
+	fflush(stdout);
+	if (launch_pipeline(cmd, &pid, NULL) == 1) {
+		job = job_create(&pid, NULL, 1, 0, cmd_to_string(cmd, 1));
+		if (!job && pid > 0)
+			kill(pid, SIGTERM);
+	}
+
+	cmd_destroy(cmd);
+	return job;
+}
+
+/*
+ * pmap [-j N] [-n max] [-0] command [arg ...]
+ *
+ * Reads argument records from the input, one per line (or separated by
+ * NUL characters with -0), and runs the command with as many records
+ * appended as fit in ARG_MAX (or at most 'max' with -n), with up to N
+ * commands running at once (default: one per online processor).
+ *
+ * The exit status is 0 if every command succeeded, 123 if any exited
+ * with a non-zero status, 125 if any was killed by a signal, and 127 if
+ * the command could not be run.
+ */
+int builtin_pmap(int argc, char **argv, FILE *in, FILE *out)
+{
+	int c, i, n, next = 0, active = 0, ret = 0, status, code;
+	int njobs = 0, max_args = 0, delim = '\n';
+	long space, base = 0;
+	struct pmap_input_t input = { NULL, 0, 0 };
+	struct builtin_getopt_t opt = BUILTIN_GETOPT_INIT;
+
+	while ((c = builtin_getopt(&opt, argc, argv, "j:n:0")) != -1) {
+		switch (c) {
+			case 'j':
+				njobs = atoi(opt.arg);
+				break;
+			case 'n':
+				max_args = atoi(opt.arg);
+				break;
+			case '0':
+				delim = '\0';
+				break;
+			default:
+				err_msg("usage: pmap [-j N] [-n max] [-0] command [arg ...]");
+				return 2;
+		}
+	}
+	if (opt.ind == argc) {
+		err_msg("usage: pmap [-j N] [-n max] [-0] command [arg ...]");
+		return 2;
+	}
+	if (njobs <= 0 && (njobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		njobs = 1;
+
+	argv += opt.ind;
+	argc -= opt.ind;
+	for (i = 0; i < argc; i++)
+		base += strlen(argv[i]) + 1 + sizeof(char *);
+	space = pmap_arg_space();
+
+	if (pmap_read(in, delim, &input) == -1) {
+		pmap_free(&input);
+		return 1;
+	}
+
+	struct job_t *jobs[njobs];
+	for (i = 0; i < njobs; i++)
+		jobs[i] = NULL;
+
+	while (next < input.nrecords || active > 0) {
+		for (i = 0; i < njobs && next < input.nrecords; i++) {
+			if (jobs[i])
+				continue;
+			n = pmap_batch(&input, next, njobs, max_args, space, base);
+			if ((jobs[i] = pmap_start(argv, argc, input.records + next,
+					n)) == NULL) {
+				ret = 127;
+				next = input.nrecords;  /* Stop starting new batches */
+				break;
+			}
+			next += n;
+			active++;
+		}
+		if (active == 0)
+			break;
+
+		if ((i = job_wait_slots(jobs, njobs)) == -1)
+			break;  /* No children left; nothing more to collect */
+
+		status = jobs[i]->procs[0].status;
+		job_wait(jobs[i]);
+		jobs[i] = NULL;
+		active--;
+
+		if (WIFSIGNALED(status))
+			code = 125;
+		else if (WEXITSTATUS(status) == 127)
+			code = 127;
+		else
+			code = WEXITSTATUS(status) ? 123 : 0;
+		if (code > ret)
+			ret = code;
+		if (code == 127)
+			next = input.nrecords;  /* No point in trying again */
+	}
+
+	for (i = 0; i < njobs; i++)
+		if (jobs[i])
+			job_destroy(jobs[i]);
+
+	pmap_free(&input);
+	return ret;
+}
+
+#endif
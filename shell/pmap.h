@@ -0,0 +1,9 @@
+#ifndef PMAP_H
+#define PMAP_H
+
+#include <stdio.h>
+
+long pmap_arg_space(void);
+int  builtin_pmap(int argc, char **argv, FILE *in, FILE *out);
+
+#endif
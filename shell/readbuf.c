@@ -0,0 +1,487 @@
+/***********************************************************************
+ * File: readbuf.c
+ * Description: The `read' and `mapfile' (or `readarray') builtins.
+ *   A record is read in blocks of READBUF_SIZE bytes, and its delimiter
+ *   found with memchr(3), whenever reading past it is harmless:
+ *
+ *   - From a regular file, the shell seeks back over the bytes read
+ *     past the record, so the next command reading the file starts
+ *     right after it.
+ *   - From a stream socket, such as the output of a coprocess read with
+ *     `read -u 60', a block is peeked at with MSG_PEEK and only the
+ *     record is then taken from the socket. The rest stays there for
+ *     whichever reads the descriptor next, the shell or a command it
+ *     was handed to with `<&60'.
+ *   - When `mapfile' loads the whole input, there is nothing left to
+ *     read anyway.
+ *
+ *   Anything else, a pipe in particular, is read one byte at a time, as
+ *   a shell has to: bytes read past the record could not be given back
+ *   to a command the descriptor is later handed to.
+ *
+ *   The shell has no variables of its own: `read' sets environment
+ *   variables, which the commands it starts see, and `mapfile NAME'
+ *   sets NAME_0, NAME_1, ... and the number of records in NAME_COUNT.
+ *   As the environment is passed to every command, a load of more than
+ *   about a megabyte makes later commands fail to exec (E2BIG).
+ **********************************************************************/
+
+#ifndef READBUF_C
+#define READBUF_C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include "readbuf.h"
+#include "builtin.h"
+#include "error.h"
+
+#define READ_USAGE     "usage: read [-r] [-d delim] [-u fd] [name ...]"
+#define MAPFILE_USAGE  "usage: mapfile [-t] [-d delim] [-n count] " \
+                       "[-s skip] [-u fd] [name]"
+
+/* How the bytes read past a record are dealt with */
+#define READBUF_BYTE  0  /* None are: the input is read byte by byte */
+#define READBUF_SEEK  1  /* The shell seeks back over them */
+#define READBUF_PEEK  2  /* They are only peeked at, and left unread */
+#define READBUF_ALL   3  /* The whole input is read */
+
+/* The input of a `read' or `mapfile' */
+struct readbuf_t {
+	int fd;
+	int mode;
+	char *data;   /* Bytes read but not used yet, from 'start' to 'end' */
+	size_t start;
+	size_t end;
+};
+
+/* A record being read, with its delimiter */
+struct readbuf_record_t {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+/*
+ * Returns non-zero if 'fd' is a stream socket, whose bytes may be
+ * peeked at.
+ */
+static int readbuf_stream(int fd)
+{
+	int type;
+	socklen_t len = sizeof(type);
+
+	return getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 &&
+	       type == SOCK_STREAM;
+}
+
+/*
+ * Prepares to read records from 'fd' (see the file header); 'all' is
+ * non-zero if the input is to be read to its end. Returns 'tmp', set up
+ * to read with, or NULL on error.
+ */
+static struct readbuf_t *readbuf_open(int fd, int all, struct readbuf_t *tmp)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) == -1) {
+		err_msg("tansh: %d: %s", fd, strerror(errno));
+		return NULL;
+	}
+
+	memset(tmp, 0, sizeof(struct readbuf_t));
+	tmp->fd = fd;
+	if (all)
+		tmp->mode = READBUF_ALL;
+	else if (S_ISREG(st.st_mode))
+		tmp->mode = READBUF_SEEK;
+	else if (S_ISSOCK(st.st_mode) && readbuf_stream(fd))
+		tmp->mode = READBUF_PEEK;
+	else
+		tmp->mode = READBUF_BYTE;
+
+	if ((tmp->data = malloc(tmp->mode == READBUF_BYTE ? 1 : READBUF_SIZE))
+			== NULL) {
+		err_malloc(errno);
+		return NULL;
+	}
+	return tmp;
+}
+
+/*
+ * Ends reading from 'buf': the shell seeks back over the bytes read
+ * past the last record of a regular file.
+ */
+static void readbuf_close(struct readbuf_t *buf)
+{
+	if (buf->mode == READBUF_SEEK && buf->end > buf->start)
+		lseek(buf->fd, -(off_t)(buf->end - buf->start), SEEK_CUR);
+	free(buf->data);
+}
+
+/*
+ * Appends 'len' bytes at 'data' to 'rec'. Returns 0, or -1 on error.
+ */
+static int readbuf_append(struct readbuf_record_t *rec, char *data, size_t len)
+{
+	char *grown;
+
+	if (rec->len + len + 1 > rec->size) {
+		rec->size = (rec->len + len + 1) * 2;
+		if ((grown = realloc(rec->data, rec->size)) == NULL) {
+			err_malloc(errno);
+			return -1;
+		}
+		rec->data = grown;
+	}
+
+	memcpy(rec->data + rec->len, data, len);
+	rec->len += len;
+	rec->data[rec->len] = '\0';
+	return 0;
+}
+
+/*
+ * Reads from the stream socket of 'buf' up to and with the delimiter
+ * 'delim', or a block if it does not come within one, leaving the bytes
+ * after it in the socket. Returns the number of bytes read, 0 at the
+ * end of the input, or -1 on error.
+ */
+static ssize_t readbuf_peek(struct readbuf_t *buf, int delim)
+{
+	char *found;
+	ssize_t n;
+
+	if ((n = recv(buf->fd, buf->data, READBUF_SIZE, MSG_PEEK)) <= 0)
+		return n;
+	if ((found = memchr(buf->data, delim, n)) != NULL)
+		n = found - buf->data + 1;
+
+	return read(buf->fd, buf->data, n);
+}
+
+/*
+ * Appends the next record of 'buf', up to and with the delimiter
+ * 'delim', to 'rec'. Returns 1 if the delimiter was found, 0 at the end
+ * of the input, or -1 on error.
+ */
+static int readbuf_record(struct readbuf_t *buf, int delim,
+		struct readbuf_record_t *rec)
+{
+	char *found;
+	ssize_t n;
+	size_t len;
+
+	for (;;) {
+		if (buf->start < buf->end) {
+			found = memchr(buf->data + buf->start, delim, buf->end - buf->start);
+			len = found ? (size_t)(found - buf->data) + 1 - buf->start
+			            : buf->end - buf->start;
+			if (readbuf_append(rec, buf->data + buf->start, len) == -1)
+				return -1;
+			buf->start += len;
+			if (found)
+				return 1;
+		}
+
+		buf->start = buf->end = 0;
+		if (buf->mode == READBUF_PEEK)
+			n = readbuf_peek(buf, delim);
+		else
+			n = read(buf->fd, buf->data,
+			         buf->mode == READBUF_BYTE ? 1 : READBUF_SIZE);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1) {
+			err_msg("tansh: read: %s", strerror(errno));
+			return -1;
+		}
+		if (n == 0)
+			return 0;
+		buf->end = n;
+	}
+}
+
+/*
+ * Returns non-zero if 'name' may be the name of a variable.
+ */
+static int readbuf_name(const char *name)
+{
+	if (!isalpha((unsigned char)*name) && *name != '_')
+		return 0;
+	for (name++; *name; name++)
+		if (!isalnum((unsigned char)*name) && *name != '_')
+			return 0;
+	return 1;
+}
+
+/*
+ * Parses the delimiter argument of -d: its first character, or NUL if
+ * it is empty.
+ */
+static int readbuf_delim(const char *arg)
+{
+	return (unsigned char)arg[0];
+}
+
+/*
+ * Removes the backslashes of the record 'rec', each of which quotes the
+ * character that follows it.
+ */
+static void readbuf_unescape(struct readbuf_record_t *rec)
+{
+	size_t i, j;
+
+	for (i = 0, j = 0; i < rec->len; i++, j++) {
+		if (rec->data[i] == '\\' && i + 1 < rec->len)
+			i++;
+		rec->data[j] = rec->data[i];
+	}
+	rec->len = j;
+	rec->data[j] = '\0';
+}
+
+/*
+ * Returns non-zero if the record 'rec' ends in a backslash that quotes
+ * its newline delimiter, i.e. continues on the next line.
+ */
+static int readbuf_continued(struct readbuf_record_t *rec)
+{
+	size_t n = 0;
+
+	if (rec->len == 0 || rec->data[rec->len - 1] != '\n')
+		return 0;
+	while (n + 1 < rec->len && rec->data[rec->len - 2 - n] == '\\')
+		n++;
+	return n % 2;
+}
+
+/*
+ * Splits the record 'line' on the characters of 'ifs' and sets the
+ * variables 'names' (a NULL terminated list) to the fields; the last
+ * one gets the rest of the line. Runs of blanks in 'ifs' count as one
+ * separator, and are trimmed at both ends. Returns 0, or -1 on error.
+ */
+static int readbuf_split(char *line, const char *ifs, char **names)
+{
+	char *p = line, *end;
+
+#define IS_IFS(c)    ((c) && strchr(ifs, (c)))
+#define IS_BLANK(c)  (IS_IFS(c) && isspace((unsigned char)(c)))
+
+	while (IS_BLANK(*p))
+		p++;
+
+	for (; names[1]; names++) {
+		end = p;
+		while (*end && !IS_IFS(*end))
+			end++;
+		if (*end) {
+			*end++ = '\0';
+			while (IS_BLANK(*end))
+				end++;
+			if (IS_IFS(*end) && !IS_BLANK(*end))
+				for (end++; IS_BLANK(*end); end++)
+					;
+		}
+		if (setenv(*names, p, 1) == -1) {
+			err_msg("tansh: read: %s: %s", *names, strerror(errno));
+			return -1;
+		}
+		p = end;
+	}
+
+	end = p + strlen(p);
+	while (end > p && IS_BLANK(end[-1]))
+		*--end = '\0';
+
+#undef IS_IFS
+#undef IS_BLANK
+
+	if (setenv(*names, p, 1) == -1) {
+		err_msg("tansh: read: %s: %s", *names, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * read [-r] [-d delim] [-u fd] [name ...]
+ *
+ * Reads a line (or a record ending in delim) from the standard input,
+ * or from fd, splits it on the characters of $IFS and sets the
+ * variables (REPLY by default) to its fields, the last one getting the
+ * rest of the line. Unless -r is given, a backslash quotes the next
+ * character, and one at the end of a line continues it on the next.
+ *
+ * The exit status is 0 if a whole record was read, 1 at the end of the
+ * input or on error, and 2 on a usage error.
+ */
+int builtin_read(int argc, char **argv, FILE *in, FILE *out)
+{
+	int c, i, fd = fileno(in), delim = '\n', raw = 0, ret;
+	char *ifs, *reply[] = { "REPLY", NULL };
+	struct readbuf_t tmp, *buf;
+	struct readbuf_record_t rec = { NULL, 0, 0 };
+	struct builtin_getopt_t opt = BUILTIN_GETOPT_INIT;
+
+	while ((c = builtin_getopt(&opt, argc, argv, "rd:u:")) != -1) {
+		switch (c) {
+			case 'r':
+				raw = 1;
+				break;
+			case 'd':
+				delim = readbuf_delim(opt.arg);
+				break;
+			case 'u':
+				fd = atoi(opt.arg);
+				break;
+			default:
+				err_msg(READ_USAGE);
+				return 2;
+		}
+	}
+	for (i = opt.ind; i < argc; i++) {
+		if (!readbuf_name(argv[i])) {
+			err_msg("tansh: read: `%s': not a valid name", argv[i]);
+			return 2;
+		}
+	}
+
+	if ((buf = readbuf_open(fd, 0, &tmp)) == NULL)
+		return 1;
+	while ((ret = readbuf_record(buf, delim, &rec)) == 1 &&
+	       !raw && delim == '\n' && readbuf_continued(&rec))
+		rec.len -= 2;  /* Drop the backslash and the newline */
+	readbuf_close(buf);
+
+	if (ret == -1 || (ret == 0 && rec.len == 0)) {
+		free(rec.data);
+		return 1;
+	}
+
+	if (ret == 1)
+		rec.len--;  /* The delimiter */
+	if (rec.data)
+		rec.data[rec.len] = '\0';
+	if (!raw)
+		readbuf_unescape(&rec);
+	if ((ifs = getenv("IFS")) == NULL)
+		ifs = " \t\n";
+
+	if (readbuf_split(rec.data ? rec.data : "", ifs,
+			opt.ind < argc ? argv + opt.ind : reply) == -1)
+		ret = -1;
+
+	free(rec.data);
+	return ret == 1 ? 0 : 1;
+}
+
+/*
+ * Sets the variable 'name'_'index' to 'value'. Returns 0, or -1 on
+ * error.
+ */
+static int readbuf_element(const char *name, long index, const char *value)
+{
+	char var[strlen(name) + 32];
+
+	snprintf(var, sizeof(var), "%s_%ld", name, index);
+	if (value)
+		return setenv(var, value, 1);
+	return unsetenv(var);
+}
+
+/*
+ * mapfile [-t] [-d delim] [-n count] [-s skip] [-u fd] [name]
+ * readarray ...
+ *
+ * Loads the lines (or records ending in delim) of the standard input,
+ * or of fd, into the variables name_0, name_1, ... (MAPFILE by
+ * default) and sets name_COUNT to their number. Elements of an earlier
+ * load of name past the new count are unset. -t removes the delimiter
+ * from each record, -s skips the first skip records and -n loads at
+ * most count records, leaving the rest of the input unread.
+ *
+ * The exit status is 0, 1 on error and 2 on a usage error.
+ */
+int builtin_mapfile(int argc, char **argv, FILE *in, FILE *out)
+{
+	int c, fd = fileno(in), delim = '\n', trim = 0, ret = 0;
+	long i, count = 0, skip = 0, loaded = 0;
+	char *name = "MAPFILE", *old, var[256], value[32];
+	struct readbuf_t tmp, *buf;
+	struct readbuf_record_t rec = { NULL, 0, 0 };
+	struct builtin_getopt_t opt = BUILTIN_GETOPT_INIT;
+
+	while ((c = builtin_getopt(&opt, argc, argv, "td:n:s:u:")) != -1) {
+		switch (c) {
+			case 't':
+				trim = 1;
+				break;
+			case 'd':
+				delim = readbuf_delim(opt.arg);
+				break;
+			case 'n':
+				count = atol(opt.arg);
+				break;
+			case 's':
+				skip = atol(opt.arg);
+				break;
+			case 'u':
+				fd = atoi(opt.arg);
+				break;
+			default:
+				err_msg(MAPFILE_USAGE);
+				return 2;
+		}
+	}
+	if (opt.ind < argc)
+		name = argv[opt.ind++];
+	if (opt.ind < argc || count < 0 || skip < 0 || !readbuf_name(name) ||
+	    strlen(name) > sizeof(var) - 16) {
+		err_msg(MAPFILE_USAGE);
+		return 2;
+	}
+
+	if ((buf = readbuf_open(fd, count == 0, &tmp)) == NULL)
+		return 1;
+
+	for (i = 0; count == 0 || loaded < count; i++) {
+		rec.len = 0;
+		if ((ret = readbuf_record(buf, delim, &rec)) == -1 ||
+		    (ret == 0 && rec.len == 0))
+			break;
+		if (i < skip)
+			continue;
+		if (trim && ret == 1)
+			rec.data[--rec.len] = '\0';
+		if (readbuf_element(name, loaded, rec.data) == -1) {
+			err_msg("tansh: mapfile: %s: %s", name, strerror(errno));
+			ret = -1;
+			break;
+		}
+		loaded++;
+	}
+	readbuf_close(buf);
+	free(rec.data);
+
+	/* Drop what is left of an earlier, longer load */
+	snprintf(var, sizeof(var), "%s_COUNT", name);
+	if ((old = getenv(var)) != NULL)
+		for (i = atol(old) - 1; i >= loaded; i--)
+			readbuf_element(name, i, NULL);
+
+	snprintf(value, sizeof(value), "%ld", loaded);
+	if (setenv(var, value, 1) == -1)
+		ret = -1;
+
+	return ret == -1 ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef READBUF_H
+#define READBUF_H
+
+#include <stdio.h>
+
+/* Bytes read at once from an input that may be read in blocks. */
+#define READBUF_SIZE  65536
+
+int builtin_read(int argc, char **argv, FILE *in, FILE *out);
+int builtin_mapfile(int argc, char **argv, FILE *in, FILE *out);
+
+#endif
@@ -1,15 +1,53 @@
+/***********************************************************************
+ * File: redirect.c
+ * Description: The redirections of a command, and the engine that
+ *   applies them. Every redirection in the list is applied in order,
+ *   straight on the file descriptors with open(2), dup2(2) and close(2),
+ *   so `2>&1 >file' and `>file 2>&1' differ as they should and no stdio
+ *   stream is involved. Files are opened close-on-exec: only the
+ *   descriptors the redirections name are inherited.
+ *
+ *   A command started with posix_spawn(3) gets its redirections as file
+ *   actions instead, so the child still runs no code of the shell. A
+ *   lone builtin runs in the shell itself, which applies the
+ *   redirections and puts the old descriptors back afterwards.
+ *
+ *   Regular input files of REDIRECT_FADVISE_MIN bytes or more are
+ *   opened with a sequential access hint (posix_fadvise(2)).
+ *
+ *   The body of a here-document or here-string, read by the parser, is
+ *   fed to the command through a pipe if it fits in one without
+ *   blocking, or else through an anonymous memory file
+ *   (memfd_create(2)). Either way the shell writes the whole body before
+ *   the command starts, and no temporary file is created.
+ **********************************************************************/
+
 #ifndef REDIRECT_C
 #define REDIRECT_C
 
+#define _GNU_SOURCE  /* memfd_create(2), pipe2(2) */
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "error.h"
+#include "list.h"
 #include "redirect.h"
 
+/* The descriptors the shell uses for its own copies start here, or
+ * above the highest descriptor the redirections name, if that is
+ * higher (see redirect_fd_base()). */
+#define REDIRECT_FD_BASE  10
+
 struct redirect_t *redirect_create()
 {
-	int i;
 	struct redirect_t *redir;
 
 	if ((redir = malloc(sizeof(struct redirect_t))) == NULL) {
@@ -20,15 +58,13 @@ struct redirect_t *redirect_create()
 	redir->type = REDIRECT_NONE;
 	redir->input_fd = -1;
 	redir->output_fd = -1;
-	redir->fd[0] = STDIN;
-	redir->fd[1] = STDOUT;
-	redir->fd[2] = STDERR;
-	for (i = 3; i < NUM_FDS; i++)
-		redir->fd[i] = -1;
+	redir->dup_fd = -1;
 
 	redir->input_filename = NULL;
 	redir->output_filename = NULL;
 	redir->concat_filename = NULL;
+	redir->here_doc = NULL;
+	redir->here_flags = 0;
 
 	return redir;
 }
@@ -44,6 +80,7 @@ void redirect_destroy(void *redirect)
 		free(((struct redirect_t *)redirect)->output_filename);
 	if (((struct redirect_t *)redirect)->concat_filename)
 		free(((struct redirect_t *)redirect)->concat_filename);
+	free(((struct redirect_t *)redirect)->here_doc);
 	free(redirect);
 }
 
@@ -52,7 +89,6 @@ void redirect_print(struct redirect_t *redir)
 	if (!redir)
 		return;
 
-/* TODO: Fix the redirection type detection to use the bit flags. */
 	err_msg("  + redirect:");
 	switch (redir->type) {
 		case REDIRECT_NONE:
@@ -64,13 +100,492 @@ void redirect_print(struct redirect_t *redir)
 		case REDIRECT_INPUT:
 			err_msg("      -> type [%d]: input redirection", redir->type);
 			break;
+		case REDIRECT_CONCAT:
+			err_msg("      -> type [%d]: append redirection", redir->type);
+			break;
+		case REDIRECT_DUP_INPUT:
+		case REDIRECT_DUP_OUTPUT:
+			err_msg("      -> type [%d]: duplicate fd %d", redir->type,
+					redir->dup_fd);
+			break;
+		case REDIRECT_READ_WRITE:
+			err_msg("      -> type [%d]: read-write redirection", redir->type);
+			break;
+		case REDIRECT_CLOBBER:
+			err_msg("      -> type [%d]: clobber redirection", redir->type);
+			break;
+		case REDIRECT_ALL_OUTPUT:
+			err_msg("      -> type [%d]: output and error redirection",
+					redir->type);
+			break;
+		case REDIRECT_CLOSE:
+			err_msg("      -> type [%d]: close", redir->type);
+			break;
+		case REDIRECT_HERE_DOC:
+			err_msg("      -> type [%d]: here-document, %lu bytes", redir->type,
+					redir->here_doc ? (unsigned long)strlen(redir->here_doc) : 0UL);
+			break;
 		default:
 			err_msg("      -> type [%d]: NOT of a registered type!", redir->type);
 			break;
 	}
+	err_msg("      -> fd: %d", redirect_target(redir));
 	err_msg("      -> filename: %s", redir->input_filename);
 	err_msg("      -> filename: %s", redir->output_filename);
 	err_msg("      -> filename: %s", redir->concat_filename);
 }
 
+/***********************************************************************
+ * Returns the file descriptor that 'redir' redirects: the one given
+ * before the operator, or stdin or stdout by default.
+ **********************************************************************/
+int redirect_target(struct redirect_t *redir)
+{
+	switch (redir->type) {
+		case REDIRECT_INPUT:
+		case REDIRECT_DUP_INPUT:
+		case REDIRECT_READ_WRITE:
+		case REDIRECT_HERE_DOC:
+			return redir->input_fd == -1 ? STDIN : redir->input_fd;
+		case REDIRECT_CLOSE:
+			if (redir->input_fd != -1)
+				return redir->input_fd;
+			return redir->output_fd == -1 ? STDOUT : redir->output_fd;
+		default:
+			return redir->output_fd == -1 ? STDOUT : redir->output_fd;
+	}
+}
+
+/*
+ * Returns the file named by 'redir', or NULL if there is none.
+ */
+char *redirect_filename(struct redirect_t *redir)
+{
+	if (redir->input_filename)
+		return redir->input_filename;
+	if (redir->output_filename)
+		return redir->output_filename;
+	return redir->concat_filename;
+}
+
+/*
+ * Returns the open(2) flags of the file of 'redir', or -1 if 'redir'
+ * does not open a file.
+ */
+static int redirect_flags(struct redirect_t *redir)
+{
+	switch (redir->type) {
+		case REDIRECT_INPUT:
+			return O_RDONLY;
+		case REDIRECT_READ_WRITE:
+			return O_RDWR | O_CREAT;
+		case REDIRECT_CONCAT:
+			return O_WRONLY | O_CREAT | O_APPEND;
+		case REDIRECT_OUTPUT:
+		case REDIRECT_CLOBBER:
+		case REDIRECT_ALL_OUTPUT:
+			return O_WRONLY | O_CREAT | O_TRUNC;
+		default:
+			return -1;
+	}
+}
+
+/*
+ * Prints the error of a <& or >& whose word is not a descriptor, and
+ * returns -1; returns 0 if 'redir' is not one.
+ */
+static int redirect_ambiguous(struct redirect_t *redir)
+{
+	if ((redir->type != REDIRECT_DUP_INPUT &&
+	     redir->type != REDIRECT_DUP_OUTPUT) || !redirect_filename(redir))
+		return 0;
+
+	err_msg("tansh: %s: ambiguous redirect", redirect_filename(redir));
+	return -1;
+}
+
+/*
+ * Writes the 'len' bytes at 'buf' to 'fd'. Returns 0, or -1 on error.
+ */
+static int redirect_write(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns a descriptor, close-on-exec, from which the body of the
+ * here-document 'redir' is read: the read end of a pipe holding it if
+ * it is small, or else a memfd rewound to its start. Returns -1 on
+ * error, after printing a message.
+ */
+static int redirect_here_doc(struct redirect_t *redir)
+{
+	int fds[2];
+	size_t len = redir->here_doc ? strlen(redir->here_doc) : 0;
+
+	if (len <= REDIRECT_HERE_PIPE_MAX) {
+		if (pipe2(fds, O_CLOEXEC) == -1) {
+			err_pipe(errno);
+			return -1;
+		}
+		if (redirect_write(fds[1], redir->here_doc, len) == -1) {
+			err_write(errno);
+			close(fds[0]);
+			fds[0] = -1;
+		}
+		close(fds[1]);
+		return fds[0];
+	}
+
+	if ((fds[0] = memfd_create("tansh-here-doc", MFD_CLOEXEC)) == -1) {
+		err_msg("tansh: here-document: %s", strerror(errno));
+		return -1;
+	}
+	if (redirect_write(fds[0], redir->here_doc, len) == -1 ||
+	    lseek(fds[0], 0, SEEK_SET) == -1) {
+		err_msg("tansh: here-document: %s", strerror(errno));
+		close(fds[0]);
+		return -1;
+	}
+
+	return fds[0];
+}
+
+/***********************************************************************
+ * Opens the file of the redirection 'redir', close-on-exec, with a
+ * sequential access hint if it is a large input file. For a
+ * here-document, returns a descriptor from which its body is read.
+ *
+ * Return value:
+ *   Returns the new file descriptor, or -1 on error, after printing a
+ *   message.
+ **********************************************************************/
+int redirect_open(struct redirect_t *redir)
+{
+	int fd, flags;
+	char *filename = redirect_filename(redir);
+	struct stat st;
+
+	if (redir->type == REDIRECT_HERE_DOC)
+		return redirect_here_doc(redir);
+
+	if ((flags = redirect_flags(redir)) == -1 || !filename) {
+		err_msg("tansh: bad redirection");
+		return -1;
+	}
+
+	if ((fd = open(filename, flags | O_CLOEXEC, 0666)) == -1) {
+		err_msg("tansh: %s: %s", filename, strerror(errno));
+		return -1;
+	}
+
+	if (redir->type == REDIRECT_INPUT && fstat(fd, &st) == 0 &&
+	    S_ISREG(st.st_mode) && st.st_size >= REDIRECT_FADVISE_MIN)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	return fd;
+}
+
+/*
+ * Returns the lowest descriptor the shell may use for its own copies
+ * while applying 'redirects': above REDIRECT_FD_BASE and above every
+ * descriptor they name, so that `3>a 10>b' does not overwrite the copy
+ * of 3 that the shell keeps at 10.
+ */
+static int redirect_fd_base(list_t *redirects)
+{
+	int base = REDIRECT_FD_BASE, target;
+	list_node_t *node;
+
+	list_foreach(redirects, node) {
+		if ((target = redirect_target(list_key(node))) >= base)
+			base = target + 1;
+	}
+
+	return base;
+}
+
+/*
+ * Remembers in 'undo' a copy of the descriptor 'fd', before it is first
+ * changed. Does nothing if 'undo' is NULL. Returns 0, or -1 on error.
+ */
+static int redirect_save(struct redirect_undo_t *undo, int fd)
+{
+	int i, saved;
+
+	if (!undo)
+		return 0;
+	for (i = 0; i < undo->n; i++)
+		if (undo->fds[i] == fd)
+			return 0;
+
+	if ((saved = fcntl(fd, F_DUPFD_CLOEXEC, undo->base)) == -1 &&
+	    errno != EBADF) {
+		err_msg("tansh: %d: %s", fd, strerror(errno));
+		return -1;
+	}
+
+	undo->fds[undo->n] = fd;
+	undo->saved[undo->n++] = saved;
+	return 0;
+}
+
+/*
+ * Makes 'to' a copy of 'from', as dup2(2) does, except that 'to' is
+ * inherited even when it is 'from' itself. Returns 0, or -1 on error.
+ */
+static int redirect_dup(int from, int to)
+{
+	int flags;
+
+	if (from == to) {
+		if ((flags = fcntl(from, F_GETFD)) != -1 &&
+		    fcntl(from, F_SETFD, flags & ~FD_CLOEXEC) != -1)
+			return 0;
+	} else if (dup2(from, to) != -1) {
+		return 0;
+	}
+
+	err_msg("tansh: %d: %s", from, strerror(errno));
+	return -1;
+}
+
+/***********************************************************************
+ * Applies the redirections in 'redirects', in order, to the file
+ * descriptors of the calling process.
+ *
+ * Parameters:
+ *   redirects: The list of redirections, or NULL.
+ *   undo: If not NULL, filled in with copies of the descriptors that
+ *     are changed, which redirect_restore() puts back; it must be
+ *     called even if redirect_apply() fails. If NULL (in a child that
+ *     is about to exec), the old descriptors are simply replaced.
+ *
+ * Return value:
+ *   Returns 0, or -1 on error, after printing a message. Redirections
+ *   before the failing one stay applied.
+ **********************************************************************/
+int redirect_apply(list_t *redirects, struct redirect_undo_t *undo)
+{
+	int fd, target, max, ret;
+	list_node_t *node;
+	struct redirect_t *redir;
+
+	if (undo) {
+		undo->n = 0;
+		undo->fds = NULL;
+	}
+	if (!redirects || list_size(redirects) == 0)
+		return 0;
+
+	/* &> changes two descriptors */
+	max = 2 * list_size(redirects);
+	if (undo) {
+		if ((undo->fds = malloc(2 * max * sizeof(int))) == NULL) {
+			err_malloc(errno);
+			return -1;
+		}
+		undo->saved = undo->fds + max;
+		undo->base = redirect_fd_base(redirects);
+	}
+
+	list_foreach(redirects, node) {
+		redir = list_key(node);
+		target = redirect_target(redir);
+
+		if (redirect_ambiguous(redir) == -1 ||
+		    redirect_save(undo, target) == -1)
+			return -1;
+
+		switch (redir->type) {
+			case REDIRECT_DUP_INPUT:
+			case REDIRECT_DUP_OUTPUT:
+				if (redirect_dup(redir->dup_fd, target) == -1)
+					return -1;
+				break;
+			case REDIRECT_CLOSE:
+				close(target);
+				break;
+			default:
+				if ((fd = redirect_open(redir)) == -1)
+					return -1;
+				ret = redirect_dup(fd, target);
+				if (fd != target)
+					close(fd);
+				if (ret == -1)
+					return -1;
+				break;
+		}
+
+		if (redir->type == REDIRECT_ALL_OUTPUT &&
+		    (redirect_save(undo, STDERR) == -1 ||
+		     redirect_dup(target, STDERR) == -1))
+			return -1;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ * Puts back the file descriptors that redirect_apply() changed, latest
+ * first, and releases 'undo'.
+ **********************************************************************/
+void redirect_restore(struct redirect_undo_t *undo)
+{
+	int i;
+
+	for (i = undo->n - 1; i >= 0; i--) {
+		if (undo->saved[i] == -1) {
+			close(undo->fds[i]);
+			continue;
+		}
+		dup2(undo->saved[i], undo->fds[i]);
+		close(undo->saved[i]);
+	}
+
+	free(undo->fds);
+	undo->fds = NULL;
+	undo->n = 0;
+}
+
+/*
+ * Adds the redirection 'redir' to 'actions' (see redirect_spawn()). A
+ * descriptor the shell opens for it is added to 'opened', at 'n'.
+ * Returns 0, or -1 on error.
+ */
+static int redirect_spawn_one(struct redirect_t *redir,
+		posix_spawn_file_actions_t *actions, int base, int *opened, int *n)
+{
+	int ret, fd, target = redirect_target(redir);
+	char *filename = redirect_filename(redir);
+	struct stat st;
+
+	if (redirect_ambiguous(redir) == -1)
+		return -1;
+
+	switch (redir->type) {
+		case REDIRECT_DUP_INPUT:
+		case REDIRECT_DUP_OUTPUT:
+			ret = posix_spawn_file_actions_adddup2(actions, redir->dup_fd,
+					target);
+			break;
+		case REDIRECT_CLOSE:
+			ret = posix_spawn_file_actions_addclose(actions, target);
+			break;
+		case REDIRECT_INPUT:
+			if (stat(filename, &st) == -1 || !S_ISREG(st.st_mode) ||
+			    st.st_size < REDIRECT_FADVISE_MIN) {
+				ret = posix_spawn_file_actions_addopen(actions, target, filename,
+						O_RDONLY, 0666);
+				break;
+			}
+			/* Fall through */
+		case REDIRECT_HERE_DOC:
+			if ((fd = redirect_open(redir)) == -1)
+				return -1;
+			/* Kept above the descriptors the child may set up before
+			 * duplicating this one */
+			if (fd < base) {
+				opened[*n] = fcntl(fd, F_DUPFD_CLOEXEC, base);
+				close(fd);
+				if ((fd = opened[*n]) == -1) {
+					err_msg("tansh: %d: %s", target, strerror(errno));
+					return -1;
+				}
+			}
+			opened[(*n)++] = fd;
+			ret = posix_spawn_file_actions_adddup2(actions, fd, target);
+			break;
+		default:
+			ret = posix_spawn_file_actions_addopen(actions, target, filename,
+					redirect_flags(redir), 0666);
+			break;
+	}
+
+	if (ret == 0 && redir->type == REDIRECT_ALL_OUTPUT)
+		ret = posix_spawn_file_actions_adddup2(actions, target, STDERR);
+	if (ret != 0) {
+		err_msg("tansh: %d: %s", target, strerror(ret));
+		return -1;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ * Adds the redirections in 'redirects' to the file actions of a
+ * posix_spawn(3) call, after those that connect the pipes. Files are
+ * opened by the child, except large input files, which the shell opens
+ * itself to give the sequential access hint, and here-documents. The
+ * child only duplicates those.
+ *
+ * Parameters:
+ *   redirects: The list of redirections, or NULL.
+ *   actions: The file actions.
+ *   opened: Filled in with the descriptors the shell opened, which the
+ *     caller closes once the child has been spawned. Must have room for
+ *     list_size(redirects) entries.
+ *
+ * Return value:
+ *   Returns the number of descriptors in 'opened', or -1 on error,
+ *   after printing a message (and with nothing left open).
+ **********************************************************************/
+int redirect_spawn(list_t *redirects, posix_spawn_file_actions_t *actions,
+		int *opened)
+{
+	int n = 0, base;
+	list_node_t *node;
+
+	if (!redirects)
+		return 0;
+
+	base = redirect_fd_base(redirects);
+	list_foreach(redirects, node) {
+		if (redirect_spawn_one(list_key(node), actions, base, opened,
+				&n) == -1) {
+			while (--n >= 0)
+				close(opened[n]);
+			return -1;
+		}
+	}
+
+	return n;
+}
+
+/***********************************************************************
+ * Returns non-zero if every redirection in 'redirects' (which may be
+ * NULL) opens a file or a here-document on stdin or stdout: a builtin
+ * on a thread of the shell can then read and write the files instead of
+ * the descriptors.
+ **********************************************************************/
+int redirect_is_stdio(list_t *redirects)
+{
+	list_node_t *node;
+	struct redirect_t *redir;
+
+	if (!redirects)
+		return 1;
+
+	list_foreach(redirects, node) {
+		redir = list_key(node);
+		if ((redirect_flags(redir) == -1 && redir->type != REDIRECT_HERE_DOC) ||
+		    redir->type == REDIRECT_ALL_OUTPUT || redirect_target(redir) > STDOUT)
+			return 0;
+	}
+
+	return 1;
+}
+
 #endif
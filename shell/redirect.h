@@ -1,32 +1,83 @@
 #ifndef REDIRECT_H
 #define REDIRECT_H
 
+#include <spawn.h>
+#include "list.h"
+
+/* A redirection. input_fd and output_fd are the descriptor redirected
+ * by an input or output redirection, or -1 for stdin or stdout. */
 struct redirect_t {
 	int type;
 	int input_fd;
 	int output_fd;
-	int fd[10];
+	int dup_fd;  /* The descriptor copied by <& and >& */
 	char *input_filename;
 	char *output_filename;
 	char *concat_filename;
+	char *here_doc;  /* The body of a here-document or here-string */
+	int here_flags;
 };
 
-#define REDIRECT_NONE        0x0
-#define REDIRECT_INPUT       0x1  /* < */
-#define REDIRECT_INPUT_BIT   0
-#define REDIRECT_OUTPUT      0x2  /* > */
-#define REDIRECT_OUTPUT_BIT  1
-#define REDIRECT_CONCAT      0x4  /* >> */
-#define REDIRECT_CONCAT_BIT  2
+#define REDIRECT_NONE            0x0
+#define REDIRECT_INPUT           0x1   /* < */
+#define REDIRECT_INPUT_BIT       0
+#define REDIRECT_OUTPUT          0x2   /* > */
+#define REDIRECT_OUTPUT_BIT      1
+#define REDIRECT_CONCAT          0x4   /* >> */
+#define REDIRECT_CONCAT_BIT      2
+#define REDIRECT_DUP_INPUT       0x8   /* <& */
+#define REDIRECT_DUP_INPUT_BIT   3
+#define REDIRECT_DUP_OUTPUT      0x10  /* >& */
+#define REDIRECT_DUP_OUTPUT_BIT  4
+#define REDIRECT_READ_WRITE      0x20  /* <> */
+#define REDIRECT_READ_WRITE_BIT  5
+#define REDIRECT_CLOBBER         0x40  /* >| */
+#define REDIRECT_CLOBBER_BIT     6
+#define REDIRECT_ALL_OUTPUT      0x80  /* &> and >& word */
+#define REDIRECT_ALL_OUTPUT_BIT  7
+#define REDIRECT_CLOSE           0x100 /* <&- and >&- */
+#define REDIRECT_CLOSE_BIT       8
+#define REDIRECT_HERE_DOC        0x200 /* <<, <<- and <<< */
+#define REDIRECT_HERE_DOC_BIT    9
+
+/* Flags of a here-document */
+#define REDIRECT_HERE_QUOTED     0x1   /* The delimiter was quoted: the body
+                                        * is not expanded */
+#define REDIRECT_HERE_STRIP      0x2   /* <<-: leading tabs are removed */
+
+#define STDIN                    0
+#define STDOUT                   1
+#define STDERR                   2
 
-#define STDIN                0
-#define STDOUT               1
-#define STDERR               2
+/* Input files at least this large are read with a sequential access
+ * hint, so the kernel reads ahead in larger chunks. */
+#define REDIRECT_FADVISE_MIN     (1 << 20)
 
-#define NUM_FDS              10
+/* Here-documents up to this size are fed through a pipe, which holds
+ * them without blocking the writer; larger ones through a memfd. */
+#define REDIRECT_HERE_PIPE_MAX   4096
+
+/* The descriptors a list of redirections replaced in the shell itself,
+ * to put them back once a builtin has run (see redirect_restore()). */
+struct redirect_undo_t {
+	int n;
+	int *fds;    /* The redirected descriptors */
+	int *saved;  /* Copies of their old files, or -1 if they were closed */
+	int base;    /* The lowest descriptor a copy may take */
+};
 
 struct redirect_t *redirect_create();
 void               redirect_destroy(void *redirect);
 void               redirect_print(struct redirect_t *redir);
+int                redirect_target(struct redirect_t *redir);
+char              *redirect_filename(struct redirect_t *redir);
+int                redirect_open(struct redirect_t *redir);
+int                redirect_apply(list_t *redirects,
+                                  struct redirect_undo_t *undo);
+void               redirect_restore(struct redirect_undo_t *undo);
+int                redirect_spawn(list_t *redirects,
+                                  posix_spawn_file_actions_t *actions,
+                                  int *opened);
+int                redirect_is_stdio(list_t *redirects);
 
 #endif
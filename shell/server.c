@@ -0,0 +1,830 @@
+/***********************************************************************
+ * File: server.c
+ * Description: Server mode, for callers that run many short scripts.
+ *   `tansh --server SOCKET [script ...]' runs its start-up scripts once
+ *   and then serves requests on the Unix socket SOCKET. Running a
+ *   script then costs no exec of the shell, no start-up, and usually no
+ *   parse:
+ *
+ *     tansh --server /run/tansh.sock /etc/tansh/start.sh &
+ *     tansh --client /run/tansh.sock deploy.sh
+ *
+ *   The client sends its scripts (or `-c command'), working directory
+ *   and environment, with its stdin, stdout and stderr as SCM_RIGHTS
+ *   (see struct server_request_t). The server reads each request as it
+ *   arrives, from an epoll set of its own, and drops a client that has
+ *   not sent all of it within SERVER_TIMEOUT seconds. For each request
+ *   it forks a worker, a copy of itself that already holds:
+ *
+ *     - the options set by the start-up scripts,
+ *     - the scripts, parsed once and kept until their file changes,
+ *     - the $PATH table (see hashcmd.c), filled with the commands of
+ *       every script as it is parsed.
+ *
+ *   The worker takes over the descriptors, directory and environment
+ *   of the client, runs the scripts as `tansh script ...' would, and
+ *   exits with the status of the last command. Its last command
+ *   replaces it, as for any script (see launch_exec()). The server
+ *   reaps the worker as an event (see event.c) and sends the status to
+ *   the client, which exits with it. Signals that stop or kill the
+ *   client are passed on to the process group of the worker.
+ *
+ *   Only clients of the same user as the server are served, and the
+ *   socket is made accessible to that user alone. A client that cannot
+ *   reach a server runs the scripts itself.
+ **********************************************************************/
+
+#ifndef SERVER_C
+#define SERVER_C
+
+#define _GNU_SOURCE  /* accept4(2), struct ucred */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "server.h"
+#include "tansh.h"
+#include "cmd.h"
+#include "builtin.h"
+#include "hashcmd.h"
+#include "event.h"
+#include "job.h"
+#include "hash.h"
+#include "list.h"
+#include "error.h"
+
+#define INT_KEY(i)  ((void *)(intptr_t)(i))
+
+/* How long the server waits for a client to finish its request, in
+ * seconds, and how many ready connections it takes at a time. */
+#define SERVER_TIMEOUT  5
+#define SERVER_EVENTS   64
+
+extern char **environ;
+
+struct expr_t *parse(FILE *file);
+
+/* A parsed script, valid while its file is unchanged. */
+struct server_script_t {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct timespec ctime;
+	struct expr_t *cmd;
+};
+
+/* A client, from accept(2) until its worker has exited. Its request is
+ * read as it arrives, so a slow client holds up no other. */
+struct server_conn_t {
+	int fd;
+	int fds[3];                   /* Its stdin, stdout and stderr, or -1 */
+	struct server_request_t req;
+	size_t got;                   /* Bytes of the request read so far */
+	char *strings;                /* The strings, once req is in */
+	time_t deadline;              /* When an unfinished request is dropped */
+	pid_t pid;                    /* Its worker, or 0 while reading */
+	list_node_t *node;            /* Its node in the list conns */
+};
+
+static int server_fd = -1;          /* The listening socket */
+static int server_epoll = -1;       /* It and the requests being read */
+static list_t *conns = NULL;        /* Every struct server_conn_t */
+static hash_t *scripts = NULL;      /* path -> struct server_script_t */
+static hash_t *workers = NULL;      /* pid -> struct server_conn_t */
+static volatile sig_atomic_t client_worker = 0;
+
+static void destroy_script(void *value)
+{
+	struct server_script_t *script = value;
+
+	cmd_destroy(script->cmd);
+	free(script);
+}
+
+/*
+ * Reads exactly 'len' bytes from 'fd'. Returns 0, or -1 on error or
+ * end-of-file.
+ */
+static int server_read(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = read(fd, buf, len)) == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf = (char *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Writes the 'len' bytes at 'buf' to the socket 'fd', without raising
+ * SIGPIPE if the other end is gone. Returns 0, or -1 on error.
+ */
+static int server_write(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = send(fd, buf, len, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Fills in the address of the socket 'path'. Returns 0, or -1 if the
+ * path is too long.
+ */
+static int server_address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		err_msg("tansh: %s: socket path too long", path);
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+/*
+ * Creates the listening socket 'path', in place of a stale one left by
+ * a server that is gone. Returns it, or -1 on error.
+ */
+static int server_listen(const char *path)
+{
+	int fd, probe;
+	mode_t mask;
+	struct sockaddr_un addr;
+	struct stat st;
+
+	if (server_address(path, &addr) == -1)
+		return -1;
+
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if ((probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) != -1 &&
+		    connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+			err_msg("tansh: %s: a server is already running", path);
+			close(probe);
+			return -1;
+		}
+		if (probe != -1)
+			close(probe);
+		unlink(path);
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			0)) == -1) {
+		err_msg("tansh: %s: %s", path, strerror(errno));
+		return -1;
+	}
+	mask = umask(077);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(fd, SOMAXCONN) == -1) {
+		err_msg("tansh: %s: %s", path, strerror(errno));
+		umask(mask);
+		close(fd);
+		return -1;
+	}
+	umask(mask);
+
+	return fd;
+}
+
+/*
+ * Looks up the commands of the parsed script 'cmd' in $PATH, so that
+ * workers find them in the table of the server.
+ */
+static void server_hash(struct expr_t *cmd)
+{
+	list_node_t *node;
+	char *word;
+
+	for (; cmd; cmd = cmd->next) {
+		word = NULL;
+		list_foreach(cmd->exec, node) {
+			word = list_key(node);
+			if (word[0] != '@')
+				break;
+		}
+		if (word && word[0] != '@' && !strchr(word, '/') &&
+		    !strchr(word, '$') && !builtin_lookup(word))
+			hashcmd_lookup(word);
+	}
+}
+
+/*
+ * Returns the parsed script 'path', from the cache unless its file has
+ * changed, or NULL if it cannot be read.
+ */
+static struct server_script_t *server_script(const char *path)
+{
+	struct server_script_t *script;
+	struct stat st;
+	FILE *file;
+	char *key;
+
+	if (!scripts && (scripts = hash_create(hash_string, hash_compare_string,
+			free, destroy_script, 0)) == NULL) {
+		err_malloc(errno);
+		return NULL;
+	}
+	if ((file = fopen(path, "re")) == NULL || fstat(fileno(file), &st) == -1) {
+		if (file)
+			fclose(file);
+		return NULL;
+	}
+
+	script = hash_value(scripts, path);
+	if (script && script->dev == st.st_dev && script->ino == st.st_ino &&
+	    script->size == st.st_size &&
+	    script->mtime.tv_sec == st.st_mtim.tv_sec &&
+	    script->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+	    script->ctime.tv_sec == st.st_ctim.tv_sec &&
+	    script->ctime.tv_nsec == st.st_ctim.tv_nsec) {
+		fclose(file);
+		return script;
+	}
+
+	if (!script) {
+		if ((script = calloc(1, sizeof(struct server_script_t))) == NULL ||
+		    (key = strdup(path)) == NULL ||
+		    hash_insert(scripts, key, script) == -1) {
+			err_malloc(errno);
+			fclose(file);
+			return NULL;
+		}
+	}
+
+	cmd_destroy(script->cmd);
+	script->cmd = parse(file);
+	script->dev = st.st_dev;
+	script->ino = st.st_ino;
+	script->size = st.st_size;
+	script->mtime = st.st_mtim;
+	script->ctime = st.st_ctim;
+	fclose(file);
+
+	server_hash(script->cmd);
+	return script;
+}
+
+/*
+ * Returns the time of the monotonic clock, in seconds.
+ */
+static time_t server_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+/*
+ * Closes the descriptors that came with 'msg', however many there are.
+ */
+static void server_close_rights(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	size_t i, n;
+	int fd;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < n; i++) {
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			close(fd);
+		}
+	}
+}
+
+/*
+ * Reads what has arrived of the request on 'conn': the header with the
+ * descriptors, then the strings. Returns 1 once the request is all in,
+ * 0 if more is to come, or -1 if it is malformed or the client is gone.
+ */
+static int server_receive(struct server_conn_t *conn)
+{
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	size_t i, n;
+	ssize_t len;
+
+	if (conn->got < sizeof(conn->req)) {
+		iov.iov_base = (char *)&conn->req + conn->got;
+		iov.iov_len = sizeof(conn->req) - conn->got;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if ((len = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC)) == -1)
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if ((msg.msg_flags & MSG_CTRUNC) || (cmsg &&
+		    (conn->fds[0] != -1 || cmsg->cmsg_level != SOL_SOCKET ||
+		     cmsg->cmsg_type != SCM_RIGHTS ||
+		     cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)) ||
+		     CMSG_NXTHDR(&msg, cmsg) != NULL))) {
+			server_close_rights(&msg);
+			return -1;
+		}
+		if (cmsg)
+			memcpy(conn->fds, CMSG_DATA(cmsg), sizeof(conn->fds));
+		if (len == 0)
+			return -1;
+		if ((conn->got += len) < sizeof(conn->req))
+			return 0;
+
+		if (conn->fds[0] == -1 || conn->req.argc < 1 ||
+		    conn->req.envc < 0 || conn->req.len == 0 ||
+		    conn->req.len > SERVER_REQUEST_MAX)
+			return -1;
+		if ((conn->strings = malloc(conn->req.len)) == NULL) {
+			err_malloc(errno);
+			return -1;
+		}
+	}
+
+	n = conn->got - sizeof(conn->req);
+	if ((len = read(conn->fd, conn->strings + n, conn->req.len - n)) == -1)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	if (len == 0)
+		return -1;
+	if ((conn->got += len) < sizeof(conn->req) + conn->req.len)
+		return 0;
+
+	/* The directory, the arguments and the environment, all there */
+	if (conn->strings[conn->req.len - 1] != '\0')
+		return -1;
+	for (i = 0, n = 0; i < conn->req.len; i++)
+		if (conn->strings[i] == '\0')
+			n++;
+	if (n != (size_t)conn->req.argc + conn->req.envc + 1)
+		return -1;
+
+	return 1;
+}
+
+/*
+ * Closes the connection 'conn', with whatever it has received, and
+ * forgets it.
+ */
+static void server_drop(struct server_conn_t *conn)
+{
+	int i;
+
+	/* Taken out before it is closed: a worker may not have closed its
+	 * copy yet, and would keep it in the set */
+	if (conn->pid == 0)
+		epoll_ctl(server_epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+	for (i = 0; i < 3; i++)
+		if (conn->fds[i] != -1)
+			close(conn->fds[i]);
+	close(conn->fd);
+	free(conn->strings);
+	list_remove(conns, conn->node);
+	free(conn);
+}
+
+/*
+ * Accepts the clients waiting on the listening socket, and adds them
+ * to the set of requests being read.
+ */
+static void server_accept(void)
+{
+	int fd;
+	struct server_conn_t *conn;
+	struct epoll_event ev;
+	struct ucred cred;
+	socklen_t len;
+
+	while ((fd = accept4(server_fd, NULL, NULL,
+			SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+		len = sizeof(cred);
+		if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 ||
+		    cred.uid != geteuid()) {
+			close(fd);
+			continue;
+		}
+		if ((conn = calloc(1, sizeof(struct server_conn_t))) == NULL ||
+		    list_push(conns, conn) == -1) {
+			err_malloc(errno);
+			free(conn);
+			close(fd);
+			continue;
+		}
+		conn->fd = fd;
+		conn->fds[0] = conn->fds[1] = conn->fds[2] = -1;
+		conn->deadline = server_now() + SERVER_TIMEOUT;
+		conn->node = list_tail(conns);
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			err_msg("tansh: epoll: %s", strerror(errno));
+			server_drop(conn);
+		}
+	}
+}
+
+/*
+ * Runs in the worker: takes over the descriptors, directory and
+ * environment of the client 'conn', runs its scripts and exits. 'found'
+ * holds the parsed script of each argument, or NULL.
+ */
+static void server_worker(struct server_conn_t *conn, char *cwd,
+		char **argv, char **envp, struct server_script_t **found)
+{
+	int i, argc = conn->req.argc;
+	FILE *file;
+	struct expr_t *cmd;
+	struct server_conn_t *other;
+	list_node_t *node;
+
+	setpgid(0, 0);
+	event_child();
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGHUP, SIG_DFL);
+
+	/* The connections of the clients, its own too, are not for the
+	 * worker: the server answers them */
+	close(server_fd);
+	close(server_epoll);
+	list_foreach(conns, node) {
+		other = list_key(node);
+		close(other->fd);
+		for (i = 0; other != conn && i < 3; i++)
+			if (other->fds[i] != -1)
+				close(other->fds[i]);
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (dup2(conn->fds[i], i) == -1) {
+			err_dup2(errno);
+			_exit(1);
+		}
+		close(conn->fds[i]);
+	}
+	if (chdir(cwd) == -1) {
+		err_msg("tansh: %s: %s", cwd, strerror(errno));
+		_exit(1);
+	}
+	environ = envp;
+
+	job_last_status = 0;
+	if (strcmp(argv[0], "-c") == 0) {
+		if (argc < 2 ||
+		    (file = fmemopen(argv[1], strlen(argv[1]), "r")) == NULL) {
+			err_msg("tansh: -c: %s", argc < 2 ?
+					"option requires an argument" : strerror(errno));
+			_exit(2);
+		}
+		if ((cmd = parse(file)) != NULL)
+			do_script(cmd, 1);
+	} else {
+		for (i = 0; i < argc; i++) {
+			if (found[i] == NULL) {
+				err_msg("tansh: warning: Invalid file '%s'.", argv[i]);
+				continue;
+			}
+			if (found[i]->cmd)
+				do_script(found[i]->cmd, i == argc - 1);
+		}
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	_exit(job_last_status & 0xff);
+}
+
+/*
+ * Serves the client 'conn', whose request is all in: forks a worker
+ * that runs it, or drops the connection if that fails.
+ */
+static void server_serve(struct server_conn_t *conn)
+{
+	int i;
+	char *p, *path;
+	struct server_reply_t reply;
+	struct server_script_t **found;
+	pid_t pid;
+
+	char *argv[conn->req.argc + 1], *envp[conn->req.envc + 1];
+	char *cwd = conn->strings;
+	p = cwd + strlen(cwd) + 1;
+	for (i = 0; i < conn->req.argc; i++, p += strlen(p) + 1)
+		argv[i] = p;
+	argv[i] = NULL;
+	for (i = 0; i < conn->req.envc; i++, p += strlen(p) + 1)
+		envp[i] = p;
+	envp[i] = NULL;
+
+	/* The scripts are parsed by the server, so the next worker finds
+	 * them parsed */
+	if ((found = calloc(conn->req.argc, sizeof(*found))) == NULL) {
+		err_malloc(errno);
+	} else if (strcmp(argv[0], "-c") != 0) {
+		for (i = 0; i < conn->req.argc; i++) {
+			if (argv[i][0] == '/') {
+				found[i] = server_script(argv[i]);
+			} else if (asprintf(&path, "%s/%s", cwd, argv[i]) != -1) {
+				found[i] = server_script(path);
+				free(path);
+			}
+		}
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	if (!found || (pid = fork()) == -1) {
+		if (found)
+			err_fork(errno);
+		pid = -1;
+	} else if (pid == 0) {
+		server_worker(conn, cwd, argv, envp, found);
+	}
+	free(found);
+
+	/* The client only waits for the status now */
+	epoll_ctl(server_epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+	for (i = 0; i < 3; i++) {
+		close(conn->fds[i]);
+		conn->fds[i] = -1;
+	}
+	free(conn->strings);
+	conn->strings = NULL;
+	conn->pid = pid;
+
+	reply.pid = pid;
+	reply.status = -1;
+	if (pid == -1 || server_write(conn->fd, &reply, sizeof(reply)) == -1 ||
+	    hash_insert(workers, INT_KEY(pid), conn) == -1)
+		server_drop(conn);
+}
+
+/*
+ * Reads the requests that have input, and accepts the clients that
+ * are waiting.
+ */
+static void server_poll(void)
+{
+	int i, n;
+	struct epoll_event ready[SERVER_EVENTS];
+	struct server_conn_t *conn;
+
+	if ((n = epoll_wait(server_epoll, ready, SERVER_EVENTS, 0)) == -1)
+		return;
+
+	for (i = 0; i < n; i++) {
+		if ((conn = ready[i].data.ptr) == NULL) {
+			server_accept();
+			continue;
+		}
+		switch (server_receive(conn)) {
+		case 1:
+			server_serve(conn);
+			break;
+		case -1:
+			server_drop(conn);
+			break;
+		}
+	}
+}
+
+/*
+ * Drops the clients that have not sent their request in time. Returns
+ * how many requests are still being read.
+ */
+static int server_expire(void)
+{
+	int pending = 0;
+	time_t now = server_now();
+	struct server_conn_t *conn;
+	list_node_t *node, *lahead;
+
+	list_foreach_safe(conns, node, lahead) {
+		conn = list_key(node);
+		if (conn->pid != 0)
+			continue;
+		if (now >= conn->deadline)
+			server_drop(conn);
+		else
+			pending++;
+	}
+
+	return pending;
+}
+
+/*
+ * Reaps the workers that have exited and tells their clients.
+ */
+static void server_reap(void)
+{
+	int status;
+	struct server_conn_t *conn;
+	struct server_reply_t reply;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		if ((conn = hash_value(workers, INT_KEY(pid))) == NULL)
+			continue;
+		hash_delete(workers, INT_KEY(pid));
+
+		reply.pid = pid;
+		reply.status = WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+			: WEXITSTATUS(status);
+		server_write(conn->fd, &reply, sizeof(reply));
+		server_drop(conn);
+	}
+}
+
+/***********************************************************************
+ * Serves requests on the Unix socket 'path' until the shell is killed.
+ * The shell must have called event_init().
+ *
+ * Return value:
+ *   Returns -1 on error; does not return otherwise.
+ **********************************************************************/
+int server_run(const char *path)
+{
+	int events;
+	struct epoll_event ev;
+
+	if ((workers = hash_create(hash_int, hash_compare_int, NULL, NULL, 0)) ==
+			NULL || (conns = list_create(NULL)) == NULL) {
+		err_malloc(errno);
+		return -1;
+	}
+	if ((server_fd = server_listen(path)) == -1)
+		return -1;
+
+	/* The listening socket and the clients are watched by a set of
+	 * their own, which is one more descriptor to event_wait() */
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if ((server_epoll = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+	    epoll_ctl(server_epoll, EPOLL_CTL_ADD, server_fd, &ev) == -1) {
+		err_msg("tansh: epoll: %s", strerror(errno));
+		close(server_fd);
+		unlink(path);
+		return -1;
+	}
+	if (event_input_fd(server_epoll) == -1) {
+		close(server_epoll);
+		close(server_fd);
+		unlink(path);
+		return -1;
+	}
+
+	for (;;) {
+		/* Woken each second while a request is still coming in */
+		events = event_wait(server_expire() ? 1000 : -1);
+		if (events == -1)
+			break;
+		if (events & EVENT_CHILD)
+			server_reap();
+		if (events & EVENT_INPUT)
+			server_poll();
+	}
+
+	close(server_epoll);
+	close(server_fd);
+	unlink(path);
+	return -1;
+}
+
+/*
+ * Passes a signal that would kill or stop the client on to its worker.
+ */
+static void client_signal(int signal)
+{
+	if (client_worker > 0)
+		kill(-client_worker, signal);
+}
+
+/*
+ * Sends the request to run 'argv' to the server on 'fd', with the stdin,
+ * stdout and stderr of the client. Returns 0, or -1 on error.
+ */
+static int client_send(int fd, int argc, char **argv)
+{
+	int i, ret, stdio[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	char control[CMSG_SPACE(sizeof(stdio))], *cwd, **env;
+	struct server_request_t req;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	if ((cwd = getcwd(NULL, 0)) == NULL)
+		return -1;
+	req.argc = argc;
+	req.envc = 0;
+	req.len = strlen(cwd) + 1;
+	for (i = 0; i < argc; i++)
+		req.len += strlen(argv[i]) + 1;
+	for (env = environ; env && *env; env++, req.envc++)
+		req.len += strlen(*env) + 1;
+
+	iov.iov_base = &req;
+	iov.iov_len = sizeof(req);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(stdio));
+	memcpy(CMSG_DATA(cmsg), stdio, sizeof(stdio));
+
+	ret = sendmsg(fd, &msg, MSG_NOSIGNAL) == sizeof(req) &&
+	      server_write(fd, cwd, strlen(cwd) + 1) == 0 ? 0 : -1;
+	for (i = 0; i < argc && ret == 0; i++)
+		ret = server_write(fd, argv[i], strlen(argv[i]) + 1);
+	for (env = environ; env && *env && ret == 0; env++)
+		ret = server_write(fd, *env, strlen(*env) + 1);
+
+	free(cwd);
+	return ret;
+}
+
+/***********************************************************************
+ * Runs scripts through the server listening on 'path', as the client
+ * mode of the shell does.
+ *
+ * Parameters:
+ *   path: The socket of the server.
+ *   argc, argv: The scripts to run, or `-c' and a command.
+ *
+ * Return value:
+ *   Returns the exit status of the scripts, or -1 if no server could
+ *   take the request, in which case nothing has run.
+ **********************************************************************/
+int server_client(const char *path, int argc, char **argv)
+{
+	int fd;
+	struct sockaddr_un addr;
+	struct server_reply_t reply;
+	struct sigaction act;
+
+	if (server_address(path, &addr) == -1 ||
+	    (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    client_send(fd, argc, argv) == -1 ||
+	    server_read(fd, &reply, sizeof(reply)) == -1 || reply.pid <= 0) {
+		close(fd);
+		return -1;
+	}
+	client_worker = reply.pid;
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = client_signal;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGQUIT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGHUP, &act, NULL);
+
+	/* The worker has the terminal too: the client only waits */
+	if (server_read(fd, &reply, sizeof(reply)) == -1) {
+		err_msg("tansh: %s: lost the server", path);
+		close(fd);
+		return 1;
+	}
+
+	close(fd);
+	return reply.status;
+}
+
+#endif
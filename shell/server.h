@@ -0,0 +1,30 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* The largest request a server accepts, in bytes of strings. */
+#define SERVER_REQUEST_MAX  (16 * 1024 * 1024)
+
+/* A request to run scripts, followed on the socket by the working
+ * directory, the arguments and the environment of the client, each NUL
+ * terminated. The stdin, stdout and stderr of the client come with it,
+ * as SCM_RIGHTS. */
+struct server_request_t {
+	int argc;
+	int envc;
+	size_t len;   /* Bytes of strings that follow */
+};
+
+/* Sent twice to the client: once the worker runs, with a status of -1,
+ * and once it has exited, with its exit status. */
+struct server_reply_t {
+	pid_t pid;    /* The worker, also its process group */
+	int status;
+};
+
+int server_run(const char *path);
+int server_client(const char *path, int argc, char **argv);
+
+#endif
@@ -0,0 +1,262 @@
+/***********************************************************************
+ * File: stageattr.c
+ * Description: Scheduling attributes of a pipeline stage. Words of the
+ *   form `@name=value' in front of the command of a stage are not part
+ *   of the command: they set how the stage is scheduled, and are
+ *   applied in the child before it executes the command, instead of
+ *   wrapping the stage in taskset(1), nice(1), chrt(1) or ionice(1):
+ *
+ *     zstd -dc big.zst | @cpu=2 parse | @cpu=3 @nice=5 aggregate
+ *     @sched=idle make -j8 &
+ *
+ *   @cpu=LIST     Runs the stage on the CPUs in LIST, as in `0-3,6'.
+ *   @nice=N       Adds N to the nice value of the stage.
+ *   @sched=NAME   Sets the scheduling policy: other, batch or idle.
+ *                 An idle stage also gets the idle I/O class, unless
+ *                 @io says otherwise.
+ *   @io=CLASS[:N] Sets the I/O scheduling class, idle, be (best-effort)
+ *                 or rt (real-time), and its level N from 0 (highest)
+ *                 to 7, 4 by default.
+ *   @batch=N[:K]  Runs the stage in batches, N at once, if its words
+ *                 are too long to exec (see argbatch.c).
+ *   @pipe=SIZE    Sets the capacity of the pipe the stage writes to, in
+ *                 bytes with an optional k, m or g, in place of `set -o
+ *                 pipesize' for that pipe alone.
+ *
+ *   A stage with attributes is always started with fork(2), since
+ *   posix_spawn(3) and the zygote have no way of applying them. @batch
+ *   and @pipe are not applied in the child, and leave the stage as it
+ *   would be started without them.
+ **********************************************************************/
+
+#ifndef STAGEATTR_C
+#define STAGEATTR_C
+
+#define _GNU_SOURCE  /* CPU_SET(3), SCHED_BATCH, SCHED_IDLE */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include "stageattr.h"
+#include "argbatch.h"
+#include "option.h"
+#include "error.h"
+
+/* From linux/ioprio.h, which the C library does not wrap */
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_CLASS_RT     1
+#define IOPRIO_CLASS_BE     2
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_WHO_PROCESS  1
+
+/*
+ * Parses the number at 's' into 'value', which must lie within 'min'
+ * and 'max'. Returns the end of the number, or NULL if there is none.
+ */
+static char *stageattr_number(char *s, long min, long max, long *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtol(s, &end, 10);
+	if (end == s || errno || *value < min || *value > max)
+		return NULL;
+	return end;
+}
+
+/*
+ * Parses the CPU list 'list', such as `0-3,6', into 'cpus'. Returns 0,
+ * or -1 if the list is malformed.
+ */
+static int stageattr_cpus(char *list, cpu_set_t *cpus)
+{
+	long first, last;
+	char *s = list;
+
+	CPU_ZERO(cpus);
+	for (;;) {
+		if ((s = stageattr_number(s, 0, CPU_SETSIZE - 1, &first)) == NULL)
+			return -1;
+		last = first;
+		if (*s == '-' &&
+		    (s = stageattr_number(s + 1, first, CPU_SETSIZE - 1, &last)) == NULL)
+			return -1;
+		for (; first <= last; first++)
+			CPU_SET(first, cpus);
+		if (*s == '\0')
+			return 0;
+		if (*s++ != ',')
+			return -1;
+	}
+}
+
+/*
+ * Parses the I/O class 'spec', `class[:level]', into an ioprio_set(2)
+ * value. Returns the value, or -1 if 'spec' is malformed.
+ */
+static int stageattr_ioprio(char *spec)
+{
+	int class;
+	long level = 4;
+	size_t len = strcspn(spec, ":");
+
+	if (len == 4 && strncmp(spec, "idle", len) == 0)
+		return IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+	else if (len == 2 && strncmp(spec, "be", len) == 0)
+		class = IOPRIO_CLASS_BE;
+	else if (len == 2 && strncmp(spec, "rt", len) == 0)
+		class = IOPRIO_CLASS_RT;
+	else
+		return -1;
+
+	if (spec[len] == ':' &&
+	    ((spec = stageattr_number(spec + len + 1, 0, 7, &level)) == NULL ||
+	     *spec != '\0'))
+		return -1;
+
+	return (class << IOPRIO_CLASS_SHIFT) | level;
+}
+
+/*
+ * Sets the attribute of the word `@name=value' 'word' in 'attr'.
+ * Returns 0, or -1 after printing a message if it is not valid.
+ */
+static int stageattr_set(char *word, struct stageattr_t *attr)
+{
+	long nice;
+	char *value = strchr(word, '=') + 1;
+	size_t len = value - word - 1;
+
+	if (len == 4 && strncmp(word, "@cpu", len) == 0) {
+		if (stageattr_cpus(value, &attr->cpus) == -1) {
+			err_msg("tansh: %s: invalid CPU list", word);
+			return -1;
+		}
+		attr->has_cpus = 1;
+	} else if (len == 5 && strncmp(word, "@nice", len) == 0) {
+		if ((value = stageattr_number(value, -40, 40, &nice)) == NULL ||
+		    *value != '\0') {
+			err_msg("tansh: %s: invalid nice value", word);
+			return -1;
+		}
+		attr->has_nice = 1;
+		attr->nice = nice;
+	} else if (len == 6 && strncmp(word, "@sched", len) == 0) {
+		if (strcmp(value, "other") == 0) {
+			attr->policy = SCHED_OTHER;
+		} else if (strcmp(value, "batch") == 0) {
+			attr->policy = SCHED_BATCH;
+		} else if (strcmp(value, "idle") == 0) {
+			attr->policy = SCHED_IDLE;
+		} else {
+			err_msg("tansh: %s: invalid policy (other, batch or idle)", word);
+			return -1;
+		}
+	} else if (len == 3 && strncmp(word, "@io", len) == 0) {
+		if ((attr->ioprio = stageattr_ioprio(value)) == -1) {
+			err_msg("tansh: %s: invalid I/O class (idle, be[:N] or rt[:N])",
+					word);
+			return -1;
+		}
+	} else if (len == 6 && strncmp(word, "@batch", len) == 0) {
+		if (argbatch_spec(value, NULL, NULL) == -1) {
+			err_msg("tansh: %s: invalid batch (N or N:K)", word);
+			return -1;
+		}
+		return 0;  /* Only matters to argbatch_needed() */
+	} else if (len == 5 && strncmp(word, "@pipe", len) == 0) {
+		if ((attr->pipesize = option_parse(value, OPTION_SIZE)) <= 0) {
+			err_msg("tansh: %s: invalid pipe size", word);
+			return -1;
+		}
+		return 0;  /* Applied by launch_pipeline() */
+	} else {
+		err_msg("tansh: %.*s: unknown stage attribute", (int)len, word);
+		return -1;
+	}
+
+	attr->set = 1;
+	return 0;
+}
+
+/***********************************************************************
+ * Reads the scheduling attributes that prefix the command of a stage.
+ *
+ * Parameters:
+ *   args: The NULL terminated words of the stage. Its leading words of
+ *     the form `@name=value' are attributes.
+ *   attr: Filled in with the attributes; attr->set is 0 if there are
+ *     none.
+ *
+ * Return value:
+ *   Returns the number of leading words that are attributes, so the
+ *   command starts at args[n], or -1 after printing a message if an
+ *   attribute is not valid or no command follows them.
+ **********************************************************************/
+int stageattr_parse(char **args, struct stageattr_t *attr)
+{
+	int n;
+
+	memset(attr, 0, sizeof(struct stageattr_t));
+	attr->policy = -1;
+	attr->ioprio = -1;
+
+	for (n = 0; args[n] && args[n][0] == '@' && strchr(args[n], '='); n++)
+		if (stageattr_set(args[n], attr) == -1)
+			return -1;
+
+	if (n > 0 && !args[n]) {
+		err_msg("tansh: %s: no command to run", args[n - 1]);
+		return -1;
+	}
+
+	/* An idle stage should not compete for the disk either */
+	if (attr->policy == SCHED_IDLE && attr->ioprio == -1)
+		attr->ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+
+	return n;
+}
+
+/***********************************************************************
+ * Applies the attributes 'attr' to the calling process. Called in the
+ * child of a stage, before it executes the command.
+ *
+ * Return value:
+ *   Returns 0, or -1 after printing a message if an attribute could not
+ *   be applied (e.g., a negative @nice without privileges).
+ **********************************************************************/
+int stageattr_apply(struct stageattr_t *attr)
+{
+	struct sched_param param = { 0 };
+
+	if (attr->policy != -1 && sched_setscheduler(0, attr->policy, &param) == -1) {
+		err_msg("tansh: @sched: %s", strerror(errno));
+		return -1;
+	}
+
+	errno = 0;
+	if (attr->has_nice && nice(attr->nice) == -1 && errno) {
+		err_msg("tansh: @nice: %s", strerror(errno));
+		return -1;
+	}
+
+	if (attr->has_cpus &&
+	    sched_setaffinity(0, sizeof(cpu_set_t), &attr->cpus) == -1) {
+		err_msg("tansh: @cpu: %s", strerror(errno));
+		return -1;
+	}
+
+	if (attr->ioprio != -1 &&
+	    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, attr->ioprio) == -1) {
+		err_msg("tansh: @io: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef STAGEATTR_H
+#define STAGEATTR_H
+
+#include <sched.h>
+
+/* The scheduling of a pipeline stage, given by the `@name=value' words
+ * that prefix its command (see stageattr.c). */
+struct stageattr_t {
+	int set;         /* Non-zero if any attribute was given */
+	int has_cpus;
+	cpu_set_t cpus;  /* @cpu: CPUs the stage may run on */
+	int policy;      /* @sched: SCHED_OTHER, SCHED_BATCH or SCHED_IDLE, or -1 */
+	int has_nice;
+	int nice;        /* @nice: increment of the nice value */
+	int ioprio;      /* @io: value for ioprio_set(2), or -1 */
+	long pipesize;   /* @pipe: capacity of the output pipe, or 0 */
+};
+
+int stageattr_parse(char **args, struct stageattr_t *attr);
+int stageattr_apply(struct stageattr_t *attr);
+
+#endif
@@ -0,0 +1,696 @@
+/***********************************************************************
+ * File: subst.c
+ * Description: Command substitution, `$(command)'. A word holding
+ *   substitutions is expanded right before the command it belongs to
+ *   runs: each substitution is replaced by the output of its command,
+ *   less the trailing newlines. Outside double quotes, the output is
+ *   then split into words at blanks and newlines.
+ *
+ *   The parser leaves the quotes of such a word in place, and they are
+ *   removed here as the word is expanded: nothing within single quotes
+ *   or after a backslash is substituted, and the output of a command is
+ *   never itself subject to quote removal.
+ *
+ *   Words are expanded in an arena, one buffer that is reused by every
+ *   substitution and grows by doubling. The expanded word is built at
+ *   its end; the output of a command is read straight after the part
+ *   of the word before it, and its trailing newlines are trimmed by
+ *   shortening the arena. Only the finished words are copied out.
+ *
+ *   A substitution is run in one of three ways:
+ *     - `$(<file)' reads the file itself, with mmap(2) for large files,
+ *       instead of running cat;
+ *     - a single builtin that may run on a thread (see builtin.c) runs
+ *       in the shell, writing to a stream that appends to the arena;
+ *     - anything else runs in a forked copy of the shell, whose output
+ *       the shell reads from a pipe.
+ *
+ *   Process substitution, `<(command)' and `>(command)', is expanded
+ *   along with them: the command is started in a forked copy of the
+ *   shell with its output (or input) on a pipe, and the word is replaced
+ *   by the name of the shell's end of the pipe, `/dev/fd/N'. The shell
+ *   holds that end until the command the word belongs to has run; the
+ *   substituted commands are in the job table, and are waited for after
+ *   a foreground command (see subst_process_finish()).
+ **********************************************************************/
+
+#ifndef SUBST_C
+#define SUBST_C
+
+#define _GNU_SOURCE  /* fopencookie(3), pipe2(2) */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "subst.h"
+#include "tansh.h"
+#include "cmd.h"
+#include "builtin.h"
+#include "job.h"
+#include "event.h"
+#include "zygote.h"
+#include "list.h"
+#include "error.h"
+
+struct expr_t *parse(FILE *file);
+
+/* The arena. Expansions refer to it by offset, as it may move when it
+ * grows. */
+static char *arena = NULL;
+static size_t arena_len = 0;
+static size_t arena_size = 0;
+
+/* The running process substitutions, in the order they were started. */
+struct subst_process_t {
+	int fd;              /* The shell's end of the pipe */
+	struct job_t *job;
+};
+static struct subst_process_t *procs = NULL;
+static int nprocs = 0;
+static int procs_size = 0;
+
+/*
+ * Makes room for at least 'room' more bytes in the arena. Returns 0, or
+ * -1 on error.
+ */
+static int subst_reserve(size_t room)
+{
+	size_t size = arena_size ? arena_size : SUBST_ARENA_MIN;
+	char *p;
+
+	while (arena_len + room > size)
+		size *= 2;
+	if (size == arena_size)
+		return 0;
+
+	if ((p = realloc(arena, size)) == NULL) {
+		err_malloc(errno);
+		return -1;
+	}
+	arena = p;
+	arena_size = size;
+	return 0;
+}
+
+/*
+ * Appends the 'len' bytes at 'text' to the arena. Returns 0, or -1 on
+ * error.
+ */
+static int subst_append(const char *text, size_t len)
+{
+	if (subst_reserve(len) == -1)
+		return -1;
+	memcpy(arena + arena_len, text, len);
+	arena_len += len;
+	return 0;
+}
+
+/*
+ * Reads 'fd' to its end into the arena, in as few reads as the free
+ * room allows. Returns 0, or -1 on error.
+ */
+static int subst_read(int fd)
+{
+	ssize_t n;
+
+	for (;;) {
+		if (subst_reserve(SUBST_ARENA_MIN / 2) == -1)
+			return -1;
+
+		if ((n = read(fd, arena + arena_len, arena_size - arena_len)) == 0)
+			return 0;
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			err_msg("tansh: command substitution: %s", strerror(errno));
+			return -1;
+		}
+		arena_len += n;
+	}
+}
+
+/*
+ * The write function of the stream a builtin writes to: appends to the
+ * arena.
+ */
+static ssize_t subst_cookie_write(void *cookie, const char *buf, size_t size)
+{
+	return subst_append(buf, size) == -1 ? 0 : (ssize_t)size;
+}
+
+/*
+ * Returns the file named by the substitution 'text' if it is of the
+ * form `<file', or NULL. The name is copied into 'name', which has room
+ * for strlen(text) + 1 bytes.
+ */
+static char *subst_file_name(const char *text, char *name)
+{
+	size_t len;
+
+	while (isspace((unsigned char)*text))
+		text++;
+	if (*text != '<' || text[1] == '<' || text[1] == '(' || text[1] == '&')
+		return NULL;
+	for (text++; isspace((unsigned char)*text); text++)
+		;
+
+	len = strcspn(text, " \t\n;&|<>()");
+	if (len == 0)
+		return NULL;
+	memcpy(name, text, len);
+	name[len] = '\0';
+
+	for (text += len; isspace((unsigned char)*text); text++)
+		;
+	return *text ? NULL : name;
+}
+
+/*
+ * Appends the contents of the file 'name' to the arena, for `$(<file)'.
+ * A large regular file is mapped and copied in one go. Returns the exit
+ * status of the substitution.
+ */
+static int subst_file(const char *name)
+{
+	int fd, ret;
+	void *map;
+	struct stat st;
+
+	if ((fd = open(name, O_RDONLY | O_CLOEXEC)) == -1) {
+		err_msg("tansh: %s: %s", name, strerror(errno));
+		return 1;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size >= SUBST_MMAP_MIN &&
+	    (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) !=
+			MAP_FAILED) {
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		ret = subst_append(map, st.st_size);
+		munmap(map, st.st_size);
+	} else {
+		ret = subst_read(fd);
+	}
+
+	close(fd);
+	return ret == -1 ? 1 : 0;
+}
+
+/*
+ * Runs the builtin command 'cmd' in the shell, with its output going to
+ * the arena. Returns its exit status.
+ */
+static int subst_builtin(struct expr_t *cmd, struct builtin_t *builtin)
+{
+	int ret, argc;
+	char **args;
+	FILE *out;
+	cookie_io_functions_t io = { NULL, subst_cookie_write, NULL, NULL };
+
+	if (subst_expand(cmd, 1) == -1)
+		return 1;
+	argc = list_size(cmd->exec);
+	if ((args = cmd_argv(cmd)) == NULL)
+		return 1;
+
+	if ((out = fopencookie(NULL, "w", io)) == NULL) {
+		err_msg("tansh: command substitution: %s", strerror(errno));
+		free(args);
+		return 1;
+	}
+	ret = builtin->function(argc, args, stdin, out);
+	fclose(out);
+
+	free(args);
+	return ret;
+}
+
+/*
+ * Runs 'cmd' in a forked copy of the shell and reads its output into
+ * the arena. Returns its exit status.
+ */
+static int subst_fork(struct expr_t *cmd, const char *text)
+{
+	int fds[2], ret, status;
+	pid_t pid;
+	struct job_t *job;
+
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		err_pipe(errno);
+		return 1;
+	}
+
+	/* No stdio buffer may be written twice, by the shell and the child. */
+	fflush(stdout);
+	fflush(stderr);
+
+	if ((pid = fork()) == -1) {
+		err_fork(errno);
+		close(fds[0]);
+		close(fds[1]);
+		return 1;
+	}
+
+	if (pid == 0) {  /* The substitution */
+		event_child();
+		job_control = 0;
+		close(fds[0]);
+		if (dup2(fds[1], STDOUT_FILENO) == -1) {
+			err_dup2(errno);
+			_exit(1);
+		}
+		close(fds[1]);
+		if (do_command(cmd) == -1)
+			job_last_status = 1;
+		fflush(stdout);
+		_exit(job_last_status & 0xff);
+	}
+
+	job = job_create(&pid, NULL, 1, 0, strdup(text));
+	close(fds[1]);
+
+	ret = subst_read(fds[0]);
+	close(fds[0]);
+
+	if (!job) {
+		kill(pid, SIGTERM);
+		return 1;
+	}
+	status = job_wait(job);
+	return ret == -1 ? 1 : status;
+}
+
+/*
+ * Runs the command substitution 'text' (what is between the
+ * parentheses) and appends its output to the arena. Returns the exit
+ * status of the substitution.
+ */
+static int subst_command(const char *text)
+{
+	int ret;
+	char name[strlen(text) + 1];
+	FILE *file;
+	struct expr_t *cmd;
+	struct builtin_t *builtin;
+
+	if (subst_file_name(text, name))
+		return subst_file(name);
+
+	if ((file = fmemopen((void *)text, strlen(text), "r")) == NULL) {
+		err_msg("tansh: command substitution: %s", strerror(errno));
+		return 1;
+	}
+	cmd = parse(file);
+	fclose(file);
+	if (!cmd)
+		return 0;
+
+	if (!cmd->next && !cmd->redirects && cmd_is_simple(cmd) &&
+	    !cmd_is_background(cmd) && (builtin = builtin_find(cmd)) &&
+	    builtin->threaded)
+		ret = subst_builtin(cmd, builtin);
+	else
+		ret = subst_fork(cmd, text);
+
+	cmd_destroy(cmd);
+	return ret;
+}
+
+/*
+ * Starts the process substitution 'text' in a forked copy of the shell.
+ * If 'input' is non-zero (`<(...)'), the shell reads its output, else
+ * (`>(...)') it writes its input. Returns the shell's end of the pipe,
+ * which stays open until subst_process_finish(), or -1 on error.
+ */
+static int subst_process_start(const char *text, int input)
+{
+	int i, fds[2], keep;
+	pid_t pid;
+	struct subst_process_t *p;
+	struct expr_t *cmd;
+	FILE *file;
+
+	if (nprocs == procs_size) {
+		i = procs_size ? procs_size * 2 : 4;
+		if ((p = realloc(procs, i * sizeof(struct subst_process_t))) == NULL) {
+			err_malloc(errno);
+			return -1;
+		}
+		procs = p;
+		procs_size = i;
+	}
+
+	if ((file = fmemopen((void *)text, strlen(text), "r")) == NULL) {
+		err_msg("tansh: process substitution: %s", strerror(errno));
+		return -1;
+	}
+	cmd = parse(file);
+	fclose(file);
+
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		err_pipe(errno);
+		cmd_destroy(cmd);
+		return -1;
+	}
+	keep = input ? 0 : 1;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	if ((pid = fork()) == -1) {
+		err_fork(errno);
+		close(fds[0]);
+		close(fds[1]);
+		cmd_destroy(cmd);
+		return -1;
+	}
+
+	if (pid == 0) {  /* The substitution */
+		event_child();
+		job_control = 0;
+
+		/* The pipes of the other substitutions must not be held open by
+		 * this one, or their commands would never see end-of-file. */
+		for (i = 0; i < nprocs; i++)
+			close(procs[i].fd);
+		close(fds[keep]);
+		if (dup2(fds[!keep], input ? STDOUT_FILENO : STDIN_FILENO) == -1) {
+			err_dup2(errno);
+			_exit(1);
+		}
+		close(fds[!keep]);
+		if (cmd && do_command(cmd) == -1)
+			job_last_status = 1;
+		fflush(stdout);
+		_exit(job_last_status & 0xff);
+	}
+
+	p = &procs[nprocs++];
+	p->fd = fds[keep];
+	p->job = job_create(&pid, NULL, 1, 0, strdup(text));
+	close(fds[!keep]);
+	cmd_destroy(cmd);
+
+	/* The command the word belongs to opens `/dev/fd/N' itself, so
+	 * the descriptor must survive exec. */
+	fcntl(p->fd, F_SETFD, 0);
+	zygote_inherit(p->fd);
+	return p->fd;
+}
+
+/*
+ * Returns the `)' that closes the substitution whose text starts at 'p',
+ * or NULL if it is not closed.
+ */
+static const char *subst_close(const char *p)
+{
+	int depth = 1;
+	char quote = 0;
+
+	for (; *p; p++) {
+		if (quote) {
+			if (*p == quote)
+				quote = 0;
+			else if (*p == '\\' && quote == '"' && p[1])
+				p++;
+		} else if (*p == '\'' || *p == '"') {
+			quote = *p;
+		} else if (*p == '\\' && p[1]) {
+			p++;
+		} else if (*p == '(') {
+			depth++;
+		} else if (*p == ')' && --depth == 0) {
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Expands the substitutions in 'word' at the end of the arena, removing
+ * its quotes and backslashes on the way. The output of a substitution
+ * outside double quotes has its blanks and newlines turned into NUL
+ * bytes, which separate the fields the word is split into. Returns 1 if
+ * there were such substitutions, 0 if not, or -1 on error.
+ */
+static int subst_build(const char *word)
+{
+	int split = 0, dquote = 0, fd;
+	size_t start;
+	const char *p, *end;
+	char *text, name[32];
+
+	p = word;
+	if ((*p == '<' || *p == '>') && p[1] == '(' &&
+	    (end = subst_close(p + 2)) != NULL) {
+		if ((text = strndup(p + 2, end - (p + 2))) == NULL) {
+			err_malloc(errno);
+			return -1;
+		}
+		fd = subst_process_start(text, *p == '<');
+		free(text);
+		if (fd == -1)
+			return -1;
+		snprintf(name, sizeof(name), "/dev/fd/%d", fd);
+		if (subst_append(name, strlen(name)) == -1)
+			return -1;
+		p = end + 1;
+	}
+
+	while (*p) {
+		if (*p == '\'' && !dquote) {
+			if ((end = strchr(p + 1, '\'')) == NULL)
+				end = p + strlen(p);
+			if (subst_append(p + 1, end - (p + 1)) == -1)
+				return -1;
+			p = *end ? end + 1 : end;
+			continue;
+		}
+		if (*p == '\\' && p[1]) {
+			if (subst_append(p + 1, 1) == -1)
+				return -1;
+			p += 2;
+			continue;
+		}
+		if (*p == '"') {
+			dquote = !dquote;
+			p++;
+			continue;
+		}
+
+		/* $((...)) is arithmetic, not a substitution */
+		if (p[0] != '$' || p[1] != '(' || p[2] == '(' ||
+		    (end = subst_close(p + 2)) == NULL) {
+			if (subst_append(p++, 1) == -1)
+				return -1;
+			continue;
+		}
+
+		if ((text = strndup(p + 2, end - (p + 2))) == NULL) {
+			err_malloc(errno);
+			return -1;
+		}
+		start = arena_len;
+		subst_command(text);
+		free(text);
+
+		while (arena_len > start && arena[arena_len - 1] == '\n')
+			arena_len--;
+		if (!dquote) {
+			for (; start < arena_len; start++)
+				if (arena[start] == ' ' || arena[start] == '\t' ||
+				    arena[start] == '\n')
+					arena[start] = '\0';
+			split = 1;
+		}
+		p = end + 1;
+	}
+
+	return split;
+}
+
+/*
+ * Returns non-zero if 'word' holds a command substitution or is a
+ * process substitution.
+ */
+int subst_needed(const char *word)
+{
+	return strstr(word, "$(") ||
+			((*word == '<' || *word == '>') && word[1] == '(');
+}
+
+/*
+ * Expands the substitutions in 'word', and pushes the resulting words
+ * onto 'words'. If 'split' is zero, the result is a single word even
+ * where the output of a substitution has blanks. Returns 0, or -1 on
+ * error.
+ */
+static int subst_word(const char *word, list_t *words, int split)
+{
+	int ret;
+	size_t base = arena_len, i, len;
+	char *copy;
+
+	if ((ret = subst_build(word)) == -1) {
+		arena_len = base;
+		return -1;
+	}
+
+	if (!split || !ret) {
+		for (i = base; i < arena_len; i++)
+			if (arena[i] == '\0')
+				arena[i] = ' ';
+		if ((copy = strndup(arena + base, arena_len - base)) != NULL)
+			list_push(words, copy);
+	} else {
+		for (i = base, copy = arena; i < arena_len && copy; i += len + 1) {
+			if ((len = strnlen(arena + i, arena_len - i)) == 0)
+				continue;  /* Empty fields are dropped */
+			if ((copy = strndup(arena + i, len)) != NULL)
+				list_push(words, copy);
+		}
+	}
+
+	arena_len = base;
+	if (!copy) {
+		err_malloc(errno);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Expands the substitutions in the redirection filename '*name', in
+ * place. Returns 0, or -1 on error.
+ */
+static int subst_filename(char **name)
+{
+	list_t *words;
+
+	if (!*name || !subst_needed(*name))
+		return 0;
+	if ((words = list_create(free)) == NULL) {
+		err_list_create(errno);
+		return -1;
+	}
+	if (subst_word(*name, words, 0) == -1 || list_size(words) != 1) {
+		list_destroy(words);
+		return -1;
+	}
+
+	free(*name);
+	*name = list_shift(words);
+	list_destroy(words);
+	return 0;
+}
+
+/***********************************************************************
+ * Runs the command substitutions in the words and redirection
+ * filenames of the 'n' stages of the pipeline that starts at 'cmd',
+ * replacing them with their output, and starts the process
+ * substitutions among them. The expressions are changed in place, as
+ * each one is run only once (loops run copies of their body).
+ *
+ * Return value:
+ *   Returns 0, or -1 on error.
+ **********************************************************************/
+int subst_expand(struct expr_t *cmd, int n)
+{
+	int i, ret = 0;
+	char *word;
+	list_t *words;
+	list_node_t *node, *next;
+	struct redirect_t *redir;
+
+	for (i = 0; i < n && cmd; i++, cmd = cmd->next) {
+		list_foreach(cmd->exec, node)
+			if (subst_needed(list_key(node)))
+				break;
+
+		if (node != cmd->exec->nil) {
+			if ((words = list_create(free)) == NULL) {
+				err_list_create(errno);
+				return -1;
+			}
+			list_foreach_safe(cmd->exec, node, next) {
+				word = list_remove(cmd->exec, node);
+				if (ret == 0 && subst_needed(word)) {
+					ret = subst_word(word, words, 1);
+					free(word);
+				} else {
+					list_push(words, word);
+				}
+			}
+			list_destroy(cmd->exec);
+			cmd->exec = words;
+		}
+
+		if (cmd->redirects) {
+			list_foreach(cmd->redirects, node) {
+				redir = list_key(node);
+				if (ret == 0)
+					ret = subst_filename(&redir->input_filename);
+				if (ret == 0)
+					ret = subst_filename(&redir->output_filename);
+				if (ret == 0)
+					ret = subst_filename(&redir->concat_filename);
+			}
+		}
+
+		if (ret == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ * Returns the number of process substitutions running, to be given to
+ * subst_process_finish() once the command that is about to be expanded
+ * has run. Substitutions started by commands run meanwhile (in loop
+ * bodies, for instance) are finished by those commands.
+ **********************************************************************/
+int subst_process_mark(void)
+{
+	return nprocs;
+}
+
+/***********************************************************************
+ * Closes the shell's end of the pipes of the process substitutions
+ * started since 'mark' (see subst_process_mark()), so their commands
+ * see end-of-file or a broken pipe, and takes care of their jobs.
+ *
+ * Parameters:
+ *   mark: The number of substitutions to leave running.
+ *   wait: Non-zero to wait for the substitutions, as after a foreground
+ *     command; zero to leave them in the job table as background jobs.
+ **********************************************************************/
+void subst_process_finish(int mark, int wait)
+{
+	struct job_t *job;
+
+	while (nprocs > mark) {
+		nprocs--;
+		zygote_forget(procs[nprocs].fd);
+		close(procs[nprocs].fd);
+		if ((job = procs[nprocs].job) == NULL)
+			continue;
+		if (wait)
+			job_wait(job);
+		else if (job->state == JOB_DONE)
+			job_destroy(job);
+		else
+			job->background = 1;
+	}
+}
+
+#endif
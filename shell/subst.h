@@ -0,0 +1,18 @@
+#ifndef SUBST_H
+#define SUBST_H
+
+#include "cmd.h"
+
+/* The arena that collects the output of command substitutions starts
+ * this large, and doubles whenever it runs out of room. */
+#define SUBST_ARENA_MIN  4096
+
+/* `$(<file)' maps files at least this large instead of reading them. */
+#define SUBST_MMAP_MIN   (64 * 1024)
+
+int  subst_needed(const char *word);
+int  subst_expand(struct expr_t *cmd, int n);
+int  subst_process_mark(void);
+void subst_process_finish(int mark, int wait);
+
+#endif
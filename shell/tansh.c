@@ -24,33 +24,45 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <errno.h>
 #include <signal.h>
-#include <setjmp.h>
+#include <pthread.h>
 #include <sys/wait.h>
 #include "tansh.h"
 #include "cmd.h"
 #include "list.h"
+#include "launch.h"
+#include "builtin.h"
+#include "job.h"
+#include "loop.h"
+#include "timing.h"
+#include "pipestats.h"
+#include "option.h"
+#include "subst.h"
+#include "jobqueue.h"
+#include "multio.h"
+#include "autopar.h"
+#include "zygote.h"
+#include "event.h"
+#include "server.h"
 #include "error.h"
+#include "config.h"
 
 /* Forward declarations for all static functions in this file. */
-static int try_jump(void);
-static void sigchld_handler(int signal);
-static void sigint_handler(int signal);
-static void cleanup(list_t *cmd_list);
-static int do_tansh(FILE *file);
+static void cleanup(struct expr_t *cmd);
+static void do_timed(struct expr_t *cmd, struct expr_t **next);
+static int do_tansh(FILE *file, int last);
 
-/* Global variables to this file - used for command state */
-static sigjmp_buf jmpbuf;
-static volatile sig_atomic_t jmpok = 0;
-
-void parse(FILE *file);
+struct expr_t *parse(FILE *file);
 
 int test_main(int argc, char *argv[])
 {
 	FILE *file = NULL;
+	struct expr_t *cmd = NULL;
 	if (argc == 2) {
 		file = fopen(argv[1], "r");
 		if (!file)
@@ -58,59 +70,28 @@ int test_main(int argc, char *argv[])
 	}
 	if (file) {
 		fprintf(stderr, "parsing file\n");
-		parse(file);
+		cmd = parse(file);
+		cmd_print(cmd);
+		cmd_destroy(cmd);
 		fclose(file);
 	} else {
 		fprintf(stderr, "parsing command line\n");
-		while (1)
-			parse(NULL);
+		while (1) {
+			cmd = parse(NULL);
+			cmd_print(cmd);
+			cmd_destroy(cmd);
+		}
 	}
 
 	return 0;
 }
 
-/*
- * Jump to the starting point for this application (just before the
- * read-eval-print loop). If it is not a valid point to jump, then
- * return -1, else do the jump and return nothing.
- */
-static int try_jump(void)
-{
-	if (jmpok == 0)
-		return -1;
-	siglongjmp(jmpbuf, 1);
-}
-
-/*
- * Handle exit signals from child processes
- */
-static void sigchld_handler(int signal)
-{
-	/* Perform a non-blocking wait. Do not perform any error handling
-	 * because this wait is not guaranteed to actually release the
-	 * resources of a child, as it may have already been released by the
-	 * parent. This will prevent zombie processes from persisting from
-	 * commands that return from the background. */
-	waitpid(-1, NULL, WNOHANG);
-}
-
-/*
- * Handle <CTRL + C> events from the user. The shell should never exit
- * abnormally, unless a serious error has occurred. This event should
- * signal the SIGINT event to the current shell command, if any.
- * Otherwise, just print the shell prompt and enter the parsing routine.
- */
-static void sigint_handler(int signal)
-{
-	try_jump();
-}
-
 /*
  * Release all data structures from memory.
  */
-static void cleanup(list_t *cmd_list)
+static void cleanup(struct expr_t *cmd)
 {
-	list_destroy(cmd_list);
+	cmd_destroy(cmd);
 }
 
 /*
@@ -118,42 +99,72 @@ static void cleanup(list_t *cmd_list)
  */ 
 int main(int argc, char *argv[])
 {
-	test_main(argc, argv);
-	return 0;
+#ifdef TEST_PARSER
+	return test_main(argc, argv);  /* Only prints what is parsed */
+#endif
 
-	/* Set up the signal handler for SIGCHLD (when a child is terminated,
-	 * stopped, or continued */
-	struct sigaction act_sigchld;
-	act_sigchld.sa_handler = sigchld_handler;
-	if (sigemptyset(&act_sigchld.sa_mask) == -1) {
-		err_sigsetops();
-		return -1;
-	}
-	/* We're only interested in children that have terminated, not ones
-	 * which have been stopped (eg user pressing control-Z at terminal) */
-	act_sigchld.sa_flags = SA_NOCLDSTOP;
-	if (sigaction(SIGCHLD, &act_sigchld, NULL) == -1) {
-		err_sigaction();
-		return -1;
+	/* A client hands its scripts to a running server, and only runs
+	 * them itself if there is none (see server.c) */
+	if (argc > 1 && strcmp(argv[1], "--client") == 0) {
+		int status;
+		if (argc < 4) {
+			err_msg("usage: tansh --client socket {-c command | script ...}");
+			return 2;
+		}
+		if ((status = server_client(argv[2], argc - 3, argv + 3)) != -1)
+			return status;
+		argv[2] = argv[0];
+		argv += 2;
+		argc -= 2;
 	}
 
-	/* Set up a signal handler for SIGINT <CTRL + C> */
-	struct sigaction act_sigint;
-	act_sigint.sa_handler = sigint_handler;
-	if (sigemptyset(&act_sigint.sa_mask) == -1) {
-		err_sigsetops();
+	if (job_init(argc == 1) == -1)
 		return -1;
-	}
-	act_sigint.sa_flags = 0;  /* No special options */
-	if (sigaction(SIGINT, &act_sigint, NULL) == -1) {
-		err_sigaction();
+
+	/* The zygote is forked now, while the shell is small */
+	if (option_value(option_lookup("zygote")))
+		zygote_start();
+
+	/* SIGCHLD (with job control, SIGINT <CTRL + C> and SIGWINCH as well)
+	 * is read as an event, not caught by a handler (see event.c) */
+	if (event_init(job_control) == -1)
 		return -1;
+
+	/* A server runs its start-up scripts once, so that every worker
+	 * starts with their functions and options */
+	if (argc > 1 && strcmp(argv[1], "--server") == 0) {
+		int i;
+		if (argc < 3) {
+			err_msg("usage: tansh --server socket [script ...]");
+			return 2;
+		}
+		for (i = 3; i < argc; i++) {
+			FILE *file = fopen(argv[i], "r");
+			if (file == NULL) {
+				err_fopen(errno);
+				err_msg("tansh: warning: Invalid file '%s'.", argv[i]);
+				continue;
+			}
+			do_tansh(file, 0);
+			fclose(file);
+		}
+		return server_run(argv[2]) == -1 ? 1 : 0;
 	}
 
 	/* Check for input files. Use the file as input if it exists, other
-	 * wise assume interactive processing (interactive shell). */
+	 * wise assume interactive processing (interactive shell). With -c,
+	 * the next argument is the script. */
 	if (argc == 1) {
-		do_tansh(NULL);
+		do_tansh(NULL, 0);
+	} else if (strcmp(argv[1], "-c") == 0) {
+		FILE *file = argc > 2 ? fmemopen(argv[2], strlen(argv[2]), "r") : NULL;
+		if (file == NULL) {
+			err_msg("tansh: -c: %s", argc > 2 ? strerror(errno) :
+					"option requires an argument");
+			return 2;
+		}
+		do_tansh(file, 1);
+		fclose(file);
 	} else {  /* Process command-line arguments as if they are files */
 		int i = 1;
 		while (i < argc) {
@@ -163,7 +174,7 @@ int main(int argc, char *argv[])
 				err_fopen(errno);
 				err_msg("tansh: warning: Invalid file '%s'.", argv[i]);
 			} else {  /* No error occured and it is a valid file */
-				do_tansh(file);
+				do_tansh(file, i == argc - 1);
 				fclose(file);
 			}
 			i++;
@@ -173,273 +184,254 @@ int main(int argc, char *argv[])
 	return 0;
 }
 
-static int do_tansh(FILE *file)
+/*
+ * Parses and runs the script 'file', or reads commands interactively
+ * if it is NULL. If 'last' is non-zero, nothing runs after the script,
+ * so its last command may replace the shell (see cmd_mark_exec()).
+ */
+static int do_tansh(FILE *file, int last)
 {
-	int n;
-	list_t *cmd_list = NULL;  /* Holds list of commands that are parsed */
-	sigset_t intmask;         /* For signal handler setting/unsetting */
+	struct expr_t *cmd = NULL;  /* Holds the commands that are parsed */
 	while (1) {
-		/* Save stack context and set jump point for use later */
-		if (sigsetjmp(jmpbuf, 1) == 1)
-			printf("\n");  /* Reset shell prompt to next line */
-		jmpok = 1;
+		/* No signal handler interrupts the parser: signals that arrive
+		 * meanwhile are events (see event_wait_input()). */
+		cmd = parse(file);
 
-		/* Print the shell prompt if interactive, or set the 'finished'
-		 * switch to properly parse and execute the 'file' once. */
-		if (!file)
-			printf("$ ");
+		/* Do the command if at least one command exists (not null). */
+		if (cmd)
+			do_script(cmd, file && last);
 
-		/* Re-initialize the `cmd_list' list to store complex command(s) */
-		if ((cmd_list = list_create(cmd_destroy)) == NULL) {
-			err_malloc(0);
-			return -1;
-		}
+		cleanup(cmd);
 
-		/* Block SIGCHLD signals while we get the next line of input via
-		 * yylex()/yyparse(). These functions are not signal safe! */
-		if ((sigemptyset(&intmask) == -1) ||
-				(sigaddset(&intmask, SIGCHLD) == -1)) {
-			err_sigsetops();
-			return -1;
-		} else if (sigprocmask(SIG_BLOCK, &intmask, NULL) == -1) {
-			err_sigprocmask();
-			return -1;
-		}
+		/* A file is parsed and executed once, as a whole. */
+		if (file || feof(stdin))
+			break;
+	}
 
-		//parse(cmd_list, file);
+	return 0;
+}
 
-		/* Unblock SIGCHLD signals now that we are past non-signal safe
-		 * functions. */
-		if (sigprocmask(SIG_UNBLOCK, &intmask, NULL) == -1) {
-			err_sigprocmask();
-			cleanup(cmd_list);
-			return -1;
-		}
+/***********************************************************************
+ * Runs the commands 'cmd' parsed from a script, or from a line typed by
+ * the user. The commands are not destroyed.
+ *
+ * Parameters:
+ *   cmd: The parsed commands.
+ *   last: Non-zero if nothing runs after them, so that the last command
+ *     may replace the shell (see cmd_mark_exec()).
+ *
+ * Return value:
+ *   Returns the value of do_command().
+ **********************************************************************/
+int do_script(struct expr_t *cmd, int last)
+{
+	int n;
 
-		/* Do the command if at least one command exists (not zero), and
-		 * parse() didn't return and error condition (not null). */
-		if (cmd_list == NULL) {
-			err_parse();
-		} else if (list_size(cmd_list) != 0) {
-#ifndef NDEBUG
-			int i = 0;
-			list_node_t *node = NULL;
-			list_foreach(cmd_list, node) {
-				err_msg("Command # %d", i);
-				cmd_print(list_key(node));
-				i++;
-			}
+	if (last)
+		cmd_mark_exec(cmd);
+#ifndef NDEBUG_PARSER
+	cmd_print(cmd);
 #endif
-			n = do_command(cmd_list, NULL);
-			if (n == -1)
-				err_msg("do_tansh: warning: Critical shell command execution error.");
-			else if (n == 1)
-				err_msg("do_tansh: warning: Invalid internal command.");
-		}
+	n = do_command(cmd);
+	if (n == -1)
+		err_msg("do_tansh: warning: Critical shell command execution error.");
+	else if (n == 1)
+		err_msg("do_tansh: warning: Invalid internal command.");
 
-		list_destroy(cmd_list);
+	return n;
+}
+
+/*
+ * Runs the timed command 'cmd' that runs in the shell itself, a loop or
+ * a single builtin, and reports the resources it used. A `time' with no
+ * command reports what the shell and its children have used so far.
+ * Sets 'next' to the expression following the command.
+ */
+static void do_timed(struct expr_t *cmd, struct expr_t **next)
+{
+	int mode = timing_mode(cmd);
+	char *text = NULL;
+	struct timing_mark_t mark;
+
+	if (list_size(cmd->exec) == 0) {
+		memset(&mark, 0, sizeof(mark));
+		clock_gettime(CLOCK_MONOTONIC, &mark.start);
+		timing_report_mark(stderr, mode, &mark, job_last_status, NULL);
+		*next = cmd->next;
+		return;
 	}
 
-	return 0;
+	if (!cmd_is_for(cmd))
+		text = cmd_to_string(cmd, 1);
+	timing_mark(&mark);
+	if (cmd_is_for(cmd)) {
+		job_last_status = loop_for(cmd, next);
+	} else {
+		if ((job_last_status = cmd_do_internal(cmd)) == -1)
+			job_last_status = 1;
+		*next = cmd->next;
+	}
+	timing_report_mark(stderr, mode, &mark, job_last_status,
+			text ? text : "for");
+	free(text);
 }
 
-/* 
+/*
  * Do the command
- * 1) Base case - empty list
- * 2) Else, shift first element off the top of the list
- *   3) Set up a pipe (if necessary)
- *   4) Execute the command in a fork'ed process
- *   5) Recurse on do_command with the shifted list
+ * 1) Nothing to do for an empty (NULL) expression
+ * 2) Else, for each loop or pipeline in the expression
+ *   3) Run a run of independent pipelines concurrently with
+ *      `set -o autopar' (see autopar.c), or run a `for' loop (see
+ *      loop_for()), or
+ *   4) Execute an internal command in the shell itself, or execute
+ *      the last command of a script in place of the shell, or
+ *   5) Start every stage of the pipeline (see launch_pipeline()) and
+ *      add it to the job table as a single job, or queue a background
+ *      pipeline past `set -o maxjobs' jobs (see jobqueue.c)
+ *   6) Wait for the job unless the pipeline is in the background
+ *   7) Report the resources used by a command run with `time', and
+ *      the statistics of its stages with `set -o pipestats'
+ *   8) Close the shell's end of the process substitutions of the
+ *      pipeline, and wait for them unless it is in the background
+ *
+ * The expression is walked iteratively and is not modified; it is up to
+ * the caller to destroy it.
  *
  * Return Value:
  *   Returns 0 on success, -1 on critical command exec[ution] error, or
  *   1 on invalid internal command.
  */
-int do_command(list_t *cmd_list, int *fd_in)
+int do_command(struct expr_t *cmd)
 {
-	if (list_size(cmd_list) == 0) {  /* Base case - empty list */
-		return 0;
-	} else {  /* Recursive case */
-		int ret;  /* Stores a return value, not meaningful beyond that */
-		int i;
-		int fd_out[2];
-		pid_t child_id;
-		FILE *file;
-
-		/* Remove the first element */
-		struct expr_t *cmd = list_shift(cmd_list);
-
-		/* Check if internal command and execute if it is an internal cmd */
-		/* FIXME: Internal commands should be better integrated into the
-		 * rest of the commands so they will work in pipes, redirection. */
-		if (cmd_is_internal(cmd)) {
-			if (cmd_do_internal(cmd) == 0) {
-				cmd_destroy(cmd);
-				do_command(cmd_list, NULL);
-				return 0;
-			} else {
-				cmd_destroy(cmd);
-				return 1;
-			}
+	int i, n, stats, mark;
+	void *result;
+	struct timespec start;
+	struct expr_t *last;
+	struct job_t *job;
+
+	while (cmd) {
+		/* A run of independent pipelines starting here may run at once */
+		if (option_value(option_lookup("autopar")) && autopar_run(cmd, &cmd))
+			continue;
+
+		/* Command substitutions run before the pipeline they are in */
+		mark = subst_process_mark();
+		if (subst_expand(cmd, launch_pipeline_length(cmd)) == -1) {
+			subst_process_finish(mark, 1);
+			return -1;
 		}
 
-		/* Set up piping, if required */
-		if (cmd_is_output_pipe(cmd) && pipe(fd_out) == -1)
-			err_pipe(errno);
-
-		/* Execute the command in a forked process */
-		/* Fork a child process */
-		child_id = fork();
-		if (child_id == -1)
-			err_fork(errno);
-
-		if (child_id == 0) {  /* This is a child */
-			/* Check for input redirection */
-			/* TODO: Perhaps all redirection handling code should be handled
-			 * internal to the redirection file. */
-			/* FIXME: There can be > 1 redirections. Make a function to handle
-			 * the generic redirection list. */
-			if (cmd_is_input_redir(cmd)) {
-				file = freopen(cmd_input_filename(cmd), "r", stdin);
-				if (!file)
-					err_freopen(errno);
-			}
+		/* Commands that run in the shell itself are timed as a whole,
+		 * from the resources used by the shell and its children. */
+		if (cmd_is_timed(cmd) && (cmd_is_for(cmd) ||
+		    list_size(cmd->exec) == 0 || (launch_pipeline_length(cmd) == 1 &&
+		    (cmd_is_internal(cmd) || builtin_find(cmd))))) {
+			do_timed(cmd, &cmd);
+			subst_process_finish(mark, 1);
+			continue;
+		}
 
-			/* Check for output redirection */
-			/* FIXME: There can be > 1 redirections. Make a function to handle
-			 * the generic redirection list. */
-			if (cmd_is_output_redir(cmd)) {
-				file = freopen(cmd_output_filename(cmd), "w+", stdout);
-				if (!file)
-					err_freopen(errno);
-			}
+		if (cmd_is_for(cmd)) {
+			job_last_status = loop_for(cmd, &cmd);
+			subst_process_finish(mark, 1);
+			continue;
+		}
 
-			/* Check for output concatenation */
-			/* FIXME: There can be > 1 redirections. Make a function to handle
-			 * the generic redirection list. */
-			if (cmd_is_concat_redir(cmd)) {
-				file = freopen(cmd_concat_filename(cmd), "a", stdout);
-				if (!file)
-					err_freopen(errno);
-			}
+		n = launch_pipeline_length(cmd);
+		last = cmd;
+		for (i = 1; i < n; i++)
+			last = last->next;
+
+		/* A builtin on its own runs in the shell itself, so it may change
+		 * the state of the shell. Builtins within a pipeline are started
+		 * by launch_pipeline() along with the other stages. */
+		if (n == 1 && (cmd_is_internal(cmd) || builtin_find(cmd)) &&
+		    !multio_needed(cmd, 0)) {
+			job_last_status = cmd_do_internal(cmd);
+			subst_process_finish(mark, 1);
+			if (job_last_status == -1)
+				return 1;
+			cmd = cmd->next;
+			continue;
+		}
 
-			if (!cmd_is_input_pipe(cmd) && cmd_is_output_pipe(cmd)) {
-				/* Open a pipe to write to stdout. This is executed if
-				 * there is a pipe in the command and it only needs to
-				 * direct is stdout to the write end of the pipe. */
-				ret = dup2(fd_out[1], STDOUT_FILENO);
-				if (ret == -1) {
-					err_dup2(errno);
-					return -1;
-				}
-
-				ret = close(fd_out[0]);
-				if (ret == -1) {
-					err_close(errno);
-					return -1;
-				}
-			} else if (cmd_is_input_pipe(cmd) && !cmd_is_output_pipe(cmd)) {
-				/* Open a pipe to read from stdin. This is run if there
-				 * is a pipe in the command and it only needs to direct
-				 * the read end of the pipe to its stdin. */
-				ret = dup2(fd_in[0], STDIN_FILENO);
-				if (ret == -1) {
-					err_dup2(errno);
-					return -1;
-				}
-
-				ret = close(fd_in[1]);
-				if (ret == -1) {
-					err_close(errno);
-					return -1;
-				}
-			} else if (cmd_is_input_pipe(cmd) && cmd_is_output_pipe(cmd)) {
-				/* Open a pipe to read from stdin, and open a pipe to
-				 * write to stdout. This is executed only if there is a
-				 * pipe and the command is in the middle of a pipeline,
-				 * therefore requiring 2 pipe file descriptors. */
-				ret = dup2(fd_in[0], STDIN_FILENO);
-				if (ret == -1) {
-					err_dup2(errno);
-					return -1;
-				}
-
-				ret = dup2(fd_out[1], STDOUT_FILENO);
-				if (ret == -1) {
-					err_dup2(errno);
-					return -1;
-				}
-
-				ret = close(fd_in[1]);
-				if (ret == -1) {
-					err_close(errno);
-					err_msg("warning: [do_command] Unable to close fd_in[1]) in child.");
-					return -1;
-				}
-				ret = close(fd_out[0]);
-				if (ret == -1) {
-					err_close(errno);
-					err_msg("warning: [do_command] Unable to close fd_out[0] in child.");
-					return -1;
-				}
+		/* The last command of a script replaces the shell, unless the
+		 * shell still has to close process substitutions, start queued
+		 * jobs or report statistics after it. */
+		if (cmd_is_exec(cmd) && mark == subst_process_mark() &&
+		    jobqueue_size() == 0 &&
+		    !option_value(option_lookup("pipestats")))
+			launch_exec(cmd);
+
+		/* Past `set -o maxjobs' running background jobs, the pipeline
+		 * waits in the queue instead, unless it reads from process
+		 * substitutions, which cannot be kept open for it. */
+		if (cmd_is_background(last) && mark == subst_process_mark()) {
+			jobqueue_run();
+			if (jobqueue_full()) {
+				jobqueue_push(cmd, n);
+				cmd = last->next;
+				continue;
 			}
+		}
 
-			/* Convert list of commands and argument(s) to char array */
-			char *args[list_size(cmd->exec) + 1];
-			cmd_to_char(cmd, args);
-
-			/* Execute the command that we parsed out of our struct */
-			execvp(args[0], args);
-			err_exec(errno);
-			err_msg("tansh: `%s' failed to exec", args[0]);
-
-			exit(-1);  /* This line only executes if execvp fails */
-		} /* Parent will continue after this conditional */
-
-		/* Close appropriate pipe file descriptors in the parent */
-		if (cmd_is_input_pipe(cmd)) {
-			for (i = 0; i < 2; i++) {
-				ret = close(fd_in[i]);
-				if (ret == -1) {
-					err_close(errno);
-					err_msg("warning: [do_command] Unable to close fd_in[%d] in parent.", i);
-					return -1;
-				}
+		/* No status change is collected before the job is in the job
+		 * table: SIGCHLD is only read by job_reap(). */
+		/* Builtin stages of a foreground pipeline run on threads, which
+		 * are joined when the job is waited for. A background pipeline
+		 * may outlive the command, so its builtins run in children. */
+		pid_t pids[n];
+		pthread_t threads[n];
+		int readers[n];
+		stats = option_value(option_lookup("pipestats")) > 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (launch_pipeline_readers(cmd, pids,
+				cmd_is_background(last) ? NULL : threads,
+				stats ? readers : NULL) == -1) {
+			subst_process_finish(mark, 1);
+			return -1;
+		}
+
+		job = job_create(pids, threads, n, cmd_is_background(last) != 0,
+				cmd_to_string(cmd, n));
+		if (job && stats)
+			job->stats = pipestats_create(cmd, n, pids, readers);
+		else if (stats)
+			for (i = 0; i < n - 1; i++)
+				close(readers[i]);
+
+		/* Wait for every stage, not only the last one, so no stage of a
+		 * foreground pipeline is left behind as a zombie. */
+		if (!job) {
+			for (i = 0; i < n; i++) {
+				if (pids[i] == 0 && pthread_join(threads[i], &result) == 0)
+					free(result);
 			}
+			job_reap(0);
+		} else if (job->background) {
+			if (job_control)
+				printf("[%d] %d\n", job->id, job->pgid);
+			else
+				cleanup_dead_jobs();
+		} else if (cmd_is_timed(cmd) || job->stats) {
+			/* The job is left in the table until it has been reported,
+			 * and its time includes starting the stages. */
+			job->keep = 1;
+			job->start = start;
+			job_foreground(job);
+			if (job->stats)
+				pipestats_report(stderr, job);
+			if (cmd_is_timed(cmd))
+				timing_report_job(stderr, timing_mode(cmd), job);
+			job->keep = 0;
+			if (job->state == JOB_DONE)
+				job_destroy(job);
+		} else {
+			job_foreground(job);
 		}
 
-		/* TODO: Write a generic function to block given signals. */
-		/* Wait for the child process to complete, if it is necessary.
-		 * NOTE: the wait(2) family of functions is *not* signal safe
-		 * when used without WNOHANG, so block the SIGCHLD signal for
-		 * possible waits here. This does contradict the POSIX standard
-		 * regarding wait(2), but I had the errors report exactly this
-		 * problem. */
-		sigset_t intmask;
-		if (sigemptyset(&intmask) == -1 || sigaddset(&intmask, SIGCHLD) == -1)
-			err_sigsetops();
-		else if (sigprocmask(SIG_BLOCK, &intmask, NULL) == -1)
-			err_sigprocmask();
-
-		if (!cmd_is_background(cmd) && !cmd_is_output_pipe(cmd))
-			waitpid(child_id, NULL, 0);
-
-		/* Unblock SIGCHLD signals now that we are past non-signal safe
-		 * functions. */
-		if (sigprocmask(SIG_UNBLOCK, &intmask, NULL) == -1)
-			err_sigprocmask();
-
-		/* Recurse on the rest of the list */
-		do_command(cmd_list, fd_out);
-
-		/* Wait for zombie processes when using pipes. Do not perform
-		 * error handling as the processes are not guaranteed to be
-		 * zombie processes. So, wait for any process, and do not hang. */
-		if (cmd_is_input_pipe(cmd) || cmd_is_output_pipe(cmd));
-			waitpid(child_id, NULL, WNOHANG);
-		
-		/* Destroy remaining command that was being processed. */
-		cmd_destroy(cmd);
+		subst_process_finish(mark, !cmd_is_background(last));
+		cmd = last->next;
 	}
 
 	return 0;
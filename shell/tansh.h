@@ -1,8 +1,9 @@
 #ifndef TANSH
 #define TANSH
 
-#include "list.h"
+#include "cmd.h"
 
-int do_command(list_t *cmd_list, int *fd_in);
+int do_command(struct expr_t *cmd);
+int do_script(struct expr_t *cmd, int last);
 
 #endif
@@ -0,0 +1,339 @@
+/***********************************************************************
+ * File: timing.c
+ * Description: The report of the `time' keyword. A timed pipeline is
+ *   measured stage by stage: the job table collects the resources used
+ *   by each stage with wait4(2) as it reaps the stage (or from the
+ *   thread itself, for a builtin stage), so no external time(1) is
+ *   needed. The report gives the wall clock, user and system time, the
+ *   largest resident set and the context switches of the pipeline as a
+ *   whole and, for pipelines of several stages, of every stage.
+ *
+ *   The totals are printed with $TIMEFORMAT, as in bash, which accepts
+ *   these conversions:
+ *     %[p][l]R  the elapsed time in seconds, with p (0 to 3, default
+ *               3) decimals, in the form MmSS.FFs with l
+ *     %[p][l]U  the user CPU time
+ *     %[p][l]S  the system CPU time
+ *     %P        the CPU percentage, (U + S) / R
+ *     %M        the largest resident set size, in KiB
+ *     %w        the voluntary context switches
+ *     %c        the involuntary context switches
+ *     %%        a literal `%'
+ *
+ *   `time -p' prints the totals in the POSIX format instead, and with
+ *   `set -o timeraw' every stage and the totals are printed as lines of
+ *   tab-separated key=value fields, for scripts and benchmarks.
+ **********************************************************************/
+
+#ifndef TIMING_C
+#define TIMING_C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "timing.h"
+#include "option.h"
+
+/* The resources used by a stage, or by a whole pipeline. */
+struct timing_sample_t {
+	double real;  /* Seconds */
+	double user;
+	double sys;
+	long maxrss;  /* KiB */
+	long nvcsw;
+	long nivcsw;
+};
+
+/*
+ * Returns the seconds from 'from' to 'to'.
+ */
+static double timing_elapsed(const struct timespec *from,
+		const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/*
+ * Returns the seconds in 'tv'.
+ */
+static double timing_seconds(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/*
+ * Fills 'sample' with the CPU times, resident set and context switches
+ * in 'usage'.
+ */
+static void timing_sample(struct timing_sample_t *sample,
+		const struct rusage *usage)
+{
+	sample->user = timing_seconds(&usage->ru_utime);
+	sample->sys = timing_seconds(&usage->ru_stime);
+	sample->maxrss = usage->ru_maxrss;
+	sample->nvcsw = usage->ru_nvcsw;
+	sample->nivcsw = usage->ru_nivcsw;
+}
+
+/*
+ * Adds the stage 'sample' to the pipeline 'total'. Times and switches
+ * add up; the resident set is that of the largest stage.
+ */
+static void timing_add(struct timing_sample_t *total,
+		const struct timing_sample_t *sample)
+{
+	total->user += sample->user;
+	total->sys += sample->sys;
+	total->nvcsw += sample->nvcsw;
+	total->nivcsw += sample->nivcsw;
+	if (sample->maxrss > total->maxrss)
+		total->maxrss = sample->maxrss;
+}
+
+/*
+ * Prints 'secs' with 'precision' decimals, as MmSS.FFs if 'longform'
+ * is non-zero.
+ */
+static void timing_print_seconds(FILE *out, double secs, int precision,
+		int longform)
+{
+	long minutes;
+
+	if (!longform) {
+		fprintf(out, "%.*f", precision, secs);
+		return;
+	}
+
+	minutes = (long)(secs / 60);
+	fprintf(out, "%ldm%.*fs", minutes, precision, secs - minutes * 60);
+}
+
+/*
+ * Prints 'sample' to 'out' with the $TIMEFORMAT style 'format',
+ * followed by a newline.
+ */
+static void timing_print_format(FILE *out, const char *format,
+		const struct timing_sample_t *sample)
+{
+	int precision, longform;
+	const char *p, *start;
+
+	for (p = format; *p; p++) {
+		if (*p != '%') {
+			fputc(*p, out);
+			continue;
+		}
+
+		start = p++;
+		precision = 3;
+		longform = 0;
+		if (isdigit((unsigned char)*p)) {
+			precision = *p - '0' > 3 ? 3 : *p - '0';
+			p++;
+		}
+		if (*p == 'l') {
+			longform = 1;
+			p++;
+		}
+
+		switch (*p) {
+			case 'R':
+				timing_print_seconds(out, sample->real, precision, longform);
+				break;
+			case 'U':
+				timing_print_seconds(out, sample->user, precision, longform);
+				break;
+			case 'S':
+				timing_print_seconds(out, sample->sys, precision, longform);
+				break;
+			case 'P':
+				fprintf(out, "%.2f", sample->real > 0 ?
+						(sample->user + sample->sys) * 100 / sample->real : 0.0);
+				break;
+			case 'M':
+				fprintf(out, "%ld", sample->maxrss);
+				break;
+			case 'w':
+				fprintf(out, "%ld", sample->nvcsw);
+				break;
+			case 'c':
+				fprintf(out, "%ld", sample->nivcsw);
+				break;
+			case '%':
+				fputc('%', out);
+				break;
+			default:  /* Not a conversion: print it as it is */
+				fwrite(start, 1, p - start + (*p != '\0'), out);
+				if (*p == '\0')
+					p--;
+				break;
+		}
+	}
+
+	fputc('\n', out);
+}
+
+/*
+ * Prints 'sample' as a line of key=value fields, for the stage 'stage'
+ * (1 for the first) or for the whole pipeline if 'stage' is 0.
+ */
+static void timing_print_raw(FILE *out, int stage, pid_t pid, int status,
+		const struct timing_sample_t *sample, const char *text)
+{
+	if (stage)
+		fprintf(out, "time\tstage=%d\tpid=%d", stage, (int)pid);
+	else
+		fprintf(out, "time\tstage=total");
+
+	fprintf(out, "\tstatus=%d\treal=%.6f\tuser=%.6f\tsys=%.6f\tmaxrss=%ld"
+			"\tnvcsw=%ld\tnivcsw=%ld", status, sample->real, sample->user,
+			sample->sys, sample->maxrss, sample->nvcsw, sample->nivcsw);
+
+	if (text)
+		fprintf(out, "\tcommand=%s", text);
+	fputc('\n', out);
+}
+
+/*
+ * Prints the totals 'total' of a timed command in the format 'mode'.
+ */
+static void timing_print_total(FILE *out, int mode,
+		const struct timing_sample_t *total, int status, const char *text)
+{
+	const char *format;
+
+	if (mode == TIMING_RAW) {
+		timing_print_raw(out, 0, 0, status, total, text);
+	} else if (mode == TIMING_POSIX) {
+		fprintf(out, "real %.2f\nuser %.2f\nsys %.2f\n", total->real,
+				total->user, total->sys);
+	} else {
+		if ((format = getenv("TIMEFORMAT")) == NULL)
+			format = TIMING_DEFAULT_FORMAT;
+		if (*format)  /* An empty format turns the report off, as in bash */
+			timing_print_format(out, format, total);
+	}
+}
+
+/***********************************************************************
+ * Returns the format in which the report of the timed command 'cmd' is
+ * printed: TIMING_POSIX for `time -p', TIMING_RAW while the `timeraw'
+ * option is on, and TIMING_FORMAT otherwise.
+ **********************************************************************/
+int timing_mode(struct expr_t *cmd)
+{
+	if (cmd_is_time_posix(cmd))
+		return TIMING_POSIX;
+	if (option_value(option_lookup("timeraw")))
+		return TIMING_RAW;
+
+	return TIMING_FORMAT;
+}
+
+/*
+ * Records in 'mark' the current time and the resources used so far by
+ * the shell and its waited-for children.
+ */
+void timing_mark(struct timing_mark_t *mark)
+{
+	clock_gettime(CLOCK_MONOTONIC, &mark->start);
+	getrusage(RUSAGE_SELF, &mark->self);
+	getrusage(RUSAGE_CHILDREN, &mark->children);
+}
+
+/***********************************************************************
+ * Reports the resources used since 'mark' was taken by the shell and
+ * the children it waited for, for a timed command that runs in the
+ * shell itself. The largest resident set is that of the shell or of
+ * its largest child, not a difference.
+ *
+ * Parameters:
+ *   out: Where the report is printed.
+ *   mode: One of TIMING_FORMAT, TIMING_POSIX and TIMING_RAW.
+ *   mark: Set by timing_mark() before the command was run.
+ *   status: The exit status of the command.
+ *   text: The command line, or NULL.
+ **********************************************************************/
+void timing_report_mark(FILE *out, int mode, struct timing_mark_t *mark,
+		int status, const char *text)
+{
+	struct timing_mark_t now;
+	struct timing_sample_t total, before, sample;
+
+	timing_mark(&now);
+
+	timing_sample(&total, &now.self);
+	timing_sample(&sample, &now.children);
+	timing_add(&total, &sample);
+
+	timing_sample(&before, &mark->self);
+	timing_sample(&sample, &mark->children);
+	timing_add(&before, &sample);
+
+	total.real = timing_elapsed(&mark->start, &now.start);
+	total.user -= before.user;
+	total.sys -= before.sys;
+	total.nvcsw -= before.nvcsw;
+	total.nivcsw -= before.nivcsw;
+
+	timing_print_total(out, mode, &total, status, text);
+	fflush(out);
+}
+
+/***********************************************************************
+ * Reports the resources used by the timed foreground job 'job', which
+ * has terminated or stopped, for every stage and in total. The elapsed
+ * time of a stage runs from the start of the job until the stage was
+ * reaped; stages that have not terminated (in a stopped job) report no
+ * CPU time yet.
+ *
+ * Parameters:
+ *   out: Where the report is printed.
+ *   mode: One of TIMING_FORMAT, TIMING_POSIX and TIMING_RAW.
+ *   job: The job, still in the job table.
+ **********************************************************************/
+void timing_report_job(FILE *out, int mode, struct job_t *job)
+{
+	int i;
+	struct timespec now;
+	struct timing_sample_t total, sample;
+	struct proc_t *proc;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	memset(&total, 0, sizeof(total));
+	total.real = timing_elapsed(&job->start, &now);
+
+	for (i = 0; i < job->nprocs; i++) {
+		proc = &job->procs[i];
+		timing_sample(&sample, &proc->usage);
+		sample.real = timing_elapsed(&job->start,
+				proc->running ? &now : &proc->end);
+		timing_add(&total, &sample);
+
+		if (mode == TIMING_RAW) {
+			timing_print_raw(out, i + 1, proc->pid, job_proc_status(proc),
+					&sample, NULL);
+		} else if (mode == TIMING_FORMAT && job->nprocs > 1) {
+			if (i == 0)
+				fputc('\n', out);
+			fprintf(out, "[%d] ", i + 1);
+			if (proc->pid > 0)
+				fprintf(out, "pid %d", (int)proc->pid);
+			else
+				fprintf(out, "builtin");
+			fprintf(out, "\treal %.3f user %.3f sys %.3f maxrss %ldK "
+					"ctxsw %ld+%ld\n", sample.real, sample.user, sample.sys,
+					sample.maxrss, sample.nvcsw, sample.nivcsw);
+		}
+	}
+
+	timing_print_total(out, mode, &total, job_status(job), job->text);
+	fflush(out);
+}
+
+#endif
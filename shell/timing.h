@@ -0,0 +1,33 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "cmd.h"
+#include "job.h"
+
+/* Ways the report of `time' may be printed. */
+#define TIMING_FORMAT  0  /* With $TIMEFORMAT, or the default format */
+#define TIMING_POSIX   1  /* `time -p': real, user and sys, POSIX style */
+#define TIMING_RAW     2  /* Tab-separated key=value lines, one per stage */
+
+/* The default format of the report; see timing_report_job(). */
+#define TIMING_DEFAULT_FORMAT \
+	"\nreal\t%3lR\nuser\t%3lU\nsys\t%3lS\nmaxrss\t%MK\nctxsw\t%w+%c"
+
+/* The resources used by the shell and its children at some point, for
+ * timing commands that run in the shell itself (builtins and loops). */
+struct timing_mark_t {
+	struct timespec start;
+	struct rusage self;
+	struct rusage children;
+};
+
+int  timing_mode(struct expr_t *cmd);
+void timing_mark(struct timing_mark_t *mark);
+void timing_report_mark(FILE *out, int mode, struct timing_mark_t *mark,
+                        int status, const char *text);
+void timing_report_job(FILE *out, int mode, struct job_t *job);
+
+#endif
@@ -0,0 +1,515 @@
+/***********************************************************************
+ * File: zygote.c
+ * Description: The zygote, a helper process that launches commands on
+ *   behalf of the shell, turned on with `set -o zygote' (or
+ *   $TANSH_ZYGOTE). The helper is forked when the shell starts, while
+ *   its heap is still small, and then only ever waits for requests, so
+ *   starting a command costs a copy of the helper instead of one of the
+ *   shell, however large the shell has grown.
+ *
+ *   The shell sends each request over a Unix socket: the path, the
+ *   arguments and the environment of the command, with its stdin,
+ *   stdout and stderr, and any other descriptor it must inherit, passed
+ *   along as SCM_RIGHTS. The helper starts the
+ *   command with clone(CLONE_PARENT), which makes it a child of the
+ *   shell rather than of the helper, so the shell reaps it and the job
+ *   table sees it like any other stage. The helper answers once the
+ *   command has exec'd (or failed to) with its pid and the error of the
+ *   exec, if any.
+ *
+ *   Only the shell that started the helper uses it: forked copies of
+ *   the shell (substitutions, builtin stages) start commands on their
+ *   own.
+ *
+ *   The zygote is experimental and off by default. It only pays off
+ *   against fork(2): posix_spawn(3), the default, copies no page tables
+ *   either, and launches faster than the zygote whatever the size of
+ *   the heap, as bench/zygote_bench.c shows. It may help where
+ *   posix_spawn(3) is built on fork(2).
+ **********************************************************************/
+
+#ifndef ZYGOTE_C
+#define ZYGOTE_C
+
+#define _GNU_SOURCE  /* MSG_CMSG_CLOEXEC, pipe2(2) */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "zygote.h"
+#include "job.h"
+#include "error.h"
+
+extern char **environ;
+
+/* The shell's end of the socket, the helper and the shell it serves */
+static int zygote_fd = -1;
+static pid_t zygote_pid = 0;
+static pid_t zygote_owner = 0;
+static int zygote_lost = 0;  /* Never started again once lost */
+
+/* The descriptors the shell leaves open for its commands. There may be
+ * more than fit in a request, and only the first ones are kept. */
+static int inherited[ZYGOTE_FDS_MAX - 3];
+static int ninherited = 0;
+
+/* The strings of a request, sent or received. Grown as needed. */
+static char *buffer = NULL;
+static size_t buffer_size = 0;
+
+/*
+ * Makes room for 'len' bytes in the request buffer. Returns 0, or -1 on
+ * error.
+ */
+static int zygote_reserve(size_t len)
+{
+	size_t size = buffer_size ? buffer_size : 4096;
+	char *p;
+
+	while (size < len)
+		size *= 2;
+	if (size == buffer_size)
+		return 0;
+
+	if ((p = realloc(buffer, size)) == NULL)
+		return -1;
+	buffer = p;
+	buffer_size = size;
+	return 0;
+}
+
+/*
+ * Reads exactly 'len' bytes from 'fd'. Returns 0, or -1 on error or
+ * end-of-file.
+ */
+static int zygote_read(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = read(fd, buf, len)) == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf = (char *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Writes the 'len' bytes at 'buf' to the socket 'fd', without raising
+ * SIGPIPE if the other end is gone. Returns 0, or -1 on error.
+ */
+static int zygote_write(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = send(fd, buf, len, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Runs in the command started by the helper: puts it in its process
+ * group, gives it the signal dispositions of a command and the
+ * descriptors 'fds' at their target numbers, and execs it. Writes the
+ * error to 'err' if the exec fails.
+ */
+static void zygote_exec(struct zygote_request_t *req, int *fds, char **argv,
+		char **envp, int err)
+{
+	int i, n, base = STDERR_FILENO + 1, error = 0;
+	sigset_t mask;
+
+	if (req->pgid != -1)
+		setpgid(0, req->pgid);
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGTSTP, SIG_DFL);
+	signal(SIGTTIN, SIG_DFL);
+	signal(SIGTTOU, SIG_DFL);
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	/* The received descriptors are close on exec. They are first moved
+	 * above every target, so none is overwritten before it is used. */
+	for (i = 0; i < req->nfds; i++)
+		if (req->targets[i] >= base)
+			base = req->targets[i] + 1;
+	for (i = 0; i < req->nfds && !error; i++)
+		if ((fds[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, base)) == -1)
+			error = errno;
+	for (i = 0; i < req->nfds && !error; i++)
+		if (dup2(fds[i], req->targets[i]) == -1)
+			error = errno;
+
+	if (!error) {
+		execve(argv[0], argv + 1, envp);
+		error = errno;
+	}
+	/* A file the kernel cannot execute is run with /bin/sh, as
+	 * execvp(3) would: `sh path args...' */
+	if (error == ENOEXEC) {
+		for (n = 1; argv[n]; n++)
+			;
+		char *sh[n + 1];
+		sh[0] = "sh";
+		sh[1] = argv[0];
+		for (i = 2; argv[i]; i++)
+			sh[i] = argv[i];
+		sh[i] = NULL;
+		execve("/bin/sh", sh, envp);
+		error = ENOEXEC;
+	}
+	write(err, &error, sizeof(error));
+	_exit(127);
+}
+
+/*
+ * Starts the command of the request 'req', whose strings are in the
+ * buffer, and fills in 'reply'.
+ */
+static void zygote_launch(struct zygote_request_t *req, int *fds,
+		struct zygote_reply_t *reply)
+{
+	int i, err[2], error;
+	char *argv[req->argc + 2], *envp[req->envc + 1], *p = buffer;
+	pid_t pid;
+
+	/* argv[0] is the path, followed by the arguments proper */
+	for (i = 0; i < req->argc + 1; i++, p += strlen(p) + 1)
+		argv[i] = p;
+	argv[i] = NULL;
+	for (i = 0; i < req->envc; i++, p += strlen(p) + 1)
+		envp[i] = p;
+	envp[i] = NULL;
+
+	reply->pid = -1;
+	reply->error = 0;
+	if (pipe2(err, O_CLOEXEC) == -1) {
+		reply->error = errno;
+		return;
+	}
+
+	/* A plain fork, but the command is the shell's child */
+	if ((pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0))
+			== -1) {
+		reply->error = errno;
+	} else if (pid == 0) {
+		close(err[0]);
+		zygote_exec(req, fds, argv, envp, err[1]);
+	} else {
+		/* The pipe closes without a word when the exec succeeds */
+		close(err[1]);
+		err[1] = -1;
+		reply->pid = pid;
+		if (zygote_read(err[0], &error, sizeof(error)) == 0)
+			reply->error = error;
+	}
+
+	close(err[0]);
+	if (err[1] != -1)
+		close(err[1]);
+}
+
+/*
+ * Closes every descriptor of the helper above stderr but its socket
+ * 'sock'. The helper may be started lazily, in the middle of launching
+ * a pipeline, and must not hold the pipes of the shell open.
+ */
+static void zygote_close_all(int sock)
+{
+	int fd;
+	long max;
+	DIR *dir;
+	struct dirent *entry;
+
+	if ((dir = opendir("/proc/self/fd")) != NULL) {
+		while ((entry = readdir(dir)) != NULL) {
+			fd = atoi(entry->d_name);
+			if (fd > STDERR_FILENO && fd != sock && fd != dirfd(dir))
+				close(fd);
+		}
+		closedir(dir);
+		return;
+	}
+
+	if ((max = sysconf(_SC_OPEN_MAX)) <= 0 || max > 65536)
+		max = 65536;
+	for (fd = STDERR_FILENO + 1; fd < max; fd++)
+		if (fd != sock)
+			close(fd);
+}
+
+/*
+ * The helper: serves the requests that come in on 'sock' until the
+ * shell closes it.
+ */
+static void zygote_main(int sock)
+{
+	int i, fds[ZYGOTE_FDS_MAX];
+	char control[CMSG_SPACE(sizeof(fds))];
+	struct zygote_request_t req;
+	struct zygote_reply_t reply;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	sigset_t mask;
+
+	zygote_close_all(sock);
+
+	/* Signals for the shell's process group are not for the helper */
+	signal(SIGINT, SIG_IGN);
+	signal(SIGQUIT, SIG_IGN);
+	signal(SIGTSTP, SIG_IGN);
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTTOU, SIG_IGN);
+	signal(SIGCHLD, SIG_DFL);
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	for (;;) {
+		iov.iov_base = &req;
+		iov.iov_len = sizeof(req);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL) !=
+				sizeof(req))
+			return;
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+		    req.nfds < 3 || req.nfds > ZYGOTE_FDS_MAX ||
+		    cmsg->cmsg_len != CMSG_LEN(req.nfds * sizeof(int)))
+			return;
+		memcpy(fds, CMSG_DATA(cmsg), req.nfds * sizeof(int));
+
+		/* The shell falls back on starting commands itself if the
+		 * helper exits, out of memory or not */
+		if (zygote_reserve(req.len) == -1 ||
+		    zygote_read(sock, buffer, req.len) == -1)
+			return;
+		zygote_launch(&req, fds, &reply);
+
+		for (i = 0; i < req.nfds; i++)
+			close(fds[i]);
+		if (zygote_write(sock, &reply, sizeof(reply)) == -1)
+			return;
+	}
+}
+
+/***********************************************************************
+ * Forks the helper, unless it is already running. This should be done
+ * early, before the heap of the shell has grown.
+ *
+ * Return value:
+ *   Returns 0 on success, or -1 on error.
+ **********************************************************************/
+int zygote_start(void)
+{
+	int sv[2];
+	pid_t pid;
+
+	if (zygote_fd != -1)
+		return 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+		err_msg("tansh: zygote: %s", strerror(errno));
+		return -1;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	if ((pid = fork()) == -1) {
+		err_fork(errno);
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	if (pid == 0) {  /* The helper */
+		close(sv[0]);
+		zygote_main(sv[1]);
+		_exit(0);
+	}
+
+	close(sv[1]);
+	zygote_fd = sv[0];
+	zygote_pid = pid;
+	zygote_owner = getpid();
+	return 0;
+}
+
+/*
+ * Returns non-zero if commands may be started through the helper,
+ * starting it if needed. A forked copy of the shell may not use it.
+ */
+int zygote_ready(void)
+{
+	if (zygote_fd != -1)
+		return zygote_owner == getpid();
+	return !zygote_lost && zygote_start() == 0;
+}
+
+/***********************************************************************
+ * Has the helper start the command at 'path'.
+ *
+ * Parameters:
+ *   path: The resolved path of the command.
+ *   args: Its arguments, NULL terminated.
+ *   fd_in: The descriptor for its stdin, or -1 for the shell's.
+ *   fd_out: The descriptor for its stdout, or -1 for the shell's.
+ *   pgid: The process group to put it in (0 for a new one), or -1 to
+ *     leave it in the shell's.
+ *
+ * Return value:
+ *   Returns the pid of the command, or -1 with errno set if it failed to
+ *   exec. Returns ZYGOTE_DIRECT if the caller should start the command
+ *   itself: the command must inherit more descriptors than a request
+ *   carries, or the helper could not be reached (it is then stopped).
+ **********************************************************************/
+pid_t zygote_spawn(char *path, char **args, int fd_in, int fd_out,
+		pid_t pgid)
+{
+	int i, fds[ZYGOTE_FDS_MAX] = { fd_in, fd_out, STDERR_FILENO };
+	char control[CMSG_SPACE(sizeof(fds))], *p;
+	size_t len;
+	struct zygote_request_t req;
+	struct zygote_reply_t reply;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	if (ninherited > ZYGOTE_FDS_MAX - 3)
+		return ZYGOTE_DIRECT;
+	if (fds[0] == -1)
+		fds[0] = STDIN_FILENO;
+	if (fds[1] == -1)
+		fds[1] = STDOUT_FILENO;
+
+	req.nfds = 3 + ninherited;
+	for (i = 0; i < req.nfds; i++) {
+		if (i >= 3)
+			fds[i] = inherited[i - 3];
+		req.targets[i] = i < 3 ? i : fds[i];
+	}
+
+	req.pgid = pgid;
+	req.len = strlen(path) + 1;
+	for (req.argc = 0; args[req.argc]; req.argc++)
+		req.len += strlen(args[req.argc]) + 1;
+	for (req.envc = 0; environ[req.envc]; req.envc++)
+		req.len += strlen(environ[req.envc]) + 1;
+
+	if (zygote_reserve(req.len) == -1) {
+		err_malloc(errno);
+		return ZYGOTE_DIRECT;
+	}
+	p = buffer;
+	for (i = -1; i < req.argc + req.envc; i++) {
+		len = strlen(i < 0 ? path : i < req.argc ? args[i] :
+				environ[i - req.argc]) + 1;
+		memcpy(p, i < 0 ? path : i < req.argc ? args[i] :
+				environ[i - req.argc], len);
+		p += len;
+	}
+
+	iov.iov_base = &req;
+	iov.iov_len = sizeof(req);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(req.nfds * sizeof(int));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(req.nfds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, req.nfds * sizeof(int));
+
+	if (sendmsg(zygote_fd, &msg, MSG_NOSIGNAL) != sizeof(req) ||
+	    zygote_write(zygote_fd, buffer, req.len) == -1 ||
+	    zygote_read(zygote_fd, &reply, sizeof(reply)) == -1) {
+		err_msg("tansh: zygote: helper lost, starting commands directly");
+		zygote_stop();
+		zygote_lost = 1;
+		return ZYGOTE_DIRECT;
+	}
+
+	if (reply.error) {
+		if (reply.pid > 0)
+			job_wait_foreign(reply.pid, NULL);
+		errno = reply.error;
+		return -1;
+	}
+
+	return reply.pid;
+}
+
+/***********************************************************************
+ * Has the commands started from now on inherit 'fd', under the same
+ * number, as they would from the shell if 'fd' is not close on exec.
+ **********************************************************************/
+void zygote_inherit(int fd)
+{
+	if (ninherited < ZYGOTE_FDS_MAX - 3)
+		inherited[ninherited] = fd;
+	ninherited++;
+}
+
+/*
+ * Stops passing 'fd' to the commands (see zygote_inherit()).
+ */
+void zygote_forget(int fd)
+{
+	int i;
+
+	for (i = 0; i < ninherited && i < ZYGOTE_FDS_MAX - 3; i++) {
+		if (inherited[i] == fd) {
+			memmove(&inherited[i], &inherited[i + 1],
+					(ZYGOTE_FDS_MAX - 4 - i) * sizeof(int));
+			break;
+		}
+	}
+	ninherited--;
+}
+
+/***********************************************************************
+ * Stops the helper: it exits once its end of the socket is closed.
+ **********************************************************************/
+void zygote_stop(void)
+{
+	if (zygote_fd == -1)
+		return;
+
+	close(zygote_fd);
+	zygote_fd = -1;
+	if (zygote_owner == getpid())
+		job_wait_foreign(zygote_pid, NULL);
+	zygote_pid = 0;
+}
+
+#endif
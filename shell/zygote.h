@@ -0,0 +1,41 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <sys/types.h>
+
+/* Returned by zygote_spawn() when the helper could not start the
+ * command; the caller should start it itself. */
+#define ZYGOTE_DIRECT  (-2)
+
+/* The most descriptors a request carries: stdin, stdout and stderr, and
+ * those the shell leaves open for its commands (see zygote_inherit()). */
+#define ZYGOTE_FDS_MAX  16
+
+/* A launch request, followed on the socket by the path, the arguments
+ * and the environment of the command, each NUL terminated. Its 'nfds'
+ * descriptors come with it, to be given the numbers in 'targets'. */
+struct zygote_request_t {
+	pid_t pgid;   /* Process group to join, 0 for a new one, or -1 */
+	int argc;
+	int envc;
+	int nfds;
+	int targets[ZYGOTE_FDS_MAX];
+	size_t len;   /* Bytes of strings that follow */
+};
+
+/* The answer to a request. A command that failed to exec has a pid
+ * too, as it still has to be reaped. */
+struct zygote_reply_t {
+	pid_t pid;
+	int error;    /* errno of a failed exec, or 0 */
+};
+
+int   zygote_start(void);
+int   zygote_ready(void);
+pid_t zygote_spawn(char *path, char **args, int fd_in, int fd_out,
+                   pid_t pgid);
+void  zygote_inherit(int fd);
+void  zygote_forget(int fd);
+void  zygote_stop(void);
+
+#endif